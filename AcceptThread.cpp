@@ -90,6 +90,9 @@ void OutputCallback::operator() (const void* buf, size_t count)
 
 CAcceptThread::CAcceptThread( unsigned int nWorkerThreadsPerMaster, unsigned short int uPort ) 
 	: error(false), s_v6(SOCKET_ERROR), s(SOCKET_ERROR)
+#ifdef HAS_EPOLL
+	, epoll_fd(-1)
+#endif
 {
 	WorkerThreadsPerMaster=nWorkerThreadsPerMaster;
 
@@ -129,6 +132,28 @@ CAcceptThread::CAcceptThread( unsigned int nWorkerThreadsPerMaster, unsigned sho
 		}
 	}
 
+#ifdef HAS_EPOLL
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+	{
+		Server->Log("CAcceptThread: Creating epoll instance failed. errno=" + convert(errno), LL_ERROR);
+		error = true;
+		return;
+	}
+
+	SOCKET listen_sockets[2] = { s, s_v6 };
+	for (size_t n = 0; n < 2; ++n)
+	{
+		if (listen_sockets[n] == SOCKET_ERROR)
+			continue;
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.fd = listen_sockets[n];
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_sockets[n], &ev);
+	}
+#endif
+
 	Server->Log("Server started up successfully!",LL_INFO);
 }
 
@@ -137,6 +162,10 @@ CAcceptThread::~CAcceptThread()
 	closesocket(s);
 	if (s_v6 != SOCKET_ERROR)
 		closesocket(s_v6);
+#ifdef HAS_EPOLL
+	if (epoll_fd != -1)
+		close(epoll_fd);
+#endif
 	Server->Log("Deleting SelectThreads..");
 	for(size_t i=0;i<SelectThreads.size();++i)
 	{
@@ -185,6 +214,11 @@ void CAcceptThread::operator()(bool single)
 		lon.tv_usec=0;
 
 		_i32 rc=select((int)s+1, &fdset, 0, 0, &lon);
+#elif defined(HAS_EPOLL)
+		epoll_event events[2];
+		int rc = epoll_wait(epoll_fd, events, 2, 1000);
+		if (rc < 0 && errno == EINTR)
+			continue;
 #else
 		pollfd conn[2];
 		conn[0].fd = s;
@@ -207,7 +241,11 @@ void CAcceptThread::operator()(bool single)
 
 		if (rc > 0)
 		{
+#ifdef HAS_EPOLL
+			for (size_t n = 0; n < static_cast<size_t>(rc); ++n)
+#else
 			for (size_t n = 0; n < 2; ++n)
+#endif
 			{
 #ifdef _WIN32
 				SOCKET accept_socket = n == 0 ? s : s_v6;
@@ -215,6 +253,8 @@ void CAcceptThread::operator()(bool single)
 					continue;
 				if (!FD_ISSET(accept_socket, &fdset))
 					continue;
+#elif defined(HAS_EPOLL)
+				SOCKET accept_socket = events[n].data.fd;
 #else
 				if (conn[n].revents == 0)
 					continue;
@@ -27,6 +27,9 @@ private:
 
 	SOCKET s;
 	SOCKET s_v6;
+#ifdef HAS_EPOLL
+	int epoll_fd;
+#endif
 	unsigned int WorkerThreadsPerMaster;
 	bool error;
 };
@@ -0,0 +1,283 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "AsyncLogger.h"
+#include "Server.h"
+#include "Interface/Mutex.h"
+#include "Interface/Condition.h"
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace
+{
+	const int writer_interval_ms = 20;
+
+#ifdef _WIN32
+	size_t load_acquire(volatile size_t* p)
+	{
+		size_t ret = *p;
+		MemoryBarrier();
+		return ret;
+	}
+
+	void store_release(volatile size_t* p, size_t val)
+	{
+		MemoryBarrier();
+		*p = val;
+	}
+
+	bool compare_exchange(volatile size_t* p, size_t expected, size_t desired)
+	{
+		return InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(p),
+			reinterpret_cast<PVOID>(desired), reinterpret_cast<PVOID>(expected)) == reinterpret_cast<PVOID>(expected);
+	}
+
+	size_t fetch_add(volatile size_t* p, size_t val)
+	{
+#ifdef _WIN64
+		return static_cast<size_t>(InterlockedExchangeAdd64(reinterpret_cast<volatile LONG64*>(p), static_cast<LONG64>(val)));
+#else
+		return static_cast<size_t>(InterlockedExchangeAdd(reinterpret_cast<volatile LONG*>(p), static_cast<LONG>(val)));
+#endif
+	}
+
+	size_t exchange(volatile size_t* p, size_t val)
+	{
+		return reinterpret_cast<size_t>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(p),
+			reinterpret_cast<PVOID>(val)));
+	}
+
+	size_t thread_hash()
+	{
+		return static_cast<size_t>(GetCurrentThreadId());
+	}
+#else
+	size_t load_acquire(volatile size_t* p)
+	{
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+	}
+
+	void store_release(volatile size_t* p, size_t val)
+	{
+		__atomic_store_n(p, val, __ATOMIC_RELEASE);
+	}
+
+	bool compare_exchange(volatile size_t* p, size_t expected, size_t desired)
+	{
+		return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+	}
+
+	size_t fetch_add(volatile size_t* p, size_t val)
+	{
+		return __atomic_fetch_add(p, val, __ATOMIC_RELAXED);
+	}
+
+	size_t exchange(volatile size_t* p, size_t val)
+	{
+		return __atomic_exchange_n(p, val, __ATOMIC_ACQ_REL);
+	}
+
+	size_t thread_hash()
+	{
+		size_t ret = reinterpret_cast<size_t>(reinterpret_cast<void*>(pthread_self()));
+		return ret ^ (ret >> 12);
+	}
+#endif
+
+	bool entry_order_less(const SAsyncLogEntry& a, const SAsyncLogEntry& b)
+	{
+		return a.order < b.order;
+	}
+}
+
+AsyncLogger::AsyncLogger(CServer* server, size_t n_rings, size_t ring_size)
+	: server(server), order_gen(0), stopping(0),
+	mutex(server->createMutex()), cond(server->createCondition()),
+	do_stop(false), stopped(false)
+{
+	size_t pow2_size = 2;
+	while (pow2_size < ring_size)
+	{
+		pow2_size *= 2;
+	}
+
+	for (size_t i = 0; i < n_rings; ++i)
+	{
+		SRing* ring = new SRing;
+		ring->slots.resize(pow2_size);
+		for (size_t j = 0; j < pow2_size; ++j)
+		{
+			ring->slots[j].seq = j;
+		}
+		ring->mask = pow2_size - 1;
+		ring->enqueue_pos = 0;
+		ring->dequeue_pos = 0;
+		ring->dropped = 0;
+		rings.push_back(ring);
+	}
+}
+
+AsyncLogger::~AsyncLogger()
+{
+	for (size_t i = 0; i < rings.size(); ++i)
+	{
+		delete rings[i];
+	}
+	server->destroy(mutex);
+	server->destroy(cond);
+}
+
+bool AsyncLogger::log(const std::string& msg, int loglevel, bool write)
+{
+	if (load_acquire(&stopping) != 0)
+	{
+		return false;
+	}
+
+	SRing& ring = *rings[thread_hash() % rings.size()];
+
+	size_t pos = load_acquire(&ring.enqueue_pos);
+	SSlot* slot;
+	while (true)
+	{
+		slot = &ring.slots[pos & ring.mask];
+		size_t seq = load_acquire(&slot->seq);
+		ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+		if (diff == 0)
+		{
+			if (compare_exchange(&ring.enqueue_pos, pos, pos + 1))
+			{
+				break;
+			}
+			pos = load_acquire(&ring.enqueue_pos);
+		}
+		else if (diff < 0)
+		{
+			if (loglevel >= LL_WARNING)
+			{
+				//Caller writes warnings and errors synchronously instead
+				return false;
+			}
+			fetch_add(&ring.dropped, 1);
+			return true;
+		}
+		else
+		{
+			pos = load_acquire(&ring.enqueue_pos);
+		}
+	}
+
+	slot->entry.msg = msg;
+	slot->entry.loglevel = loglevel;
+	slot->entry.write = write;
+	slot->entry.time = time(NULL);
+	slot->entry.order = fetch_add(&order_gen, 1);
+
+	store_release(&slot->seq, pos + 1);
+
+	return true;
+}
+
+size_t AsyncLogger::drain(std::vector<SAsyncLogEntry>& entries, size_t& dropped)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < rings.size(); ++i)
+	{
+		SRing& ring = *rings[i];
+		while (true)
+		{
+			SSlot& slot = ring.slots[ring.dequeue_pos & ring.mask];
+			size_t seq = load_acquire(&slot.seq);
+			if (static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(ring.dequeue_pos + 1) < 0)
+			{
+				break;
+			}
+
+			entries.push_back(SAsyncLogEntry());
+			SAsyncLogEntry& entry = entries.back();
+			entry.msg.swap(slot.entry.msg);
+			entry.loglevel = slot.entry.loglevel;
+			entry.write = slot.entry.write;
+			entry.time = slot.entry.time;
+			entry.order = slot.entry.order;
+
+			store_release(&slot.seq, ring.dequeue_pos + ring.mask + 1);
+			++ring.dequeue_pos;
+			++n;
+		}
+
+		dropped += exchange(&ring.dropped, 0);
+	}
+
+	std::sort(entries.end() - n, entries.end(), entry_order_less);
+
+	return n;
+}
+
+void AsyncLogger::operator()()
+{
+	std::vector<SAsyncLogEntry> entries;
+	while (true)
+	{
+		bool curr_stop;
+		{
+			IScopedLock lock(mutex);
+			if (!do_stop)
+			{
+				cond->wait(&lock, writer_interval_ms);
+			}
+			curr_stop = do_stop;
+		}
+
+		size_t dropped = 0;
+		entries.clear();
+		drain(entries, dropped);
+
+		if (!entries.empty()
+			|| dropped > 0)
+		{
+			server->writeLogEntries(entries, dropped);
+		}
+
+		if (curr_stop)
+		{
+			break;
+		}
+	}
+
+	IScopedLock lock(mutex);
+	stopped = true;
+	cond->notify_all();
+}
+
+void AsyncLogger::stop()
+{
+	store_release(&stopping, 1);
+
+	IScopedLock lock(mutex);
+	do_stop = true;
+	cond->notify_all();
+	while (!stopped)
+	{
+		cond->wait(&lock);
+	}
+}
@@ -0,0 +1,92 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+
+#include "Interface/Thread.h"
+#include "Interface/Types.h"
+#include <string>
+#include <vector>
+#include <time.h>
+
+class CServer;
+class IMutex;
+class ICondition;
+
+struct SAsyncLogEntry
+{
+	std::string msg;
+	int loglevel;
+	bool write;
+	time_t time;
+	size_t order;
+};
+
+/**
+* Log messages are put into a fixed number of bounded lock-free rings
+* (threads are hashed onto them) and written to the log file by a
+* single writer thread in batches with one flush per batch.
+* If a ring is full, debug and info messages are dropped and counted.
+* For warnings and errors log() returns false, so the caller writes them
+* synchronously.
+*/
+class AsyncLogger : public IThread
+{
+public:
+	AsyncLogger(CServer* server, size_t n_rings, size_t ring_size);
+	~AsyncLogger();
+
+	bool log(const std::string& msg, int loglevel, bool write);
+
+	void operator()();
+
+	void stop();
+
+private:
+	struct SSlot
+	{
+		SSlot()
+			: seq(0) {}
+
+		volatile size_t seq;
+		SAsyncLogEntry entry;
+	};
+
+	struct SRing
+	{
+		std::vector<SSlot> slots;
+		size_t mask;
+		char pad1[64];
+		volatile size_t enqueue_pos;
+		char pad2[64];
+		size_t dequeue_pos;
+		volatile size_t dropped;
+	};
+
+	size_t drain(std::vector<SAsyncLogEntry>& entries, size_t& dropped);
+
+	CServer* server;
+	std::vector<SRing*> rings;
+	volatile size_t order_gen;
+	volatile size_t stopping;
+
+	IMutex* mutex;
+	ICondition* cond;
+	bool do_stop;
+	bool stopped;
+};
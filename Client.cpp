@@ -28,6 +28,7 @@ CClient::CClient()
 	mutex=Server->createMutex();
 	m_lock=NULL;
 	processing=false;
+	select_thread=NULL;
 }
 
 CClient::~CClient()
@@ -71,6 +72,16 @@ void CClient::set(SOCKET ps, OutputCallback *poutput, FCGIProtocolDriver * pdriv
 #endif
 }
 
+void CClient::setSelectThread(CSelectThread* pselect_thread)
+{
+	select_thread=pselect_thread;
+}
+
+CSelectThread* CClient::getSelectThread()
+{
+	return select_thread;
+}
+
 void  CClient::lock()
 {
 	IScopedLock *n_lock=new IScopedLock(mutex);
@@ -52,7 +52,8 @@ bool DatabaseCursor::reset()
 	is_shutdown = false;
 	transaction_lock = false;
 
-	query->setupStepping(timeoutms, false);
+	//Same as in the constructor: the statement stays open between next() calls
+	query->setupStepping(timeoutms, true);
 
 #ifdef LOG_READ_QUERIES
 	active_query = new ScopedAddActiveQuery(query);
@@ -66,7 +67,7 @@ bool DatabaseCursor::next(db_single_result &res)
 	do
 	{
 		bool reset=false;
-		lastErr=query->step(res, timeoutms, tries, transaction_lock, reset);
+		lastErr=query->step(&res, timeoutms, tries, transaction_lock, reset);
 		//TODO handle reset (should not happen in WAL mode)
 		if(lastErr==SQLITE_ROW)
 		{
@@ -84,6 +85,55 @@ bool DatabaseCursor::next(db_single_result &res)
 	return false;
 }
 
+bool DatabaseCursor::next()
+{
+	do
+	{
+		bool reset=false;
+		lastErr=query->step(NULL, timeoutms, tries, transaction_lock, reset);
+		if(lastErr==SQLITE_ROW)
+		{
+			return true;
+		}
+	}
+	while(query->resultOkay(lastErr));
+
+	if(lastErr!=SQLITE_DONE)
+	{
+		Server->Log("SQL Error: "+query->getErrMsg()+ " Stmt: ["+query->getStatement()+"]", LL_ERROR);
+		_has_error=true;
+	}
+
+	return false;
+}
+
+int DatabaseCursor::getInt(int col)
+{
+	return query->columnInt(col);
+}
+
+int64 DatabaseCursor::getInt64(int col)
+{
+	return query->columnInt64(col);
+}
+
+std::string DatabaseCursor::getString(int col)
+{
+	size_t bsize;
+	const char* data = query->columnBlob(col, bsize);
+	return std::string(data, data+bsize);
+}
+
+const char* DatabaseCursor::getBlob(int col, size_t& bsize)
+{
+	return query->columnBlob(col, bsize);
+}
+
+bool DatabaseCursor::isNull(int col)
+{
+	return query->columnIsNull(col);
+}
+
 bool DatabaseCursor::has_error(void)
 {
 	return _has_error;
@@ -15,6 +15,13 @@ public:
 
 	bool next(db_single_result &res);
 
+	bool next();
+	int getInt(int col);
+	int64 getInt64(int col);
+	std::string getString(int col);
+	const char* getBlob(int col, size_t& bsize);
+	bool isNull(int col);
+
 	bool reset();
 
 	bool has_error();
@@ -21,6 +21,8 @@ public:
 	virtual void ReceivePackets(IRunOtherCallback* run_other)=0;
 
 	virtual bool wantReceive(void){ return true; }
+	//If false, Run() is only called after ReceivePackets() and at a coarse idle interval
+	virtual bool wantPeriodicRun(void){ return true; }
 	virtual bool closeSocket(void){ return true; }
 };
 
@@ -8,6 +8,16 @@ class IDatabaseCursor
 public:
 	virtual bool next(db_single_result &res)=0;
 
+	//Typed access to the current row after next() without building a db_single_result.
+	//Columns are indexed by their position in the select list.
+	//Blob pointers stay valid until the next call to next()
+	virtual bool next()=0;
+	virtual int getInt(int col)=0;
+	virtual int64 getInt64(int col)=0;
+	virtual std::string getString(int col)=0;
+	virtual const char* getBlob(int col, size_t& bsize)=0;
+	virtual bool isNull(int col)=0;
+
 	virtual bool has_error()=0;
 
 	virtual bool reset() = 0;
@@ -34,6 +44,36 @@ public:
 		return cursor->next(res);
 	}
 
+	bool next()
+	{
+		return cursor->next();
+	}
+
+	int getInt(int col)
+	{
+		return cursor->getInt(col);
+	}
+
+	int64 getInt64(int col)
+	{
+		return cursor->getInt64(col);
+	}
+
+	std::string getString(int col)
+	{
+		return cursor->getString(col);
+	}
+
+	const char* getBlob(int col, size_t& bsize)
+	{
+		return cursor->getBlob(col, bsize);
+	}
+
+	bool isNull(int col)
+	{
+		return cursor->isNull(col);
+	}
+
 	virtual bool has_error()
 	{
 		return cursor->has_error();
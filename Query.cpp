@@ -269,7 +269,8 @@ bool CQuery::Execute(int timeoutms)
 
 void CQuery::setupStepping(int *timeoutms, bool with_read_lock)
 {
-	if (with_read_lock)
+	if (with_read_lock
+		&& single_use_lock.get()==NULL)
 	{
 		single_use_lock.reset(new IScopedReadLock(db->getSingleUseMutex()));
 	}
@@ -345,7 +346,7 @@ db_results CQuery::Read(int *timeoutms)
 	do
 	{
 		bool reset=false;
-		err=step(res, timeoutms, tries, transaction_lock, reset);
+		err=step(&res, timeoutms, tries, transaction_lock, reset);
 		if(reset)
 		{
 			rows.clear();
@@ -385,7 +386,7 @@ namespace
 	}
 }
 
-int CQuery::step(db_single_result& res, int *timeoutms, int& tries, bool& transaction_lock, bool& reset)
+int CQuery::step(db_single_result* res, int *timeoutms, int& tries, bool& transaction_lock, bool& reset)
 {
 	int err=sqlite3_step(ps);
 	if( resultOkay(err) )
@@ -427,6 +428,11 @@ int CQuery::step(db_single_result& res, int *timeoutms, int& tries, bool& transa
 		}
 		else if( err==SQLITE_ROW )
 		{
+			if(res==NULL)
+			{
+				return err;
+			}
+
 			int column=0;
 			std::string column_name;
 			while( !(column_name=ustring_sqlite3_column_name(ps, column) ).empty() )
@@ -444,7 +450,7 @@ int CQuery::step(db_single_result& res, int *timeoutms, int& tries, bool& transa
 					data_size = sqlite3_column_bytes(ps, column);
 				}
 				std::string datastr(reinterpret_cast<const char*>(data), reinterpret_cast<const char*>(data)+data_size);				
-				res.insert( std::pair<std::string, std::string>(column_name, datastr) );
+				res->insert( std::pair<std::string, std::string>(column_name, datastr) );
 				++column;
 			}
 		}
@@ -465,6 +471,41 @@ int CQuery::step(db_single_result& res, int *timeoutms, int& tries, bool& transa
 	return err;
 }
 
+int CQuery::columnInt(int col)
+{
+	return sqlite3_column_int(ps, col);
+}
+
+int64 CQuery::columnInt64(int col)
+{
+	return sqlite3_column_int64(ps, col);
+}
+
+const char* CQuery::columnBlob(int col, size_t& bsize)
+{
+	const void* data;
+	if(sqlite3_column_type(ps, col)==SQLITE_BLOB)
+	{
+		data = sqlite3_column_blob(ps, col);
+	}
+	else
+	{
+		data = sqlite3_column_text(ps, col);
+	}
+	bsize = sqlite3_column_bytes(ps, col);
+	if(data==NULL)
+	{
+		bsize = 0;
+		return "";
+	}
+	return reinterpret_cast<const char*>(data);
+}
+
+bool CQuery::columnIsNull(int col)
+{
+	return sqlite3_column_type(ps, col)==SQLITE_NULL;
+}
+
 IDatabaseCursor* CQuery::Cursor(int *timeoutms)
 {
 	if(cursor==NULL)
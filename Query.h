@@ -49,7 +49,12 @@ public:
 	void setupStepping(int *timeoutms, bool with_read_lock);
 	void shutdownStepping(int err, int *timeoutms, bool& transaction_lock);
 
-	int step(db_single_result& res, int *timeoutms, int& tries, bool& transaction_lock, bool& reset);
+	int step(db_single_result* res, int *timeoutms, int& tries, bool& transaction_lock, bool& reset);
+
+	int columnInt(int col);
+	int64 columnInt64(int col);
+	const char* columnBlob(int col, size_t& bsize);
+	bool columnIsNull(int col);
 
 	bool resultOkay(int rc);
 
@@ -2,6 +2,7 @@
 #include "../stringtools.h"
 #include <regex>
 #include <iostream>
+#include <algorithm>
 
 enum CPPFileTokenType
 {
@@ -495,6 +496,151 @@ std::string return_blob(size_t tabs, std::string value_name, std::string sql_nam
 	return ret;
 }
 
+std::string retInitializer(const std::vector<ReturnType>& return_types, bool use_cond)
+{
+	std::string code="false, ";
+	size_t num = use_cond ? 1 : return_types.size();
+	for(size_t i=0;i<num;++i)
+	{
+		if(return_types[i].type=="int" || return_types[i].type=="int64")
+		{
+			code+="0";
+		}
+		else
+		{
+			code+="\"\"";
+		}
+		if(i+1<num)
+		{
+			code+=", ";
+		}
+	}
+	return code;
+}
+
+bool splitSelectColumns(const std::string& sql, std::vector<std::string>& names)
+{
+	std::string lsql=strlower(sql);
+	size_t select_pos=lsql.find("select");
+	if(select_pos==std::string::npos)
+	{
+		return false;
+	}
+
+	size_t start=select_pos+6;
+	while(start<lsql.size() && isspace(static_cast<unsigned char>(lsql[start])))
+	{
+		++start;
+	}
+	if(lsql.compare(start, 9, "distinct ")==0)
+	{
+		start+=9;
+	}
+
+	std::vector<std::string> exprs;
+	int depth=0;
+	size_t expr_start=start;
+	size_t end=std::string::npos;
+	for(size_t i=start;i<lsql.size();++i)
+	{
+		char ch=lsql[i];
+		if(ch=='(')
+		{
+			++depth;
+		}
+		else if(ch==')')
+		{
+			--depth;
+		}
+		else if(depth==0 && ch==',')
+		{
+			exprs.push_back(sql.substr(expr_start, i-expr_start));
+			expr_start=i+1;
+		}
+		else if(depth==0 && isspace(static_cast<unsigned char>(ch))
+			&& lsql.compare(i+1, 4, "from")==0
+			&& (i+5>=lsql.size() || isspace(static_cast<unsigned char>(lsql[i+5]))) )
+		{
+			end=i;
+			break;
+		}
+	}
+
+	if(end==std::string::npos)
+	{
+		return false;
+	}
+
+	exprs.push_back(sql.substr(expr_start, end-expr_start));
+
+	for(size_t i=0;i<exprs.size();++i)
+	{
+		std::string expr=trim(exprs[i]);
+		size_t as_pos=strlower(expr).rfind(" as ");
+		if(as_pos!=std::string::npos)
+		{
+			expr=trim(expr.substr(as_pos+4));
+		}
+		else if(expr.find("(")==std::string::npos
+			&& expr.find(".")!=std::string::npos)
+		{
+			expr=expr.substr(expr.find_last_of('.')+1);
+		}
+		if(expr=="*")
+		{
+			return false;
+		}
+		names.push_back(expr);
+	}
+
+	return true;
+}
+
+bool getColumnIndices(const std::string& sql, const std::vector<ReturnType>& return_types, std::vector<size_t>& columns)
+{
+	std::vector<std::string> names;
+	if(!splitSelectColumns(sql, names))
+	{
+		return false;
+	}
+
+	for(size_t i=0;i<return_types.size();++i)
+	{
+		std::vector<std::string>::iterator it=std::find(names.begin(), names.end(), return_types[i].name);
+		if(it==names.end())
+		{
+			return false;
+		}
+		columns.push_back(it-names.begin());
+	}
+	return true;
+}
+
+std::string cursorGet(const ReturnType& rtype, size_t column)
+{
+	if(rtype.type=="int")
+	{
+		return "cur->getInt("+convert(column)+")";
+	}
+	else if(rtype.type=="int64")
+	{
+		return "cur->getInt64("+convert(column)+")";
+	}
+	else
+	{
+		return "cur->getString("+convert(column)+")";
+	}
+}
+
+std::string cppType(const std::string& type)
+{
+	if(type=="string" || type=="blob")
+	{
+		return "std::string";
+	}
+	return type;
+}
+
 AnnotatedCode generateSqlFunction(IDatabase* db, AnnotatedCode input, GeneratedData& gen_data, bool check)
 {
 	std::string sql=input.annotations["sql"];
@@ -790,6 +936,95 @@ AnnotatedCode generateSqlFunction(IDatabase* db, AnnotatedCode input, GeneratedD
 		}
 	}
 
+	std::vector<size_t> columns;
+	if(stmt_type==StatementType_Select
+		&& !return_types.empty()
+		&& (return_vector || use_cond || use_raw || (use_struct && use_exists))
+		&& getColumnIndices(parsedSql, return_types, columns))
+	{
+		std::string full_struct_name=(classname.empty()?"":classname+"::")+struct_name;
+
+		if(return_vector)
+		{
+			code+="\t"+return_outer+" ret;\r\n";
+		}
+		else if(use_raw)
+		{
+			code+="\t"+cppType(return_types[0].type)+" ret";
+			if(return_types[0].type=="int" || return_types[0].type=="int64")
+			{
+				code+="=0";
+			}
+			code+=";\r\n";
+		}
+		else
+		{
+			code+="\t"+struct_name+" ret = { "+retInitializer(return_types, use_cond)+" };\r\n";
+		}
+
+		code+="\tIDatabaseCursor* cur="+query_name+"->Cursor();\r\n";
+
+		if(return_vector)
+		{
+			code+="\twhile(cur->next())\r\n";
+			code+="\t{\r\n";
+			if(use_struct)
+			{
+				code+="\t\tret.push_back("+full_struct_name+"());\r\n";
+				code+="\t\t"+full_struct_name+"& curr=ret.back();\r\n";
+				if(gen_data.structures[struct_name].use_exist)
+				{
+					code+="\t\tcurr.exists=true;\r\n";
+				}
+				for(size_t i=0;i<return_types.size();++i)
+				{
+					code+="\t\tcurr."+return_types[i].name+"="+cursorGet(return_types[i], columns[i])+";\r\n";
+				}
+			}
+			else
+			{
+				code+="\t\tret.push_back("+cursorGet(return_types[0], columns[0])+");\r\n";
+			}
+			code+="\t}\r\n";
+		}
+		else if(use_raw)
+		{
+			code+="\tbool has_row=cur->next();\r\n";
+			code+="\tassert(has_row);\r\n";
+			code+="\tif(has_row)\r\n";
+			code+="\t{\r\n";
+			code+="\t\tret="+cursorGet(return_types[0], columns[0])+";\r\n";
+			code+="\t}\r\n";
+		}
+		else
+		{
+			code+="\tif(cur->next())\r\n";
+			code+="\t{\r\n";
+			code+="\t\tret.exists=true;\r\n";
+			if(use_cond)
+			{
+				code+="\t\tret.value="+cursorGet(return_types[0], columns[0])+";\r\n";
+			}
+			else
+			{
+				for(size_t i=0;i<return_types.size();++i)
+				{
+					code+="\t\tret."+return_types[i].name+"="+cursorGet(return_types[i], columns[i])+";\r\n";
+				}
+			}
+			code+="\t}\r\n";
+		}
+
+		code+="\tcur->shutdown();\r\n";
+		if(!params.empty())
+		{
+			code+="\t"+query_name+"->Reset();\r\n";
+		}
+		code+="\treturn ret;\r\n";
+		code+="}";
+		return AnnotatedCode(input.annotations, code);
+	}
+
 	bool has_return=false;
 
 	if(stmt_type==StatementType_Select)
@@ -914,47 +1149,7 @@ AnnotatedCode generateSqlFunction(IDatabase* db, AnnotatedCode input, GeneratedD
 	}
 	else if(!return_types.empty() && !use_raw)
 	{
-		code+="\t"+struct_name+" ret = { ";
-		if(!use_cond)
-		{
-			code+="false, ";
-			for(size_t i=0;i<return_types.size();++i)
-			{
-				if(return_types[i].type=="int" || return_types[i].type=="int64")
-				{
-					code+="0";
-				}
-				else if(return_types[i].type=="blob")
-				{
-					code+="\"\"";
-				}
-				else
-				{
-					code+="\"\"";
-				}
-				if(i+1<return_types.size())
-				{
-					code+=", ";
-				}
-			}
-		}
-		else
-		{
-			code+="false, ";
-			if(return_types[0].type=="int" || return_types[0].type=="int64")
-			{
-				code+="0";
-			}
-			else if(return_types[0].type=="blob")
-			{
-				code+="\"\"";
-			}
-			else
-			{
-				code+="\"\"";
-			}
-		}
-		code+=" };\r\n";
+		code+="\t"+struct_name+" ret = { "+retInitializer(return_types, use_cond)+" };\r\n";
 		code+="\tif(!res.empty())\r\n";
 		code+="\t{\r\n";
 		if(use_exists)
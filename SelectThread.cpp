@@ -68,6 +68,22 @@ CSelectThread::CSelectThread(_u32 pWorkerThreadsPerMaster)
 		}
 	}
 	run=true;
+
+#ifdef HAS_EPOLL
+	epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+	wakeup_fd=eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+
+	if(epoll_fd==-1 || wakeup_fd==-1)
+	{
+		Server->Log("Creating epoll instance failed. errno="+convert(errno), LL_ERROR);
+		abort();
+	}
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+#endif
 }
 
 CSelectThread::~CSelectThread()
@@ -88,14 +104,79 @@ CSelectThread::~CSelectThread()
 		workers.clear();
 	}
 	
+#ifdef HAS_EPOLL
+	close(epoll_fd);
+	close(wakeup_fd);
+#endif
+	
 	Server->destroy(mutex);
 	Server->destroy(stop_mutex);
 	Server->destroy(cond);
 	Server->destroy(stop_cond);
 }
 
+#ifdef HAS_EPOLL
+void CSelectThread::runEpoll(void)
+{
+	epoll_event events[max_clients+1];
+
+	while(run)
+	{
+		{
+			IScopedLock lock(mutex);
+			while( clients.size()==0 )
+			{
+				cond->wait(&lock);
+				if(!run)
+				{
+				  IScopedLock slock(stop_mutex);
+				  stop_cond->notify_one();
+				  return;
+				}
+			}
+		}
+
+		//Client sockets are registered one-shot. They are re-armed via
+		//ContinueClient() once a worker is done processing them
+		int rc = epoll_wait(epoll_fd, events, max_clients+1, -1);
+
+		if(rc>0)
+		{
+			IScopedLock lock(mutex);
+			for(int i=0;i<rc;++i)
+			{
+				CClient* client = reinterpret_cast<CClient*>(events[i].data.ptr);
+				if(client==NULL)
+				{
+					uint64_t val;
+					if(read(wakeup_fd, &val, sizeof(val))!=sizeof(val)
+						&& errno!=EAGAIN)
+					{
+						Server->Log("Reading from eventfd failed. errno="+convert(errno), LL_ERROR);
+					}
+					continue;
+				}
+
+				FindWorker(client);
+			}
+		}
+		else if(rc==-1 && errno!=EINTR)
+		{
+			Server->Log("epoll_wait error: "+convert(errno),LL_ERROR);
+		}
+	}
+	IScopedLock slock(stop_mutex);
+	stop_cond->notify_one();
+}
+#endif //HAS_EPOLL
+
 void CSelectThread::operator()()
 {
+#ifdef HAS_EPOLL
+	runEpoll();
+	return;
+#endif
+
 #ifdef _WIN32
 	_i32 max;
 	fd_set fdset;
@@ -240,6 +321,16 @@ bool CSelectThread::AddClient(CClient *client)
 	{
 		IScopedLock lock(mutex);
 		clients.push_back(client);
+		client->setSelectThread(this);
+#ifdef HAS_EPOLL
+		epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = client;
+		if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->getSocket(), &ev)!=0)
+		{
+			Server->Log("Adding client socket to epoll failed. errno="+convert(errno), LL_ERROR);
+		}
+#endif
 		WakeUp();
 		return true;
 	}
@@ -259,6 +350,10 @@ bool CSelectThread::RemoveClient(CClient *client)
 	{
 		if( clients[i]==client )
 		{
+#ifdef HAS_EPOLL
+			epoll_event ev = {};
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->getSocket(), &ev);
+#endif
 			clients.erase( clients.begin()+i );
 			client->remove();
 			delete client;
@@ -279,7 +374,30 @@ void CSelectThread::FindWorker(CClient *client)
 	}
 }
 
+void CSelectThread::ContinueClient(CClient *client)
+{
+#ifdef HAS_EPOLL
+	epoll_event ev = {};
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = client;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->getSocket(), &ev)!=0)
+	{
+		Server->Log("Re-arming client socket in epoll failed. errno="+convert(errno), LL_ERROR);
+	}
+#else
+	WakeUp();
+#endif
+}
+
 void CSelectThread::WakeUp(void)
 {
 	cond->notify_one();
+#ifdef HAS_EPOLL
+	uint64_t val = 1;
+	if(write(wakeup_fd, &val, sizeof(val))!=sizeof(val)
+		&& errno!=EAGAIN)
+	{
+		Server->Log("Writing to eventfd failed. errno="+convert(errno), LL_ERROR);
+	}
+#endif
 }
@@ -7,6 +7,7 @@
 #include <deque>
 #include <vector>
 #include "types.h"
+#include "socket_header.h"
 
 class CClient;
 class CWorkerThread;
@@ -26,10 +27,19 @@ public:
 
 	size_t FreeClients(void);
 
+	void ContinueClient(CClient *client);
+
 	void WakeUp(void);
 private:
 	void FindWorker(CClient *client);
 
+#ifdef HAS_EPOLL
+	void runEpoll(void);
+
+	int epoll_fd;
+	int wakeup_fd;
+#endif
+
 	std::deque<CClient*> clients;
 
 	IMutex *mutex;
@@ -37,6 +37,7 @@
 #include "Interface/DatabaseFactory.h"
 
 #include "Server.h"
+#include "AsyncLogger.h"
 #include "Template.h"
 #include "stringtools.h"
 #include "defaults.h"
@@ -166,6 +167,7 @@ CServer::CServer()
 	curr_postfilekey=0;
 	loglevel=LL_INFO;
 	logfile_a=false;
+	async_logger=NULL;
 	circular_log_buffer_id=0;
 	circular_log_buffer_idx=0;
 	has_circular_log_buffer=false;
@@ -270,6 +272,8 @@ void CServer::destroyDatabases(THREAD_ID tid)
 
 CServer::~CServer()
 {
+	stopAsyncLog();
+
 	if(getServerParameter("leak_check")!="true") //minimal cleanup
 	{
 		return;
@@ -406,6 +410,13 @@ void CServer::setServerParameter(const std::string &key, const std::string &valu
 
 void CServer::Log( const std::string &pStr, int LogLevel)
 {
+	if(async_logger!=NULL
+		&& (loglevel<=LogLevel || has_circular_log_buffer)
+		&& async_logger->log(pStr, LogLevel, loglevel<=LogLevel) )
+	{
+		return;
+	}
+
 	if( loglevel <=LogLevel )
 	{
 		IScopedLock lock(log_mutex);
@@ -457,14 +468,130 @@ void CServer::Log( const std::string &pStr, int LogLevel)
 
 		if(has_circular_log_buffer)
 		{
-			logToCircularBuffer(pStr, LogLevel);
+			logToCircularBuffer(pStr, LogLevel, getTimeSeconds());
 		}
 	}
 	else if(has_circular_log_buffer)
 	{
 		IScopedLock lock(log_mutex);
 
-		logToCircularBuffer(pStr, LogLevel);
+		logToCircularBuffer(pStr, LogLevel, getTimeSeconds());
+	}
+}
+
+namespace
+{
+	AsyncLogger* g_async_logger=NULL;
+
+	void stop_async_log_at_exit()
+	{
+		if(g_async_logger!=NULL)
+		{
+			g_async_logger->stop();
+		}
+	}
+}
+
+void CServer::startAsyncLog(size_t n_rings, size_t ring_size)
+{
+	if(async_logger!=NULL)
+		return;
+
+	AsyncLogger* logger=new AsyncLogger(this, n_rings, ring_size);
+	createThread(logger, "log writer");
+	async_logger=logger;
+
+	//Write out queued messages if the process ends via exit()
+	g_async_logger=logger;
+	atexit(stop_async_log_at_exit);
+}
+
+void CServer::stopAsyncLog()
+{
+	if(async_logger!=NULL)
+	{
+		async_logger->stop();
+	}
+}
+
+void CServer::writeLogEntries(std::vector<SAsyncLogEntry>& entries, size_t dropped)
+{
+	IScopedLock lock(log_mutex);
+
+	std::string out_console;
+	std::string out_file;
+	char buffer [100];
+	buffer[0]=0;
+	time_t last_time=0;
+
+	for(size_t i=0;i<entries.size();++i)
+	{
+		SAsyncLogEntry& entry=entries[i];
+
+		if(has_circular_log_buffer)
+		{
+			logToCircularBuffer(entry.msg, entry.loglevel, entry.time);
+		}
+
+		if(!entry.write)
+			continue;
+
+		if(i==0 || entry.time!=last_time)
+		{
+#ifdef _WIN32
+			struct tm  timeinfo;
+			localtime_s(&timeinfo, &entry.time);
+			strftime (buffer,100,"%Y-%m-%d %X: ",&timeinfo);
+#else
+			struct tm timeinfo;
+			localtime_r(&entry.time, &timeinfo);
+			strftime (buffer,100,"%Y-%m-%d %X: ",&timeinfo);
+#endif
+			last_time=entry.time;
+		}
+
+		const char* prefix="";
+		if( entry.loglevel==LL_ERROR )
+			prefix="ERROR: ";
+		else if( entry.loglevel==LL_WARNING )
+			prefix="WARNING: ";
+
+		if(log_console_time)
+		{
+			out_console+=buffer;
+		}
+		out_console+=prefix;
+		out_console+=entry.msg;
+		out_console+="\n";
+
+		if(logfile_a)
+		{
+			out_file+=buffer;
+			out_file+=prefix;
+			out_file+=entry.msg;
+			out_file+="\n";
+		}
+	}
+
+	if(dropped>0)
+	{
+		std::string msg="WARNING: "+convert(dropped)+" log messages were dropped because the log buffer was full\n";
+		out_console+=msg;
+		if(logfile_a)
+		{
+			out_file+=msg;
+		}
+	}
+
+	std::cout << out_console;
+	std::cout.flush();
+
+	if(logfile_a)
+	{
+		logfile.write(out_file.data(), out_file.size());
+		logfile.flush();
+
+		rotateLogfile();
 	}
 }
 
@@ -2191,7 +2318,7 @@ std::vector<SCircularLogEntry> CServer::getCicularLogBuffer( size_t minid )
 	return std::vector<SCircularLogEntry>();
 }
 
-void CServer::logToCircularBuffer(const std::string& msg, int loglevel)
+void CServer::logToCircularBuffer(const std::string& msg, int loglevel, int64 times)
 {
 	if(circular_log_buffer.empty())
 		return;
@@ -2201,7 +2328,7 @@ void CServer::logToCircularBuffer(const std::string& msg, int loglevel)
 	entry.utf8_msg=msg;
 	entry.loglevel=loglevel;
 	entry.id=circular_log_buffer_id++;
-	entry.time=Server->getTimeSeconds();
+	entry.time=times;
 
 	circular_log_buffer_idx=(circular_log_buffer_idx+1)%circular_log_buffer.size();
 }
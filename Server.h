@@ -33,6 +33,8 @@ class CSessionMgr;
 class CServiceAcceptor;
 class CThreadPool;
 class IOutputStream;
+class AsyncLogger;
+struct SAsyncLogEntry;
 
 struct SDatabase
 {
@@ -207,6 +209,10 @@ public:
 
 	void setLogConsoleTime(bool b);
 
+	void startAsyncLog(size_t n_rings, size_t ring_size);
+	void stopAsyncLog();
+	void writeLogEntries(std::vector<SAsyncLogEntry>& entries, size_t dropped);
+
 #ifdef _WIN32
 	void setSocketWindowSizes(int p_send_window_size, int p_recv_window_size);
 
@@ -217,7 +223,7 @@ public:
 
 private:
 
-	void logToCircularBuffer(const std::string& msg, int loglevel);
+	void logToCircularBuffer(const std::string& msg, int loglevel, int64 times);
 
 	bool UnloadDLLs(void);
 	void UnloadDLLs2(void);
@@ -232,6 +238,7 @@ private:
 	std::fstream logfile;
 
 	IMutex* log_mutex;
+	AsyncLogger* async_logger;
 	IMutex* action_mutex;
 	IMutex* requests_mutex;
 	IMutex* outputs_mutex;
@@ -24,6 +24,17 @@
 #include "stringtools.h"
 #include <stdlib.h>
 
+namespace
+{
+	const size_t not_active = static_cast<size_t>(-1);
+#ifdef HAS_EPOLL
+	//Clients which want a periodic Run() are run at this interval
+	const int64 active_run_interval = 10;
+	//All other clients are Run() at this interval (e.g. for timeouts)
+	const int64 idle_run_interval = 1000;
+#endif
+}
+
 CServiceWorker::CServiceWorker(IService *pService, std::string pName, IPipe * pExit, int pMaxClientsPerThread)
 	: exit(pExit), tid(0)
 {
@@ -52,17 +63,47 @@ CServiceWorker::CServiceWorker(IService *pService, std::string pName, IPipe * pE
 			max_clients=MAX_CLIENTS;
 		}
 	}
+
+#ifdef HAS_EPOLL
+	epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+	wakeup_fd=eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	timer_fd=timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+	timer_interval=0;
+	last_idle_run=0;
+	n_polled=0;
+
+	if(epoll_fd==-1 || wakeup_fd==-1 || timer_fd==-1)
+	{
+		Server->Log(name+": Creating epoll instance failed. errno="+convert(errno), LL_ERROR);
+		abort();
+	}
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = &wakeup_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+
+	ev.data.ptr = &timer_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+#endif
 }
 
 CServiceWorker::~CServiceWorker()
 {
 	for(size_t i=0;i<clients.size();++i)
 	{
-		service->destroyClient( clients[i].first );
-		delete clients[i].second;
+		service->destroyClient( clients[i]->client );
+		delete clients[i]->pipe;
+		delete clients[i];
 	}
 	clients.clear();
 
+#ifdef HAS_EPOLL
+	close(epoll_fd);
+	close(wakeup_fd);
+	close(timer_fd);
+#endif
+
 	Server->destroy(mutex);
 	Server->destroy(nc_mutex);
 	Server->destroy(cond);
@@ -73,7 +114,154 @@ void CServiceWorker::stop(void)
 	IScopedLock lock(mutex);
 	do_stop=true;
 	cond->notify_all();
+#ifdef HAS_EPOLL
+	wakeUp();
+#endif
+}
+
+bool CServiceWorker::runClient(SClient* client)
+{
+	if (!client->client->Run(this))
+	{
+		removeClient(client);
+		return false;
+	}
+
+#ifdef HAS_EPOLL
+	updateClient(client);
+#endif
+	return true;
+}
+
+void CServiceWorker::removeClient(SClient* client)
+{
+	IScopedLock lock(mutex);
+	//Server->Log(name+": Removing user"+convert(Server->getTimeMS()), LL_DEBUG);
+#ifdef HAS_EPOLL
+	//The socket may live on (closeSocket()==false), so it has to be removed explicitly
+	setPolled(client, false);
+	removeActive(client);
+#endif
+	if (client->client->closeSocket())
+	{
+		delete client->pipe;
+	}
+	service->destroyClient(client->client);
+
+	size_t idx = client->idx;
+	clients[idx] = clients[clients.size() - 1];
+	clients[idx]->idx = idx;
+	clients.pop_back();
+	delete client;
+
+	IScopedLock lock2(nc_mutex);
+	--nClients;
+}
+
+#ifdef HAS_EPOLL
+void CServiceWorker::updateClient(SClient* client)
+{
+	if (client->client->wantPeriodicRun())
+	{
+		if (client->active_idx == not_active)
+		{
+			client->active_idx = active_clients.size();
+			active_clients.push_back(client);
+		}
+	}
+	else
+	{
+		removeActive(client);
+	}
+
+	setPolled(client, client->client->wantReceive());
+}
+
+void CServiceWorker::removeActive(SClient* client)
+{
+	size_t idx = client->active_idx;
+	if (idx == not_active)
+	{
+		return;
+	}
+
+	active_clients[idx] = active_clients[active_clients.size() - 1];
+	active_clients[idx]->active_idx = idx;
+	active_clients.pop_back();
+	client->active_idx = not_active;
+}
+
+void CServiceWorker::setPolled(SClient* client, bool b)
+{
+	if (client->polled == b)
+	{
+		return;
+	}
+
+	SOCKET s = client->pipe->getSocket();
+	if (b)
+	{
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = client;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &ev) != 0)
+		{
+			Server->Log(name + ": Adding socket to epoll failed. errno=" + convert(errno), LL_ERROR);
+			return;
+		}
+		++n_polled;
+	}
+	else
+	{
+		epoll_event ev = {};
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, &ev);
+		--n_polled;
+	}
+
+	client->polled = b;
+}
+
+void CServiceWorker::setTimer(int64 interval_ms)
+{
+	if (timer_interval == interval_ms)
+	{
+		return;
+	}
+
+	itimerspec ts = {};
+	ts.it_interval.tv_sec = static_cast<time_t>(interval_ms / 1000);
+	ts.it_interval.tv_nsec = static_cast<long>((interval_ms % 1000) * 1000000);
+	ts.it_value = ts.it_interval;
+
+	if (timerfd_settime(timer_fd, 0, &ts, NULL) != 0)
+	{
+		Server->Log(name + ": Setting timer failed. errno=" + convert(errno), LL_ERROR);
+		return;
+	}
+
+	timer_interval = interval_ms;
+}
+
+void CServiceWorker::wakeUp(void)
+{
+	uint64_t val = 1;
+	if (write(wakeup_fd, &val, sizeof(val)) != sizeof(val)
+		&& errno!=EAGAIN)
+	{
+		Server->Log(name + ": Writing to eventfd failed. errno=" + convert(errno), LL_ERROR);
+	}
+}
+
+void CServiceWorker::drainFd(int fd)
+{
+	uint64_t val;
+	if (read(fd, &val, sizeof(val)) != sizeof(val)
+		&& errno != EAGAIN)
+	{
+		Server->Log(name + ": Reading from eventfd/timerfd failed. errno=" + convert(errno), LL_ERROR);
+	}
 }
+#endif
 
 
 namespace
@@ -96,7 +284,7 @@ namespace
 	};
 }
 
-void CServiceWorker::work(ICustomClient * skip_client)
+void CServiceWorker::work(SClient* skip_client)
 {
 	if (clients.empty())
 	{
@@ -118,32 +306,124 @@ void CServiceWorker::work(ICustomClient * skip_client)
 	curr_work.push(curr_work_c);
 	ScopedWorkStack work_stack(curr_work);
 
-	for (size_t i = 0; i<clients.size();)
+#ifdef HAS_EPOLL
+	int64 curr_time = Server->getTimeMS();
+	if (skip_client == NULL
+		&& curr_time - last_idle_run >= idle_run_interval)
 	{
-		if (clients[i].first == skip_client)
+		last_idle_run = curr_time;
+
+		for (size_t i = 0; i<clients.size();)
 		{
-			++i;
-			continue;
+			SClient* client = clients[i];
+			curr_work.top().client = client;
+
+			if (runClient(client))
+			{
+				++i;
+			}
+
+			if (curr_work.top().did_other_work)
+			{
+				return;
+			}
 		}
+	}
+	else
+	{
+		for (size_t i = 0; i<active_clients.size();)
+		{
+			SClient* client = active_clients[i];
+			if (client == skip_client)
+			{
+				++i;
+				continue;
+			}
 
-		curr_work.top().client = clients[i].first;
+			curr_work.top().client = client;
 
-		bool b = clients[i].first->Run(this);
+			if (runClient(client)
+				&& client->active_idx == i)
+			{
+				++i;
+			}
 
-		if (b == false)
-		{
-			IScopedLock lock(mutex);
-			//Server->Log(name+": Removing user"+convert(Server->getTimeMS()), LL_DEBUG);
-			if (clients[i].first->closeSocket())
+			if (curr_work.top().did_other_work)
 			{
-				delete clients[i].second;
+				return;
 			}
-			service->destroyClient(clients[i].first);
-			clients.erase(clients.begin() + i);
-			IScopedLock lock2(nc_mutex);
-			--nClients;
 		}
-		else
+	}
+
+	int timeout;
+	if (skip_client != NULL)
+	{
+		//Level triggered, so it would wake us up continuously.
+		//The outer work() polls it again after its Run()/ReceivePackets()
+		setPolled(skip_client, false);
+
+		size_t n_active = active_clients.size();
+		if (skip_client->active_idx != not_active)
+		{
+			--n_active;
+		}
+
+		if (n_polled == 0 && n_active == 0)
+		{
+			return;
+		}
+
+		//The caller is waiting for something else and calls us in a loop
+		timeout = static_cast<int>(active_run_interval);
+	}
+	else
+	{
+		setTimer(active_clients.empty() ? idle_run_interval : active_run_interval);
+		timeout = -1;
+	}
+
+	epoll_events.resize(n_polled + 2);
+	int rc = epoll_wait(epoll_fd, &epoll_events[0], static_cast<int>(epoll_events.size()), timeout);
+
+	for (int i = 0; i<rc; ++i)
+	{
+		void* ptr = epoll_events[i].data.ptr;
+		if (ptr == &wakeup_fd)
+		{
+			drainFd(wakeup_fd);
+			continue;
+		}
+		else if (ptr == &timer_fd)
+		{
+			drainFd(timer_fd);
+			continue;
+		}
+
+		SClient* client = reinterpret_cast<SClient*>(ptr);
+
+		curr_work.top().client = client;
+
+		client->client->ReceivePackets(this);
+
+		updateClient(client);
+
+		if (curr_work.top().did_other_work)
+		{
+			return;
+		}
+	}
+#else //HAS_EPOLL
+	for (size_t i = 0; i<clients.size();)
+	{
+		if (clients[i] == skip_client)
+		{
+			++i;
+			continue;
+		}
+
+		curr_work.top().client = clients[i];
+
+		if (runClient(clients[i]))
 		{
 			++i;
 		}
@@ -159,7 +439,7 @@ void CServiceWorker::work(ICustomClient * skip_client)
 	int max;
 #else
 	std::vector<pollfd> conn;
-	std::vector<ICustomClient*> conn_clients;
+	std::vector<SClient*> conn_clients;
 #endif
 
 
@@ -175,14 +455,14 @@ void CServiceWorker::work(ICustomClient * skip_client)
 
 	for (size_t i = 0; i<clients.size(); ++i)
 	{
-		if (clients[i].first == skip_client)
+		if (clients[i] == skip_client)
 		{
 			continue;
 		}
 
-		if (clients[i].first->wantReceive())
+		if (clients[i]->client->wantReceive())
 		{
-			SOCKET s = clients[i].second->getSocket();
+			SOCKET s = clients[i]->pipe->getSocket();
 #ifdef _WIN32
 			if ((_i32)s>max)
 				max = (_i32)s;
@@ -193,7 +473,7 @@ void CServiceWorker::work(ICustomClient * skip_client)
 			nconn.events = POLLIN;
 			nconn.revents = 0;
 			conn.push_back(nconn);
-			conn_clients.push_back(clients[i].first);
+			conn_clients.push_back(clients[i]);
 #endif
 			has_select_client = true;
 		}
@@ -216,18 +496,18 @@ void CServiceWorker::work(ICustomClient * skip_client)
 #ifdef _WIN32
 			for (size_t i = 0; i<clients.size(); ++i)
 			{
-				if (clients[i].first == skip_client)
+				if (clients[i] == skip_client)
 				{
 					continue;
 				}
 
-				SOCKET s = clients[i].second->getSocket();
+				SOCKET s = clients[i]->pipe->getSocket();
 				if (FD_ISSET(s, &fdset))
 				{
-					curr_work.top().client = clients[i].first;
+					curr_work.top().client = clients[i];
 
 					//Server->Log("Incoming data for client..", LL_DEBUG);
-					clients[i].first->ReceivePackets(this);
+					clients[i]->client->ReceivePackets(this);
 
 					if (curr_work.top().did_other_work)
 					{
@@ -240,9 +520,9 @@ void CServiceWorker::work(ICustomClient * skip_client)
 			{
 				if (conn[i].revents != 0)
 				{
-					curr_work.top().client = clients[i].first;
+					curr_work.top().client = conn_clients[i];
 
-					conn_clients[i]->ReceivePackets(this);
+					conn_clients[i]->client->ReceivePackets(this);
 
 					if (curr_work.top().did_other_work)
 					{
@@ -257,6 +537,7 @@ void CServiceWorker::work(ICustomClient * skip_client)
 	{
 		Server->wait(10);
 	}
+#endif //HAS_EPOLL
 }
 
 void CServiceWorker::addNewClients(void)
@@ -266,7 +547,16 @@ void CServiceWorker::addNewClients(void)
 		CStreamPipe *pipe=new CStreamPipe(new_clients[i].first);
 		ICustomClient *nc=service->createClient();
 		nc->Init(tid, pipe, new_clients[i].second);
-		clients.push_back( std::pair<ICustomClient*, CStreamPipe*>(nc, pipe) );
+		SClient* client = new SClient;
+		client->client = nc;
+		client->pipe = pipe;
+		client->polled = false;
+		client->idx = clients.size();
+		client->active_idx = not_active;
+		clients.push_back(client);
+#ifdef HAS_EPOLL
+		updateClient(client);
+#endif
     }
     new_clients.clear();
 }
@@ -307,6 +597,9 @@ void CServiceWorker::AddClient(SOCKET pSocket, const std::string& endpoint)
 	new_clients.push_back( std::make_pair(pSocket, endpoint) );
 	
 	cond->notify_all();
+#ifdef HAS_EPOLL
+	wakeUp();
+#endif
 	
 	IScopedLock lock2(nc_mutex);
 	++nClients;
@@ -29,19 +29,41 @@ public:
 
 	virtual void runOther();
 
-	struct SCurrWork
+	struct SClient
 	{
 		ICustomClient* client;
+		CStreamPipe* pipe;
+		bool polled;
+		size_t idx;
+		size_t active_idx;
+	};
+
+	struct SCurrWork
+	{
+		SClient* client;
 		bool did_other_work;
 	};
 
 private:
 
-	void work(ICustomClient* skip_client);
+	void work(SClient* skip_client);
     
 	void addNewClients(void);
 
-	std::vector<std::pair<ICustomClient*, CStreamPipe*> > clients;
+	bool runClient(SClient* client);
+
+	void removeClient(SClient* client);
+
+#ifdef HAS_EPOLL
+	void updateClient(SClient* client);
+	void removeActive(SClient* client);
+	void setPolled(SClient* client, bool b);
+	void setTimer(int64 interval_ms);
+	void wakeUp(void);
+	void drainFd(int fd);
+#endif
+
+	std::vector<SClient*> clients;
 	std::vector<std::pair<SOCKET, std::string> > new_clients;
 
 	IMutex* mutex;
@@ -61,4 +83,15 @@ private:
 	volatile bool do_stop;	
 
 	std::stack<SCurrWork> curr_work;
+
+#ifdef HAS_EPOLL
+	int epoll_fd;
+	int wakeup_fd;
+	int timer_fd;
+	int64 timer_interval;
+	int64 last_idle_run;
+	size_t n_polled;
+	std::vector<SClient*> active_clients;
+	std::vector<epoll_event> epoll_events;
+#endif
 };
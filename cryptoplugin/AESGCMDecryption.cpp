@@ -24,11 +24,12 @@
 
 const size_t iv_size = 12;
 const size_t end_marker_zeros = 4;
+const size_t tag_size = 16;
 
 using namespace CryptoPPCompat;
 
 AESGCMDecryption::AESGCMDecryption( const std::string &password, bool hash_password )
-	: decryption(), decryption_filter(decryption), iv_done(false), end_marker_state(0),
+	: decryption(), message_pos(0), iv_done(false), end_marker_state(0),
 	overhead_bytes(0)
 {
 	if(hash_password)
@@ -114,17 +115,20 @@ bool AESGCMDecryption::put( const char *data, size_t data_size)
 
 				if(carry_zeros>0)
 				{
-					for(size_t i=0;i<carry_zeros;++i)
-						decryption_filter.Put(0);
+					const char zeros[end_marker_zeros] = {};
+					putCiphertext(zeros, carry_zeros);
 				}
 
-				if(has_copy && data_size-escaped_zeros>0)
+				if(has_copy)
 				{
-					decryption_filter.Put(reinterpret_cast<const byte*>(data_copy.data()), data_size-escaped_zeros);
+					if(data_size-escaped_zeros>0)
+					{
+						putCiphertext(data_copy.data(), data_size-escaped_zeros);
+					}
 				}
 				else if(data_size>0)
 				{
-					decryption_filter.Put(reinterpret_cast<const byte*>(data), data_size);
+					putCiphertext(data, data_size);
 				}
 
 				VLOG(Server->Log("Data without end: "+convert(data_size), LL_DEBUG));
@@ -132,27 +136,38 @@ bool AESGCMDecryption::put( const char *data, size_t data_size)
 		}
 		else
 		{
-			if(end_marker_pos>end_marker_zeros+1)
+			//Zeros held back by the last call are data, unless they are
+			//part of the end marker. Message data may end with zeros as well
+			size_t data_zeros = carry_zeros;
+			if(end_marker_pos<end_marker_zeros+1)
 			{
-				if(carry_zeros>0)
-				{
-					for(size_t i=0;i<carry_zeros;++i)
-						decryption_filter.Put(0);
-				}
+				data_zeros -= (std::min)(data_zeros, end_marker_zeros+1-end_marker_pos);
+			}
 
+			if(data_zeros>0)
+			{
+				const char zeros[end_marker_zeros] = {};
+				putCiphertext(zeros, data_zeros);
+			}
+
+			if(end_marker_pos>end_marker_zeros+1)
+			{
 				if(has_copy)
 				{
-					decryption_filter.Put(reinterpret_cast<const byte*>(data_copy.data()), end_marker_pos-end_marker_zeros-1);
+					putCiphertext(data_copy.data(), end_marker_pos-end_marker_zeros-1);
 				}
 				else
 				{
-					decryption_filter.Put(reinterpret_cast<const byte*>(data), end_marker_pos-end_marker_zeros-1);
+					putCiphertext(data, end_marker_pos-end_marker_zeros-1);
 				}
 			}
 			try
 			{
-				VLOG(Server->Log("Message end. Size: "+convert(decryption_filter.MaxRetrievable()), LL_DEBUG));
-				decryption_filter.MessageEnd();
+				VLOG(Server->Log("Message end. Size: "+convert(plain_buffer.size()), LL_DEBUG));
+				if(!finishMessage())
+				{
+					return false;
+				}
 			}
 			catch (CryptoPP::Exception& e)
 			{
@@ -160,7 +175,7 @@ bool AESGCMDecryption::put( const char *data, size_t data_size)
 				return false;
 			}
 			
-			overhead_bytes+=16; //tag size
+			overhead_bytes+=tag_size;
 
 			CryptoPP::IncrementCounterByOne(reinterpret_cast<byte*>(&iv_buffer[0]), static_cast<unsigned int>(iv_buffer.size()));
 			decryption.Resynchronize(reinterpret_cast<const byte*>(iv_buffer.data()), static_cast<int>(iv_buffer.size()));
@@ -182,61 +197,122 @@ bool AESGCMDecryption::put( const char *data, size_t data_size)
 
 std::string AESGCMDecryption::get( bool& has_error )
 {
-	try
+	std::string ret;
+	has_error = !get(ret);
+	return ret;
+}
+
+bool AESGCMDecryption::get(std::string& ret)
+{
+	if(messages.empty())
 	{
-		std::string ret;
-		if(decryption_filter.NumberOfMessages()>0)
-		{
-			ret.resize(decryption_filter.MaxRetrievable());
+		ret.clear();
+		return true;
+	}
 
-			if(!ret.empty())
-			{
-				size_t nb = decryption_filter.Get(reinterpret_cast<byte*>(&ret[0]), ret.size());
-				if(nb!=ret.size())
-				{
-					assert(false);
-					ret.resize(nb);
-				}
-			}
+	std::string& msg = messages.front();
 
-			decryption_filter.GetNextMessage();
+	if(message_pos>0)
+	{
+		ret.assign(msg, message_pos, std::string::npos);
+		message_pos=0;
+	}
+	else
+	{
+		//Hand the decrypted message over without copying it. The old
+		//memory of ret is used for the next message
+		ret.swap(msg);
+		msg.clear();
+		if(plain_buffer.empty())
+		{
+			plain_buffer.swap(msg);
 		}
+	}
+
+	messages.pop_front();
+	return true;
+}
 
-		has_error=false;
-		return ret;
+bool AESGCMDecryption::get( char *data, size_t& data_size )
+{
+	if(messages.empty())
+	{
+		data_size=0;
+		return true;
 	}
-	catch (CryptoPP::Exception& e)
+
+	const std::string& msg = messages.front();
+
+	data_size = (std::min)(data_size, msg.size()-message_pos);
+	if(data_size>0)
 	{
-		Server->Log(std::string("Exception during decryption (get): ")+e.what(), LL_ERROR);
-		has_error=true;
+		memcpy(data, msg.data()+message_pos, data_size);
+		message_pos+=data_size;
 	}
 
-	return std::string();
+	if(message_pos==msg.size())
+	{
+		messages.pop_front();
+		message_pos=0;
+	}
+
+	return true;
 }
 
-bool AESGCMDecryption::get( char *data, size_t& data_size )
+void AESGCMDecryption::putCiphertext(const char* data, size_t data_size)
 {
-	try
+	//The last tag_size bytes of a message are its authentication tag.
+	//They are only known once the end marker arrives, so hold them back
+	size_t avail = tag_buffer.size()+data_size;
+	if(avail<=tag_size)
 	{
-		if(decryption_filter.NumberOfMessages()>0)
-		{
-			data_size = decryption_filter.Get(reinterpret_cast<byte*>(data), data_size);
+		tag_buffer.append(data, data_size);
+		return;
+	}
 
-			decryption_filter.GetNextMessage();
-		}
-		else
-		{
-			data_size=0;
-		}
+	size_t to_decrypt = avail-tag_size;
+	size_t from_tag = (std::min)(to_decrypt, tag_buffer.size());
+	size_t from_data = to_decrypt-from_tag;
 
-		return true;
+	size_t off = plain_buffer.size();
+	plain_buffer.resize(off+to_decrypt);
+	byte* out = reinterpret_cast<byte*>(&plain_buffer[off]);
+
+	if(from_tag>0)
+	{
+		decryption.ProcessData(out, reinterpret_cast<const byte*>(tag_buffer.data()), from_tag);
 	}
-	catch (CryptoPP::Exception& e)
+	if(from_data>0)
 	{
-		Server->Log(std::string("Exception during decryption (get2): ")+e.what(), LL_ERROR);
+		decryption.ProcessData(out+from_tag, reinterpret_cast<const byte*>(data), from_data);
+	}
+
+	tag_buffer.erase(0, from_tag);
+	tag_buffer.append(data+from_data, data_size-from_data);
+}
+
+bool AESGCMDecryption::finishMessage()
+{
+	if(tag_buffer.size()!=tag_size)
+	{
+		Server->Log("Encrypted message is shorter than its authentication tag", LL_DEBUG);
+		return false;
+	}
+
+	bool ok = decryption.TruncatedVerify(reinterpret_cast<const byte*>(tag_buffer.data()), tag_size);
+	tag_buffer.clear();
+
+	if(!ok)
+	{
+		Server->Log("Authentication of encrypted message failed", LL_DEBUG);
+		plain_buffer.clear();
+		return false;
 	}
 
-	return false;
+	//Decrypted data is only handed out after its message was authenticated
+	messages.push_back(std::string());
+	messages.back().swap(plain_buffer);
+	return true;
 }
 
 size_t AESGCMDecryption::findAndUnescapeEndMarker( const char* data, size_t data_size, std::string& data_copy,
@@ -313,6 +389,6 @@ int64 AESGCMDecryption::getOverheadBytes()
 
 bool AESGCMDecryption::hasData()
 {
-	return decryption_filter.NumberOfMessages()>0;
+	return !messages.empty();
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 #include "IAESGCMDecryption.h"
 #include "cryptopp_inc.h"
+#include <deque>
 
 class AESGCMDecryption : public IAESGCMDecryption
 {
@@ -13,6 +14,8 @@ public:
 
 	virtual bool get(char *data, size_t& data_size);
 
+	virtual bool get(std::string& ret);
+
 	virtual int64 getOverheadBytes();
 
 	virtual bool hasData();
@@ -21,9 +24,14 @@ private:
 	size_t findAndUnescapeEndMarker(const char *data, size_t data_size,
 		std::string& data_copy, bool& has_copy, bool& has_error,
 		size_t& escaped_zeros);
+	void putCiphertext(const char* data, size_t data_size);
+	bool finishMessage();
 
 	CryptoPP::GCM<CryptoPP::AES >::Decryption decryption;
-	CryptoPP::AuthenticatedDecryptionFilter decryption_filter;
+	std::string tag_buffer;
+	std::string plain_buffer;
+	std::deque<std::string> messages;
+	size_t message_pos;
 
 	CryptoPP::SecByteBlock m_sbbKey;
 	std::string iv_buffer;
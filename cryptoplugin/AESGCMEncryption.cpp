@@ -25,11 +25,12 @@
 
 const size_t iv_size = 12;
 const size_t end_marker_zeros = 4;
+const size_t tag_size = 16;
 
 using namespace CryptoPPCompat;
 
 AESGCMEncryption::AESGCMEncryption( const std::string& key, bool hash_password)
-	: encryption(), encryption_filter(encryption), iv_done(false), end_marker_state(0),
+	: encryption(), iv_done(false), end_marker_state(0),
 	overhead_size(0), message_size(0)
 {
 	if(hash_password)
@@ -63,23 +64,39 @@ AESGCMEncryption::AESGCMEncryption( const std::string& key, bool hash_password)
 
 void AESGCMEncryption::put( const char *data, size_t data_size )
 {
-	encryption_filter.Put(reinterpret_cast<const byte*>(data), data_size);
+	if(data_size==0)
+	{
+		return;
+	}
+
+	//Encrypt straight into the buffer get() hands out. Going through
+	//an AuthenticatedEncryptionFilter would queue the ciphertext and copy it again
+	size_t off = output.size();
+	output.resize(off+data_size);
+	encryption.ProcessData(reinterpret_cast<byte*>(&output[off]), reinterpret_cast<const byte*>(data), data_size);
 	message_size+=data_size;
 }
 
 void AESGCMEncryption::flush()
 {
-	encryption_filter.MessageEnd();
-	end_markers.push_back(encryption_filter.MaxRetrievable());
+	size_t off = output.size();
+	output.resize(off+tag_size);
+	encryption.TruncatedFinal(reinterpret_cast<byte*>(&output[off]), tag_size);
+	end_markers.push_back(output.size());
 	CryptoPP::IncrementCounterByOne(m_IV.BytePtr(), static_cast<unsigned int>(m_IV.size()));
 	encryption.Resynchronize(m_IV.BytePtr(), static_cast<int>(m_IV.size()));
-	overhead_size+=16; //tag size
+	overhead_size+=tag_size;
 }
 
 std::string AESGCMEncryption::get()
 {
 	std::string ret;
+	get(ret);
+	return ret;
+}
 
+void AESGCMEncryption::get(std::string& ret)
+{
 	size_t iv_add = iv_done ? 0 : m_IV.size();
 
 	size_t max_retrievable;
@@ -93,43 +110,54 @@ std::string AESGCMEncryption::get()
 	}
 	else
 	{
-		max_retrievable = encryption_filter.MaxRetrievable();
+		max_retrievable = output.size();
 	}
 
-	ret.resize(max_retrievable+iv_add + ( add_end_marker ? (end_marker_zeros + 1) : 0 ) );
+	if(iv_add==0 && max_retrievable==output.size())
+	{
+		//Hand the ciphertext over without copying it. The old memory of
+		//ret is used for the next data that gets encrypted
+		ret.swap(output);
+		output.clear();
+	}
+	else
+	{
+		ret.resize(max_retrievable+iv_add);
+
+		if(!iv_done)
+		{
+			memcpy(&ret[0], m_orig_IV.BytePtr(), m_orig_IV.size());
+		}
+
+		if(max_retrievable>0)
+		{
+			memcpy(&ret[iv_add], output.data(), max_retrievable);
+			output.erase(0, max_retrievable);
+		}
+	}
 
 	if(!iv_done)
 	{
-		memcpy(&ret[0], m_orig_IV.BytePtr(), m_orig_IV.size());
 		iv_done=true;
 		overhead_size+=m_orig_IV.size();
 	}
 
 	if(max_retrievable>0)
 	{
-		size_t nb = encryption_filter.Get(reinterpret_cast<byte*>(&ret[iv_add]), max_retrievable);
-		assert(nb==max_retrievable);
-		/*if(nb!=max_retrievable)
-		{
-			ret.resize(nb+iv_add+ ( add_end_marker ? (end_marker_zeros + 1) : 0 ));
-		}*/
-		escapeEndMarker(ret, iv_add+nb, iv_add);
-		decEndMarkers(nb);
+		escapeEndMarker(ret, iv_add+max_retrievable, iv_add);
+		decEndMarkers(max_retrievable);
 	}
 
 	if(add_end_marker)	
 	{
-		//The rest is already zero
-		ret[ret.size()-1]=1;
+		ret.append(end_marker_zeros, 0);
+		ret+=static_cast<char>(1);
 		end_marker_state=0;
 		overhead_size+=end_marker_zeros+1;
 		message_size+=end_marker_zeros+1;
-		encryption_filter.GetNextMessage();
 		VLOG(Server->Log("New message. Size: "+convert(message_size), LL_DEBUG));
 		message_size=0;
 	}
-
-	return ret;
 }
 
 void AESGCMEncryption::decEndMarkers( size_t n )
@@ -159,6 +187,8 @@ void AESGCMEncryption::escapeEndMarker(std::string& ret, size_t size, size_t off
 			{
 				char ich=2;
 				ret.insert(ret.begin()+i+1, ich);
+				//The escape shifts the rest of the data, which still has to be scanned
+				++size;
 				++i;
 				end_marker_state=0;
 				Server->Log("Escaped something at "+convert(i), LL_DEBUG);
@@ -14,6 +14,8 @@ public:
 
 	virtual std::string get();
 
+	virtual void get(std::string& ret);
+
 	virtual int64 getOverheadBytes();
 
 private:
@@ -28,7 +30,7 @@ private:
 	CryptoPP::SecByteBlock m_orig_IV;
 
 	CryptoPP::GCM<CryptoPP::AES >::Encryption encryption;
-	CryptoPP::AuthenticatedEncryptionFilter encryption_filter;
+	std::string output;
 	std::vector<size_t> end_markers;
 	int64 overhead_size;
 	size_t message_size;
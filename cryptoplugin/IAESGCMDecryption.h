@@ -10,6 +10,8 @@ public:
 	virtual bool put(const char *data, size_t data_size) = 0;
 	virtual std::string get(bool& has_error) = 0;
 	virtual bool get(char *data, size_t& data_size) = 0;
+	//Same as get(bool&), but reuses the memory of ret
+	virtual bool get(std::string& ret) = 0;
 
 	virtual int64 getOverheadBytes() = 0;
 
@@ -8,6 +8,9 @@ public:
 	virtual void put(const char *data, size_t data_size) = 0;
 	virtual void flush() = 0;
 	virtual std::string get() = 0;
+	//Same as get(), but hands over the encrypted data without a copy
+	//where possible. The old memory of ret is reused.
+	virtual void get(std::string& ret) = 0;
 
 	virtual int64 getOverheadBytes() = 0;
 };
\ No newline at end of file
@@ -217,6 +217,7 @@ void CClientThread::operator()(void)
 					}
 					delete next_chunks.front().pipe_file_user;
 				}
+				delete next_chunks.front().cdc_request;
 
 				next_chunks.pop();
 			}
@@ -1283,13 +1284,19 @@ bool CClientThread::ProcessPacket(CRData *data)
 			}break;
 		case ID_GET_FILE_BLOCKDIFF:
 			{
-				bool b=GetFileBlockdiff(data, false);
+				bool b=GetFileBlockdiff(data, false, false);
 				if(!b)
 					return false;
 			}break;
 		case ID_GET_FILE_BLOCKDIFF_WITH_METADATA:
 			{
-				bool b=GetFileBlockdiff(data, true);
+				bool b=GetFileBlockdiff(data, true, false);
+				if(!b)
+					return false;
+			}break;
+		case ID_GET_FILE_CDC:
+			{
+				bool b=GetFileBlockdiff(data, true, true);
 				if(!b)
 					return false;
 			}break;
@@ -1693,7 +1700,7 @@ bool CClientThread::isKillable(void)
 	return killable;
 }
 
-bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata)
+bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata, bool cdc)
 {
 	std::string s_filename;
 	if(data->getStr(&s_filename)==false)
@@ -1768,6 +1775,19 @@ bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata)
 		resumed = true;
 	}
 
+	std::auto_ptr<SCdcRequest> cdc_request;
+	if (cdc)
+	{
+		cdc_request.reset(new SCdcRequest);
+		if (is_script
+			|| !read_cdc_hashes(*data, cdc_request->min_size, cdc_request->avg_size,
+				cdc_request->max_size, cdc_request->filesize, cdc_request->chunks))
+		{
+			Log("Invalid content-defined chunking request for "+o_filename, LL_ERROR);
+			return false;
+		}
+	}
+
 	Log("Sending file (chunked) "+o_filename, LL_DEBUG);
 
 	bool allow_exec;
@@ -2007,6 +2027,15 @@ bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata)
 
 	queueChunk(chunk);
 
+	if (cdc_request.get() != NULL)
+	{
+		SChunk cdc_chunk;
+		cdc_chunk.startpos = 0;
+		cdc_chunk.transfer_all = 3;
+		cdc_chunk.cdc_request = cdc_request.release();
+		queueChunk(cdc_chunk);
+	}
+
 	return true;
 }
 
@@ -23,6 +23,7 @@
 #include "settings.h"
 #include "../md5.h"
 #include "FileServ.h"
+#include "../urbackupcommon/CdcChunker.h"
 
 class CTCPFileServ;
 class IPipe;
@@ -47,16 +48,25 @@ struct SSendData
 	char* delbufptr;
 };
 
+struct SCdcRequest
+{
+	unsigned int min_size;
+	unsigned int avg_size;
+	unsigned int max_size;
+	int64 filesize;
+	std::vector<SCdcChunk> chunks;
+};
+
 struct SChunk
 {
 	SChunk()
-		: msg(ID_ILLEGAL), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info()
+		: msg(ID_ILLEGAL), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info(), cdc_request(NULL)
 	{
 
 	}
 
 	explicit SChunk(char msg)
-		: msg(msg), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info()
+		: msg(msg), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info(), cdc_request(NULL)
 	{
 
 	}
@@ -73,6 +83,7 @@ struct SChunk
 	bool with_sparse;
 	std::string s_filename;
 	IFileServ::CbtHashFileInfo cbt_hash_file_info;
+	SCdcRequest* cdc_request;
 };
 
 struct SLPData
@@ -128,7 +139,7 @@ private:
 	void ReleaseMemory(void);
 	void CloseThread(HANDLE hFile);
 
-	bool GetFileBlockdiff(CRData *data, bool with_metadata);
+	bool GetFileBlockdiff(CRData *data, bool with_metadata, bool cdc);
 	bool Handle_ID_BLOCK_REQUEST(CRData *data);
 
 	bool GetFileHashAndMetadata(CRData* data);
@@ -235,6 +235,8 @@ void ChunkSendThread::operator()(void)
 
 bool ChunkSendThread::sendChunk(SChunk *chunk)
 {
+	std::auto_ptr<SCdcRequest> cdc_request(chunk->cdc_request);
+
 	if(file==NULL)
 	{
 		return false;
@@ -246,6 +248,17 @@ bool ChunkSendThread::sendChunk(SChunk *chunk)
 		return sendError(ERR_SEEKING_FAILED, getSystemErrorCode());
 	}
 
+	if(chunk->transfer_all==2)
+	{
+		return sendBlockProbeHash(chunk);
+	}
+
+	if(chunk->transfer_all==3
+		&& cdc_request.get()!=NULL)
+	{
+		return sendCdc(*cdc_request);
+	}
+
 	if(chunk->transfer_all)
 	{
 		size_t off=1+sizeof(_i64)+sizeof(_u32);
@@ -682,6 +695,154 @@ bool ChunkSendThread::sendChunk(SChunk *chunk)
 	return true;
 }
 
+bool ChunkSendThread::sendBlockProbeHash(SChunk *chunk)
+{
+	unsigned int blockleft;
+	if(curr_file_size<=chunk->startpos && curr_file_size>0)
+	{
+		blockleft=0;
+	}
+	else if(curr_file_size-chunk->startpos<c_checkpoint_dist && curr_file_size>0)
+	{
+		blockleft=static_cast<unsigned int>(curr_file_size-chunk->startpos);
+	}
+	else
+	{
+		blockleft=c_checkpoint_dist;
+	}
+
+	Log("Sending block probe hash start="+convert(chunk->startpos)+" size="+convert(blockleft), LL_DEBUG);
+
+	int64 spos = chunk->startpos;
+	unsigned int r=0;
+	while(r<blockleft)
+	{
+		bool readerr = false;
+		_u32 r_add=file->Read(spos, chunk_buf+r, blockleft-r, &readerr);
+
+		if (readerr)
+		{
+			unsigned int readderr_code = getSystemErrorCode();
+			Server->Log("Reading from file \"" + file->getFilename() + "\" at position "+convert(spos)+" failed (code: " + convert(readderr_code) + ")(4).", LL_ERROR);
+			FileServ::callErrorCallback(s_filename, file->getFilename(), spos, "code: " + convert(readderr_code));
+			return sendError(ERR_READING_FAILED, readderr_code);
+		}
+
+		if(r_add==0)
+		{
+			memset(chunk_buf+r, 0, blockleft-r);
+			r=blockleft;
+		}
+
+		spos+=r_add;
+		r+=r_add;
+	}
+
+	md5_hash.init();
+	md5_hash.update((unsigned char*)chunk_buf, blockleft);
+	md5_hash.finalize();
+
+	char msg[1+sizeof(_i64)+big_hash_size];
+	*msg=ID_BLOCK_PROBE_HASH;
+	_i64 chunk_startpos = little_endian(chunk->startpos);
+	memcpy(msg+1, &chunk_startpos, sizeof(_i64));
+	memcpy(msg+1+sizeof(_i64), md5_hash.raw_digest_int(), big_hash_size);
+
+	if(parent->SendInt(msg, sizeof(msg))==SOCKET_ERROR)
+	{
+		Log("Error sending block probe hash", LL_DEBUG);
+		return false;
+	}
+
+	if( FileServ::isPause() ) Sleep(500);
+
+	return true;
+}
+
+bool ChunkSendThread::sendCdc(SCdcRequest& cdc_request)
+{
+	CdcChunker chunker(cdc_request.min_size, cdc_request.avg_size, cdc_request.max_size);
+	CdcChunkIndex chunk_index(cdc_request.chunks);
+	CdcFileChunker file_chunker(chunker, file, curr_file_size);
+
+	Log("Sending content-defined chunks of file with size "+convert(curr_file_size)+" ("+convert(cdc_request.chunks.size())+" chunks in old version)", LL_DEBUG);
+
+	md5_hash.init();
+
+	int64 ref_bytes = 0;
+	int64 data_bytes = 0;
+
+	while(true)
+	{
+		SCdcChunk chunk;
+		const char* chunk_data;
+		if(!file_chunker.next(chunk, chunk_data))
+		{
+			unsigned int readerr_code = getSystemErrorCode();
+			Server->Log("Reading from file \"" + file->getFilename() + "\" at position "+convert(file_chunker.getReadPos())+" failed (code: " + convert(readerr_code) + ")(cdc).", LL_ERROR);
+			FileServ::callErrorCallback(s_filename, file->getFilename(), file_chunker.getReadPos(), "code: " + convert(readerr_code));
+			return sendError(ERR_READING_FAILED, readerr_code);
+		}
+
+		if(chunk.size==0)
+		{
+			break;
+		}
+
+		md5_hash.update((unsigned char*)chunk_data, chunk.size);
+
+		char msg[1+sizeof(_u32)];
+		int64 chunk_idx = chunk_index.find(chunk);
+		if(chunk_idx!=-1)
+		{
+			*msg = ID_CDC_REF;
+			_u32 idx = little_endian(static_cast<_u32>(chunk_idx));
+			memcpy(msg+1, &idx, sizeof(_u32));
+
+			if(parent->SendInt(msg, sizeof(msg))==SOCKET_ERROR)
+			{
+				Log("Error sending chunk reference", LL_DEBUG);
+				return false;
+			}
+
+			ref_bytes+=chunk.size;
+		}
+		else
+		{
+			*msg = ID_CDC_DATA;
+			_u32 size = little_endian(chunk.size);
+			memcpy(msg+1, &size, sizeof(_u32));
+
+			if(parent->SendInt(msg, sizeof(msg))==SOCKET_ERROR
+				|| parent->SendInt(chunk_data, chunk.size)==SOCKET_ERROR)
+			{
+				Log("Error sending chunk data", LL_DEBUG);
+				return false;
+			}
+
+			data_bytes+=chunk.size;
+		}
+
+		if( FileServ::isPause() ) Sleep(500);
+	}
+
+	md5_hash.finalize();
+
+	char msg[1+big_hash_size];
+	*msg = ID_CDC_END;
+	memcpy(msg+1, md5_hash.raw_digest_int(), big_hash_size);
+
+	if(parent->SendInt(msg, sizeof(msg), true)==SOCKET_ERROR)
+	{
+		Log("Error sending file hash", LL_DEBUG);
+		return false;
+	}
+
+	Log("Sent "+PrettyPrintBytes(data_bytes)+" of new chunks and referenced "+PrettyPrintBytes(ref_bytes)+" of old chunks", LL_DEBUG);
+
+	return true;
+}
+
 bool ChunkSendThread::sendError( _u32 errorcode1, _u32 errorcode2 )
 {
 	char buffer[1+sizeof(_u32)*2];
@@ -10,6 +10,7 @@
 class ScopedPipeFileUser;
 class CClientThread;
 struct SChunk;
+struct SCdcRequest;
 
 class ChunkSendThread : public IThread
 {
@@ -23,6 +24,10 @@ public:
 
 private:
 
+	bool sendBlockProbeHash(SChunk *chunk);
+
+	bool sendCdc(SCdcRequest& cdc_request);
+
 	bool sendError(_u32 errorcode1, _u32 errorcode2);
 
 	CClientThread *parent;
@@ -60,6 +60,17 @@
 
 const size_t metadata_id_size = 4+4+8+4;
 
+namespace
+{
+	//Number of metadata requests read from the pipe in advance
+	const size_t metadata_lookahead_max = 512;
+#ifndef _WIN32
+	//Extended attribute sets smaller than this are always sent inline
+	const size_t eattr_dict_min_size = 64;
+	const size_t eattr_dict_max_entries = 100000;
+#endif
+}
+
 
 FileMetadataPipe::FileMetadataPipe( IPipe* pipe, const std::string& cmd )
 	: PipeFileBase(cmd), pipe(pipe),
@@ -68,12 +79,35 @@ FileMetadataPipe::FileMetadataPipe( IPipe* pipe, const std::string& cmd )
 	backup_read_state(-1),
 #else
 	backup_state(BackupState_StatInit),
+	os_metadata_off(0),
+	eattr_dict_enabled(false),
+	eattr_dict_next_id(0),
+	eattr_dict_saved_bytes(0),
 #endif
 	metadata_state(MetadataState_Wait),
 		errpipe(Server->createMemoryPipe()),
 	metadata_file(NULL)
 {
 	metadata_buffer.resize(4096);
+
+#ifndef _WIN32
+	std::vector<std::string> cmd_toks;
+	Tokenize(cmd, cmd_toks, "|");
+	for (size_t i = 3; i < cmd_toks.size(); ++i)
+	{
+		if (cmd_toks[i] == METADATA_PIPE_CMD_EATTR_DICT)
+		{
+			eattr_dict_enabled = true;
+		}
+	}
+
+	size_t prefetch_threads = watoi(Server->getServerParameter("metadata_prefetch_threads", "4"));
+	if (prefetch_threads > 0)
+	{
+		prefetcher.reset(new FileMetadataPrefetcher(prefetch_threads));
+	}
+#endif
+
 	init();
 }
 
@@ -460,23 +494,39 @@ bool FileMetadataPipe::readStdoutIntoBuffer( char* buf, size_t buf_avail, size_t
 	while(true)
 	{
 		std::string msg;
-		size_t r = pipe->Read(&msg, 60000);
-
-		if(r==0)
+		int64 prefetch_id = -1;
+		if (!queued_msgs.empty())
 		{
-			if(pipe->hasError())
-			{
-				read_bytes = 0;
-				return false;
-			}
-			else
+			msg = queued_msgs.front().first;
+			prefetch_id = queued_msgs.front().second;
+			queued_msgs.pop_front();
+		}
+		else
+		{
+			size_t r = pipe->Read(&msg, 60000);
+
+			if (r == 0)
 			{
-				*buf = ID_METADATA_NOP;
-				read_bytes = 1;
-				return true;
+				if (pipe->hasError())
+				{
+					read_bytes = 0;
+					return false;
+				}
+				else
+				{
+					*buf = ID_METADATA_NOP;
+					read_bytes = 1;
+					return true;
+				}
 			}
 		}
-		else
+
+		queueMetadataPrefetch();
+
+#ifndef _WIN32
+		curr_prefetched.reset(prefetch_id != -1 ? prefetcher->get(prefetch_id) : NULL);
+#endif
+
 		{
 			CRData msg_data(&msg);
 
@@ -631,6 +681,56 @@ bool FileMetadataPipe::readStdoutIntoBuffer( char* buf, size_t buf_avail, size_t
 void FileMetadataPipe::finishStdout()
 {
 	token_callback.reset();
+
+#ifndef _WIN32
+	if (!eattr_dict.empty())
+	{
+		Server->Log("Sent " + convert(eattr_dict.size()) + " distinct extended attribute sets once. Saved " + PrettyPrintBytes(eattr_dict_saved_bytes) + " of metadata transfer", LL_DEBUG);
+	}
+#endif
+}
+
+void FileMetadataPipe::queueMetadataPrefetch()
+{
+	while (queued_msgs.size() < metadata_lookahead_max)
+	{
+		std::string msg;
+		size_t r = pipe->Read(&msg, 0);
+
+		if (r == 0)
+		{
+			break;
+		}
+
+		int64 prefetch_id = -1;
+#ifndef _WIN32
+		if (prefetcher.get() != NULL)
+		{
+			CRData msg_data(&msg);
+
+			char id;
+			std::string l_public_fn;
+			std::string l_local_fn;
+			int64 l_folder_items;
+			int64 l_metadata_id;
+			std::string l_server_token;
+			void* l_callback;
+			if (msg_data.getChar(&id)
+				&& id == METADATA_PIPE_SEND_FILE
+				&& msg_data.getStr(&l_public_fn)
+				&& msg_data.getStr(&l_local_fn)
+				&& msg_data.getInt64(&l_folder_items)
+				&& msg_data.getInt64(&l_metadata_id)
+				&& msg_data.getStr(&l_server_token)
+				&& !msg_data.getVoidPtr(&l_callback))
+			{
+				prefetch_id = prefetcher->add(l_local_fn);
+			}
+		}
+#endif
+
+		queued_msgs.push_back(std::make_pair(msg, prefetch_id));
+	}
 }
 
 bool FileMetadataPipe::readStderrIntoBuffer( char* buf, size_t buf_avail, size_t& read_bytes )
@@ -678,14 +778,27 @@ void FileMetadataPipe::cleanupOnForceShutdown()
 	}
 #endif
 
+#ifndef _WIN32
+	curr_prefetched.reset();
+	prefetcher.reset();
+#endif
+
 	while (true)
 	{
 		std::string msg;
-		size_t r = pipe->Read(&msg, 0);
-
-		if (r == 0)
+		if (!queued_msgs.empty())
 		{
-			break;
+			msg = queued_msgs.front().first;
+			queued_msgs.pop_front();
+		}
+		else
+		{
+			size_t r = pipe->Read(&msg, 0);
+
+			if (r == 0)
+			{
+				break;
+			}
 		}
 
 		CRData msg_data(&msg);
@@ -1090,147 +1203,257 @@ namespace
 	}
 }
 
-bool FileMetadataPipe::transmitCurrMetadata(char* buf, size_t buf_avail, size_t& read_bytes)
+bool read_unix_metadata(const std::string& local_fn, SUnixMetadata& md)
 {
-	if(backup_state==BackupState_StatInit)
+	CWData data;
+	struct stat64 statbuf;
+	int rc = lstat64(local_fn.c_str(), &statbuf);
+
+	if(rc!=0)
 	{
-		CWData data;
-        struct stat64 statbuf;
-        int rc = lstat64(local_fn.c_str(), &statbuf);
+		Server->Log("Error with lstat of "+local_fn+" errorcode: "+convert(errno), LL_ERROR);
+		return false;
+	}
 
-		if(rc!=0)
+	std::string symlink_target;
+	if (S_ISLNK(statbuf.st_mode))
+	{
+		if (!os_get_symlink_target(local_fn, symlink_target))
 		{
-            Server->Log("Error with lstat of "+local_fn+" errorcode: "+convert(errno), LL_ERROR);
+			Server->Log("Error getting symlink target of " + local_fn + " errorcode: " + convert(errno), LL_ERROR);
 			return false;
 		}
+	}
 
-		std::string symlink_target;
-		if (S_ISLNK(statbuf.st_mode))
-		{
-			if (!os_get_symlink_target(local_fn, symlink_target))
-			{
-				Server->Log("Error getting symlink target of " + local_fn + " errorcode: " + convert(errno), LL_ERROR);
-				return false;
-			}
-		}
+	serialize_stat_buf(statbuf, symlink_target, data);
 
-        serialize_stat_buf(statbuf, symlink_target, data);
+	if(data.getDataSize()+sizeof(_u32)>4096)
+	{
+		Server->Log("File metadata of "+local_fn+" too large ("+convert((size_t)data.getDataSize()+sizeof(_u32))+")", LL_ERROR);
+		return false;
+	}
+
+	_u32 metadata_size = little_endian(static_cast<_u32>(data.getDataSize()));
+	md.stat_data.assign(reinterpret_cast<char*>(&metadata_size), sizeof(_u32));
+	md.stat_data.append(data.getDataPtr(), data.getDataSize());
+	md.stat_ok = true;
+
+	std::vector<std::string> eattr_keys;
+	if(!get_xattr_keys(local_fn, eattr_keys))
+	{
+		return false;
+	}
 
-		if(data.getDataSize()+sizeof(_u32)>metadata_buffer.size())
+	md.eattr_num = static_cast<int64>(eattr_keys.size());
+	md.eattr_ok = true;
+
+	std::string eattr_val;
+	for (size_t i = 0; i < eattr_keys.size(); ++i)
+	{
+		if(!get_xattr(local_fn, eattr_keys[i], eattr_val))
 		{
-			Server->Log("File metadata of "+local_fn+" too large ("+convert((size_t)data.getDataSize()+sizeof(_u32))+")", LL_ERROR);
-			return false;
+			eattr_val.resize(sizeof(_u32));
+			unsigned int umax = UINT_MAX;
+			memcpy(&eattr_val[0], &umax, sizeof(umax));
 		}
 
+		md.eattr_data += eattr_keys[i];
+		md.eattr_data += eattr_val;
+	}
 
-		_u32 metadata_size = little_endian(static_cast<_u32>(data.getDataSize()));
-		memcpy(metadata_buffer.data(), &metadata_size, sizeof(_u32));
-		memcpy(metadata_buffer.data()+sizeof(_u32), data.getDataPtr(), data.getDataSize());
-		metadata_buffer_size=data.getDataSize()+sizeof(_u32);
-		metadata_buffer_off=0;
-		backup_state=BackupState_Stat;
+	return true;
+}
 
-		return transmitCurrMetadata(buf, buf_avail, read_bytes);
+FileMetadataPrefetcher::FileMetadataPrefetcher(size_t n_threads)
+	: mutex(Server->createMutex()), cond(Server->createCondition()),
+	next_id(0), do_exit(false)
+{
+	for (size_t i = 0; i < n_threads; ++i)
+	{
+		tickets.push_back(Server->getThreadPool()->execute(new Worker(*this), "metadata prefetch"));
 	}
-    else if(backup_state==BackupState_Stat)
+}
+
+FileMetadataPrefetcher::~FileMetadataPrefetcher()
+{
 	{
-		if(metadata_buffer_size-metadata_buffer_off>0)
-		{
-			read_bytes = (std::min)(metadata_buffer_size-metadata_buffer_off, buf_avail);
-			memcpy(buf, metadata_buffer.data()+metadata_buffer_off, read_bytes);
-			metadata_buffer_off+=read_bytes;
-		}
-		if(metadata_buffer_size-metadata_buffer_off==0)
-		{
-			backup_state=BackupState_EAttrInit;
-		}
-		return true;
+		IScopedLock lock(mutex.get());
+		do_exit = true;
+		pending.clear();
+		cond->notify_all();
 	}
-	else if(backup_state==BackupState_EAttrInit)
+
+	Server->getThreadPool()->waitFor(tickets);
+
+	for (std::map<int64, SJob>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+	{
+		delete it->second.res;
+	}
+}
+
+int64 FileMetadataPrefetcher::add(const std::string& local_fn)
+{
+	IScopedLock lock(mutex.get());
+
+	int64 id = next_id++;
+	SJob& job = jobs[id];
+	job.local_fn = local_fn;
+	job.done = false;
+	job.res = NULL;
+	pending.push_back(id);
+	cond->notify_all();
+
+	return id;
+}
+
+SUnixMetadata* FileMetadataPrefetcher::get(int64 id)
+{
+	IScopedLock lock(mutex.get());
+
+	std::map<int64, SJob>::iterator it = jobs.find(id);
+	if (it == jobs.end())
+	{
+		return NULL;
+	}
+
+	while (!it->second.done)
 	{
-		eattr_keys.clear();
-        if(!get_xattr_keys(local_fn, eattr_keys))
+		cond->wait(&lock);
+	}
+
+	SUnixMetadata* ret = it->second.res;
+	jobs.erase(it);
+	return ret;
+}
+
+void FileMetadataPrefetcher::Worker::operator()()
+{
+	prefetcher.prefetchWorker();
+	delete this;
+}
+
+void FileMetadataPrefetcher::prefetchWorker()
+{
+	IScopedLock lock(mutex.get());
+	while (true)
+	{
+		while (pending.empty()
+			&& !do_exit)
 		{
-			return false;
+			cond->wait(&lock);
 		}
 
-		CWData data;
-		data.addInt64(eattr_keys.size());
+		if (do_exit)
+		{
+			return;
+		}
 
-		memcpy(metadata_buffer.data(), data.getDataPtr(), data.getDataSize());
-		metadata_buffer_size=data.getDataSize();
-		metadata_buffer_off=0;
-		backup_state=BackupState_EAttr;
+		int64 id = pending.front();
+		pending.pop_front();
+		std::string local_fn = jobs[id].local_fn;
+
+		lock.relock(NULL);
+		std::auto_ptr<SUnixMetadata> md(new SUnixMetadata);
+		read_unix_metadata(local_fn, *md);
+		lock.relock(mutex.get());
 
-        return transmitCurrMetadata(buf, buf_avail, read_bytes);
+		std::map<int64, SJob>::iterator it = jobs.find(id);
+		if (it != jobs.end())
+		{
+			it->second.res = md.release();
+			it->second.done = true;
+			cond->notify_all();
+		}
 	}
-	else if(backup_state==BackupState_EAttr)
+}
+
+bool FileMetadataPipe::transmitCurrMetadata(char* buf, size_t buf_avail, size_t& read_bytes)
+{
+	if(backup_state==BackupState_StatInit)
 	{
-		if(metadata_buffer_size-metadata_buffer_off>0)
+		SUnixMetadata local_md;
+		SUnixMetadata* md = curr_prefetched.get();
+		if (md == NULL)
+		{
+			read_unix_metadata(local_fn, local_md);
+			md = &local_md;
+		}
+
+		if (!md->stat_ok)
 		{
-			read_bytes = (std::min)(metadata_buffer_size-metadata_buffer_off, buf_avail);
-			memcpy(buf, metadata_buffer.data()+metadata_buffer_off, read_bytes);
-			metadata_buffer_off+=read_bytes;
+			curr_prefetched.reset();
+			read_bytes = 0;
+			return false;
 		}
-		if(metadata_buffer_size-metadata_buffer_off==0)
+
+		os_metadata = md->stat_data;
+		os_metadata_off = 0;
+
+		if (md->eattr_ok)
 		{
-			if(!eattr_keys.empty())
+			CWData data;
+			bool add_eattr_data = true;
+			if (eattr_dict_enabled
+				&& md->eattr_num>0
+				&& md->eattr_data.size()>=eattr_dict_min_size)
 			{
-				eattr_idx=0;
-				backup_state=BackupState_EAttr_Vals_Key;
-				eattr_key_off=0;
+				unsigned char dig[SHA256_DIGEST_SIZE];
+				sha256(reinterpret_cast<const unsigned char*>(md->eattr_data.data()),
+					static_cast<unsigned int>(md->eattr_data.size()), dig);
+				std::string eattr_hash(reinterpret_cast<char*>(dig), SHA256_DIGEST_SIZE);
+
+				std::map<std::string, int64>::iterator it = eattr_dict.find(eattr_hash);
+				if (it != eattr_dict.end())
+				{
+					data.addInt64(METADATA_EATTR_DICT_REF);
+					data.addInt64(it->second);
+					add_eattr_data = false;
+					eattr_dict_saved_bytes += md->eattr_data.size();
+				}
+				else if (eattr_dict.size() < eattr_dict_max_entries)
+				{
+					int64 dict_id = eattr_dict_next_id++;
+					eattr_dict[eattr_hash] = dict_id;
+					data.addInt64(METADATA_EATTR_DICT_DEFINE);
+					data.addInt64(dict_id);
+					data.addInt64(md->eattr_num);
+				}
+				else
+				{
+					data.addInt64(md->eattr_num);
+				}
 			}
 			else
 			{
-				return false;
+				data.addInt64(md->eattr_num);
 			}
-		}
-		return true;
-	}
-	else if(backup_state==BackupState_EAttr_Vals_Key)
-	{
-        if(eattr_keys[eattr_idx].size()-eattr_key_off>0)
-		{
-            read_bytes = (std::min)(eattr_keys[eattr_idx].size()-eattr_key_off, buf_avail);
-			memcpy(buf, eattr_keys[eattr_idx].c_str()+eattr_key_off, read_bytes);
-			eattr_key_off+=read_bytes;
-		}
 
-        if(eattr_keys[eattr_idx].size()-eattr_key_off==0)
-		{			
-            if(!get_xattr(local_fn, eattr_keys[eattr_idx], eattr_val))
+			os_metadata.append(data.getDataPtr(), data.getDataSize());
+			if (add_eattr_data)
 			{
-				eattr_val.resize(sizeof(_u32));
-				unsigned int umax = UINT_MAX;
-				memcpy(&eattr_val[0], &umax, sizeof(umax));
+				os_metadata += md->eattr_data;
 			}
-			backup_state = BackupState_EAttr_Vals_Val;
-			eattr_val_off=0;
 		}
-		return true;
+
+		curr_prefetched.reset();
+		backup_state=BackupState_Transmit;
 	}
-	else if (backup_state == BackupState_EAttr_Vals_Val)
+
+	if (backup_state == BackupState_Transmit)
 	{
-		if (eattr_val.size() - eattr_val_off > 0)
+		read_bytes = 0;
+		if (os_metadata.size() - os_metadata_off > 0)
 		{
-			read_bytes = (std::min)(eattr_val.size() - eattr_val_off, buf_avail);
-			memcpy(buf, eattr_val.data() + eattr_val_off, read_bytes);
-			eattr_val_off += read_bytes;
+			read_bytes = (std::min)(os_metadata.size() - os_metadata_off, buf_avail);
+			memcpy(buf, os_metadata.data() + os_metadata_off, read_bytes);
+			os_metadata_off += read_bytes;
 		}
 
-		if (eattr_val.size() - eattr_val_off == 0)
+		if (os_metadata.size() - os_metadata_off == 0)
 		{
-			if (eattr_idx + 1 < eattr_keys.size())
-			{
-				++eattr_idx;
-				backup_state = BackupState_EAttr_Vals_Key;
-				eattr_key_off = 0;
-			}
-			else
-			{
-				//finished
-				return false;
-			}
+			//finished
+			os_metadata.clear();
+			return false;
 		}
 		return true;
 	}
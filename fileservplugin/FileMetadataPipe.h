@@ -4,7 +4,9 @@
 #include <string>
 #include <memory>
 #include <deque>
+#include <map>
 #include "../Interface/Condition.h"
+#include "../Interface/ThreadPool.h"
 #include "IFileServ.h"
 #include "../urbackupcommon/sha2/sha2.h"
 
@@ -25,6 +27,71 @@ const char METADATA_PIPE_SEND_RAW = 1;
 const char METADATA_PIPE_EXIT = 2;
 const char METADATA_PIPE_SEND_RAW_FILEDATA = 3;
 
+//Server requests with this command token that identical extended attribute
+//sets are only transmitted once per metadata stream
+const std::string METADATA_PIPE_CMD_EATTR_DICT = "eattr_dict";
+const int64 METADATA_EATTR_DICT_DEFINE = -2;
+const int64 METADATA_EATTR_DICT_REF = -3;
+
+#ifndef _WIN32
+struct SUnixMetadata
+{
+	SUnixMetadata()
+		: stat_ok(false), eattr_ok(false), eattr_num(0) {}
+
+	bool stat_ok;
+	std::string stat_data;
+	bool eattr_ok;
+	int64 eattr_num;
+	std::string eattr_data;
+};
+
+bool read_unix_metadata(const std::string& local_fn, SUnixMetadata& md);
+
+class FileMetadataPrefetcher
+{
+public:
+	FileMetadataPrefetcher(size_t n_threads);
+	~FileMetadataPrefetcher();
+
+	int64 add(const std::string& local_fn);
+
+	SUnixMetadata* get(int64 id);
+
+private:
+	class Worker : public IThread
+	{
+	public:
+		Worker(FileMetadataPrefetcher& prefetcher)
+			: prefetcher(prefetcher) {}
+
+		virtual ~Worker() {}
+
+		void operator()();
+
+	private:
+		FileMetadataPrefetcher& prefetcher;
+	};
+
+	void prefetchWorker();
+
+	struct SJob
+	{
+		std::string local_fn;
+		bool done;
+		SUnixMetadata* res;
+	};
+
+	std::auto_ptr<IMutex> mutex;
+	std::auto_ptr<ICondition> cond;
+	std::map<int64, SJob> jobs;
+	std::deque<int64> pending;
+	int64 next_id;
+	bool do_exit;
+	std::vector<THREADPOOL_TICKET> tickets;
+};
+#endif
+
 class FileMetadataPipe : public PipeFileBase
 {
 public:
@@ -48,6 +115,8 @@ private:
 
 	bool transmitCurrMetadata(char* buf, size_t buf_avail, size_t& read_bytes);
 
+	void queueMetadataPrefetch();
+
 	bool openFileHandle();
 
 #ifdef _WIN32
@@ -61,20 +130,22 @@ private:
 	enum BackupState
 	{
         BackupState_StatInit,
-		BackupState_Stat,
-		BackupState_EAttrInit,
-		BackupState_EAttr,
-		BackupState_EAttr_Vals_Key,
-		BackupState_EAttr_Vals_Val
+		BackupState_Transmit
 	};
 
 	BackupState backup_state;
-	size_t eattr_idx;
-	std::vector<std::string> eattr_keys;
-	size_t eattr_key_off;
-	std::string eattr_val;
-	size_t eattr_val_off;
+	std::string os_metadata;
+	size_t os_metadata_off;
+
+	bool eattr_dict_enabled;
+	std::map<std::string, int64> eattr_dict;
+	int64 eattr_dict_next_id;
+	int64 eattr_dict_saved_bytes;
+
+	std::auto_ptr<FileMetadataPrefetcher> prefetcher;
+	std::auto_ptr<SUnixMetadata> curr_prefetched;
 #endif
+	std::deque<std::pair<std::string, int64> > queued_msgs;
 
 	enum MetadataState
 	{
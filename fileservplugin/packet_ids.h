@@ -28,6 +28,7 @@ const uchar ID_BLOCK_REQUEST=9;
 		const uchar ID_NO_CHANGE=15;
 		const uchar ID_BLOCK_HASH=16;
 		const uchar ID_BLOCK_ERROR=18;
+		const uchar ID_BLOCK_PROBE_HASH=21;
 const uchar ID_GET_FILE_HASH_AND_METADATA=10;
 		const uchar ID_FILE_HASH_AND_METADATA=17;
 const uchar ID_INFORM_METADATA_STREAM_END=11;
@@ -35,6 +36,10 @@ const uchar ID_FLUSH_SOCKET=13;
 const uchar ID_SCRIPT_FINISH=14;
 const uchar ID_FREE_SERVER_FILE = 18;
 const uchar ID_STOP_PHASH = 19;
+const uchar ID_GET_FILE_CDC=20;
+		const uchar ID_CDC_REF=22;
+		const uchar ID_CDC_DATA=23;
+		const uchar ID_CDC_END=24;
 
 const unsigned int ERR_SEEKING_FAILED = 0;
 const unsigned int ERR_READING_FAILED = 1;
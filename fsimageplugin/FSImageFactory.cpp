@@ -319,7 +319,15 @@ IFilesystem *FSImageFactory::createFilesystem(const std::string &pDevOrig, ERead
 #ifndef _WIN32
 	if(read_ahead==EReadaheadMode_Overlapped)
 	{
-		read_ahead = EReadaheadMode_None;
+		//No overlapped IO here. Use the bitmap driven readahead threads instead
+		if(watoi(Server->getServerParameter("image_readahead_threads", "4"))>0)
+		{
+			read_ahead = EReadaheadMode_Thread;
+		}
+		else
+		{
+			read_ahead = EReadaheadMode_None;
+		}
 	}
 
 	pDev = trim(getFile(pDevOrig+"-dev"));
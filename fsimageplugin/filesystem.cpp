@@ -73,18 +73,25 @@ namespace
 #endif
 }
 
-class Filesystem_ReadaheadThread : public IThread
+class Filesystem_ReadaheadThread
 {
 public:
-	Filesystem_ReadaheadThread(Filesystem& fs, bool background_priority)
+	Filesystem_ReadaheadThread(Filesystem& fs, bool background_priority, size_t n_threads)
 		: fs(fs),
 		mutex(Server->createMutex()),
 		start_readahead_cond(Server->createCondition()),
 		read_block_cond(Server->createCondition()),
+		n_queued_blocks(0),
 		current_block(-1),
 		do_stop(false),
 		readahead_miss(false),
-		background_priority(background_priority)
+		background_priority(background_priority),
+		n_threads(n_threads),
+		starttime(Server->getTimeMS()),
+		read_bytes(0),
+		read_requests(0),
+		read_time_ms(0),
+		block_wait_time_ms(0)
 	{
 
 	}
@@ -93,12 +100,40 @@ public:
 		for (std::map<int64, IFilesystem::IFsBuffer*>::iterator it = read_blocks.begin();
 			it != read_blocks.end(); ++it)
 		{
-			fs.releaseBuffer(it->second);
+			if (it->second != NULL)
+			{
+				fs.releaseBuffer(it->second);
+			}
 		}
 	}
 
+	class Worker : public IThread
+	{
+	public:
+		Worker(Filesystem_ReadaheadThread& readahead)
+			: readahead(readahead) {}
+
+		virtual ~Worker() {}
+
+		void operator()()
+		{
+			readahead.readaheadWorker();
+			delete this;
+		}
+
+	private:
+		Filesystem_ReadaheadThread& readahead;
+	};
+
+	void start()
+	{
+		for (size_t i = 0; i < n_threads; ++i)
+		{
+			worker_tickets.push_back(Server->getThreadPool()->execute(new Worker(*this), "device readahead"));
+		}
+	}
 
-	void operator()()
+	void readaheadWorker()
 	{
 		ScopedBackgroundPrio background_prio(false);
 		if (background_priority)
@@ -108,12 +143,15 @@ public:
 #endif
 		}
 
+		std::vector<char> run_buf;
+		std::vector<IFilesystem::IFsBuffer*> run_bufs;
+
 		IScopedLock lock(mutex.get());
 		while (!do_stop)
 		{
-			if (read_blocks.size() >= readahead_num_blocks)
+			if (numBufferedBlocks() >= readahead_num_blocks)
 			{
-				while (read_blocks.size()>readahead_low_level_blocks
+				while (numBufferedBlocks()>readahead_low_level_blocks
 					&& !readahead_miss)
 				{
 					start_readahead_cond->wait(&lock);
@@ -133,39 +171,86 @@ public:
 
 			if (do_stop) break;
 
-			std::map<int64, IFilesystem::IFsBuffer*>::iterator it;
-			do
+			while (current_block != -1
+				&& (read_blocks.find(current_block) != read_blocks.end()
+					|| isQueued(current_block)) )
 			{
-				it = read_blocks.find(current_block);
-				if (it != read_blocks.end())
-				{
-					current_block = fs.nextBlockInt(current_block);
-				}
-			} while (it != read_blocks.end());
+				current_block = fs.nextBlockInt(current_block);
+			}
+
+			if (current_block == -1)
+			{
+				continue;
+			}
 
-			if (current_block != -1)
+			//Coalesce consecutive used blocks into one larger read request
+			int64 run_start = current_block;
+			size_t run_len = 1;
+			size_t max_run_len = static_cast<size_t>((std::max)((std::min)(fs.curr_fs_readahead_n_max_buffers,
+				static_cast<int64>(fs_readahead_n_max_buffers)), static_cast<int64>(1)));
+			int64 next_block = fs.nextBlockInt(run_start);
+			while (run_len < max_run_len
+				&& next_block == run_start + static_cast<int64>(run_len)
+				&& read_blocks.find(next_block) == read_blocks.end()
+				&& !isQueued(next_block))
 			{
-				int64 l_current_block = current_block;
-				lock.relock(NULL);
-				IFilesystem::IFsBuffer* buf = fs.readBlockInt(l_current_block, false, NULL);
-				lock.relock(mutex.get());
+				++run_len;
+				next_block = fs.nextBlockInt(next_block);
+			}
+			current_block = next_block;
+
+			queued_runs[run_start] = run_len;
+			n_queued_blocks += run_len;
 
-				read_blocks[l_current_block] = buf;
+			lock.relock(NULL);
+
+			int64 blocksize = fs.getBlocksize();
+			if (run_buf.size() < run_len*blocksize)
+			{
+				run_buf.resize(static_cast<size_t>(max_run_len*blocksize));
+			}
 
-				current_block = fs.nextBlockInt(l_current_block);
+			int64 read_starttime = Server->getTimeMS();
+			bool ok = fs.readFromDevAt(run_start*blocksize, run_buf.data(), static_cast<_u32>(run_len*blocksize));
+			int64 read_passed_ms = Server->getTimeMS() - read_starttime;
 
-				if (readahead_miss)
+			run_bufs.clear();
+			if (ok)
+			{
+				for (size_t i = 0; i < run_len; ++i)
 				{
-					read_block_cond->notify_all();
-					readahead_miss = false;
+					IFilesystem::IFsBuffer* buf = fs.getBuffer();
+					memcpy(buf->getBuf(), run_buf.data() + i*blocksize, static_cast<size_t>(blocksize));
+					run_bufs.push_back(buf);
 				}
 			}
-		}
-	}
+			else
+			{
+				Server->Log("Reading from device failed -2", LL_ERROR);
+				fs.has_error = true;
+				run_bufs.resize(run_len, NULL);
+			}
 
-	void setMaxReadaheadNBuffers(int64 n_max_buffers)
-	{
-		curr_fs_readahead_n_max_buffers = n_max_buffers;
+			lock.relock(mutex.get());
+
+			for (size_t i = 0; i < run_len; ++i)
+			{
+				read_blocks[run_start + i] = run_bufs[i];
+			}
+
+			queued_runs.erase(run_start);
+			n_queued_blocks -= run_len;
+
+			read_bytes += run_len*blocksize;
+			++read_requests;
+			read_time_ms += read_passed_ms;
+
+			if (readahead_miss)
+			{
+				read_block_cond->notify_all();
+				readahead_miss = false;
+			}
+		}
 	}
 
 	IFilesystem::IFsBuffer* getBlock(int64 block)
@@ -175,6 +260,7 @@ public:
 		clearUnusedReadahead(block);
 
 		IFilesystem::IFsBuffer* ret = NULL;
+		int64 wait_starttime = -1;
 		while (ret == NULL)
 		{
 			std::map<int64, IFilesystem::IFsBuffer*>::iterator it = read_blocks.find(block);
@@ -183,27 +269,87 @@ public:
 			{
 				ret = it->second;
 				read_blocks.erase(it);
+
+				if (ret == NULL)
+				{
+					break;
+				}
 			}
 			else
 			{
-				readaheadFromInt(block);
+				if (wait_starttime == -1)
+				{
+					wait_starttime = Server->getTimeMS();
+				}
+
+				if (!isQueued(block))
+				{
+					readaheadFromInt(block);
+				}
 				readahead_miss = true;
 				read_block_cond->wait(&lock);
 			}
 		}
 
+		if (wait_starttime != -1)
+		{
+			block_wait_time_ms += Server->getTimeMS() - wait_starttime;
+		}
+
+		if (numBufferedBlocks() <= readahead_low_level_blocks)
+		{
+			start_readahead_cond->notify_all();
+		}
+
 		return ret;
 	}
 
 	void stop()
+	{
+		{
+			IScopedLock lock(mutex.get());
+			do_stop = true;
+			start_readahead_cond->notify_all();
+		}
+
+		Server->getThreadPool()->waitFor(worker_tickets);
+		worker_tickets.clear();
+	}
+
+	void logStats()
 	{
 		IScopedLock lock(mutex.get());
-		do_stop = true;
-		start_readahead_cond->notify_all();
+
+		if (read_requests == 0)
+		{
+			return;
+		}
+
+		int64 passed_ms = (std::max)(Server->getTimeMS() - starttime, static_cast<int64>(1));
+		Server->Log("Device readahead with " + convert(n_threads) + " threads read " + PrettyPrintBytes(read_bytes)
+			+ " in " + convert(read_requests) + " requests (avg. " + PrettyPrintBytes(read_bytes / read_requests) + ", "
+			+ convert(read_time_ms / read_requests) + "ms per request). Throughput " + PrettyPrintSpeed(static_cast<size_t>((read_bytes * 1000) / passed_ms))
+			+ ". Waited " + PrettyPrintTime(block_wait_time_ms) + " for blocks", LL_INFO);
 	}
 
 private:
 
+	size_t numBufferedBlocks()
+	{
+		return read_blocks.size() + n_queued_blocks;
+	}
+
+	bool isQueued(int64 pBlock)
+	{
+		std::map<int64, size_t>::iterator it = queued_runs.upper_bound(pBlock);
+		if (it == queued_runs.begin())
+		{
+			return false;
+		}
+		--it;
+		return pBlock < it->first + static_cast<int64>(it->second);
+	}
+
 	void readaheadFromInt(int64 pBlock)
 	{
 		current_block = pBlock;
@@ -219,7 +365,10 @@ private:
 			{
 				std::map<int64, IFilesystem::IFsBuffer*>::iterator todel = it;
 				++it;
-				fs.releaseBuffer(todel->second);
+				if (todel->second != NULL)
+				{
+					fs.releaseBuffer(todel->second);
+				}
 				read_blocks.erase(todel);
 			}
 			else
@@ -235,6 +384,8 @@ private:
 	Filesystem& fs;
 
 	std::map<int64, IFilesystem::IFsBuffer*> read_blocks;
+	std::map<int64, size_t> queued_runs;
+	size_t n_queued_blocks;
 
 	bool readahead_miss;
 
@@ -244,7 +395,14 @@ private:
 
 	bool background_priority;
 
-	int64 curr_fs_readahead_n_max_buffers;
+	size_t n_threads;
+	std::vector<THREADPOOL_TICKET> worker_tickets;
+
+	int64 starttime;
+	int64 read_bytes;
+	int64 read_requests;
+	int64 read_time_ms;
+	int64 block_wait_time_ms;
 };
 
 Filesystem::Filesystem(const std::string &pDev, IFSImageFactory::EReadaheadMode read_ahead, IFsNextBlockCallback* next_block_callback)
@@ -493,6 +651,30 @@ std::vector<int64> Filesystem::readBlocks(int64 pStartBlock, unsigned int n,
 	return ret;
 }
 
+bool Filesystem::readFromDevAt(int64 pos, char *buf, _u32 bsize)
+{
+	assert(read_ahead_mode != IFSImageFactory::EReadaheadMode_Overlapped);
+
+	int tries=20;
+	_u32 rc=dev->Read(pos, buf, bsize);
+	while(rc<bsize)
+	{
+		Server->wait(200);
+		errcode = getLastSystemError();
+		Server->Log("Reading from device at position "+convert(pos+rc)+" failed. Retrying. Errorcode: "+convert(errcode), LL_WARNING);
+		rc+=dev->Read(pos+rc, buf+rc, bsize-rc);
+		--tries;
+		if(tries<0
+			&& rc<bsize)
+		{
+			errcode = getLastSystemError();
+			Server->Log("Reading from device at position "+convert(pos+rc)+" failed. Errorcode: "+convert(errcode), LL_ERROR);
+			return false;
+		}
+	}
+	return true;
+}
+
 bool Filesystem::readFromDev(char *buf, _u32 bsize)
 {
 	assert(read_ahead_mode != IFSImageFactory::EReadaheadMode_Overlapped);
@@ -592,8 +774,9 @@ void Filesystem::initReadahead(IFSImageFactory::EReadaheadMode read_ahead, bool
 	}
 	else if (read_ahead == IFSImageFactory::EReadaheadMode_Thread)
 	{
-		readahead_thread.reset(new Filesystem_ReadaheadThread(*this, background_priority));
-		readahead_thread_ticket = Server->getThreadPool()->execute(readahead_thread.get(), "device readahead");
+		size_t n_threads = (std::max)(watoi(Server->getServerParameter("image_readahead_threads", "4")), 1);
+		readahead_thread.reset(new Filesystem_ReadaheadThread(*this, background_priority, n_threads));
+		readahead_thread->start();
 	}
 
 	if (read_ahead != IFSImageFactory::EReadaheadMode_None
@@ -834,7 +1017,7 @@ void Filesystem::shutdownReadahead()
 	if(readahead_thread.get()!=NULL)
 	{
 		readahead_thread->stop();
-		Server->getThreadPool()->waitFor(readahead_thread_ticket);
+		readahead_thread->logStats();
 		readahead_thread.reset();
 	}
 
@@ -58,6 +58,7 @@ struct SNextBlock
 
 class Filesystem : public IFilesystem, public IFsNextBlockCallback
 {
+	friend class Filesystem_ReadaheadThread;
 public:
 	Filesystem(const std::string &pDev, IFSImageFactory::EReadaheadMode read_ahead, IFsNextBlockCallback* next_block_callback);
 	Filesystem(IFile *pDev, IFsNextBlockCallback* next_block_callback);
@@ -102,6 +103,7 @@ public:
 
 protected:
 	bool readFromDev(char *buf, _u32 bsize);
+	bool readFromDevAt(int64 pos, char *buf, _u32 bsize);
 	void initReadahead(IFSImageFactory::EReadaheadMode read_ahead, bool background_priority);
 	bool queueOverlappedReads(bool force_queue);
 	bool waitForCompletion(unsigned int wtimems);
@@ -132,7 +134,6 @@ protected:
 	std::vector<SSimpleBuffer*> buffers;
 	std::auto_ptr<IMutex> buffer_mutex;
 	std::auto_ptr<Filesystem_ReadaheadThread> readahead_thread;
-	THREADPOOL_TICKET readahead_thread_ticket;
 
 	size_t num_uncompleted_blocks;
 	int64 overlapped_next_block;
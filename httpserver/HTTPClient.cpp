@@ -235,6 +235,14 @@ bool CHTTPClient::Run(IRunOtherCallback* run_other)
 	return true;
 }
 
+bool CHTTPClient::wantPeriodicRun(void)
+{
+	//While reading a request there is nothing to do until data arrives
+	return do_quit
+		|| http_g_state==HTTP_STATE_WAIT_FOR_THREAD
+		|| http_g_state==HTTP_STATE_DONE;
+}
+
 void CHTTPClient::processCommand(char ch)
 {
 	switch(http_state)
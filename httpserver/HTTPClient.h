@@ -24,6 +24,7 @@ public:
 
 	virtual void ReceivePackets(IRunOtherCallback* run_other);
 	virtual bool Run(IRunOtherCallback* run_other);
+	virtual bool wantPeriodicRun(void);
 
 	static void init_mutex(void);
 	static void destroy_mutex(void);
@@ -2,6 +2,7 @@
 #include "../Interface/Plugin.h"
 #include <string>
 #include <algorithm>
+#include <vector>
 
 class ILuaInterpreter : public IPlugin
 {
@@ -149,9 +150,28 @@ public:
 	};
 
 
+	struct SBatchItem
+	{
+		SBatchItem()
+			: ret(-1), ret2(-1), run_time_ms(0) {}
+
+		Param params;
+		std::string state;
+		std::string state_mem;
+		int64 ret;
+		int64 ret2;
+		int64 run_time_ms;
+	};
+
 	virtual std::string compileScript(const std::string& script) = 0;
 	virtual int64 runScript(const std::string& script, const Param& params, int64& ret2,
 		std::string& state, std::string& state_mem,
 		std::string& global_data, 
 		std::string& global_data_mem, SInterpreterFunctions& funcs) = 0;
+
+	//Runs the script once per item in one pooled state. The global tables are kept
+	//in the state between items and only serialized at the end
+	virtual bool runScriptBatch(const std::string& script, std::vector<SBatchItem>& items,
+		std::string& global_data,
+		std::string& global_data_mem, SInterpreterFunctions& funcs) = 0;
 };
\ No newline at end of file
@@ -427,6 +427,207 @@ namespace
 		Server->Log(msg, loglevel);
 		return 0;
 	}
+
+	bool set_global_table(lua_State* state, const std::string& data, const char* name)
+	{
+		bool ret = true;
+		if (data.empty())
+		{
+			lua_newtable(state);
+		}
+		else if (!unserialize_table(state, data))
+		{
+			Server->Log(std::string("Error unserializing ") + name, LL_ERROR);
+			assert(false);
+			ret = false;
+		}
+
+		lua_setglobal(state, name);
+		return ret;
+	}
+
+	std::string serialize_global_table(lua_State* state, const char* name)
+	{
+		lua_getglobal(state, name);
+
+		std::string ret = serialize_table(state);
+		if (ret.empty())
+		{
+			Server->Log(std::string("Error serializing ") + name, LL_ERROR);
+			assert(false);
+		}
+
+		lua_pop(state, 1);
+		return ret;
+	}
+
+	//Adds a shallow copy and the metatable of the table at idx to the
+	//snapshot table, keyed by the table itself
+	void snapshot_table(lua_State* state, int snapshot, int idx)
+	{
+		lua_pushvalue(state, idx);
+		lua_rawget(state, snapshot);
+		bool done = !lua_isnil(state, -1);
+		lua_pop(state, 1);
+		if (done)
+		{
+			return;
+		}
+
+		lua_pushvalue(state, idx);
+		lua_createtable(state, 2, 0);
+		lua_newtable(state);
+		for (lua_pushnil(state); lua_next(state, idx) != 0; lua_pop(state, 1))
+		{
+			lua_pushvalue(state, -2);
+			lua_pushvalue(state, -2);
+			lua_rawset(state, -5);
+		}
+		lua_rawseti(state, -2, 1);
+		if (lua_getmetatable(state, idx))
+		{
+			lua_rawseti(state, -2, 2);
+		}
+		lua_rawset(state, snapshot);
+	}
+
+	//Snapshots the global table, the tables it references (string, table,
+	//math, package, ...), the tables those reference (package.loaded, ...)
+	//and the string metatable
+	int snapshot_globals(lua_State* state)
+	{
+		int top = lua_gettop(state);
+
+		lua_newtable(state);
+		int snapshot = lua_gettop(state);
+		lua_pushglobaltable(state);
+		int globals = lua_gettop(state);
+
+		snapshot_table(state, snapshot, globals);
+
+		for (lua_pushnil(state); lua_next(state, globals) != 0; lua_pop(state, 1))
+		{
+			if (!lua_istable(state, -1))
+			{
+				continue;
+			}
+
+			int lib = lua_gettop(state);
+			snapshot_table(state, snapshot, lib);
+
+			for (lua_pushnil(state); lua_next(state, lib) != 0; lua_pop(state, 1))
+			{
+				if (lua_istable(state, -1))
+				{
+					snapshot_table(state, snapshot, lua_gettop(state));
+				}
+			}
+		}
+
+		lua_pushliteral(state, "");
+		if (lua_getmetatable(state, -1))
+		{
+			snapshot_table(state, snapshot, lua_gettop(state));
+		}
+
+		lua_settop(state, snapshot);
+		int ret = luaL_ref(state, LUA_REGISTRYINDEX);
+		lua_settop(state, top);
+		return ret;
+	}
+
+	//Sets the content of the table at target to the content of the table at copy
+	void restore_table(lua_State* state, int target, int copy)
+	{
+		for (lua_pushnil(state); lua_next(state, target) != 0; lua_pop(state, 1))
+		{
+			lua_pushvalue(state, -2);
+			lua_rawget(state, copy);
+			if (!lua_rawequal(state, -1, -2))
+			{
+				lua_pushvalue(state, -3);
+				lua_insert(state, -2);
+				lua_rawset(state, target);
+			}
+			else
+			{
+				lua_pop(state, 1);
+			}
+		}
+
+		for (lua_pushnil(state); lua_next(state, copy) != 0; lua_pop(state, 1))
+		{
+			lua_pushvalue(state, -2);
+			lua_rawget(state, target);
+			bool missing = lua_isnil(state, -1);
+			lua_pop(state, 1);
+			if (missing)
+			{
+				lua_pushvalue(state, -2);
+				lua_pushvalue(state, -2);
+				lua_rawset(state, target);
+			}
+		}
+	}
+
+	//Restores the global table, the library tables and their metatables to
+	//the snapshot taken after setup, so a pooled state does not carry
+	//changes (e.g. string.format = ...) from one run into the next
+	void reset_globals(lua_State* state, int baseline_ref)
+	{
+		lua_settop(state, 0);
+		lua_rawgeti(state, LUA_REGISTRYINDEX, baseline_ref);
+
+		for (lua_pushnil(state); lua_next(state, 1) != 0; lua_pop(state, 1))
+		{
+			lua_rawgeti(state, 3, 1);
+			restore_table(state, 2, 4);
+			lua_pop(state, 1);
+			lua_rawgeti(state, 3, 2);
+			lua_setmetatable(state, 2);
+		}
+
+		lua_settop(state, 0);
+		lua_gc(state, LUA_GCSTEP, 0);
+	}
+
+	void replace_ref(lua_State* state, int& ref, const char* name)
+	{
+		lua_getglobal(state, name);
+		if (lua_istable(state, -1))
+		{
+			luaL_unref(state, LUA_REGISTRYINDEX, ref);
+			ref = luaL_ref(state, LUA_REGISTRYINDEX);
+		}
+		else
+		{
+			lua_pop(state, 1);
+		}
+	}
+}
+
+LuaInterpreter::LuaInterpreter()
+	: mutex(Server->createMutex()),
+	max_pool_size(4), sandbox(Server->getServerParameter("lua_sandbox") == "true")
+{
+	std::string pool_size = Server->getServerParameter("lua_state_pool_size");
+	if (!pool_size.empty())
+	{
+		max_pool_size = static_cast<size_t>(watoi(pool_size));
+	}
+}
+
+LuaInterpreter::~LuaInterpreter()
+{
+	for (std::map<std::string, std::vector<SPooledState*> >::iterator it = pool.begin();
+		it != pool.end(); ++it)
+	{
+		for (size_t i = 0; i < it->second.size(); ++i)
+		{
+			destroyState(it->second[i]);
+		}
+	}
+	Server->destroy(mutex);
 }
 
 std::string LuaInterpreter::compileScript(const std::string & script)
@@ -463,105 +664,109 @@ int64 LuaInterpreter::runScript(const std::string& script, const Param& params,
 {
 	ret2 = -1;
 
-	lua_State* state = luaL_newstate();
-	if (state == NULL)
+	SPooledState* pstate = getState(script);
+	if (pstate == NULL)
 	{
 		return -1;
 	}
 
-	ScopedLuaState scoped_state(state);
+	lua_State* state = pstate->state;
 
-	if (Server->getServerParameter("lua_sandbox") == "true")
+	set_global_table(state, global_data, "global");
+	set_global_table(state, global_data_mem, "global_mem");
+
+	int64 ret;
+	if (runChunk(pstate, params, ret, ret2, state_data, state_data_mem, funcs))
 	{
-		luaL_openlibs_custom(state);
+		global_data = serialize_global_table(state, "global");
+		global_data_mem = serialize_global_table(state, "global_mem");
 	}
-	else
+
+	releaseState(script, pstate);
+	
+	return ret;
+}
+
+bool LuaInterpreter::runScriptBatch(const std::string& script, std::vector<SBatchItem>& items,
+	std::string& global_data, std::string& global_data_mem, SInterpreterFunctions& funcs)
+{
+	SPooledState* pstate = getState(script);
+	if (pstate == NULL)
 	{
-		luaL_openlibs_all(state);
+		return false;
 	}
 
-	int rc = luaL_loadbuffer(state, script.c_str(), script.size(), "script");
-	if (rc) {
-		Server->Log(std::string("Error loading lua script: ") + lua_tostring(state, -1), LL_ERROR);
-		return -1;
-	}
+	lua_State* state = pstate->state;
 
-	set_param(state, params);
-	lua_setglobal(state, "params");
+	set_global_table(state, global_data, "global");
+	set_global_table(state, global_data_mem, "global_mem");
+	int global_ref = LUA_NOREF;
+	int global_mem_ref = LUA_NOREF;
+	replace_ref(state, global_ref, "global");
+	replace_ref(state, global_mem_ref, "global_mem");
 
-	lua_pushlightuserdata(state, const_cast<ILuaInterpreter::SInterpreterFunctions*>(&funcs));
-	lua_setglobal(state, "_g_funcs");
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		SBatchItem& item = items[i];
 
-	lua_pushcfunction(state, l_mail);
-	lua_setglobal(state, "mail");
-	lua_pushcfunction(state, l_require);
-	lua_setglobal(state, "require");
-	lua_pushcfunction(state, l_request_url);
-	lua_setglobal(state, "request_url");
+		int64 starttime = Server->getTimeMS();
 
-	lua_pushcfunction(state, l_log);
-	lua_setglobal(state, "log");
-	lua_pushinteger(state, LL_DEBUG);
-	lua_setglobal(state,"LL_DEBUG");
-	lua_pushinteger(state, LL_INFO);
-	lua_setglobal(state, "LL_INFO");
-	lua_pushinteger(state, LL_WARNING);
-	lua_setglobal(state, "LL_WARNING");
-	lua_pushinteger(state, LL_ERROR);
-	lua_setglobal(state, "LL_ERROR");
+		lua_rawgeti(state, LUA_REGISTRYINDEX, global_ref);
+		lua_setglobal(state, "global");
+		lua_rawgeti(state, LUA_REGISTRYINDEX, global_mem_ref);
+		lua_setglobal(state, "global_mem");
 
-	if (state_data.empty())
-	{
-		lua_newtable(state);
-	}
-	else if (!unserialize_table(state, state_data))
-	{
-		Server->Log("Error unserializing state data", LL_ERROR);
-		assert(false);
-	}
+		if (runChunk(pstate, item.params, item.ret, item.ret2, item.state, item.state_mem, funcs))
+		{
+			replace_ref(state, global_ref, "global");
+			replace_ref(state, global_mem_ref, "global_mem");
+		}
 
-	lua_setglobal(state, "state");
+		reset_globals(state, pstate->baseline_ref);
 
-	if (state_data_mem.empty())
-	{
-		lua_newtable(state);
-	}
-	else if (!unserialize_table(state, state_data_mem))
-	{
-		Server->Log("Error unserializing state data mem", LL_ERROR);
-		assert(false);
+		item.run_time_ms = Server->getTimeMS() - starttime;
 	}
 
-	lua_setglobal(state, "state_mem");
+	lua_rawgeti(state, LUA_REGISTRYINDEX, global_ref);
+	lua_setglobal(state, "global");
+	lua_rawgeti(state, LUA_REGISTRYINDEX, global_mem_ref);
+	lua_setglobal(state, "global_mem");
 
-	if (global_data.empty())
-	{
-		lua_newtable(state);
-	}
-	else if (!unserialize_table(state, global_data))
-	{
-		Server->Log("Error unserializing global data", LL_ERROR);
-		assert(false);
-	}
+	global_data = serialize_global_table(state, "global");
+	global_data_mem = serialize_global_table(state, "global_mem");
 
-	lua_setglobal(state, "global");
+	luaL_unref(state, LUA_REGISTRYINDEX, global_ref);
+	luaL_unref(state, LUA_REGISTRYINDEX, global_mem_ref);
 
-	if (global_data_mem.empty())
-	{
-		lua_newtable(state);
-	}
-	else if (!unserialize_table(state, global_data_mem))
-	{
-		Server->Log("Error unserializing global data mem", LL_ERROR);
-		assert(false);
-	}
+	releaseState(script, pstate);
 
-	lua_setglobal(state, "global_mem");
+	return true;
+}
 
-	rc = lua_pcall(state, 0, LUA_MULTRET, 0);
+bool LuaInterpreter::runChunk(SPooledState* pstate, const Param& params, int64& ret, int64& ret2,
+	std::string& state_data, std::string& state_data_mem, SInterpreterFunctions& funcs)
+{
+	ret = -1;
+	ret2 = -1;
+
+	lua_State* state = pstate->state;
+
+	lua_rawgeti(state, LUA_REGISTRYINDEX, pstate->chunk_ref);
+
+	set_param(state, params);
+	lua_setglobal(state, "params");
+
+	lua_pushlightuserdata(state, const_cast<ILuaInterpreter::SInterpreterFunctions*>(&funcs));
+	lua_setglobal(state, "_g_funcs");
+
+	set_global_table(state, state_data, "state");
+	set_global_table(state, state_data_mem, "state_mem");
+
+	int rc = lua_pcall(state, 0, LUA_MULTRET, 0);
 	if (rc) {
 		Server->Log(std::string("Error running lua script: ") + lua_tostring(state, -1), LL_ERROR);
-		return -1;
+		lua_settop(state, 0);
+		return false;
 	}
 
 	if (lua_gettop(state) > 1)
@@ -569,44 +774,119 @@ int64 LuaInterpreter::runScript(const std::string& script, const Param& params,
 		ret2 = lua_tointeger(state, -1);
 		lua_pop(state, 1);
 	}
-	int64 ret = lua_tointeger(state, -1);
-	lua_pop(state, 1);
+	ret = lua_tointeger(state, -1);
+	lua_settop(state, 0);
+
+	state_data = serialize_global_table(state, "state");
+	state_data_mem = serialize_global_table(state, "state_mem");
 
-	lua_getglobal(state, "state");
+	return true;
+}
 
-	state_data = serialize_table(state);
-	if (state_data.empty())
+LuaInterpreter::SPooledState* LuaInterpreter::getState(const std::string& script)
+{
 	{
-		Server->Log("Error serializing state data", LL_ERROR);
-		assert(false);
+		IScopedLock lock(mutex);
+
+		std::map<std::string, std::vector<SPooledState*> >::iterator it = pool.find(script);
+		if (it != pool.end()
+			&& !it->second.empty())
+		{
+			SPooledState* ret = it->second.back();
+			it->second.pop_back();
+			return ret;
+		}
 	}
 
-	lua_getglobal(state, "state_mem");
+	return createState(script);
+}
+
+void LuaInterpreter::releaseState(const std::string& script, SPooledState* pstate)
+{
+	reset_globals(pstate->state, pstate->baseline_ref);
 
-	state_data_mem = serialize_table(state);
-	if (state_data_mem.empty())
+	IScopedLock lock(mutex);
+
+	std::map<std::string, std::vector<SPooledState*> >::iterator it = pool.find(script);
+	if (it == pool.end())
 	{
-		Server->Log("Error serializing state mem data", LL_ERROR);
-		assert(false);
-	}
+		//Drop states of scripts that are no longer used (e.g. after the script was edited)
+		while (!pool.empty()
+			&& pool.size() >= 16)
+		{
+			for (size_t i = 0; i < pool.begin()->second.size(); ++i)
+			{
+				destroyState(pool.begin()->second[i]);
+			}
+			pool.erase(pool.begin());
+		}
 
-	lua_getglobal(state, "global");
+		it = pool.insert(std::make_pair(script, std::vector<SPooledState*>())).first;
+	}
 
-	global_data = serialize_table(state);
-	if (global_data.empty())
+	if (it->second.size() < max_pool_size)
 	{
-		Server->Log("Error serializing global data", LL_ERROR);
-		assert(false);
+		it->second.push_back(pstate);
 	}
+	else
+	{
+		destroyState(pstate);
+	}
+}
 
-	lua_getglobal(state, "global_mem");
+LuaInterpreter::SPooledState* LuaInterpreter::createState(const std::string& script)
+{
+	lua_State* state = luaL_newstate();
+	if (state == NULL)
+	{
+		return NULL;
+	}
 
-	global_data_mem = serialize_table(state);
-	if (global_data_mem.empty())
+	if (sandbox)
 	{
-		Server->Log("Error serializing global mem data", LL_ERROR);
-		assert(false);
+		luaL_openlibs_custom(state);
 	}
-	
+	else
+	{
+		luaL_openlibs_all(state);
+	}
+
+	int rc = luaL_loadbuffer(state, script.c_str(), script.size(), "script");
+	if (rc) {
+		Server->Log(std::string("Error loading lua script: ") + lua_tostring(state, -1), LL_ERROR);
+		lua_close(state);
+		return NULL;
+	}
+
+	SPooledState* ret = new SPooledState;
+	ret->state = state;
+	ret->chunk_ref = luaL_ref(state, LUA_REGISTRYINDEX);
+
+	lua_pushcfunction(state, l_mail);
+	lua_setglobal(state, "mail");
+	lua_pushcfunction(state, l_require);
+	lua_setglobal(state, "require");
+	lua_pushcfunction(state, l_request_url);
+	lua_setglobal(state, "request_url");
+
+	lua_pushcfunction(state, l_log);
+	lua_setglobal(state, "log");
+	lua_pushinteger(state, LL_DEBUG);
+	lua_setglobal(state,"LL_DEBUG");
+	lua_pushinteger(state, LL_INFO);
+	lua_setglobal(state, "LL_INFO");
+	lua_pushinteger(state, LL_WARNING);
+	lua_setglobal(state, "LL_WARNING");
+	lua_pushinteger(state, LL_ERROR);
+	lua_setglobal(state, "LL_ERROR");
+
+	ret->baseline_ref = snapshot_globals(state);
+
 	return ret;
 }
+
+void LuaInterpreter::destroyState(SPooledState* pstate)
+{
+	lua_close(pstate->state);
+	delete pstate;
+}
@@ -2,10 +2,18 @@
 #include <string>
 #include "../Interface/Types.h"
 #include "ILuaInterpreter.h"
+#include "../Interface/Mutex.h"
+#include <map>
+#include <vector>
+
+struct lua_State;
 
 class LuaInterpreter : public ILuaInterpreter
 {
 public:
+	LuaInterpreter();
+	~LuaInterpreter();
+
 	virtual std::string compileScript(const std::string& script);
 
 	virtual int64 runScript(const std::string& script, const Param& params, int64& ret2,
@@ -13,4 +21,28 @@ public:
 		std::string& global_data,
 		std::string& global_data_mem, SInterpreterFunctions& funcs);
 
+	virtual bool runScriptBatch(const std::string& script, std::vector<SBatchItem>& items,
+		std::string& global_data,
+		std::string& global_data_mem, SInterpreterFunctions& funcs);
+
+private:
+	struct SPooledState
+	{
+		lua_State* state;
+		int chunk_ref;
+		int baseline_ref;
+	};
+
+	SPooledState* getState(const std::string& script);
+	void releaseState(const std::string& script, SPooledState* pstate);
+	SPooledState* createState(const std::string& script);
+	void destroyState(SPooledState* pstate);
+
+	bool runChunk(SPooledState* pstate, const Param& params, int64& ret, int64& ret2,
+		std::string& state_data, std::string& state_data_mem, SInterpreterFunctions& funcs);
+
+	IMutex* mutex;
+	std::map<std::string, std::vector<SPooledState*> > pool;
+	size_t max_pool_size;
+	bool sandbox;
 };
\ No newline at end of file
@@ -468,6 +468,18 @@ int main_fkt(int argc, char *argv[])
 		Server->setLogConsoleTime(false);
 	}
 
+	if(Server->getServerParameter("async_log")!="false")
+	{
+		size_t log_rings=8;
+		size_t log_ring_size=4096;
+		if(!Server->getServerParameter("async_log_rings").empty())
+			log_rings=(std::max)(1, watoi(Server->getServerParameter("async_log_rings")));
+		if(!Server->getServerParameter("async_log_ring_size").empty())
+			log_ring_size=(std::max)(2, watoi(Server->getServerParameter("async_log_ring_size")));
+
+		Server->startAsyncLog(log_rings, log_ring_size);
+	}
+
 	if(is_big_endian())
 	{
 		Server->setLogLevel(LL_DEBUG);
@@ -19,6 +19,12 @@
 #	define closesocket close
 #	define SOCKET int
 #	define Sleep(x) usleep(x*1000)
+#	if defined(__linux__) && !defined(NO_EPOLL)
+#		include <sys/epoll.h>
+#		include <sys/eventfd.h>
+#		include <sys/timerfd.h>
+#		define HAS_EPOLL
+#	endif
 #endif
 #if defined(__sun__) || defined(__APPLE__)
 #	define MSG_NOSIGNAL 0
@@ -0,0 +1,474 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "FileHashCache.h"
+#include "../Interface/Server.h"
+#include "../Interface/File.h"
+#include "../md5.h"
+#include "../stringtools.h"
+#include "../common/adler32.h"
+#include "../urbackupcommon/os_functions.h"
+#include <memory.h>
+#include <stddef.h>
+#include <algorithm>
+#include <memory>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace
+{
+	const char* cache_magic = "URBFHC1";
+	const _u32 cache_version = 2;
+	const _u32 default_num_slots = 256*1024;
+	const _u32 max_num_slots = 8*1024*1024;
+	const _u32 max_probes = 8;
+	const size_t slots_offset = 64;
+}
+
+FileHashCache* FileHashCache::instance = NULL;
+
+void FileHashCache::init()
+{
+	if (Server->getServerParameter("file_hash_cache") == "false")
+	{
+		return;
+	}
+
+	std::string cache_fn = "urbackup" + os_file_sep() + "file_hash_cache.dat";
+
+	_u32 num_slots = default_num_slots;
+	bool fixed_size = false;
+	std::string slots_param = Server->getServerParameter("file_hash_cache_entries");
+	if (!slots_param.empty())
+	{
+		num_slots = (std::max)(static_cast<_u32>(1024), static_cast<_u32>(watoi(slots_param)));
+		fixed_size = true;
+	}
+	else
+	{
+		num_slots = (std::max)(num_slots, getStoredNumSlots(cache_fn));
+	}
+
+	FileHashCache* cache = new FileHashCache;
+	cache->fixed_size = fixed_size;
+	if (!cache->open(cache_fn, num_slots))
+	{
+		Server->Log("Error opening file hash cache. Running without it.", LL_WARNING);
+		delete cache;
+		return;
+	}
+
+	instance = cache;
+}
+
+void FileHashCache::destroy()
+{
+	delete instance;
+	instance = NULL;
+}
+
+FileHashCache* FileHashCache::getInstance()
+{
+	return instance;
+}
+
+FileHashCache::FileHashCache()
+	: mutex(Server->createMutex()), fixed_size(false), num_slots(0), data(NULL), data_size(0),
+#ifdef _WIN32
+	hFile(INVALID_HANDLE_VALUE), hMap(NULL)
+#else
+	fd(-1)
+#endif
+{
+}
+
+FileHashCache::~FileHashCache()
+{
+	close();
+	Server->destroy(mutex);
+}
+
+bool FileHashCache::open(const std::string& p_fn, _u32 p_num_slots)
+{
+	fn = p_fn;
+	num_slots = p_num_slots;
+	data_size = slots_offset + static_cast<size_t>(num_slots)*sizeof(SSlot);
+
+#ifdef _WIN32
+	hFile = CreateFileW(Server->ConvertToWchar(fn).c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		Server->Log("Error opening file hash cache file \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(hFile, &fsize))
+	{
+		return false;
+	}
+
+	bool reinit = static_cast<size_t>(fsize.QuadPart) != data_size;
+
+	LARGE_INTEGER msize;
+	msize.QuadPart = data_size;
+
+	if (reinit
+		&& (!SetFilePointerEx(hFile, msize, NULL, FILE_BEGIN)
+			|| !SetEndOfFile(hFile)))
+	{
+		Server->Log("Error resizing file hash cache. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+	hMap = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, msize.HighPart, msize.LowPart, NULL);
+	if (hMap == NULL)
+	{
+		Server->Log("Error creating mapping of file hash cache. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	data = reinterpret_cast<char*>(MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, data_size));
+	if (data == NULL)
+	{
+		Server->Log("Error mapping file hash cache. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+#else
+	fd = ::open(fn.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+	{
+		Server->Log("Error opening file hash cache file \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		return false;
+	}
+
+	bool reinit = static_cast<size_t>(st.st_size) != data_size;
+
+	if (reinit
+		&& (ftruncate(fd, 0) != 0
+			|| ftruncate(fd, data_size) != 0) )
+	{
+		Server->Log("Error resizing file hash cache. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	void* addr = mmap(NULL, data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		Server->Log("Error mapping file hash cache. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+	data = reinterpret_cast<char*>(addr);
+#endif
+
+	SHeader* header = reinterpret_cast<SHeader*>(data);
+
+	if (!reinit
+		&& (memcmp(header->magic, cache_magic, sizeof(header->magic)) != 0
+			|| header->version != cache_version
+			|| header->num_slots != num_slots))
+	{
+		reinit = true;
+	}
+
+	if (reinit)
+	{
+		Server->Log("Initializing file hash cache with " + convert(num_slots) + " entries (" + PrettyPrintBytes(data_size) + ")", LL_INFO);
+		memset(data, 0, data_size);
+		memcpy(header->magic, cache_magic, sizeof(header->magic));
+		header->version = cache_version;
+		header->num_slots = num_slots;
+	}
+
+	return true;
+}
+
+void FileHashCache::close()
+{
+#ifdef _WIN32
+	if (data != NULL)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (hMap != NULL)
+	{
+		CloseHandle(hMap);
+	}
+	if (hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+	}
+	hMap = NULL;
+	hFile = INVALID_HANDLE_VALUE;
+#else
+	if (data != NULL)
+	{
+		munmap(data, data_size);
+	}
+	if (fd != -1)
+	{
+		::close(fd);
+	}
+	fd = -1;
+#endif
+	data = NULL;
+}
+
+_u32 FileHashCache::getStoredNumSlots(const std::string& fn)
+{
+	std::auto_ptr<IFsFile> f(Server->openFile(fn, MODE_READ));
+	if (f.get() == NULL)
+	{
+		return 0;
+	}
+
+	SHeader header;
+	if (f->Read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)
+		|| memcmp(header.magic, cache_magic, sizeof(header.magic)) != 0
+		|| header.version != cache_version
+		|| header.num_slots > max_num_slots
+		|| f->Size() != static_cast<int64>(slots_offset + static_cast<size_t>(header.num_slots)*sizeof(SSlot)))
+	{
+		return 0;
+	}
+
+	return header.num_slots;
+}
+
+bool FileHashCache::get(const std::string& path, int64 size, uint64 change_indicator, int sha_version, std::string& hash)
+{
+	unsigned char key[16];
+	calcKey(path, sha_version, key);
+
+	_u32 start;
+	memcpy(&start, key, sizeof(start));
+
+	IScopedLock lock(mutex);
+
+	if (data == NULL)
+	{
+		return false;
+	}
+
+	for (_u32 i = 0; i < max_probes; ++i)
+	{
+		SSlot* slot = getSlot((start + i) % num_slots);
+
+		if (isEmptyKey(slot->key))
+		{
+			return false;
+		}
+
+		if (memcmp(slot->key, key, sizeof(key)) == 0)
+		{
+			if (slot->size != size
+				|| slot->change_indicator != change_indicator
+				|| slot->hash_size > max_hash_size
+				|| slot->checksum != calcChecksum(*slot))
+			{
+				return false;
+			}
+
+			hash.assign(slot->hash, slot->hash_size);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FileHashCache::put(const std::string& path, int64 size, uint64 change_indicator, int sha_version, const std::string& hash)
+{
+	if (hash.empty()
+		|| hash.size() > max_hash_size)
+	{
+		return;
+	}
+
+	SSlot new_slot = {};
+	calcKey(path, sha_version, new_slot.key);
+	new_slot.size = size;
+	new_slot.change_indicator = change_indicator;
+	new_slot.hash_size = static_cast<_u32>(hash.size());
+	memcpy(new_slot.hash, hash.data(), hash.size());
+	new_slot.checksum = calcChecksum(new_slot);
+
+	IScopedLock lock(mutex);
+
+	if (data == NULL)
+	{
+		return;
+	}
+
+	insertSlot(new_slot);
+}
+
+void FileHashCache::reserve(int64 num_files)
+{
+	if (fixed_size)
+	{
+		return;
+	}
+
+	IScopedLock lock(mutex);
+
+	if (data == NULL)
+	{
+		return;
+	}
+
+	_u32 new_num_slots = num_slots;
+	while (new_num_slots < max_num_slots
+		&& static_cast<int64>(new_num_slots) < num_files * 2)
+	{
+		new_num_slots *= 2;
+	}
+
+	if (new_num_slots <= num_slots)
+	{
+		return;
+	}
+
+	Server->Log("Growing file hash cache to " + convert(new_num_slots) + " entries for " + convert(num_files) + " indexed files", LL_INFO);
+
+	std::string curr_fn = fn;
+	std::string new_fn = fn + ".new";
+
+	{
+		FileHashCache grown;
+		if (!grown.open(new_fn, new_num_slots))
+		{
+			grown.close();
+			Server->deleteFile(new_fn);
+			return;
+		}
+
+		for (_u32 i = 0; i < num_slots; ++i)
+		{
+			SSlot* slot = getSlot(i);
+			if (!isEmptyKey(slot->key)
+				&& slot->hash_size <= max_hash_size
+				&& slot->checksum == calcChecksum(*slot))
+			{
+				grown.insertSlot(*slot);
+			}
+		}
+	}
+
+	_u32 curr_num_slots = num_slots;
+	close();
+
+	if (!os_rename_file(new_fn, curr_fn))
+	{
+		Server->Log("Error renaming \"" + new_fn + "\" to \"" + curr_fn + "\". " + os_last_error_str(), LL_ERROR);
+		Server->deleteFile(new_fn);
+		new_num_slots = curr_num_slots;
+	}
+
+	if (!open(curr_fn, new_num_slots))
+	{
+		Server->Log("Error reopening file hash cache. Running without it.", LL_ERROR);
+		close();
+	}
+}
+
+void FileHashCache::insertSlot(const SSlot& new_slot)
+{
+	_u32 start;
+	memcpy(&start, new_slot.key, sizeof(start));
+
+	SSlot* target = getSlot(start % num_slots);
+
+	for (_u32 i = 0; i < max_probes; ++i)
+	{
+		SSlot* slot = getSlot((start + i) % num_slots);
+
+		if (isEmptyKey(slot->key)
+			|| memcmp(slot->key, new_slot.key, sizeof(new_slot.key)) == 0)
+		{
+			target = slot;
+			break;
+		}
+	}
+
+	*target = new_slot;
+}
+
+void FileHashCache::calcKey(const std::string& path, int sha_version, unsigned char* key)
+{
+	MD5 md;
+	md.update(reinterpret_cast<unsigned char*>(&sha_version), sizeof(sha_version));
+#ifndef _WIN32
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0)
+	{
+		//Device and inode survive renames and are the same in block level snapshots
+		int64 file_id[2] = { static_cast<int64>(st.st_dev), static_cast<int64>(st.st_ino) };
+		md.update(reinterpret_cast<unsigned char*>(file_id), sizeof(file_id));
+	}
+	else
+#endif
+	{
+		md.update(reinterpret_cast<unsigned char*>(const_cast<char*>(path.data())), static_cast<unsigned int>(path.size()));
+	}
+	md.finalize();
+	memcpy(key, md.raw_digest_int(), 16);
+
+	if (isEmptyKey(key))
+	{
+		//All zero key marks empty slots
+		key[0] = 1;
+	}
+}
+
+_u32 FileHashCache::calcChecksum(const SSlot& slot)
+{
+	_u32 checksum = urb_adler32(urb_adler32(0, NULL, 0), reinterpret_cast<const char*>(&slot), offsetof(SSlot, checksum));
+	return urb_adler32(checksum, slot.hash, slot.hash_size);
+}
+
+FileHashCache::SSlot* FileHashCache::getSlot(_u32 idx)
+{
+	return reinterpret_cast<SSlot*>(data + slots_offset) + idx;
+}
+
+bool FileHashCache::isEmptyKey(const unsigned char* key)
+{
+	for (size_t i = 0; i < 16; ++i)
+	{
+		if (key[i] != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
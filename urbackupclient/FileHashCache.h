@@ -0,0 +1,85 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Mutex.h"
+#include <string>
+
+/**
+* Persistent file hash cache shared by all backup groups. Maps a file
+* together with its size and change indicator (which contains the
+* modification and change time) to the file hash, so IndexThread and
+* ParallelHash do not have to hash unchanged files again, e.g. after the
+* file entries of a directory were lost from the client database.
+* Files are identified by device and inode of the original path on Linux
+* and by the original path on Windows.
+*
+* The cache is a memory mapped hash table with linear probing. It grows
+* with the number of indexed files (see reserve()). Each slot carries a
+* checksum, so torn writes after a crash only cause cache misses. Colliding
+* entries are overwritten.
+*/
+class FileHashCache
+{
+public:
+	static void init();
+	static void destroy();
+
+	//Returns NULL if the cache is disabled or could not be opened
+	static FileHashCache* getInstance();
+
+	bool get(const std::string& path, int64 size, uint64 change_indicator, int sha_version, std::string& hash);
+
+	void put(const std::string& path, int64 size, uint64 change_indicator, int sha_version, const std::string& hash);
+
+	//Grows the table so that num_files entries fit at a low load factor
+	void reserve(int64 num_files);
+
+private:
+	FileHashCache();
+	~FileHashCache();
+
+	bool open(const std::string& fn, _u32 num_slots);
+	void close();
+	static _u32 getStoredNumSlots(const std::string& fn);
+
+	static const size_t max_hash_size = 64;
+
+	struct SHeader
+	{
+		char magic[8];
+		_u32 version;
+		_u32 num_slots;
+	};
+
+	struct SSlot
+	{
+		unsigned char key[16];
+		int64 size;
+		uint64 change_indicator;
+		_u32 hash_size;
+		_u32 checksum;
+		char hash[max_hash_size];
+	};
+
+	void calcKey(const std::string& path, int sha_version, unsigned char* key);
+	void insertSlot(const SSlot& new_slot);
+	_u32 calcChecksum(const SSlot& slot);
+	SSlot* getSlot(_u32 idx);
+	static bool isEmptyKey(const unsigned char* key);
+
+	static FileHashCache* instance;
+
+	IMutex* mutex;
+	std::string fn;
+	bool fixed_size;
+	_u32 num_slots;
+	char* data;
+	size_t data_size;
+
+#ifdef _WIN32
+	void* hFile;
+	void* hMap;
+#else
+	int fd;
+#endif
+};
@@ -0,0 +1,184 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ImageHashPipeline.h"
+#include "../Interface/Server.h"
+
+ImageHashPipeline::ImageHashPipeline(unsigned int blocksize, size_t buf_offset, size_t nthreads, size_t max_jobs)
+	: blocksize(blocksize), buf_offset(buf_offset), max_jobs(max_jobs),
+	zeroblockbuf(blocksize), mutex(Server->createMutex()), cond(Server->createCondition()),
+	do_exit(false), hash_time_ms(0), wait_time_ms(0)
+{
+	for (size_t i = 0; i < nthreads; ++i)
+	{
+		workers.push_back(new HashWorker(this));
+		worker_tickets.push_back(Server->getThreadPool()->execute(workers[i], "image hash"));
+	}
+}
+
+ImageHashPipeline::~ImageHashPipeline()
+{
+	{
+		IScopedLock lock(mutex);
+		do_exit = true;
+		cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(worker_tickets);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		delete workers[i];
+	}
+
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		delete jobs[i];
+	}
+
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+void ImageHashPipeline::addJob(SHashJob* job)
+{
+	job->done = false;
+
+	IScopedLock lock(mutex);
+	jobs.push_back(job);
+	pending.push_back(job);
+	cond->notify_all();
+}
+
+ImageHashPipeline::SHashJob* ImageHashPipeline::getFinishedJob(bool wait)
+{
+	IScopedLock lock(mutex);
+
+	if (jobs.empty())
+	{
+		return NULL;
+	}
+
+	if (!jobs.front()->done)
+	{
+		if (!wait)
+		{
+			return NULL;
+		}
+
+		int64 starttime = Server->getTimeMS();
+		while (!jobs.front()->done)
+		{
+			cond->wait(&lock);
+		}
+		wait_time_ms += Server->getTimeMS() - starttime;
+	}
+
+	SHashJob* ret = jobs.front();
+	jobs.pop_front();
+	return ret;
+}
+
+size_t ImageHashPipeline::numJobs()
+{
+	IScopedLock lock(mutex);
+	return jobs.size();
+}
+
+size_t ImageHashPipeline::getMaxJobs()
+{
+	return max_jobs;
+}
+
+size_t ImageHashPipeline::getNumThreads()
+{
+	return workers.size();
+}
+
+int64 ImageHashPipeline::getHashTimeMs()
+{
+	IScopedLock lock(mutex);
+	return hash_time_ms;
+}
+
+int64 ImageHashPipeline::getWaitTimeMs()
+{
+	IScopedLock lock(mutex);
+	return wait_time_ms;
+}
+
+void ImageHashPipeline::hashJob(SHashJob* job)
+{
+	sha256_ctx shactx;
+	sha256_init(&shactx);
+
+	size_t idx = 0;
+	for (int64 j = job->vhd_start; j < job->nextblock; ++j)
+	{
+		if (idx < job->blocks.size()
+			&& job->blocks[idx] == j)
+		{
+			sha256_update(&shactx, reinterpret_cast<unsigned char*>(job->bufs[idx]) + buf_offset, blocksize);
+			++idx;
+		}
+		else
+		{
+			sha256_update(&shactx, &zeroblockbuf[0], blocksize);
+		}
+	}
+
+	sha256_final(&shactx, job->digest);
+}
+
+ImageHashPipeline::HashWorker::HashWorker(ImageHashPipeline* pipeline)
+	: pipeline(pipeline)
+{
+}
+
+void ImageHashPipeline::HashWorker::operator()()
+{
+	while (true)
+	{
+		SHashJob* job;
+		{
+			IScopedLock lock(pipeline->mutex);
+			while (pipeline->pending.empty()
+				&& !pipeline->do_exit)
+			{
+				pipeline->cond->wait(&lock);
+			}
+
+			if (pipeline->pending.empty())
+			{
+				return;
+			}
+
+			job = pipeline->pending.front();
+			pipeline->pending.pop_front();
+		}
+
+		int64 starttime = Server->getTimeMS();
+		pipeline->hashJob(job);
+		int64 passed_time = Server->getTimeMS() - starttime;
+
+		IScopedLock lock(pipeline->mutex);
+		job->done = true;
+		pipeline->hash_time_ms += passed_time;
+		pipeline->cond->notify_all();
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../urbackupcommon/sha2/sha2.h"
+#include <vector>
+#include <deque>
+
+/**
+* Hashes the VHD blocks of a full image backup on a pool of worker threads
+* while ImageThread keeps reading. Jobs are returned in the order they were
+* added, so the data of a VHD block and its checksum are sent in the same
+* order as without the pipeline. Incremental (CBT) images are still hashed
+* serially by ImageThread.
+*/
+class ImageHashPipeline
+{
+public:
+	struct SHashJob
+	{
+		int64 vhd_start;
+		int64 nextblock;
+		std::vector<char*> bufs;
+		std::vector<int64> blocks;
+		bool done;
+		unsigned char digest[SHA256_DIGEST_SIZE];
+	};
+
+	ImageHashPipeline(unsigned int blocksize, size_t buf_offset, size_t nthreads, size_t max_jobs);
+	~ImageHashPipeline();
+
+	void addJob(SHashJob* job);
+
+	//Returns the oldest job once it is hashed or NULL if it isn't (and wait is false)
+	SHashJob* getFinishedJob(bool wait);
+
+	size_t numJobs();
+	size_t getMaxJobs();
+	size_t getNumThreads();
+
+	int64 getHashTimeMs();
+	int64 getWaitTimeMs();
+
+private:
+	class HashWorker : public IThread
+	{
+	public:
+		HashWorker(ImageHashPipeline* pipeline);
+		virtual ~HashWorker() {}
+		void operator()();
+
+	private:
+		ImageHashPipeline* pipeline;
+	};
+
+	void hashJob(SHashJob* job);
+
+	unsigned int blocksize;
+	size_t buf_offset;
+	size_t max_jobs;
+	std::vector<unsigned char> zeroblockbuf;
+
+	IMutex* mutex;
+	ICondition* cond;
+	std::deque<SHashJob*> jobs;
+	std::deque<SHashJob*> pending;
+	bool do_exit;
+
+	int64 hash_time_ms;
+	int64 wait_time_ms;
+
+	std::vector<HashWorker*> workers;
+	std::vector<THREADPOOL_TICKET> worker_tickets;
+};
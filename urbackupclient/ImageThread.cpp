@@ -30,6 +30,7 @@
 #include "ClientService.h"
 #include "ImageThread.h"
 #include "ClientSend.h"
+#include "ImageHashPipeline.h"
 #include "client.h"
 
 #include <memory.h>
@@ -303,21 +304,50 @@ bool ImageThread::sendFullImageThread(void)
 				}
 			}
 			
-			clientSend=new ClientSend(pipe, blocksize+sizeof(int64), 2000);
+			const unsigned int num_send_bufs=2000;
+			clientSend=new ClientSend(pipe, blocksize+sizeof(int64), num_send_bufs);
 			THREADPOOL_TICKET send_ticket=Server->getThreadPool()->execute(clientSend, "full image transfer");
 
+			std::auto_ptr<ImageHashPipeline> hash_pipeline;
+			ImageHashPipeline::SHashJob* curr_hash_job=NULL;
+			if(with_checksum)
+			{
+				size_t hash_threads = watoi(Server->getServerParameter("image_hash_threads", "0"));
+				if(hash_threads==0)
+				{
+					size_t num_cpus = os_get_num_cpus();
+					hash_threads = num_cpus>2 ? (std::min)(num_cpus-1, static_cast<size_t>(8)) : 1;
+				}
+				//Every VHD block in the pipeline holds its send buffers until it is hashed.
+				//Leave enough for the current VHD block, a read batch and the checksum buffer
+				size_t max_hash_jobs = (num_send_bufs-64-1)/vhdblocks;
+				max_hash_jobs = max_hash_jobs>0 ? (std::min)(max_hash_jobs-1, hash_threads*2) : 0;
+				if(hash_threads>1 && max_hash_jobs>=2)
+				{
+					hash_pipeline.reset(new ImageHashPipeline(blocksize, sizeof(int64), hash_threads, max_hash_jobs));
+				}
+			}
+
+			int64 transfer_starttime=Server->getTimeMS();
+			int64 read_time_ms=0;
+			int64 send_wait_time_ms=0;
+
 			unsigned int needed_bufs=64;
 			int64 last_hash_block=-1;
 			std::vector<char*> bufs;
 			int64 startpos = image_inf->startpos < 0 ? 0 : image_inf->startpos;
 			for(int64 i=startpos,blocks=drivesize/blocksize;i<blocks;i+=64)
 			{
+				int64 stage_starttime=Server->getTimeMS();
 				std::vector<char*> n_bufs= clientSend->getBuffers(needed_bufs);
 				bufs.insert(bufs.end(), n_bufs.begin(), n_bufs.end() );
 				needed_bufs=0;
+				send_wait_time_ms+=Server->getTimeMS()-stage_starttime;
 
+				stage_starttime=Server->getTimeMS();
 				unsigned int n=(unsigned int)(std::min)(blocks-i, (int64)64);
 				std::vector<int64> secs=fs->readBlocks(i, n, bufs, sizeof(int64));
+				read_time_ms+=Server->getTimeMS()-stage_starttime;
 				if(fs->hasError())
 				{
 					ImageErrRunning("Error while reading from shadow copy device (1). "+getFsErrMsg());
@@ -327,7 +357,52 @@ bool ImageThread::sendFullImageThread(void)
 				}
 				needed_bufs+=(_u32)secs.size();
 				bool notify_cs=false;
-				if(with_checksum)
+				if(hash_pipeline.get()!=NULL)
+				{
+					size_t idx=0;
+					size_t n_secs=secs.size();
+					for(int64 j=i;j<i+64 && j<blocks;++j)
+					{
+						if(idx<n_secs && secs[idx]==j)
+						{
+							if(curr_hash_job==NULL)
+							{
+								curr_hash_job=new ImageHashPipeline::SHashJob;
+								curr_hash_job->vhd_start=(j/vhdblocks)*vhdblocks;
+							}
+
+							memcpy(bufs[idx], &secs[idx], sizeof(int64) );
+							curr_hash_job->bufs.push_back(bufs[idx]);
+							curr_hash_job->blocks.push_back(j);
+							++idx;
+							last_hash_block=j;
+						}
+
+						if( (j+1)%vhdblocks==0 || j+1==blocks )
+						{
+							if(last_hash_block>=j+1-vhdblocks )
+							{
+								if(curr_hash_job==NULL)
+								{
+									//Same zero blocks as the serial hashing hashes after the previous VHD block
+									curr_hash_job=new ImageHashPipeline::SHashJob;
+									curr_hash_job->vhd_start=last_hash_block+1;
+								}
+								curr_hash_job->nextblock=j+1;
+								hash_pipeline->addJob(curr_hash_job);
+								curr_hash_job=NULL;
+							}
+						}
+					}
+
+					ImageHashPipeline::SHashJob* hash_job;
+					while((hash_job=hash_pipeline->getFinishedJob(hash_pipeline->numJobs()>=hash_pipeline->getMaxJobs()))!=NULL)
+					{
+						sendHashJob(hash_job, blocksize, vhdblocks, hdat_img, hdat_vol, r_shadow_id);
+						notify_cs=true;
+					}
+				}
+				else if(with_checksum)
 				{
 					size_t idx=0;
 					size_t n_secs=secs.size();
@@ -425,6 +500,46 @@ bool ImageThread::sendFullImageThread(void)
 				}
 			}
 
+			if(hash_pipeline.get()!=NULL)
+			{
+				if(curr_hash_job!=NULL)
+				{
+					bufs.insert(bufs.end(), curr_hash_job->bufs.begin(), curr_hash_job->bufs.end());
+					delete curr_hash_job;
+				}
+
+				ImageHashPipeline::SHashJob* hash_job;
+				while((hash_job=hash_pipeline->getFinishedJob(true))!=NULL)
+				{
+					if(run)
+					{
+						sendHashJob(hash_job, blocksize, vhdblocks, hdat_img, hdat_vol, r_shadow_id);
+					}
+					else
+					{
+						bufs.insert(bufs.end(), hash_job->bufs.begin(), hash_job->bufs.end());
+						delete hash_job;
+					}
+				}
+				clientSend->notifySendBuffer();
+			}
+
+			int64 transfer_time_ms=Server->getTimeMS()-transfer_starttime;
+			std::string stage_stats="Image transfer of "+PrettyPrintBytes(ncurrblocks*blocksize)+" took "+PrettyPrintTime(transfer_time_ms)
+				+". Reading: "+PrettyPrintSpeed(static_cast<size_t>((ncurrblocks*blocksize*1000)/(std::max)(read_time_ms, (int64)1)))
+				+" ("+PrettyPrintTime(read_time_ms)+")";
+			if(hash_pipeline.get()!=NULL)
+			{
+				int64 hash_time_ms=hash_pipeline->getHashTimeMs();
+				stage_stats+=", hashing with "+convert(hash_pipeline->getNumThreads())+" threads: "
+					+PrettyPrintSpeed(static_cast<size_t>((ncurrblocks*blocksize*1000)/(std::max)(hash_time_ms, (int64)1)))
+					+" per thread, waited "+PrettyPrintTime(hash_pipeline->getWaitTimeMs())+" for hashes";
+			}
+			stage_stats+=", waited "+PrettyPrintTime(send_wait_time_ms)+" for send buffers";
+			Server->Log(stage_stats, LL_INFO);
+
+			hash_pipeline.reset();
+
 			for(size_t i=0;i<bufs.size();++i)
 			{
 				clientSend->freeBuffer(bufs[i]);
@@ -483,6 +598,34 @@ bool ImageThread::sendFullImageThread(void)
 	return success;
 }
 
+void ImageThread::sendHashJob(ImageHashPipeline::SHashJob* job, unsigned int blocksize, unsigned int vhdblocks,
+	std::auto_ptr<IFile>& hdat_img, const std::string& hdat_vol, int r_shadow_id)
+{
+	for(size_t k=0;k<job->bufs.size();++k)
+	{
+		clientSend->sendBuffer(job->bufs[k], sizeof(int64)+blocksize, false);
+	}
+
+	char* cb=clientSend->getBuffer();
+	int64 bs=-126;
+	memcpy(cb, &bs, sizeof(int64) );
+	memcpy(cb+sizeof(int64), &job->nextblock, sizeof(int64));
+	memcpy(cb+2*sizeof(int64), job->digest, c_hashsize);
+	clientSend->sendBuffer(cb, 2*sizeof(int64)+c_hashsize, false);
+
+	if (hdat_img.get() != NULL
+		&& IndexThread::getShadowId(hdat_vol, hdat_img.get())==r_shadow_id)
+	{
+		hdat_img->Write(sizeof(int) + ((job->nextblock-1) / vhdblocks)*c_hashsize, reinterpret_cast<char*>(job->digest), c_hashsize);
+	}
+	else
+	{
+		hdat_img.reset();
+	}
+
+	delete job;
+}
+
 void ImageThread::removeShadowCopyThread(int save_id)
 {
 	if(!image_inf->no_shadowcopy)
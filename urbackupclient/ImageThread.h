@@ -7,6 +7,8 @@
 #include "../Interface/Server.h"
 #include "../fsimageplugin/IFilesystem.h"
 #include "../common/bitmap.h"
+#include "ImageHashPipeline.h"
+#include <memory>
 
 class ClientConnector;
 struct ImageInformation;
@@ -37,6 +39,8 @@ private:
 	void createShadowData(str_map& other_vols, CWData& shadow_data);
 
 	bool sendFullImageThread(void);
+	void sendHashJob(ImageHashPipeline::SHashJob* job, unsigned int blocksize, unsigned int vhdblocks,
+		std::auto_ptr<IFile>& hdat_img, const std::string& hdat_vol, int r_shadow_id);
 	bool sendIncrImageThread(void);
 
 	void removeShadowCopyThread(int save_id);
@@ -2,6 +2,7 @@
 #include "../Interface/Server.h"
 #include "../Interface/ThreadPool.h"
 #include "ClientHash.h"
+#include "FileHashCache.h"
 #include <algorithm>
 #include "database.h"
 #include "../stringtools.h"
@@ -269,12 +270,34 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 		return false;
 	}
 
+	int64 filesize;
+	int64 change_indicator;
+	if (!data.getVarInt(&filesize)
+		|| !data.getVarInt(&change_indicator))
+	{
+		return false;
+	}
+
 	std::string full_path = curr_snapshot_dir + os_file_sep() + fn;
+	std::string orig_path = curr_dir + os_file_sep() + fn;
 
-	std::auto_ptr<IFsFile>  f(Server->openFile(os_file_prefix(full_path), MODE_READ_SEQUENTIAL_BACKUP));
+	FileHashCache* file_hash_cache = FileHashCache::getInstance();
 
 	SFileAndHash fandhash;
-	if (f.get() != NULL && f->Size() < link_file_min_size)
+	bool cached = filesize >= link_file_min_size
+		&& file_hash_cache != NULL
+		&& file_hash_cache->get(orig_path, filesize, change_indicator, sha_version, fandhash.hash);
+
+	std::auto_ptr<IFsFile> f;
+	if (!cached)
+	{
+		f.reset(Server->openFile(os_file_prefix(full_path), MODE_READ_SEQUENTIAL_BACKUP));
+	}
+
+	int64 curr_filesize = f.get() != NULL ? f->Size() : -1;
+
+	if (cached
+		|| (f.get() != NULL && f->Size() < link_file_min_size) )
 	{
 		f.reset();
 	}
@@ -333,6 +356,13 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 		}
 	}
 
+	if (!cached
+		&& file_hash_cache != NULL
+		&& curr_filesize == filesize)
+	{
+		file_hash_cache->put(orig_path, filesize, change_indicator, sha_version, fandhash.hash);
+	}
+
 	CWData wdata;
 	wdata.addUShort(0);
 	wdata.addChar(1);
@@ -31,10 +31,11 @@ namespace
 }
 
 RestoreDownloadThread::RestoreDownloadThread( FileClient& fc, FileClientChunked& fc_chunked, const std::string& client_token, str_map& metadata_path_mapping,
-	RestoreFiles& restore_files)
+	RestoreFiles& restore_files, IMutex* rename_mutex)
 	: fc(fc), fc_chunked(fc_chunked), queue_size(0), all_downloads_ok(true),
 	mutex(Server->createMutex()), cond(Server->createCondition()), skipping(false), is_offline(false),
-	client_token(client_token), metadata_path_mapping(metadata_path_mapping), restore_files(restore_files)
+	client_token(client_token), metadata_path_mapping(metadata_path_mapping), restore_files(restore_files),
+	rename_mutex(rename_mutex), local_copy_bytes(0)
 {
 
 }
@@ -121,7 +122,10 @@ void RestoreDownloadThread::operator()()
 			is_offline=true;
 		}
 	}
+}
 
+void RestoreDownloadThread::informMetadataStreamEnd()
+{
 	if(!is_offline && !skipping)
 	{
 		_u32 rc = fc.InformMetadataStreamEnd(client_token, 3);
@@ -134,7 +138,8 @@ void RestoreDownloadThread::operator()()
 }
 
 void RestoreDownloadThread::addToQueueFull( size_t id, const std::string &remotefn, const std::string &destfn,
-    _i64 predicted_filesize, const FileMetadata& metadata, bool is_script, bool metadata_only, size_t folder_items, IFsFile* orig_file)
+    _i64 predicted_filesize, const FileMetadata& metadata, bool is_script, bool metadata_only, size_t folder_items, IFsFile* orig_file,
+	const std::string& local_copy_hash_key, const std::string& local_copy_hash)
 {
 	SQueueItem ni;
 	ni.id = id;
@@ -150,6 +155,8 @@ void RestoreDownloadThread::addToQueueFull( size_t id, const std::string &remote
 	ni.metadata_only = metadata_only;
 	ni.folder_items = folder_items;
 	ni.patch_dl_files.orig_file = orig_file;
+	ni.local_copy_hash_key = local_copy_hash_key;
+	ni.local_copy_hash = local_copy_hash;
 
 	IScopedLock lock(mutex.get());
 	dl_queue.push_back(ni);
@@ -228,7 +235,7 @@ bool RestoreDownloadThread::load_file( SQueueItem todl )
 				todl.destfn=old_destfn+"_"+convert(idx);
 				++idx;
 
-				IScopedLock lock(mutex.get());
+				IScopedLock lock(rename_mutex);
 				dest_f.reset(Server->openFile(os_file_prefix(todl.destfn), MODE_WRITE));
 
 				if (dest_f.get() != NULL)
@@ -239,6 +246,7 @@ bool RestoreDownloadThread::load_file( SQueueItem todl )
 
 			if (dest_f.get() != NULL)
 			{
+				IScopedLock lock(rename_mutex);
 				rename_queue.push_back(std::make_pair(todl.destfn, old_destfn));
 				metadata_path_mapping[old_destfn] = todl.destfn;
 			}
@@ -256,6 +264,18 @@ bool RestoreDownloadThread::load_file( SQueueItem todl )
 			download_nok_ids.push_back(todl.id);
 			return false;
 		}
+
+		if (!todl.local_copy_hash.empty()
+			&& restore_files.restoreFromLocalCopy(todl.local_copy_hash_key, todl.local_copy_hash,
+				todl.predicted_filesize, todl.destfn, dest_f.get()))
+		{
+			//Only the metadata still has to be downloaded
+			dest_f.reset();
+			todl.metadata_only = true;
+
+			IScopedLock lock(mutex.get());
+			local_copy_bytes += todl.predicted_filesize;
+		}
 	}
 
 	_u32 rc = fc.GetFile(todl.remotefn, dest_f.get(), true, todl.metadata_only, todl.folder_items, false, todl.id+1);
@@ -362,6 +382,13 @@ std::string RestoreDownloadThread::getQueuedFileFull( FileClient::MetadataQueue&
 		if(it->action==EQueueAction_Fileclient && 
 			!it->queued && it->fileclient==EFileClient_Full)
 		{
+			if(!it->local_copy_hash.empty())
+			{
+				//Whether the data has to be downloaded is only known once the
+				//local copy was tried in load_file(), so stop pipelining here
+				return std::string();
+			}
+
 			it->queued=true;
 			if(it->metadata_only)
 			{
@@ -473,6 +500,24 @@ bool RestoreDownloadThread::hasError()
     return !download_nok_ids.empty();
 }
 
+bool RestoreDownloadThread::isOnline()
+{
+	IScopedLock lock(mutex.get());
+	return !is_offline && !skipping;
+}
+
+size_t RestoreDownloadThread::getQueueSize()
+{
+	IScopedLock lock(mutex.get());
+	return queue_size;
+}
+
+int64 RestoreDownloadThread::getLocalCopyBytes()
+{
+	IScopedLock lock(mutex.get());
+	return local_copy_bytes;
+}
+
 void RestoreDownloadThread::log(const std::string & msg, int loglevel)
 {
 	restore_files.log(msg, loglevel);
@@ -490,12 +535,171 @@ void RestoreDownloadThread::sleepQueue(IScopedLock& lock)
 
 std::vector<std::pair<std::string, std::string> > RestoreDownloadThread::getRenameQueue()
 {
+	IScopedLock lock(rename_mutex);
 	return rename_queue;
 }
 
 bool RestoreDownloadThread::isRenamedFile(const std::string & fn)
 {
-	IScopedLock lock(mutex.get());
+	IScopedLock lock(rename_mutex);
 	return renamed_files.find(fn) != renamed_files.end();
 }
 
+RestoreDownloadPool::RestoreDownloadPool(const std::string& client_token, str_map& metadata_path_mapping,
+	RestoreFiles& restore_files)
+	: client_token(client_token), metadata_path_mapping(metadata_path_mapping),
+	restore_files(restore_files), rename_mutex(Server->createMutex())
+{
+}
+
+RestoreDownloadPool::~RestoreDownloadPool()
+{
+	for(size_t i=0;i<workers.size();++i)
+	{
+		delete workers[i].thread;
+		delete workers[i].fc_chunked;
+		if(workers[i].owns_fc)
+		{
+			delete workers[i].fc;
+		}
+	}
+}
+
+void RestoreDownloadPool::startWorker(FileClient* fc, bool owns_fc, FileClientChunked* fc_chunked)
+{
+	SWorker worker;
+	worker.fc = fc;
+	worker.owns_fc = owns_fc;
+	worker.fc_chunked = fc_chunked;
+	worker.thread = new RestoreDownloadThread(*fc, *fc_chunked, client_token,
+		metadata_path_mapping, restore_files, rename_mutex.get());
+	worker.ticket = Server->getThreadPool()->execute(worker.thread, "file restore download");
+	workers.push_back(worker);
+}
+
+size_t RestoreDownloadPool::numWorkers()
+{
+	return workers.size();
+}
+
+RestoreDownloadThread* RestoreDownloadPool::getMetadataWorker()
+{
+	return workers[0].thread;
+}
+
+RestoreDownloadThread* RestoreDownloadPool::getDataWorker()
+{
+	size_t min_idx = 0;
+	size_t min_queue_size = std::string::npos;
+	for(size_t i=0;i<workers.size();++i)
+	{
+		size_t curr_queue_size = workers[i].thread->getQueueSize();
+		if(curr_queue_size<min_queue_size)
+		{
+			min_queue_size = curr_queue_size;
+			min_idx = i;
+		}
+	}
+	return workers[min_idx].thread;
+}
+
+void RestoreDownloadPool::queueStop()
+{
+	for(size_t i=0;i<workers.size();++i)
+	{
+		workers[i].thread->queueStop();
+	}
+}
+
+bool RestoreDownloadPool::waitForWorkers(int timeoutms)
+{
+	std::vector<THREADPOOL_TICKET> tickets;
+	for(size_t i=0;i<workers.size();++i)
+	{
+		tickets.push_back(workers[i].ticket);
+	}
+	return Server->getThreadPool()->waitFor(tickets, timeoutms);
+}
+
+void RestoreDownloadPool::informMetadataStreamEnd()
+{
+	//The metadata stream is shared by all connections. It may only be
+	//ended once every worker is done
+	for(size_t i=0;i<workers.size();++i)
+	{
+		if(!workers[i].thread->isOnline())
+		{
+			return;
+		}
+	}
+
+	workers[0].thread->informMetadataStreamEnd();
+}
+
+bool RestoreDownloadPool::hasError()
+{
+	for(size_t i=0;i<workers.size();++i)
+	{
+		if(workers[i].thread->hasError())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<std::pair<std::string, std::string> > RestoreDownloadPool::getRenameQueue()
+{
+	std::vector<std::pair<std::string, std::string> > ret;
+	for(size_t i=0;i<workers.size();++i)
+	{
+		std::vector<std::pair<std::string, std::string> > curr = workers[i].thread->getRenameQueue();
+		ret.insert(ret.end(), curr.begin(), curr.end());
+	}
+	return ret;
+}
+
+bool RestoreDownloadPool::isRenamedFile(const std::string& fn)
+{
+	for(size_t i=0;i<workers.size();++i)
+	{
+		if(workers[i].thread->isRenamedFile(fn))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int64 RestoreDownloadPool::getReceivedDataBytes(bool with_sparse)
+{
+	int64 ret = 0;
+	for(size_t i=0;i<workers.size();++i)
+	{
+		ret += workers[i].fc->getReceivedDataBytes(with_sparse)
+			+ workers[i].fc_chunked->getReceivedDataBytes(with_sparse);
+	}
+	return ret;
+}
+
+int64 RestoreDownloadPool::getLocalCopyBytes()
+{
+	int64 ret = 0;
+	for(size_t i=0;i<workers.size();++i)
+	{
+		ret += workers[i].thread->getLocalCopyBytes();
+	}
+	return ret;
+}
+
+int64 RestoreDownloadPool::getTransferredBytes()
+{
+	int64 ret = 0;
+	for(size_t i=0;i<workers.size();++i)
+	{
+		ret += workers[i].fc->getTransferredBytes()
+			+ workers[i].fc_chunked->getTransferredBytes();
+	}
+	return ret;
+}
+
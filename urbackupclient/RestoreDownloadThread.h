@@ -1,5 +1,6 @@
 #pragma once
 #include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
 #include "../urbackupcommon/fileclient/FileClient.h"
 #include "../urbackupcommon/fileclient/FileClientChunked.h"
 #include "../Interface/Mutex.h"
@@ -53,6 +54,8 @@ namespace
 		FileMetadata metadata;
 		bool is_script;
 		size_t folder_items;
+		std::string local_copy_hash_key;
+		std::string local_copy_hash;
 	};
 }
 
@@ -62,12 +65,15 @@ class RestoreDownloadThread : public IThread, public FileClient::QueueCallback,
 {
 public:
 	RestoreDownloadThread(FileClient& fc, FileClientChunked& fc_chunked, const std::string& client_token, str_map& metadata_path_mapping,
-		RestoreFiles& restore_files);
+		RestoreFiles& restore_files, IMutex* rename_mutex);
+	virtual ~RestoreDownloadThread() {}
 
 	void operator()();
 
+	//If local_copy_hash is set, a local file with that hash is copied instead of downloading the file if possible
 	void addToQueueFull(size_t id, const std::string &remotefn, const std::string &destfn,
-        _i64 predicted_filesize, const FileMetadata& metadata, bool is_script, bool metadata_only, size_t folder_items, IFsFile* orig_file);
+        _i64 predicted_filesize, const FileMetadata& metadata, bool is_script, bool metadata_only, size_t folder_items, IFsFile* orig_file,
+		const std::string& local_copy_hash_key = std::string(), const std::string& local_copy_hash = std::string());
 
 	void addToQueueChunked(size_t id, const std::string &remotefn, const std::string &destfn,
 		_i64 predicted_filesize, const FileMetadata& metadata, bool is_script, IFsFile* orig_file, IFile* chunkhashes);
@@ -94,10 +100,18 @@ public:
 
     bool hasError();
 
+	bool isOnline();
+
+	size_t getQueueSize();
+
+	void informMetadataStreamEnd();
+
 	std::vector<std::pair<std::string, std::string> > getRenameQueue();
 
 	bool isRenamedFile(const std::string& fn);
 
+	int64 getLocalCopyBytes();
+
 private:
 
 	void log(const std::string& msg, int loglevel);
@@ -125,4 +139,59 @@ private:
 	str_map& metadata_path_mapping;
 	std::set<std::string> renamed_files;
 	RestoreFiles& restore_files;
+	IMutex* rename_mutex;
+	int64 local_copy_bytes;
+};
+
+class RestoreDownloadPool
+{
+public:
+	RestoreDownloadPool(const std::string& client_token, str_map& metadata_path_mapping,
+		RestoreFiles& restore_files);
+	~RestoreDownloadPool();
+
+	void startWorker(FileClient* fc, bool owns_fc, FileClientChunked* fc_chunked);
+
+	size_t numWorkers();
+
+	//Directory and metadata only items are always restored by the first worker
+	RestoreDownloadThread* getMetadataWorker();
+
+	//Worker with the least queued work
+	RestoreDownloadThread* getDataWorker();
+
+	void queueStop();
+
+	bool waitForWorkers(int timeoutms);
+
+	void informMetadataStreamEnd();
+
+	bool hasError();
+
+	std::vector<std::pair<std::string, std::string> > getRenameQueue();
+
+	bool isRenamedFile(const std::string& fn);
+
+	int64 getReceivedDataBytes(bool with_sparse);
+
+	int64 getTransferredBytes();
+
+	int64 getLocalCopyBytes();
+
+private:
+	struct SWorker
+	{
+		FileClient* fc;
+		bool owns_fc;
+		FileClientChunked* fc_chunked;
+		RestoreDownloadThread* thread;
+		THREADPOOL_TICKET ticket;
+	};
+
+	std::vector<SWorker> workers;
+
+	const std::string& client_token;
+	str_map& metadata_path_mapping;
+	RestoreFiles& restore_files;
+	std::auto_ptr<IMutex> rename_mutex;
 };
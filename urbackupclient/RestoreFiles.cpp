@@ -47,6 +47,12 @@ namespace
 	const int64 restore_flag_open_all_files_first = 1 << 4;
 	const int64 restore_flag_reboot_overwrite_all = 1 << 5;
 	const int64 restore_flag_ignore_permissions = 1 << 6;
+	const int64 restore_flag_local_reuse = 1 << 7;
+
+	//Smaller files are downloaded. Looking for local copies scans the whole files table,
+	//so it is only done if the files that could be reused are large enough in total
+	const int64 local_reuse_min_filesize = 1024 * 1024;
+	const int64 local_reuse_min_total_size = 64 * 1024 * 1024;
 
 	class RestoreUpdaterThread : public IThread
 	{
@@ -341,6 +347,13 @@ void RestoreFiles::operator()()
 			return;
 		}
 
+		if ( (restore_flags & restore_flag_local_reuse)
+			|| Server->getServerParameter("restore_local_reuse")=="true")
+		{
+			log("Searching for local copies of files to restore...", LL_INFO);
+			buildLocalHashIndex();
+		}
+
 		FileClient fc_metadata(false, client_token, 3,
 			true, this, NULL);
 
@@ -559,6 +572,179 @@ int64 RestoreFiles::calculateDownloadSize()
 	return total_size;
 }
 
+void RestoreFiles::buildLocalHashIndex()
+{
+	std::vector<char> buffer;
+	buffer.resize(32768);
+
+	FileListParser filelist_parser;
+
+	_u32 read;
+	SFile data;
+	std::map<std::string, std::string> extra;
+
+	std::set<std::string> wanted_hashes;
+	int64 wanted_size = 0;
+
+	filelist->Seek(0);
+
+	do
+	{
+		read = filelist->Read(buffer.data(), static_cast<_u32>(buffer.size()));
+
+		for (_u32 i = 0; i<read; ++i)
+		{
+			if (filelist_parser.nextEntry(buffer[i], data, &extra))
+			{
+				if (data.isdir || data.size < local_reuse_min_filesize)
+				{
+					continue;
+				}
+
+				std::map<std::string, std::string>::iterator it = extra.find("shahash");
+				if (it == extra.end())
+				{
+					it = extra.find("thash");
+				}
+
+				if (it != extra.end()
+					&& wanted_hashes.insert(base64_decode_dash(it->second)).second)
+				{
+					wanted_size += data.size;
+				}
+			}
+		}
+	} while (read>0);
+
+	if (wanted_size < local_reuse_min_total_size)
+	{
+		log("Not searching for local copies. Only " + PrettyPrintBytes(wanted_size) + " in files large enough to be reused", LL_DEBUG);
+		return;
+	}
+
+	ClientDAO client_dao(db);
+	client_dao.getFilesByHash(wanted_hashes, 4, local_hash_files);
+
+	log("Found local copies for " + convert(local_hash_files.size()) + " of " + convert(wanted_hashes.size()) + " distinct files to restore", LL_DEBUG);
+}
+
+//Returns the content hash of a file to restore if there are local files with the same hash
+bool RestoreFiles::getLocalCopyHash(std::map<std::string, std::string>& extra, std::string& hash_key, std::string& hash)
+{
+	hash_key = "shahash";
+	if (extra.find(hash_key) == extra.end())
+	{
+		hash_key = "thash";
+		if (extra.find(hash_key) == extra.end())
+		{
+			return false;
+		}
+	}
+
+	hash = base64_decode_dash(extra[hash_key]);
+
+	return local_hash_files.find(hash) != local_hash_files.end();
+}
+
+//Copies a local file with the same content hash into dest_file instead of downloading it.
+//The hash is calculated while copying, so files modified since indexing are detected
+bool RestoreFiles::restoreFromLocalCopy(const std::string& hash_key, const std::string& hash, int64 size, const std::string& local_fn, IFsFile* dest_file)
+{
+	std::map<std::string, std::vector<std::string> >::const_iterator it = local_hash_files.find(hash);
+	if (it == local_hash_files.end())
+	{
+		return false;
+	}
+
+	std::vector<char> buffer;
+
+	for (size_t i = 0; i < it->second.size(); ++i)
+	{
+		const std::string& src_fn = it->second[i];
+
+		if (src_fn == local_fn)
+		{
+			continue;
+		}
+
+		std::auto_ptr<IFile> src_file(Server->openFile(os_file_prefix(src_fn), MODE_READ_SEQUENTIAL));
+		if (src_file.get() == NULL
+			|| src_file->Size() != size)
+		{
+			continue;
+		}
+
+		std::auto_ptr<IHashFunc> hashf;
+		if (hash_key == "shahash")
+		{
+			hashf.reset(new HashSha512);
+		}
+		else
+		{
+			hashf.reset(new TreeHash(NULL));
+		}
+
+		buffer.resize(32768);
+
+		if (!dest_file->Seek(0))
+		{
+			return false;
+		}
+
+		int64 copied = 0;
+		bool copy_ok = true;
+		while (copied < size && copy_ok)
+		{
+			_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(buffer.size()), size - copied));
+			bool has_read_error = false;
+			_u32 r = src_file->Read(buffer.data(), toread, &has_read_error);
+
+			if (r == 0 || has_read_error)
+			{
+				copy_ok = false;
+				break;
+			}
+
+			hashf->hash(buffer.data(), r);
+
+			_u32 written = 0;
+			while (written < r)
+			{
+				_u32 w = dest_file->Write(buffer.data() + written, r - written);
+				if (w == 0)
+				{
+					log("Error writing to \"" + local_fn + "\" while copying from \"" + src_fn + "\". " + os_last_error_str(), LL_WARNING);
+					dest_file->Resize(0);
+					dest_file->Seek(0);
+					return false;
+				}
+				written += w;
+			}
+
+			copied += r;
+		}
+
+		if (copy_ok
+			&& hashf->finalize() == hash)
+		{
+			if (dest_file->Size() > size)
+			{
+				dest_file->Resize(size);
+			}
+
+			log("Restored \"" + local_fn + "\" from local file \"" + src_fn + "\"", LL_DEBUG);
+			return true;
+		}
+
+		log("Local file \"" + src_fn + "\" changed since indexing. Not using it to restore \"" + local_fn + "\"", LL_DEBUG);
+	}
+
+	dest_file->Resize(0);
+	dest_file->Seek(0);
+
+	return false;
+}
+
 bool RestoreFiles::openFiles(std::map<std::string, IFsFile*>& open_files, bool& overwrite_failure)
 {
 	std::vector<char> buffer;
@@ -967,6 +1153,8 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 
 	fc_chunked->setProgressLogCallback(this);
 
+	int download_threads = atoi(Server->getServerParameter("restore_download_threads", "4").c_str());
+
 	_u32 read;
 	SFile data;
 	std::map<std::string, std::string> extra;
@@ -978,8 +1166,38 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 	std::string share_path;
 	std::string server_path = "clientdl";
 
-	std::auto_ptr<RestoreDownloadThread> restore_download(new RestoreDownloadThread(fc, *fc_chunked, client_token, metadata_path_mapping, *this));
-    THREADPOOL_TICKET restore_download_ticket = Server->getThreadPool()->execute(restore_download.get(), "file restore download");
+	std::auto_ptr<RestoreDownloadPool> restore_download(new RestoreDownloadPool(client_token, metadata_path_mapping, *this));
+	restore_download->startWorker(&fc, false, fc_chunked.release());
+
+	for (int i = 1; i < download_threads; ++i)
+	{
+		std::auto_ptr<FileClient> fc_worker(new FileClient(false, client_token, 3,
+			true, this, NULL));
+
+		if (!connectFileClient(*fc_worker))
+		{
+			log("Connecting additional file restore download connection failed. Continuing with "+convert(restore_download->numWorkers())+" connections", LL_WARNING);
+			break;
+		}
+
+		std::auto_ptr<FileClientChunked> fc_chunked_worker = createFcChunked();
+
+		if (fc_chunked_worker.get() == NULL)
+		{
+			log("Connecting additional chunked file restore download connection failed. Continuing with " + convert(restore_download->numWorkers()) + " connections", LL_WARNING);
+			break;
+		}
+
+		fc_worker->setProgressLogCallback(this);
+		fc_chunked_worker->setProgressLogCallback(this);
+
+		restore_download->startWorker(fc_worker.release(), true, fc_chunked_worker.release());
+	}
+
+	if (restore_download->numWorkers() > 1)
+	{
+		log("Restoring files using " + convert(restore_download->numWorkers()) + " parallel connections", LL_DEBUG);
+	}
 
 	std::string curr_files_dir;
 	std::vector<SFileAndHash> curr_files;
@@ -992,6 +1210,8 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 
 	int64 laststatsupdate=Server->getTimeMS();
 	int64 skipped_bytes = 0;
+	std::string local_copy_hash_key;
+	std::string local_copy_hash;
 	int db_tgroup = 0;
 
 	std::vector<size_t> folder_items;
@@ -1127,12 +1347,12 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 					}
 					else
 					{
-						int64 done_bytes = fc.getReceivedDataBytes(true) + fc_chunked->getReceivedDataBytes(true) + skipped_bytes;
+						int64 done_bytes = restore_download->getReceivedDataBytes(true) + restore_download->getLocalCopyBytes() + skipped_bytes;
 						int pcdone = (std::min)(100,(int)(((float)done_bytes)/((float)total_size/100.f)+0.5f));
 						restore_updater.update_pc(pcdone, total_size, done_bytes);
 					}
 
-					calculateDownloadSpeed(fc, fc_chunked.get());
+					calculateDownloadSpeed(*restore_download);
 				}
 
 				if(!data.isdir || data.name!="..")
@@ -1325,7 +1545,7 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 					{
 						--depth;			
 
-                        restore_download->addToQueueFull(line, server_path, restore_path, 0,
+                        restore_download->getMetadataWorker()->addToQueueFull(line, server_path, restore_path, 0,
                             metadata, false, true, folder_items.back(), NULL);
 
 						server_path = ExtractFilePath(server_path, "/");
@@ -1600,7 +1820,7 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 
 							orig_file.reset();
 
-							restore_download->addToQueueFull(line, server_fn, local_fn,
+							restore_download->getMetadataWorker()->addToQueueFull(line, server_fn, local_fn,
 								data.size, metadata, false, true, 0, NULL);
 						}
 						else
@@ -1684,14 +1904,14 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
                                     }
 
 									IFsFile* r_orig_file = orig_file.release();
-									restore_download->addToQueueChunked(line, server_fn, local_fn, 
+									restore_download->getDataWorker()->addToQueueChunked(line, server_fn, local_fn, 
 										data.size, metadata, false, r_orig_file, chunkhashes);
 								}
 								else
 								{
 									skipped_bytes += data.size;
 
-									restore_download->addToQueueFull(line, server_fn, local_fn, 
+									restore_download->getMetadataWorker()->addToQueueFull(line, server_fn, local_fn, 
                                         data.size, metadata, false, true, 0, NULL);
 
 									std::string tmpfn = chunkhashes->getFilename();
@@ -1737,13 +1957,19 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 							}
 							else
 							{
-								restore_download->addToQueueFull(line, server_fn, local_fn,
+								restore_download->getMetadataWorker()->addToQueueFull(line, server_fn, local_fn,
 									data.size, metadata, false, true, 0, NULL);
 							}
 						}
+						else if (!local_hash_files.empty()
+							&& getLocalCopyHash(extra, local_copy_hash_key, local_copy_hash))
+						{
+							restore_download->getDataWorker()->addToQueueFull(line, server_fn, local_fn,
+								data.size, metadata, false, false, 0, orig_file, local_copy_hash_key, local_copy_hash);
+						}
 						else
 						{
-							restore_download->addToQueueFull(line, server_fn, local_fn,
+							restore_download->getDataWorker()->addToQueueFull(line, server_fn, local_fn,
 								data.size, metadata, false, false, 0, orig_file);
 						}
 					}
@@ -1779,7 +2005,7 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 
     restore_download->queueStop();
 
-    while(!Server->getThreadPool()->waitFor(restore_download_ticket, 1000))
+    while(!restore_download->waitForWorkers(1000))
     {
         if(total_size==0)
         {
@@ -1787,14 +2013,22 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
         }
         else
         {
-			int64 done_bytes = fc.getReceivedDataBytes(true) + fc_chunked->getReceivedDataBytes(true) + skipped_bytes;
+			int64 done_bytes = restore_download->getReceivedDataBytes(true) + restore_download->getLocalCopyBytes() + skipped_bytes;
             int pcdone = (std::min)(100,(int)(((float)done_bytes)/((float)total_size/100.f)+0.5f));
 			restore_updater.update_pc(pcdone, total_size, done_bytes);
         }
 
-		calculateDownloadSpeed(fc, fc_chunked.get());
+		calculateDownloadSpeed(*restore_download);
     }
 
+	restore_download->informMetadataStreamEnd();
+
+	int64 local_copy_bytes = restore_download->getLocalCopyBytes();
+	if (local_copy_bytes > 0)
+	{
+		log("Restored " + PrettyPrintBytes(local_copy_bytes) + " from local copies of identical files instead of downloading them", LL_INFO);
+	}
+
 #ifdef _WIN32
 	if(!has_error && !restore_download->hasError())
 	{
@@ -1890,7 +2124,7 @@ void RestoreFiles::restore_failed(client::FileMetadataDownloadThread& metadata_t
 	ClientConnector::restoreDone(log_id, status_id, restore_id, false, server_token);
 }
 
-bool RestoreFiles::removeFiles( std::string restore_path, std::string share_path, RestoreDownloadThread* restore_download,
+bool RestoreFiles::removeFiles( std::string restore_path, std::string share_path, RestoreDownloadPool* restore_download,
 	std::stack<std::vector<std::string> > &folder_files, std::vector<std::string> &deletion_queue, bool& has_include_exclude,
 	const std::vector<int64>& tids, ClientDAO* clientdao, tokens::TokenCache& cache)
 {
@@ -2095,7 +2329,7 @@ bool RestoreFiles::renameFilesOnRestart( std::vector<std::pair<std::string, std:
 #endif
 }
 
-void RestoreFiles::calculateDownloadSpeed(FileClient & fc, FileClientChunked * fc_chunked)
+void RestoreFiles::calculateDownloadSpeed(RestoreDownloadPool& restore_download)
 {
 	int64 ctime = Server->getTimeMS();
 	if (speed_set_time == 0)
@@ -2105,7 +2339,7 @@ void RestoreFiles::calculateDownloadSpeed(FileClient & fc, FileClientChunked * f
 
 	if (ctime - speed_set_time>10000)
 	{
-		int64 received_data_bytes = fc.getTransferredBytes() + (fc_chunked != NULL ? fc_chunked->getTransferredBytes() : 0);
+		int64 received_data_bytes = restore_download.getTransferredBytes();
 
 		int64 new_bytes = received_data_bytes - last_speed_received_bytes;
 		int64 passed_time = ctime - speed_set_time;
@@ -11,7 +11,7 @@
 #include <memory>
 #include <stack>
 
-class RestoreDownloadThread;
+class RestoreDownloadPool;
 class ScopedRestoreUpdater;
 
 namespace client
@@ -64,6 +64,9 @@ public:
 
 	virtual void log_progress(const std::string & fn, int64 total, int64 downloaded, int64 speed_bps);
 
+	//Called by the download workers. local_hash_files is not modified while they run
+	bool restoreFromLocalCopy(const std::string& hash_key, const std::string& hash, int64 size, const std::string& local_fn, IFsFile* dest_file);
+
 private:
 	
 	bool connectFileClient(FileClient& fc);
@@ -77,7 +80,7 @@ private:
 
 	bool downloadFiles(FileClient& fc, int64 total_size, ScopedRestoreUpdater& restore_updater, std::map<std::string, IFsFile*>& open_files);
 
-	bool removeFiles( std::string restore_path, std::string share_path, RestoreDownloadThread* restore_download, 
+	bool removeFiles( std::string restore_path, std::string share_path, RestoreDownloadPool* restore_download, 
 		std::stack<std::vector<std::string> > &folder_files, std::vector<std::string> &deletion_queue, bool& has_include_exclude,
 		const std::vector<int64>& tids, ClientDAO* clientdao, tokens::TokenCache& cache);
 
@@ -91,12 +94,16 @@ private:
 
 	std::auto_ptr<FileClientChunked> createFcChunked();
 
-	void calculateDownloadSpeed(FileClient & fc, FileClientChunked * fc_chunked);
+	void calculateDownloadSpeed(RestoreDownloadPool& restore_download);
 
 	bool createDirectoryWin(const std::string& dir);
 
 	std::pair<IFile*, int64> getCbtHashFile(const std::string& fn);
 
+	void buildLocalHashIndex();
+
+	bool getLocalCopyHash(std::map<std::string, std::string>& extra, std::string& hash_key, std::string& hash);
+
 	int64 local_process_id;
 
 	int64 restore_id;
@@ -140,4 +147,6 @@ private:
 	bool is_offline;
 
 	std::map<std::string, std::pair<IFile*, int64> > cbt_hash_files;
+
+	std::map<std::string, std::vector<std::string> > local_hash_files;
 };
\ No newline at end of file
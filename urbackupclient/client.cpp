@@ -18,6 +18,7 @@
 
 #include "client.h"
 #include "ParallelHash.h"
+#include "FileHashCache.h"
 #include "../Interface/Server.h"
 #include "../Interface/File.h"
 #include "../Interface/SettingsReader.h"
@@ -109,6 +110,7 @@ namespace
 	const unsigned int shadowcopy_timeout = 7 * 24 * 60 * 60 * 1000;
 	const unsigned int shadowcopy_startnew_timeout = 55 * 60 * 1000;
 	const size_t max_file_buffer_size = 4 * 1024 * 1024;
+	const size_t max_file_buffer_dirs = 10000;
 	const int64 file_buffer_commit_interval = 120 * 1000;
 	const int64 link_file_min_size = 2048;
 }
@@ -1846,8 +1848,7 @@ IndexThread::IndexErrorInfo IndexThread::indexDirs(bool full_backup, bool simult
 					index_exclude_dirs.insert(index_exclude_dirs.end(), rm_exclude_dirs.begin(), rm_exclude_dirs.end());
 				}
 
-				commitModifyFilesBuffer();
-				commitAddFilesBuffer();
+				commitFilesBuffer();
 				commitModifyHardLinks();
 				commitPhashQueue();
 			}
@@ -1914,8 +1915,7 @@ IndexThread::IndexErrorInfo IndexThread::indexDirs(bool full_backup, bool simult
 		outfile_size = static_cast<std::streamoff>(outfile.tellp());
 	}
 
-	commitModifyFilesBuffer();
-	commitAddFilesBuffer();
+	commitFilesBuffer();
 	commitModifyHardLinks();
 
 	if (phash_queue != NULL)
@@ -1927,6 +1927,13 @@ IndexThread::IndexErrorInfo IndexThread::indexDirs(bool full_backup, bool simult
 
 	commitPhashQueue();
 
+	FileHashCache* file_hash_cache = FileHashCache::getInstance();
+	if (file_hash_cache != NULL
+		&& !index_error)
+	{
+		file_hash_cache->reserve(file_id);
+	}
+
 	index_hdat_file.reset();
 
 #ifdef _WIN32
@@ -2542,6 +2549,8 @@ bool IndexThread::initialCheck(std::vector<SRecurParams>& params_stack, size_t s
 				wdata.addChar(ID_HASH_FILE);
 				wdata.addVarInt(file_id);
 				wdata.addString2(files[i].name);
+				wdata.addVarInt(files[i].size);
+				wdata.addVarInt(static_cast<int64>(files[i].change_indicator));
 				addToPhashQueue(wdata);
 			}
 
@@ -3067,7 +3076,7 @@ bool IndexThread::addMissingHashes(std::vector<SFileAndHash>* dbfiles, std::vect
 				&& calc_hashes
 				&& fsfile.size>= link_file_min_size)
 			{
-				fsfile.hash=getShaBinary(filepath+os_file_sep()+fsfile.name);
+				fsfile.hash=getShaBinaryCached(orig_path+os_file_sep()+fsfile.name, filepath+os_file_sep()+fsfile.name, fsfile);
 				calculated_hash=true;
 			}
 		}
@@ -3092,7 +3101,7 @@ bool IndexThread::addMissingHashes(std::vector<SFileAndHash>* dbfiles, std::vect
 			if (dbfile.size < link_file_min_size)
 				continue;
 
-			dbfile.hash=getShaBinary(filepath+os_file_sep()+dbfile.name);
+			dbfile.hash=getShaBinaryCached(orig_path+os_file_sep()+dbfile.name, filepath+os_file_sep()+dbfile.name, dbfile);
 			calculated_hash=true;
 		}
 	}
@@ -3247,6 +3256,11 @@ std::vector<SFileAndHash> IndexThread::getFilesProxy(const std::string &orig_pat
 #endif
 
 
+		if (calculate_filehashes_on_client)
+		{
+			addCachedHashes(orig_path, fs_files);
+		}
+
 		if(calculate_filehashes_on_client
 			&& (phash_queue==NULL || has_files) )
 		{
@@ -4658,67 +4672,85 @@ void IndexThread::modifyFilesInt(std::string path, int tgroup,
 {
 	modify_file_buffer_size+=calcBufferSize(path, data);
 
-	modify_file_buffer.push_back(SBufferItem(path, tgroup, data, target_generation));
-
-	if(last_file_buffer_commit_time==0)
-	{
-		last_file_buffer_commit_time = Server->getTimeMS();
-	}
-
-	if( modify_file_buffer_size+add_file_buffer_size>max_file_buffer_size 
-		|| Server->getTimeMS()-last_file_buffer_commit_time>file_buffer_commit_interval)
-	{
-		commitModifyFilesBuffer();
-		commitAddFilesBuffer();
-		commitPhashQueue();
-	}
-}
-
-void IndexThread::commitModifyFilesBuffer(void)
-{
-	db->BeginWriteTransaction();
-	for(size_t i=0;i<modify_file_buffer.size();++i)
-	{
-		cd->modifyFiles(modify_file_buffer[i].path, modify_file_buffer[i].tgroup,
-			modify_file_buffer[i].files, modify_file_buffer[i].target_generation);
-	}
-	db->EndTransaction();
+	modify_file_buffer.push_back(SFilesBatchItem(path, tgroup, data, target_generation));
 
-	modify_file_buffer.clear();
-	modify_file_buffer_size=0;
-	last_file_buffer_commit_time=Server->getTimeMS();
+	checkFilesBufferCommit();
 }
 
 void IndexThread::addFilesInt( std::string path, int tgroup, const std::vector<SFileAndHash> &data )
 {
 	add_file_buffer_size+=calcBufferSize(path, data);
 
-	add_file_buffer.push_back(SBufferItem(path, tgroup, data, 0));
+	add_file_buffer.push_back(SFilesBatchItem(path, tgroup, data, 0));
 
+	checkFilesBufferCommit();
+}
+
+void IndexThread::checkFilesBufferCommit()
+{
 	if(last_file_buffer_commit_time==0)
 	{
 		last_file_buffer_commit_time = Server->getTimeMS();
 	}
 
-	if(add_file_buffer_size+ add_file_buffer_size>max_file_buffer_size
+	if( modify_file_buffer_size+add_file_buffer_size>max_file_buffer_size
+		|| modify_file_buffer.size()+add_file_buffer.size()>=max_file_buffer_dirs
 		|| Server->getTimeMS()-last_file_buffer_commit_time>file_buffer_commit_interval)
 	{
-		commitAddFilesBuffer();
-		commitModifyFilesBuffer();
+		commitFilesBuffer();
 		commitPhashQueue();
 	}
+}
 
+namespace
+{
+	struct SFilesBatchItemLess
+	{
+		bool operator()(const SFilesBatchItem* a, const SFilesBatchItem* b) const
+		{
+			if(a->path!=b->path)
+			{
+				return a->path<b->path;
+			}
+			return a->tgroup<b->tgroup;
+		}
+	};
+
+	std::vector<const SFilesBatchItem*> sortedFilesBatch(const std::vector<SFilesBatchItem>& items)
+	{
+		std::vector<const SFilesBatchItem*> ret;
+		ret.reserve(items.size());
+		for(size_t i=0;i<items.size();++i)
+		{
+			ret.push_back(&items[i]);
+		}
+		std::stable_sort(ret.begin(), ret.end(), SFilesBatchItemLess());
+		return ret;
+	}
 }
 
-void IndexThread::commitAddFilesBuffer()
+//Writes all buffered directories in one transaction. Rows are written
+//in key order so that SQLite appends to the same index pages
+void IndexThread::commitFilesBuffer(void)
 {
-	db->BeginWriteTransaction();
-	for(size_t i=0;i<add_file_buffer.size();++i)
+	if(!modify_file_buffer.empty()
+		|| !add_file_buffer.empty())
 	{
-		cd->addFiles(add_file_buffer[i].path, add_file_buffer[i].tgroup, add_file_buffer[i].files);
+		std::vector<const SFilesBatchItem*> modify_items = sortedFilesBatch(modify_file_buffer);
+		std::vector<const SFilesBatchItem*> add_items = sortedFilesBatch(add_file_buffer);
+
+		db->BeginWriteTransaction();
+		for(size_t i=0;i<modify_items.size();++i)
+		{
+			cd->modifyFiles(modify_items[i]->path, modify_items[i]->tgroup,
+				modify_items[i]->files, modify_items[i]->target_generation);
+		}
+		cd->addFilesBatch(add_items);
+		db->EndTransaction();
 	}
-	db->EndTransaction();
 
+	modify_file_buffer.clear();
+	modify_file_buffer_size=0;
 	add_file_buffer.clear();
 	add_file_buffer_size=0;
 	last_file_buffer_commit_time=Server->getTimeMS();
@@ -5393,6 +5425,50 @@ std::string IndexThread::getShaBinary(const std::string& fn)
 	}
 }
 
+std::string IndexThread::getShaBinaryCached(const std::string& orig_fn, const std::string& fn, const SFileAndHash& file)
+{
+	FileHashCache* file_hash_cache = FileHashCache::getInstance();
+
+	std::string ret;
+	if (file_hash_cache != NULL
+		&& file_hash_cache->get(orig_fn, file.size, file.change_indicator, sha_version, ret))
+	{
+		return ret;
+	}
+
+	ret = getShaBinary(fn);
+
+	if (file_hash_cache != NULL)
+	{
+		file_hash_cache->put(orig_fn, file.size, file.change_indicator, sha_version, ret);
+	}
+
+	return ret;
+}
+
+void IndexThread::addCachedHashes(const std::string& orig_path, std::vector<SFileAndHash>& files)
+{
+	FileHashCache* file_hash_cache = FileHashCache::getInstance();
+	if (file_hash_cache == NULL)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		SFileAndHash& file = files[i];
+		if (file.isdir
+			|| file.isspecialf
+			|| !file.hash.empty()
+			|| file.size < link_file_min_size)
+		{
+			continue;
+		}
+
+		file_hash_cache->get(orig_path + os_file_sep() + file.name, file.size, file.change_indicator, sha_version, file.hash);
+	}
+}
+
 bool IndexThread::getShaBinary( const std::string& fn, IHashFunc& hf, bool with_cbt)
 {
 	return client_hash->getShaBinary(fn, hf, with_cbt);
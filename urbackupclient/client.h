@@ -507,11 +507,12 @@ private:
 	void modifyFilesInt(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation);
 	size_t calcBufferSize( std::string &path, const std::vector<SFileAndHash> &data );
 
-	void commitModifyFilesBuffer();
-
 	void addFilesInt(std::string path, int tgroup, const std::vector<SFileAndHash> &data);
-	void commitAddFilesBuffer();
+	void checkFilesBufferCommit();
+	void commitFilesBuffer();
 	std::string getShaBinary(const std::string& fn);
+	std::string getShaBinaryCached(const std::string& orig_fn, const std::string& fn, const SFileAndHash& file);
+	void addCachedHashes(const std::string& orig_path, std::vector<SFileAndHash>& files);
 
 	std::string removeDirectorySeparatorAtEnd(const std::string& path);
 
@@ -658,23 +659,11 @@ private:
 
 	static std::map<std::string, std::string> filesrv_share_dirs;
 
-	struct SBufferItem
-	{
-		SBufferItem(std::string path, int tgroup, std::vector<SFileAndHash> files, int64 target_generation)
-			: path(path), tgroup(tgroup), files(files), target_generation(target_generation)
-		{}
-
-		std::string path;
-		int tgroup;
-		std::vector<SFileAndHash> files;
-		int64 target_generation;
-	};
-
 	std::auto_ptr<ClientHash> client_hash;
 
-	std::vector< SBufferItem > modify_file_buffer;
+	std::vector< SFilesBatchItem > modify_file_buffer;
 	size_t modify_file_buffer_size;
-	std::vector< SBufferItem > add_file_buffer;
+	std::vector< SFilesBatchItem > add_file_buffer;
 	size_t add_file_buffer_size;
 
 	int64 last_file_buffer_commit_time;
@@ -19,12 +19,28 @@
 #include "clientdao.h"
 #include "../stringtools.h"
 #include "../Interface/Server.h"
+#include "../Interface/DatabaseCursor.h"
+#include "../common/data.h"
 #include <memory.h>
+#include <algorithm>
 
 const int ClientDAO::c_is_group = 0;
 const int ClientDAO::c_is_user = 1;
 const int ClientDAO::c_is_system_user = 2;
 
+namespace
+{
+	//Compact file lists start with two zero bytes, which would be
+	//an empty file name in the legacy format
+	const char files_compact_magic[] = { 0, 0, 1 };
+
+	const char files_flag_dir = 1;
+	const char files_flag_sym = 2;
+	const char files_flag_special = 4;
+
+	const size_t files_batch_rows = 32;
+}
+
 ClientDAO::ClientDAO(IDatabase *pDB)
 {
 	db=pDB;
@@ -39,7 +55,14 @@ ClientDAO::~ClientDAO()
 void ClientDAO::prepareQueries()
 {
 	q_get_files=db->Prepare("SELECT data, num, generation FROM files WHERE name=? AND tgroup=?", false);
+	q_get_all_files=db->Prepare("SELECT name, data, num FROM files", false);
 	q_add_files=db->Prepare("INSERT OR REPLACE INTO files (name, tgroup, num, data) VALUES (?,?,?,?)", false);
+	std::string add_files_batch="INSERT OR REPLACE INTO files (name, tgroup, num, data) VALUES (?,?,?,?)";
+	for(size_t i=1;i<files_batch_rows;++i)
+	{
+		add_files_batch+=",(?,?,?,?)";
+	}
+	q_add_files_batch=db->Prepare(add_files_batch, false);
 	q_get_dirs=db->Prepare("SELECT name, path, id, optional, tgroup, symlinked, server_default, reset_keep FROM backupdirs", false);
 	q_remove_all=db->Prepare("DELETE FROM files", false);
 	q_get_changed_dirs=db->Prepare("SELECT id, name FROM mdirs WHERE name GLOB ? UNION SELECT id, name FROM mdirs_backup WHERE name GLOB ?", false);
@@ -67,7 +90,9 @@ void ClientDAO::prepareQueries()
 void ClientDAO::destroyQueries(void)
 {
 	db->destroyQuery(q_get_files);
+	db->destroyQuery(q_get_all_files);
 	db->destroyQuery(q_add_files);
+	db->destroyQuery(q_add_files_batch);
 	db->destroyQuery(q_get_dirs);
 	db->destroyQuery(q_remove_all);
 	db->destroyQuery(q_get_changed_dirs);
@@ -164,23 +189,56 @@ std::string ClientDAO::escapeGlob(const std::string& glob)
 	return ret;
 }
 
-bool ClientDAO::getFiles(std::string path, int tgroup, std::vector<SFileAndHash> &data, int64& generation)
+static bool parseDataCompact(const std::string& qdata, size_t num, std::vector<SFileAndHash> &data)
 {
-	q_get_files->Bind(path);
-	q_get_files->Bind(tgroup);
-	db_results res=q_get_files->Read();
-	q_get_files->Reset();
-	if(res.size()==0)
-		return false;
+	CRData rd(qdata.data()+sizeof(files_compact_magic), (std::min)(qdata.size(), num)-sizeof(files_compact_magic));
 
-	generation = watoi64(res[0]["generation"]);
+	std::string prev_name;
+	while(rd.getLeft()>0)
+	{
+		SFileAndHash f;
+		int64 prefix_len;
+		std::string suffix;
+		char flags;
+		int64 size;
+		int64 change_indicator;
+		if(!rd.getVarInt(&prefix_len)
+			|| prefix_len<0
+			|| static_cast<size_t>(prefix_len)>prev_name.size()
+			|| !rd.getStr2(&suffix)
+			|| !rd.getChar(&flags)
+			|| !rd.getVarInt(&size)
+			|| !rd.getVarInt(&change_indicator)
+			|| !rd.getStr2(&f.hash) )
+		{
+			return false;
+		}
+
+		f.name = prev_name.substr(0, static_cast<size_t>(prefix_len)) + suffix;
+		f.size = size;
+		f.change_indicator = static_cast<uint64>(change_indicator);
+		f.isdir = (flags & files_flag_dir)!=0;
+		f.issym = (flags & files_flag_sym)!=0;
+		f.isspecialf = (flags & files_flag_special)!=0;
 
-	std::string &qdata=res[0]["data"];
+		if(f.issym
+			&& !rd.getStr2(&f.symlink_target))
+		{
+			return false;
+		}
 
+		prev_name = f.name;
+		data.push_back(f);
+	}
+
+	return true;
+}
+
+static void parseDataLegacy(std::string& qdata, int num, std::vector<SFileAndHash> &data)
+{
 	if(qdata.empty())
-		return true;
+		return;
 
-	int num=watoi(res[0]["num"]);
 	char *ptr=(char*)&qdata[0];
 	while(ptr-(char*)&qdata[0]<num)
 	{
@@ -240,74 +298,122 @@ bool ClientDAO::getFiles(std::string path, int tgroup, std::vector<SFileAndHash>
 
 		data.push_back(f);
 	}
+}
+
+static void parseData(std::string& qdata, int num, std::vector<SFileAndHash> &data)
+{
+	if(qdata.size()>=sizeof(files_compact_magic)
+		&& num>=static_cast<int>(sizeof(files_compact_magic))
+		&& memcmp(qdata.data(), files_compact_magic, sizeof(files_compact_magic))==0)
+	{
+		if(!parseDataCompact(qdata, static_cast<size_t>(num), data))
+		{
+			Server->Log("Error parsing file list from client database", LL_ERROR);
+			data.clear();
+		}
+	}
+	else
+	{
+		parseDataLegacy(qdata, num, data);
+	}
+}
+
+bool ClientDAO::getFiles(std::string path, int tgroup, std::vector<SFileAndHash> &data, int64& generation)
+{
+	q_get_files->Bind(path);
+	q_get_files->Bind(tgroup);
+	db_results res=q_get_files->Read();
+	q_get_files->Reset();
+	if(res.size()==0)
+		return false;
+
+	generation = watoi64(res[0]["generation"]);
+
+	parseData(res[0]["data"], watoi(res[0]["num"]), data);
 	return true;
 }
 
-char * constructData(const std::vector<SFileAndHash> &data, size_t &datasize)
+//Streams the file lists of the last indexing run. Returned files may have
+//changed since then, so callers have to verify their content
+void ClientDAO::getFilesByHash(const std::set<std::string>& hashes, size_t max_per_hash,
+	std::map<std::string, std::vector<std::string> >& ret)
 {
-	datasize=0;
-	std::vector<std::string> utf;
-	utf.resize(data.size());
-	for(size_t i=0;i<data.size();++i)
+	if(hashes.empty())
+		return;
+
+	ScopedDatabaseCursor cur(q_get_all_files->Cursor());
+	db_single_result res;
+	std::vector<SFileAndHash> files;
+	while(cur.next(res))
 	{
-		utf[i]=(data[i].name);
-		datasize+=utf[i].size();
-		datasize+=sizeof(unsigned short);
-		datasize+=sizeof(int64)*2;
-		++datasize; //isdir
-		datasize+=sizeof(unsigned short);
-		datasize+=data[i].hash.size();
-		++datasize; //issym
-		++datasize; //isspecial
-		if(data[i].issym)
+		files.clear();
+		parseData(res["data"], watoi(res["num"]), files);
+
+		const std::string& dir = res["name"];
+
+		for(size_t i=0;i<files.size();++i)
 		{
-			datasize+=sizeof(unsigned short);
-			datasize+=(data[i].symlink_target).size();
+			const SFileAndHash& f = files[i];
+			if(f.isdir || f.issym || f.isspecialf
+				|| f.size<=0 || f.hash.empty()
+				|| hashes.find(f.hash)==hashes.end())
+			{
+				continue;
+			}
+
+			std::vector<std::string>& paths = ret[f.hash];
+			if(paths.size()<max_per_hash)
+			{
+				paths.push_back(dir + f.name);
+			}
 		}
 	}
-	char *buffer=new char[datasize];
-	char *ptr=buffer;
+	q_get_all_files->Reset();
+}
+
+std::string constructData(const std::vector<SFileAndHash> &data)
+{
+	CWData wd;
+	wd.addBuffer(files_compact_magic, sizeof(files_compact_magic));
+
+	const std::string* prev_name = NULL;
 	for(size_t i=0;i<data.size();++i)
 	{
-		unsigned short ss=(unsigned short)utf[i].size();
-		memcpy(ptr, (char*)&ss, sizeof(unsigned short));
-		ptr+=sizeof(unsigned short);
-		memcpy(ptr, &utf[i][0], ss);
-		ptr+=ss;
-		memcpy(ptr, (char*)&data[i].size, sizeof(int64));
-		ptr+=sizeof(int64);
-		memcpy(ptr, (char*)&data[i].change_indicator, sizeof(uint64));
-		ptr+=sizeof(uint64);
-		char isdir=1;
-		if(!data[i].isdir)
-			isdir=0;
-		*ptr=isdir;
-		ptr+=sizeof(char);
-		unsigned short hashsize=static_cast<unsigned short>(data[i].hash.size());
-		memcpy(ptr, &hashsize, sizeof(hashsize));
-		ptr+=sizeof(hashsize);
-		memcpy(ptr, data[i].hash.data(), hashsize);
-		ptr+=hashsize;
-		char issym = data[i].issym?1:0;
-		*ptr=issym;
-		++ptr;
-		char isspecialf = data[i].isspecialf?1:0;
-		*ptr= isspecialf ?1:0;
-		++ptr;
-		if(data[i].issym)
+		const SFileAndHash& f = data[i];
+
+		size_t prefix_len = 0;
+		if(prev_name!=NULL)
 		{
-			std::string symlink_target = (data[i].symlink_target);
-			ss=(unsigned short)symlink_target.size();
-			memcpy(ptr, (char*)&ss, sizeof(unsigned short));
-			ptr+=sizeof(unsigned short);
-			if(ss>0)
+			size_t max_prefix = (std::min)(prev_name->size(), f.name.size());
+			while(prefix_len<max_prefix
+				&& (*prev_name)[prefix_len]==f.name[prefix_len])
 			{
-				memcpy(ptr, &symlink_target[0], ss);
+				++prefix_len;
 			}
-			ptr+=ss;
 		}
+
+		wd.addVarInt(prefix_len);
+		wd.addString2(f.name.substr(prefix_len));
+
+		char flags = 0;
+		if(f.isdir) flags|=files_flag_dir;
+		if(f.issym) flags|=files_flag_sym;
+		if(f.isspecialf) flags|=files_flag_special;
+		wd.addChar(flags);
+
+		wd.addVarInt(f.size);
+		wd.addVarInt(static_cast<int64>(f.change_indicator));
+		wd.addString2(f.hash);
+
+		if(f.issym)
+		{
+			wd.addString2(f.symlink_target);
+		}
+
+		prev_name = &f.name;
 	}
-	return buffer;
+
+	return std::string(wd.getDataPtr(), wd.getDataSize());
 }
 
 std::string guidToString( GUID guid )
@@ -324,30 +430,51 @@ GUID randomGuid()
 
 void ClientDAO::addFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data)
 {
-	size_t ds;
-	char *buffer=constructData(data, ds);
+	std::string buffer=constructData(data);
 	q_add_files->Bind(path);
 	q_add_files->Bind(tgroup);
-	q_add_files->Bind(ds);
-	q_add_files->Bind(buffer, (_u32)ds);
+	q_add_files->Bind(buffer.size());
+	q_add_files->Bind(buffer.data(), (_u32)buffer.size());
 	q_add_files->Write();
 	q_add_files->Reset();
-	delete []buffer;
+}
+
+//Inserts the file lists with a multi-row statement. Should be called
+//inside of a write transaction with items sorted by path
+void ClientDAO::addFilesBatch(const std::vector<const SFilesBatchItem*>& items)
+{
+	size_t i=0;
+	for(;i+files_batch_rows<=items.size();i+=files_batch_rows)
+	{
+		for(size_t j=i;j<i+files_batch_rows;++j)
+		{
+			std::string buffer=constructData(items[j]->files);
+			q_add_files_batch->Bind(items[j]->path);
+			q_add_files_batch->Bind(items[j]->tgroup);
+			q_add_files_batch->Bind(buffer.size());
+			q_add_files_batch->Bind(buffer.data(), (_u32)buffer.size());
+		}
+		q_add_files_batch->Write();
+		q_add_files_batch->Reset();
+	}
+
+	for(;i<items.size();++i)
+	{
+		addFiles(items[i]->path, items[i]->tgroup, items[i]->files);
+	}
 }
 
 void ClientDAO::modifyFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation)
 {
-	size_t ds;
-	char *buffer=constructData(data, ds);
-	q_modify_files->Bind(buffer, (_u32)ds);
-	q_modify_files->Bind(ds);
+	std::string buffer=constructData(data);
+	q_modify_files->Bind(buffer.data(), (_u32)buffer.size());
+	q_modify_files->Bind(buffer.size());
 	q_modify_files->Bind(target_generation+1);
 	q_modify_files->Bind(path);
 	q_modify_files->Bind(tgroup);
 	q_modify_files->Bind(target_generation);
 	q_modify_files->Write();
 	q_modify_files->Reset();
-	delete []buffer;
 }
 
 bool ClientDAO::hasFiles(std::string path, int tgroup)
@@ -4,6 +4,8 @@
 #include "../Interface/Query.h"
 #include "../urbackupcommon/os_functions.h"
 #include <vector>
+#include <set>
+#include <map>
 #include <memory.h>
 
 #ifndef GUID_DEFINED
@@ -118,6 +120,18 @@ struct SFileAndHash
 	}
 };
 
+struct SFilesBatchItem
+{
+	SFilesBatchItem(std::string path, int tgroup, std::vector<SFileAndHash> files, int64 target_generation)
+		: path(path), tgroup(tgroup), files(files), target_generation(target_generation)
+	{}
+
+	std::string path;
+	int tgroup;
+	std::vector<SFileAndHash> files;
+	int64 target_generation;
+};
+
 class ClientDAO
 {
 public:
@@ -135,8 +149,11 @@ public:
 	}
 
 	bool getFiles(std::string path, int tgroup, std::vector<SFileAndHash> &data, int64& generation);
+	void getFilesByHash(const std::set<std::string>& hashes, size_t max_per_hash,
+		std::map<std::string, std::vector<std::string> >& ret);
 
 	void addFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data);
+	void addFilesBatch(const std::vector<const SFilesBatchItem*>& items);
 	void modifyFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation);
 	bool hasFiles(std::string path, int tgroup);
 	
@@ -216,7 +233,9 @@ private:
 	IDatabase *db;
 
 	IQuery *q_get_files;
+	IQuery *q_get_all_files;
 	IQuery *q_add_files;
+	IQuery *q_add_files_batch;
 	IQuery *q_get_dirs;
 	IQuery *q_remove_all;
 	IQuery *q_get_changed_dirs;
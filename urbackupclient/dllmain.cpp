@@ -59,6 +59,8 @@ extern IServer* Server;
 
 #include "ClientService.h"
 #include "client.h"
+#include "FileHashCache.h"
+#include "index_benchmark.h"
 #include "../stringtools.h"
 #include "ServerIdentityMgr.h"
 #include "../urbackupcommon/os_functions.h"
@@ -72,6 +74,7 @@ extern IServer* Server;
 
 #include "../urbackupcommon/chunk_hasher.h"
 #include "../urbackupcommon/WalCheckpointThread.h"
+#include "../urbackupcommon/PipeBufferPool.h"
 
 #define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
 #include "../common/miniz.h"
@@ -280,6 +283,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	}
 
 	WalCheckpointThread::init_mutex();
+	PipeBufferPool::init_mutex();
 
 	WalCheckpointThread* wal_checkpoint_thread = new WalCheckpointThread(10 * 1024 * 1024, 200 * 1024 * 1024,
 		"urbackup" + os_file_sep() + "backup_client.db", URBACKUPDB_CLIENT);
@@ -406,6 +410,8 @@ DLLEXPORT void LoadActions(IServer* pServer)
 
 	filesrv_pluginid=Server->StartPlugin("fileserv", params);
 
+	FileHashCache::init();
+
 	IndexThread *it=new IndexThread();
 	if(!do_leak_check)
 	{
@@ -424,6 +430,11 @@ DLLEXPORT void LoadActions(IServer* pServer)
 
 	Server->Log("Started UrBackupClient Backend...", LL_INFO);
 	Server->wait(1000);
+
+	if(Server->getServerParameter("index_benchmark")=="true")
+	{
+		exit(index_benchmark());
+	}
 }
 
 DLLEXPORT void UnloadActions(void)
@@ -438,6 +449,8 @@ DLLEXPORT void UnloadActions(void)
 
 		ClientConnector::destroy_mutex();
 
+		FileHashCache::destroy();
+
 		Server->destroyAllDatabases();
 	}
 }
@@ -646,6 +659,13 @@ void update_client27_28(IDatabase* db)
 	ClientConnector::updateDefaultDirsSetting(db, true, 0);
 }
 
+void update_client28_29(IDatabase* db)
+{
+	//File lists in the files table may now be stored in the compact
+	//encoding. Older clients cannot read it, so they have to refuse
+	//this database version.
+}
+
 bool upgrade_client(void)
 {
 	IDatabase *db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_CLIENT);
@@ -657,7 +677,7 @@ bool upgrade_client(void)
 		return false;
 	int ver=watoi(res_v[0]["tvalue"]);
 	int old_v;
-	int max_v = 28;
+	int max_v = 29;
 
 	if (ver > max_v)
 	{
@@ -789,6 +809,10 @@ bool upgrade_client(void)
 				update_client27_28(db);
 				++ver;
 				break;
+			case 28:
+				update_client28_29(db);
+				++ver;
+				break;
 			default:
 				break;
 		}
@@ -0,0 +1,343 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "index_benchmark.h"
+#include "client.h"
+#include "clientdao.h"
+#include "database.h"
+#include "../Interface/Server.h"
+#include "../Interface/Database.h"
+#include "../Interface/Query.h"
+#include "../Interface/File.h"
+#include "../common/data.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include <memory>
+#include <memory.h>
+
+namespace
+{
+	const char* bench_backupdir_name = "index_benchmark";
+	const size_t dir_fanout = 16;
+
+	const char* name_words[] = { "report", "image", "document", "backup", "invoice", "photo", "notes", "data" };
+	const char* name_exts[] = { ".txt", ".jpg", ".pdf", ".docx", ".csv", ".log" };
+
+	uint64 splitmix64(uint64& state)
+	{
+		uint64 z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	//Directory d is a child of directory (d-1)/dir_fanout. Directory 0 is the root.
+	std::string dir_path(const std::string& root, int64 dir)
+	{
+		std::string ret;
+		while (dir > 0)
+		{
+			ret = os_file_sep() + "d" + convert(dir) + ret;
+			dir = (dir - 1) / dir_fanout;
+		}
+		return root + ret;
+	}
+
+	//File names only depend on seed, directory and index, so changed files can be found again
+	std::string file_name(uint64 seed, int64 dir, int64 idx, int64 files_per_dir)
+	{
+		uint64 state = seed * 0x100000001B3ULL + static_cast<uint64>(dir * files_per_dir + idx);
+		std::string word = name_words[splitmix64(state) % (sizeof(name_words) / sizeof(name_words[0]))];
+		std::string ext = name_exts[splitmix64(state) % (sizeof(name_exts) / sizeof(name_exts[0]))];
+		return word + "_" + convert(splitmix64(state) % 100000) + "_" + convert(idx) + ext;
+	}
+
+	bool write_file(const std::string& fn, int64 size, uint64 content_id, std::vector<char>& buf)
+	{
+		std::auto_ptr<IFile> f(Server->openFile(os_file_prefix(fn), MODE_WRITE));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening \"" + fn + "\" for writing. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		buf.resize(static_cast<size_t>(size));
+		for (size_t i = 0; i < buf.size(); i += sizeof(uint64))
+		{
+			uint64 r = splitmix64(content_id);
+			memcpy(&buf[i], &r, (std::min)(sizeof(uint64), buf.size() - i));
+		}
+
+		if (f->Write(buf.data(), static_cast<_u32>(buf.size())) != buf.size())
+		{
+			Server->Log("Error writing to \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+		return true;
+	}
+
+	int64 file_size(uint64& state, int64 min_size, int64 max_size)
+	{
+		return min_size + static_cast<int64>(splitmix64(state) % static_cast<uint64>(max_size - min_size + 1));
+	}
+
+	bool run_index(char action, int group, unsigned int flags, int sha_version, std::string& result)
+	{
+		unsigned int result_id = IndexThread::getResultId();
+
+		CWData data;
+		data.addChar(action);
+		data.addUInt(result_id);
+		data.addString(bench_backupdir_name);
+		data.addInt(group);
+		data.addInt(flags);
+		data.addString(std::string());
+		data.addInt(sha_version);
+		data.addInt(1);
+		data.addChar(0);
+
+		IndexThread::getMsgPipe()->Write(data.getDataPtr(), data.getDataSize());
+
+		result.clear();
+		while (result.empty())
+		{
+			if (!IndexThread::getResult(result_id, 60000, result))
+			{
+				Server->Log("Index result " + convert(result_id) + " disappeared", LL_ERROR);
+				return false;
+			}
+		}
+
+		IndexThread::removeResult(result_id);
+
+		return result == "done";
+	}
+
+	//Size of a file list in the encoding used before the compact one
+	int64 legacy_list_size(const std::vector<SFileAndHash>& files)
+	{
+		int64 ret = 0;
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			ret += sizeof(unsigned short) + files[i].name.size();
+			ret += sizeof(int64) * 2;
+			ret += 1;
+			ret += sizeof(unsigned short) + files[i].hash.size();
+			ret += 2;
+			if (files[i].issym)
+			{
+				ret += sizeof(unsigned short) + files[i].symlink_target.size();
+			}
+		}
+		return ret;
+	}
+
+	int64 db_file_size(const std::string& fn)
+	{
+		std::auto_ptr<IFile> f(Server->openFile(fn, MODE_READ));
+		if (f.get() == NULL)
+		{
+			return 0;
+		}
+		return f->Size();
+	}
+
+	void log_db_stats(IDatabase* db, ClientDAO& cd, const std::string& root_lower, int tgroup)
+	{
+		IQuery* q = db->Prepare("SELECT name, LENGTH(data) AS data_size FROM files WHERE tgroup=? AND name GLOB ?", false);
+		q->Bind(tgroup);
+		q->Bind(ClientDAO::escapeGlob(root_lower) + "*");
+		db_results res = q->Read();
+		db->destroyQuery(q);
+
+		int64 n_files = 0;
+		int64 stored_bytes = 0;
+		int64 legacy_bytes = 0;
+		for (size_t i = 0; i < res.size(); ++i)
+		{
+			std::vector<SFileAndHash> files;
+			int64 generation;
+			if (cd.getFiles(res[i]["name"], tgroup, files, generation))
+			{
+				n_files += files.size();
+				stored_bytes += watoi64(res[i]["data_size"]);
+				legacy_bytes += legacy_list_size(files);
+			}
+		}
+
+		int64 l_n_files = (std::max)(n_files, static_cast<int64>(1));
+		Server->Log("Client database: " + convert(res.size()) + " directory lists with " + convert(n_files) + " entries. Stored lists "
+			+ PrettyPrintBytes(stored_bytes) + " (" + convert(stored_bytes / l_n_files) + " bytes/entry), legacy encoding would be "
+			+ PrettyPrintBytes(legacy_bytes) + " (" + convert(legacy_bytes / l_n_files) + " bytes/entry). Database file "
+			+ PrettyPrintBytes(db_file_size("urbackup" + os_file_sep() + "backup_client.db")) + ", WAL "
+			+ PrettyPrintBytes(db_file_size("urbackup" + os_file_sep() + "backup_client.db-wal")), LL_INFO);
+	}
+
+	void remove_bench_entries(IDatabase* db, const std::string& root_lower, int tgroup)
+	{
+		IQuery* q = db->Prepare("DELETE FROM files WHERE tgroup=? AND name GLOB ?", false);
+		q->Bind(tgroup);
+		q->Bind(ClientDAO::escapeGlob(root_lower) + "*");
+		q->Write();
+		db->destroyQuery(q);
+	}
+}
+
+/**
+* Generates a synthetic file tree, adds it as backup path and lets
+* IndexThread index it, first as full and then as incremental file backups
+* with a fraction of the files changed in between. Reports index time and
+* the size of the directory lists in the client database, together with the
+* size they would have in the legacy list encoding.
+*
+* Run it with a separate client data directory, since IndexThread also
+* indexes the other backup paths of the group.
+*/
+int index_benchmark()
+{
+	std::string workdir = Server->getServerParameter("workdir", "index_benchmark");
+	int64 n_dirs = (std::max)(watoi64(Server->getServerParameter("dirs", "10000")), static_cast<int64>(1));
+	int64 files_per_dir = (std::max)(watoi64(Server->getServerParameter("files_per_dir", "10")), static_cast<int64>(1));
+	int64 min_size = (std::max)(watoi64(Server->getServerParameter("min_size", "2048")), static_cast<int64>(0));
+	int64 max_size = (std::max)(watoi64(Server->getServerParameter("max_size", "4096")), min_size);
+	double change_rate = atof(Server->getServerParameter("change_rate", "0.01").c_str());
+	int runs = (std::max)(watoi(Server->getServerParameter("runs", "3")), 1);
+	int group = watoi(Server->getServerParameter("group", "0"));
+	int sha_version = watoi(Server->getServerParameter("sha_version", "528"));
+	uint64 seed = watoi64(Server->getServerParameter("seed", "1"));
+	bool calc_hashes = Server->getServerParameter("calc_hashes", "1") == "1";
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_CLIENT);
+	ClientDAO cd(db);
+
+	std::vector<SBackupDir> backup_dirs = cd.getBackupDirs();
+	for (size_t i = 0; i < backup_dirs.size(); ++i)
+	{
+		if (backup_dirs[i].tname == bench_backupdir_name)
+		{
+			Server->Log("Backup path \"" + std::string(bench_backupdir_name) + "\" exists. Remove it before running the benchmark", LL_ERROR);
+			return 1;
+		}
+	}
+
+	std::string root = workdir + os_file_sep() + "tree";
+	if (!os_create_dir_recursive(os_file_prefix(root)))
+	{
+		Server->Log("Error creating directory \"" + root + "\". " + os_last_error_str(), LL_ERROR);
+		return 1;
+	}
+	root = os_get_final_path(root);
+
+	Server->Log("Generating " + convert(n_dirs) + " directories with " + convert(files_per_dir) + " files each in \"" + root + "\"...", LL_INFO);
+
+	std::vector<char> buf;
+	uint64 size_state = seed;
+	int64 starttime = Server->getTimeMS();
+	for (int64 d = 0; d < n_dirs; ++d)
+	{
+		std::string path = dir_path(root, d);
+		if (d > 0
+			&& !os_create_dir(os_file_prefix(path)))
+		{
+			Server->Log("Error creating directory \"" + path + "\". " + os_last_error_str(), LL_ERROR);
+			return 1;
+		}
+
+		for (int64 i = 0; i < files_per_dir; ++i)
+		{
+			if (!write_file(path + os_file_sep() + file_name(seed, d, i, files_per_dir),
+				file_size(size_state, min_size, max_size), static_cast<uint64>(d * files_per_dir + i), buf))
+			{
+				return 1;
+			}
+		}
+	}
+	Server->Log("Generated tree in " + PrettyPrintTime(Server->getTimeMS() - starttime), LL_INFO);
+
+	cd.addBackupDir(bench_backupdir_name, root, 0, EBackupDirFlags_Default, group, 0);
+	int64 backupdir_id = db->getLastInsertID();
+
+	int tgroup = (EBackupDirFlags_Default & EBackupDirFlag_ShareHashes) ? 0 : group + 1;
+#ifdef _WIN32
+	std::string root_lower = strlower(root + os_file_sep());
+#else
+	std::string root_lower = root + os_file_sep();
+#endif
+
+	unsigned int flags = calc_hashes ? flag_calc_checksums : 0;
+	int64 n_files = n_dirs * files_per_dir;
+	uint64 change_state = seed ^ 0xA5A5A5A5A5A5A5A5ULL;
+	int rc = 0;
+
+	for (int run = 0; run < runs; ++run)
+	{
+		int64 n_changed = 0;
+		if (run > 0)
+		{
+			//Change indicators have second granularity
+			Server->wait(1100);
+
+			int64 to_change = static_cast<int64>(n_files * change_rate + 0.5);
+			for (int64 j = 0; j < to_change; ++j)
+			{
+				int64 idx = static_cast<int64>(splitmix64(change_state) % static_cast<uint64>(n_files));
+				int64 d = idx / files_per_dir;
+				int64 i = idx % files_per_dir;
+				if (!write_file(dir_path(root, d) + os_file_sep() + file_name(seed, d, i, files_per_dir),
+					file_size(change_state, min_size, max_size), splitmix64(change_state), buf))
+				{
+					rc = 1;
+					break;
+				}
+				++n_changed;
+			}
+
+			if (rc != 0)
+			{
+				break;
+			}
+		}
+
+		starttime = Server->getTimeMS();
+		std::string result;
+		if (!run_index(run == 0 ? IndexThread::IndexThreadAction_StartFullFileBackup : IndexThread::IndexThreadAction_StartIncrFileBackup,
+			group, flags, sha_version, result))
+		{
+			Server->Log("Indexing failed: " + result, LL_ERROR);
+			rc = 1;
+			break;
+		}
+		int64 run_ms = (std::max)(Server->getTimeMS() - starttime, static_cast<int64>(1));
+
+		Server->Log(std::string(run == 0 ? "Full" : "Incremental") + " index " + convert(run) + " (" + convert(n_changed) + " changed files): "
+			+ convert(n_files) + " files in " + convert(n_dirs) + " directories in " + PrettyPrintTime(run_ms) + ". "
+			+ convert(n_files * 1000 / run_ms) + " files/s", LL_INFO);
+
+		log_db_stats(db, cd, root_lower, tgroup);
+	}
+
+	cd.delBackupDir(backupdir_id);
+
+	if (Server->getServerParameter("keep") != "1")
+	{
+		remove_bench_entries(db, root_lower, tgroup);
+		os_remove_nonempty_dir(os_file_prefix(workdir));
+	}
+
+	return rc;
+}
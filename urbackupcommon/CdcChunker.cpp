@@ -0,0 +1,347 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "CdcChunker.h"
+#include "../Interface/Server.h"
+#include "../md5.h"
+#include "../common/data.h"
+#include "../stringtools.h"
+#include <memory.h>
+#include <algorithm>
+
+namespace
+{
+	const char cdc_hashes_magic[] = "URBACKUP CDC V1";
+
+	uint64 gear_table[256];
+
+	class GearTableInit
+	{
+	public:
+		GearTableInit()
+		{
+			//splitmix64, so every build gets the same table
+			uint64 x = 0x5542434443444331ULL;
+			for (size_t i = 0; i < 256; ++i)
+			{
+				x += 0x9E3779B97F4A7C15ULL;
+				uint64 z = x;
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+				gear_table[i] = z ^ (z >> 31);
+			}
+		}
+	};
+
+	GearTableInit gear_table_init;
+
+	std::string chunk_key(const SCdcChunk& chunk)
+	{
+		std::string ret(chunk.hash, sizeof(chunk.hash));
+		ret.append(reinterpret_cast<const char*>(&chunk.size), sizeof(chunk.size));
+		return ret;
+	}
+
+	unsigned int log2_floor(unsigned int v)
+	{
+		unsigned int r = 0;
+		while (v >>= 1)
+		{
+			++r;
+		}
+		return r;
+	}
+
+	uint64 top_bits_mask(unsigned int bits)
+	{
+		if (bits == 0)
+		{
+			return 0;
+		}
+		if (bits >= 64)
+		{
+			return ~0ULL;
+		}
+		return ((1ULL << bits) - 1) << (64 - bits);
+	}
+}
+
+CdcChunker::CdcChunker(unsigned int min_size, unsigned int avg_size, unsigned int max_size)
+	: min_size(min_size), avg_size(avg_size), max_size(max_size)
+{
+	if (this->min_size == 0)
+	{
+		this->min_size = 1;
+	}
+	if (this->avg_size < this->min_size)
+	{
+		this->avg_size = this->min_size;
+	}
+	if (this->max_size < this->avg_size)
+	{
+		this->max_size = this->avg_size;
+	}
+
+	//Normalized chunking: harder to cut before the average size, easier after
+	unsigned int bits = log2_floor(this->avg_size);
+	mask_s = top_bits_mask(bits + 2);
+	mask_l = top_bits_mask(bits > 2 ? bits - 2 : 0);
+}
+
+size_t CdcChunker::findBoundary(const char* buf, size_t bsize, bool eof)
+{
+	if (bsize <= min_size)
+	{
+		return eof ? bsize : 0;
+	}
+
+	if (bsize < max_size && !eof)
+	{
+		return 0;
+	}
+
+	size_t n = (std::min)(bsize, static_cast<size_t>(max_size));
+	size_t normal = (std::min)(n, static_cast<size_t>(avg_size));
+	const unsigned char* ubuf = reinterpret_cast<const unsigned char*>(buf);
+
+	uint64 fp = 0;
+	size_t i = min_size;
+	for (; i < normal; ++i)
+	{
+		fp = (fp << 1) + gear_table[ubuf[i]];
+		if (!(fp & mask_s))
+		{
+			return i + 1;
+		}
+	}
+
+	for (; i < n; ++i)
+	{
+		fp = (fp << 1) + gear_table[ubuf[i]];
+		if (!(fp & mask_l))
+		{
+			return i + 1;
+		}
+	}
+
+	return n;
+}
+
+bool CdcChunker::chunkFile(IFile* f, std::vector<SCdcChunk>& chunks)
+{
+	CdcFileChunker file_chunker(*this, f);
+
+	while (true)
+	{
+		SCdcChunk chunk;
+		const char* chunk_data;
+		if (!file_chunker.next(chunk, chunk_data))
+		{
+			Server->Log("Error reading from \"" + f->getFilename() + "\" while chunking", LL_ERROR);
+			return false;
+		}
+
+		if (chunk.size == 0)
+		{
+			return true;
+		}
+
+		chunks.push_back(chunk);
+	}
+}
+
+unsigned int CdcChunker::getMinSize()
+{
+	return min_size;
+}
+
+unsigned int CdcChunker::getAvgSize()
+{
+	return avg_size;
+}
+
+unsigned int CdcChunker::getMaxSize()
+{
+	return max_size;
+}
+
+CdcFileChunker::CdcFileChunker(CdcChunker& chunker, IFile* f, int64 max_pos)
+	: chunker(chunker), f(f), max_pos(max_pos), buf(chunker.getMaxSize() * 4),
+	buf_start(0), buf_end(0), eof(false), read_pos(0), offset(0)
+{
+}
+
+bool CdcFileChunker::next(SCdcChunk& chunk, const char*& chunk_data)
+{
+	if (!eof && buf_end - buf_start < chunker.getMaxSize())
+	{
+		if (buf_start > 0)
+		{
+			memmove(&buf[0], &buf[buf_start], buf_end - buf_start);
+			buf_end -= buf_start;
+			buf_start = 0;
+		}
+
+		while (!eof && buf_end < buf.size())
+		{
+			_u32 toread = static_cast<_u32>(buf.size() - buf_end);
+			if (max_pos != -1
+				&& read_pos + toread > max_pos)
+			{
+				toread = static_cast<_u32>(max_pos - read_pos);
+			}
+
+			if (toread == 0)
+			{
+				eof = true;
+				break;
+			}
+
+			bool has_read_error = false;
+			_u32 read = f->Read(read_pos, &buf[buf_end], toread, &has_read_error);
+			if (has_read_error)
+			{
+				return false;
+			}
+			if (read == 0)
+			{
+				eof = true;
+			}
+			buf_end += read;
+			read_pos += read;
+		}
+	}
+
+	chunk.offset = offset;
+
+	if (buf_start == buf_end)
+	{
+		chunk.size = 0;
+		chunk_data = NULL;
+		return true;
+	}
+
+	size_t csize = chunker.findBoundary(&buf[buf_start], buf_end - buf_start, eof);
+
+	chunk.size = static_cast<unsigned int>(csize);
+	MD5 md5(reinterpret_cast<unsigned char*>(&buf[buf_start]), chunk.size);
+	memcpy(chunk.hash, md5.raw_digest_int(), sizeof(chunk.hash));
+	chunk_data = &buf[buf_start];
+
+	buf_start += csize;
+	offset += csize;
+
+	return true;
+}
+
+int64 CdcFileChunker::getReadPos()
+{
+	return read_pos;
+}
+
+CdcChunkIndex::CdcChunkIndex(const std::vector<SCdcChunk>& chunks)
+{
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		idx.insert(std::make_pair(chunk_key(chunks[i]), i));
+	}
+}
+
+int64 CdcChunkIndex::find(const SCdcChunk& chunk)
+{
+	std::map<std::string, size_t>::iterator it = idx.find(chunk_key(chunk));
+	if (it == idx.end())
+	{
+		return -1;
+	}
+	return static_cast<int64>(it->second);
+}
+
+void write_cdc_hashes(CWData& data, CdcChunker& chunker, int64 filesize, const std::vector<SCdcChunk>& chunks)
+{
+	data.addString(cdc_hashes_magic);
+	data.addVarInt(chunker.getMinSize());
+	data.addVarInt(chunker.getAvgSize());
+	data.addVarInt(chunker.getMaxSize());
+	data.addVarInt(filesize);
+	data.addVarInt(chunks.size());
+
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		data.addVarInt(chunks[i].size);
+		data.addBuffer(chunks[i].hash, sizeof(chunks[i].hash));
+	}
+}
+
+bool read_cdc_hashes(CRData& data, unsigned int& min_size, unsigned int& avg_size, unsigned int& max_size,
+	int64& filesize, std::vector<SCdcChunk>& chunks)
+{
+	std::string magic;
+	int64 i_min_size, i_avg_size, i_max_size;
+	int64 num_chunks;
+	if (!data.getStr(&magic)
+		|| magic != cdc_hashes_magic
+		|| !data.getVarInt(&i_min_size)
+		|| !data.getVarInt(&i_avg_size)
+		|| !data.getVarInt(&i_max_size)
+		|| !data.getVarInt(&filesize)
+		|| !data.getVarInt(&num_chunks))
+	{
+		Server->Log("CDC hash list is damaged", LL_ERROR);
+		return false;
+	}
+
+	if (i_min_size <= 0
+		|| i_avg_size < i_min_size
+		|| i_max_size < i_avg_size
+		|| i_max_size > c_cdc_max_allowed_size
+		|| num_chunks < 0
+		|| num_chunks > static_cast<int64>(data.getLeft()))
+	{
+		Server->Log("CDC hash list has invalid chunking parameters", LL_ERROR);
+		return false;
+	}
+
+	min_size = static_cast<unsigned int>(i_min_size);
+	avg_size = static_cast<unsigned int>(i_avg_size);
+	max_size = static_cast<unsigned int>(i_max_size);
+
+	chunks.reserve(chunks.size() + static_cast<size_t>(num_chunks));
+	int64 offset = 0;
+	for (int64 i = 0; i < num_chunks; ++i)
+	{
+		SCdcChunk chunk;
+		int64 csize;
+		if (!data.getVarInt(&csize)
+			|| csize <= 0
+			|| csize > i_max_size
+			|| data.getLeft() < sizeof(chunk.hash))
+		{
+			Server->Log("CDC hash list is truncated", LL_ERROR);
+			return false;
+		}
+		memcpy(chunk.hash, data.getCurrDataPtr(), sizeof(chunk.hash));
+		data.incrementPtr(sizeof(chunk.hash));
+		chunk.offset = offset;
+		chunk.size = static_cast<unsigned int>(csize);
+		offset += csize;
+		chunks.push_back(chunk);
+	}
+
+	return offset == filesize;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/File.h"
+#include <vector>
+#include <string>
+#include <map>
+
+class CWData;
+class CRData;
+
+const unsigned int c_cdc_min_size = 4*1024;
+const unsigned int c_cdc_avg_size = 16*1024;
+const unsigned int c_cdc_max_size = 64*1024;
+//Largest max chunk size accepted in a CDC hash list from the other side
+const unsigned int c_cdc_max_allowed_size = 1024*1024;
+
+struct SCdcChunk
+{
+	int64 offset;
+	unsigned int size;
+	char hash[16];
+};
+
+/**
+* Content-defined chunking (FastCDC with normalized chunking over a
+* gear rolling hash). Chunk boundaries depend only on the data around
+* them, so an insertion or deletion only changes the chunks it touches
+* instead of shifting every following fixed-size block.
+*/
+class CdcChunker
+{
+public:
+	CdcChunker(unsigned int min_size=c_cdc_min_size, unsigned int avg_size=c_cdc_avg_size,
+		unsigned int max_size=c_cdc_max_size);
+
+	/**
+	* Returns the size of the chunk starting at buf. If fewer than max_size
+	* bytes are available and eof is false, returns 0 (more data needed).
+	*/
+	size_t findBoundary(const char* buf, size_t bsize, bool eof);
+
+	bool chunkFile(IFile* f, std::vector<SCdcChunk>& chunks);
+
+	unsigned int getMinSize();
+	unsigned int getAvgSize();
+	unsigned int getMaxSize();
+
+private:
+	unsigned int min_size;
+	unsigned int avg_size;
+	unsigned int max_size;
+	uint64 mask_s;
+	uint64 mask_l;
+};
+
+/**
+* Reads a file front to back and returns it chunk by chunk (with md5).
+* Reads at most max_pos bytes if max_pos is not -1.
+*/
+class CdcFileChunker
+{
+public:
+	CdcFileChunker(CdcChunker& chunker, IFile* f, int64 max_pos=-1);
+
+	/**
+	* Returns false on a read error. Otherwise chunk_data points to the data of
+	* chunk (valid until the next call) and chunk.size is zero at the end of the file.
+	*/
+	bool next(SCdcChunk& chunk, const char*& chunk_data);
+
+	int64 getReadPos();
+
+private:
+	CdcChunker& chunker;
+	IFile* f;
+	int64 max_pos;
+	std::vector<char> buf;
+	size_t buf_start;
+	size_t buf_end;
+	bool eof;
+	int64 read_pos;
+	int64 offset;
+};
+
+/**
+* Looks up chunks by (md5, size) in a CDC hash list
+*/
+class CdcChunkIndex
+{
+public:
+	CdcChunkIndex(const std::vector<SCdcChunk>& chunks);
+
+	/**
+	* Returns the index of a chunk with the same content or -1
+	*/
+	int64 find(const SCdcChunk& chunk);
+
+private:
+	std::map<std::string, size_t> idx;
+};
+
+/**
+* CDC hash list: "URBACKUP CDC V1", chunker parameters, file size and
+* (size, md5) per chunk. Offsets are implicit. Used as payload of
+* ID_GET_FILE_CDC.
+*/
+void write_cdc_hashes(CWData& data, CdcChunker& chunker, int64 filesize, const std::vector<SCdcChunk>& chunks);
+
+bool read_cdc_hashes(CRData& data, unsigned int& min_size, unsigned int& avg_size, unsigned int& max_size,
+	int64& filesize, std::vector<SCdcChunk>& chunks);
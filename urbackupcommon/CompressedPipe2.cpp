@@ -27,11 +27,13 @@
 #include <stdexcept>
 #include <assert.h>
 #include "InternetServicePipe2.h"
+#include "PipeBufferPool.h"
 
 #define VLOG(x)
 
 
 const size_t max_send_size=20000;
+const size_t comp_buffer_size=4096;
 const size_t output_incr_size=8192;
 const size_t output_max_size=32*1024;
 
@@ -41,7 +43,6 @@ CompressedPipe2::CompressedPipe2(IPipe *cs, int compression_level)
 	input_buffer_size(0), read_mutex(Server->createMutex()), write_mutex(Server->createMutex()),
 	last_send_time(Server->getTimeMS())
 {
-	comp_buffer.resize(4096);
 	input_buffer.resize(16384);
 	destroy_cs=false;
 
@@ -252,6 +253,8 @@ bool CompressedPipe2::Write(const char *buffer, size_t bsize, int timeoutms, boo
 {
 	IScopedLock lock(write_mutex.get());
 
+	ScopedPipeBuffer comp_buffer(comp_buffer_size);
+
 	assert(buffer != NULL || bsize == 0);
 	const char* ptr=buffer;
 	size_t cbsize=bsize;
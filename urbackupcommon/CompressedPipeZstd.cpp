@@ -30,11 +30,13 @@
 #include <assert.h>
 #include "InternetServicePipe2.h"
 #include "os_functions.h"
+#include "PipeBufferPool.h"
 
 #define VLOG(x)
 
 
 const size_t max_send_size=20000;
+const size_t comp_buffer_size=8192;
 const size_t output_incr_size=8192;
 const size_t output_max_size=32*1024;
 
@@ -46,7 +48,6 @@ CompressedPipeZstd::CompressedPipeZstd(IPipe *cs, int compression_level, int thr
 	inf_stream(ZSTD_createDStream()),
 	def_stream(ZSTD_createCCtx())
 {
-	comp_buffer.resize(8192);
 	input_buffer.resize(16384);
 	destroy_cs=false;
 
@@ -272,6 +273,8 @@ bool CompressedPipeZstd::Write(const char *buffer, size_t bsize, int timeoutms,
 {
 	IScopedLock lock(write_mutex.get());
 
+	ScopedPipeBuffer comp_buffer(comp_buffer_size);
+
 	assert(buffer != NULL || bsize == 0);
 	const char* ptr=buffer;
 	size_t cbsize=bsize;
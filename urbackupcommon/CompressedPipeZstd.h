@@ -59,7 +59,6 @@ private:
 	void ProcessToString(std::string* ret, bool fromLast);
 
 	IPipe *cs;
-	std::vector<char> comp_buffer;
 	std::vector<char> input_buffer;
 	size_t input_buffer_size;
 
@@ -20,9 +20,16 @@
 #include "../cryptoplugin/ICryptoFactory.h"
 #include "../Interface/Server.h"
 #include "../Interface/Mutex.h"
+#include "PipeBufferPool.h"
 
 extern ICryptoFactory *crypto_fak;
 
+namespace
+{
+	//Writes are flushed every 128KB, so this is enough for the steady state
+	const size_t max_kept_buffer_size = 512*1024;
+}
+
 InternetServicePipe2::InternetServicePipe2()
 	: read_mutex(Server->createMutex()), write_mutex(Server->createMutex())
 {
@@ -116,10 +123,7 @@ size_t InternetServicePipe2::Read( std::string *ret, int timeoutms/*=-1 */ )
 {
 	IScopedLock lock(read_mutex.get());
 
-	bool l_has_error=false;
-	*ret = dec->get(l_has_error);
-
-	if(l_has_error)
+	if(!dec->get(*ret))
 	{
 		has_error=true;
 		return 0;
@@ -130,6 +134,8 @@ size_t InternetServicePipe2::Read( std::string *ret, int timeoutms/*=-1 */ )
 		return ret->size();
 	}
 
+	ScopedPipeBuffer read_buffer(32768);
+
 	int64 starttime=0;
 
 	if(timeoutms>0)
@@ -139,20 +145,17 @@ size_t InternetServicePipe2::Read( std::string *ret, int timeoutms/*=-1 */ )
 
 	do 
 	{
-		size_t read = cs->Read(ret, static_cast<int>(timeoutms>0 ? (timeoutms-(Server->getTimeMS()-starttime)) : timeoutms));
+		size_t read = cs->Read(read_buffer.data(), read_buffer.size(), static_cast<int>(timeoutms>0 ? (timeoutms-(Server->getTimeMS()-starttime)) : timeoutms));
 
 		if(read>0)
 		{
-			if(!dec->put(ret->data(), read))
+			if(!dec->put(read_buffer.data(), read))
 			{
 				has_error=true;
 				return 0;
 			}
 
-			bool l_has_error=false;
-			*ret = dec->get(l_has_error);
-
-			if(l_has_error)
+			if(!dec->get(*ret))
 			{
 				has_error=true;
 				return 0;
@@ -192,11 +195,19 @@ bool InternetServicePipe2::Write( const char *buffer, size_t bsize, int timeoutm
 		last_flush_time=Server->getTimeMS();
 	}
 
-	std::string tosend = enc->get();
+	enc->get(write_buffer);
 
-	if(!tosend.empty())
+	if(!write_buffer.empty())
 	{
-		return cs->Write(tosend, timeoutms, flush);
+		bool ret = cs->Write(write_buffer.data(), write_buffer.size(), timeoutms, flush);
+
+		if(write_buffer.capacity()>max_kept_buffer_size)
+		{
+			//Only keep buffers of the usual chunk size around
+			std::string().swap(write_buffer);
+		}
+
+		return ret;
 	}
 	else
 	{
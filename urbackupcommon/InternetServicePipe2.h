@@ -2,6 +2,7 @@
 
 #include "../Interface/Pipe.h"
 #include <memory>
+#include <vector>
 
 class IAESGCMEncryption;
 class IAESGCMDecryption;
@@ -85,4 +86,6 @@ private:
 
 	std::auto_ptr<IMutex> read_mutex;
 	std::auto_ptr<IMutex> write_mutex;
+
+	std::string write_buffer;
 };
\ No newline at end of file
@@ -0,0 +1,71 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "PipeBufferPool.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+
+namespace
+{
+	//Per buffer size. Enough for the pipes that are busy at the same time
+	const size_t max_free_buffers = 64;
+}
+
+IMutex* PipeBufferPool::mutex = NULL;
+std::map<size_t, std::vector<char*> > PipeBufferPool::free_buffers;
+
+void PipeBufferPool::init_mutex()
+{
+	mutex = Server->createMutex();
+}
+
+char* PipeBufferPool::acquire(size_t bsize)
+{
+	if (mutex != NULL)
+	{
+		IScopedLock lock(mutex);
+
+		std::map<size_t, std::vector<char*> >::iterator it = free_buffers.find(bsize);
+		if (it != free_buffers.end()
+			&& !it->second.empty())
+		{
+			char* ret = it->second.back();
+			it->second.pop_back();
+			return ret;
+		}
+	}
+
+	return new char[bsize];
+}
+
+void PipeBufferPool::release(char* buffer, size_t bsize)
+{
+	if (mutex != NULL)
+	{
+		IScopedLock lock(mutex);
+
+		std::vector<char*>& buffers = free_buffers[bsize];
+		if (buffers.size() < max_free_buffers)
+		{
+			buffers.push_back(buffer);
+			return;
+		}
+	}
+
+	delete[] buffer;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include <map>
+#include <vector>
+
+class IMutex;
+
+/**
+* Scratch buffers shared by the compression and encryption pipes. They
+* only need them while a read or write is running, so connections take
+* a buffer from here instead of each keeping its own. Idle connections
+* then do not hold any of this memory.
+*/
+class PipeBufferPool
+{
+public:
+	static void init_mutex();
+
+	static char* acquire(size_t bsize);
+	static void release(char* buffer, size_t bsize);
+
+private:
+	static IMutex* mutex;
+	static std::map<size_t, std::vector<char*> > free_buffers;
+};
+
+class ScopedPipeBuffer
+{
+public:
+	explicit ScopedPipeBuffer(size_t bsize)
+		: buffer(PipeBufferPool::acquire(bsize)), bsize(bsize)
+	{}
+
+	~ScopedPipeBuffer()
+	{
+		PipeBufferPool::release(buffer, bsize);
+	}
+
+	char* data()
+	{
+		return buffer;
+	}
+
+	size_t size() const
+	{
+		return bsize;
+	}
+
+private:
+	ScopedPipeBuffer(const ScopedPipeBuffer& other);
+	ScopedPipeBuffer& operator=(const ScopedPipeBuffer& other);
+
+	char* buffer;
+	size_t bsize;
+};
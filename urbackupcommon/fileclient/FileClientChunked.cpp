@@ -67,7 +67,7 @@ FileClientChunked::FileClientChunked(IPipe *pipe, bool del_pipe, CTCPStack *stac
 	  nofreespace_callback(nofreespace_callback), reconnection_timeout(300000), identity(identity), received_data_bytes(0),
 	  parent(prev), queue_only(false), queue_callback(NULL), remote_filesize(-1), ofb_pipe(NULL), hashfilesize(-1), did_queue_fc(false), queued_chunks(0),
 	  last_transferred_bytes(0), last_progress_log(0), progress_log_callback(NULL), reconnected(false), needs_flush(false),
-	  real_transferred_bytes(0), queue_next(false), sparse_bytes(0)
+	  real_transferred_bytes(0), queue_next(false), sparse_bytes(0), chunk_source_callback(NULL), chunk_source_bytes(0)
 {
 	has_error=false;
 	if(parent==NULL)
@@ -83,7 +83,8 @@ FileClientChunked::FileClientChunked(IPipe *pipe, bool del_pipe, CTCPStack *stac
 FileClientChunked::FileClientChunked(void)
 	: pipe(NULL), stack(NULL), destroy_pipe(false), transferred_bytes(0), reconnection_callback(NULL), reconnection_timeout(300000), received_data_bytes(0),
 	  parent(NULL), remote_filesize(-1), ofb_pipe(NULL), hashfilesize(-1), did_queue_fc(false), queued_chunks(0), last_transferred_bytes(0), last_progress_log(0),
-	  progress_log_callback(NULL), reconnected(false), real_transferred_bytes(0), queue_next(false), sparse_bytes(0)
+	  progress_log_callback(NULL), reconnected(false), real_transferred_bytes(0), queue_next(false), sparse_bytes(0),
+	  chunk_source_callback(NULL), chunk_source_bytes(0)
 {
 	has_error=true;
 	mutex=NULL;
@@ -150,6 +151,255 @@ _u32 FileClientChunked::GetFileChunked(std::string remotefn, IFile *file, IFile
 	return rc;
 }
 
+_u32 FileClientChunked::GetFileCdc(std::string remotefn, IFile *orig_file, IFile *chunkhashes, CdcChunker& chunker, const std::vector<SCdcChunk>& orig_chunks, IFile *outfile, _i64& predicted_filesize, int64 file_id)
+{
+	if( (parent!=NULL && !parent->queued_fcs.empty())
+		|| (parent==NULL && !queued_fcs.empty()) )
+	{
+		Server->Log("Cannot load file with content-defined chunks while block requests are queued", LL_ERROR);
+		return ERR_INT_ERROR;
+	}
+
+	m_file=orig_file;
+	m_chunkhashes=chunkhashes;
+	m_hashoutput=NULL;
+	m_patchfile=NULL;
+	patch_mode=false;
+	remote_filename=remotefn;
+	curr_file_id=file_id;
+	curr_is_script=false;
+	remote_filesize=-1;
+	last_transferred_bytes=0;
+	file_pos=0;
+
+	if(getPipe()==NULL)
+		return ERR_ERROR;
+
+	setReconnectTries(50);
+
+	int64 orig_filesize=0;
+	if(!orig_chunks.empty())
+	{
+		orig_filesize=orig_chunks[orig_chunks.size()-1].offset+orig_chunks[orig_chunks.size()-1].size;
+	}
+
+	CWData data;
+	data.addUChar(ID_GET_FILE_CDC);
+	data.addString(remotefn);
+	data.addString(identity);
+	data.addChar(0); //version
+	data.addVarInt(file_id);
+	data.addChar(0); //without sparse
+	data.addInt64(0); //file offset
+	data.addInt64(orig_filesize);
+	data.addInt64(predicted_filesize);
+	data.addUChar(0); //flags
+	write_cdc_hashes(data, chunker, orig_filesize, orig_chunks);
+
+	int tries = 10;
+	while (stack->Send(getPipe(), data.getDataPtr(), data.getDataSize(), c_default_timeout, true) != data.getDataSize())
+	{
+		Server->Log("Timeout during content-defined chunking file request. Reconnecting...", LL_DEBUG);
+
+		--tries;
+
+		if (tries == 0
+			|| !Reconnect(false))
+		{
+			Server->Log("Timeout during content-defined chunking file request", LL_ERROR);
+			return ERR_TIMEOUT;
+		}
+	}
+
+	bool in_sync=false;
+	_u32 rc = receiveCdc(chunker, orig_chunks, outfile, predicted_filesize, in_sync);
+
+	if(rc!=ERR_SUCCESS && !in_sync)
+	{
+		//Rest of the reply is still on the way. Start over with a new connection
+		Server->Log("Reconnecting after failed content-defined chunking transfer...", LL_DEBUG);
+		if(!Reconnect(false))
+		{
+			return ERR_CONN_LOST;
+		}
+	}
+
+	if (has_error)
+		return ERR_ERROR;
+
+	return rc;
+}
+
+_u32 FileClientChunked::receiveCdc(CdcChunker& chunker, const std::vector<SCdcChunk>& orig_chunks, IFile *outfile, _i64& filesize_out, bool& in_sync)
+{
+	char id;
+	if(!readCdc(&id, 1))
+	{
+		return ERR_TIMEOUT;
+	}
+
+	switch(id)
+	{
+	case ID_COULDNT_OPEN:
+		in_sync=true;
+		return ERR_CANNOT_OPEN_FILE;
+	case ID_BASE_DIR_LOST:
+		in_sync=true;
+		return ERR_BASE_DIR_LOST;
+	case ID_READ_ERROR:
+		in_sync=true;
+		return ERR_READ_ERROR;
+	case ID_FILESIZE:
+		{
+			_i64 filesize;
+			if(!readCdc(reinterpret_cast<char*>(&filesize), sizeof(filesize)))
+			{
+				return ERR_TIMEOUT;
+			}
+			remote_filesize=little_endian(filesize);
+		} break;
+	default:
+		Server->Log("Unknown Packet ID "+convert(static_cast<int>(id))+" at start of content-defined chunking transfer of "+remote_filename, LL_ERROR);
+		return ERR_ERROR;
+	}
+
+	std::vector<char> buf(chunker.getMaxSize());
+	md5_hash.init();
+
+	while(true)
+	{
+		if(!readCdc(&id, 1))
+		{
+			return ERR_TIMEOUT;
+		}
+
+		switch(id)
+		{
+		case ID_CDC_REF:
+		case ID_CDC_DATA:
+			{
+				_u32 val;
+				if(!readCdc(reinterpret_cast<char*>(&val), sizeof(val)))
+				{
+					return ERR_TIMEOUT;
+				}
+				val=little_endian(val);
+
+				_u32 chunk_size;
+				if(id==ID_CDC_REF)
+				{
+					if(val>=orig_chunks.size())
+					{
+						Server->Log("Chunk reference "+convert(val)+" out of range while loading "+remote_filename, LL_ERROR);
+						return ERR_ERROR;
+					}
+
+					const SCdcChunk& orig_chunk = orig_chunks[val];
+					chunk_size=orig_chunk.size;
+					if(m_file->Read(orig_chunk.offset, &buf[0], chunk_size)!=chunk_size)
+					{
+						Server->Log("Error reading chunk at "+convert(orig_chunk.offset)+" from old file ""+m_file->getFilename()+"". "+os_last_error_str(), LL_ERROR);
+						return ERR_INT_ERROR;
+					}
+				}
+				else
+				{
+					if(val==0 || val>buf.size())
+					{
+						Server->Log("Chunk size "+convert(val)+" out of range while loading "+remote_filename, LL_ERROR);
+						return ERR_ERROR;
+					}
+
+					chunk_size=val;
+					if(!readCdc(&buf[0], chunk_size))
+					{
+						return ERR_TIMEOUT;
+					}
+				}
+
+				md5_hash.update(reinterpret_cast<unsigned char*>(&buf[0]), chunk_size);
+				writeFileRepeat(outfile, &buf[0], chunk_size);
+				if(has_error)
+				{
+					return ERR_ERROR;
+				}
+
+				file_pos+=chunk_size;
+				addReceivedBytes(chunk_size);
+				logTransferProgress();
+			} break;
+		case ID_BLOCK_ERROR:
+			{
+				_u32 ec[2];
+				if(!readCdc(reinterpret_cast<char*>(ec), sizeof(ec)))
+				{
+					return ERR_TIMEOUT;
+				}
+
+				Server->Log("Received error codes (ID_BLOCK_ERROR) ec1=" + convert(ec[0]) + " ec2=" + convert(ec[1]), LL_DEBUG);
+
+				setErrorCodes(ec[0], ec[1]);
+				in_sync=true;
+				return ERR_ERRORCODES;
+			}
+		case ID_CDC_END:
+			{
+				char hash_from_client[big_hash_size];
+				if(!readCdc(hash_from_client, big_hash_size))
+				{
+					return ERR_TIMEOUT;
+				}
+
+				in_sync=true;
+
+				md5_hash.finalize();
+				if(memcmp(md5_hash.raw_digest_int(), hash_from_client, big_hash_size)!=0)
+				{
+					Server->Log("File hash differs after content-defined chunking transfer of "+remote_filename, LL_WARNING);
+					return ERR_HASH;
+				}
+
+				Server->Log("Successful (cdc). Returning filesize " + convert(file_pos), LL_DEBUG);
+				filesize_out=file_pos;
+				return ERR_SUCCESS;
+			}
+		default:
+			Server->Log("Unknown Packet ID "+convert(static_cast<int>(id))+" in content-defined chunking transfer of "+remote_filename+" at pos "+convert(file_pos), LL_ERROR);
+			return ERR_ERROR;
+		}
+	}
+}
+
+bool FileClientChunked::readCdc(char* buf, size_t bsize)
+{
+	size_t read=0;
+	int64 last_data=Server->getTimeMS();
+	while(read<bsize)
+	{
+		size_t rc=getPipe()->Read(buf+read, bsize-read, 1000);
+		if(rc==0)
+		{
+			if(getPipe()->hasError())
+			{
+				Server->Log("Pipe has error during content-defined chunking transfer", LL_DEBUG);
+				return false;
+			}
+
+			if(Server->getTimeMS()-last_data>SERVER_TIMEOUT)
+			{
+				Server->Log("Connection timeout during content-defined chunking transfer", LL_DEBUG);
+				return false;
+			}
+		}
+		else
+		{
+			read+=rc;
+			last_data=Server->getTimeMS();
+		}
+	}
+	return true;
+}
+
 _u32 FileClientChunked::GetFile(std::string remotefn, _i64& filesize_out, int64 file_id, IFile** sparse_extents_f)
 {
 	bool was_prepared = false;
@@ -384,7 +634,7 @@ _u32 FileClientChunked::GetFile(std::string remotefn, _i64& filesize_out, int64
 				{
 					buf[0] = ID_BLOCK_REQUEST;
 					*((_i64*)(buf + 1)) = little_endian(next_chunk*c_checkpoint_dist);
-					buf[1 + sizeof(_i64)] = 1;
+					buf[1 + sizeof(_i64)] = probeBlock(next_chunk*c_checkpoint_dist) ? 2 : 1;
 					buf_size = sizeof(char) * 2 + sizeof(_i64);
 
 					pending_chunks.insert(std::pair<_i64, SChunkHashes>(next_chunk*c_checkpoint_dist, SChunkHashes() ));
@@ -482,17 +732,18 @@ _u32 FileClientChunked::GetFile(std::string remotefn, _i64& filesize_out, int64
 
 						next->setQueueCallback(queue_callback);
 						next->setProgressLogCallback(progress_log_callback);
+						next->setChunkSourceCallback(chunk_source_callback);
 
 						next->setQueueOnly(true);
 
 						_u32 rc;
-						if (patch_mode)
+						if (orig_file!=NULL)
 						{
 							rc = next->GetFilePatch(remotefn, orig_file, patchfile, chunkhashes, hashoutput, predicted_filesize, file_id, is_script, NULL);
 						}
 						else
 						{
-							rc = next->GetFileChunked(remotefn, orig_file, chunkhashes, hashoutput, predicted_filesize, file_id, is_script, NULL);
+							rc = next->GetFileChunked(remotefn, patchfile, chunkhashes, hashoutput, predicted_filesize, file_id, is_script, NULL);
 						}
 
 						if(rc!=ERR_SUCCESS)
@@ -785,6 +1036,7 @@ void FileClientChunked::State_First(void)
 	case ID_UPDATE_CHUNK: need_bytes=sizeof(_i64)+sizeof(_u32); break;
 	case ID_NO_CHANGE: need_bytes=sizeof(_i64); break;
 	case ID_BLOCK_HASH: need_bytes=sizeof(_i64)+big_hash_size; break;
+	case ID_BLOCK_PROBE_HASH: need_bytes=sizeof(_i64)+big_hash_size; break;
 	case ID_BLOCK_ERROR: need_bytes=sizeof(_u32)*2; break;
 	default:
 		Server->Log("Unknown Packet ID "+convert(static_cast<int>(curr_id))+" in State_First"
@@ -1128,6 +1380,14 @@ void FileClientChunked::State_Acc(bool ignore_filesize, bool allow_reconnect, IF
 				Hash_finalize(block_start, blockhash);
 				state=CS_ID_FIRST;
 			}break;
+		case ID_BLOCK_PROBE_HASH:
+			{
+				_i64 block_start;
+				msg.getInt64(&block_start);
+				const char *blockhash=msg.getCurrDataPtr();
+				Hash_probe(block_start, blockhash);
+				state=CS_ID_FIRST;
+			}break;
 		case ID_BLOCK_ERROR:
 			{
 				_u32 ec1 = -1;
@@ -1387,6 +1647,84 @@ void FileClientChunked::Hash_nochange(_i64 curr_pos)
 	}
 }
 
+void FileClientChunked::Hash_probe(_i64 block_start, const char *hash_from_client)
+{
+	std::map<_i64, SChunkHashes>::iterator it=pending_chunks.find(block_start);
+	if(it==pending_chunks.end())
+	{
+		Server->Log("Probed block not requested. ("+convert(block_start)+")", LL_ERROR);
+		logPendingChunks();
+		retval=ERR_ERROR;
+		getfile_done=true;
+		return;
+	}
+
+	_u32 block_size = static_cast<_u32>((std::min)(c_checkpoint_dist, remote_filesize-block_start));
+
+	if(probe_buf.size()<c_checkpoint_dist)
+	{
+		probe_buf.resize(c_checkpoint_dist);
+	}
+
+	if(!patch_mode
+		&& chunk_source_callback!=NULL
+		&& block_start<remote_filesize
+		&& chunk_source_callback->getChunkSource(hash_from_client, block_size, probe_buf.data()) )
+	{
+		VLOG(Server->Log("Block from local chunk source. block_start="+convert(block_start), LL_DEBUG));
+
+		if(!m_file->Seek(block_start))
+		{
+			Server->Log("Chunked Transfer: Seeking failed (probe)", LL_ERROR);
+			retval=ERR_ERROR;
+			getfile_done=true;
+			return;
+		}
+		writeFileRepeat(m_file, probe_buf.data(), block_size);
+		curr_output_fsize = (std::max)(curr_output_fsize, block_start+block_size);
+
+		if(m_hashoutput!=NULL)
+		{
+			m_hashoutput->Seek(chunkhash_file_off+(block_start/c_checkpoint_dist)*chunkhash_single_size);
+			writeFileRepeat(m_hashoutput, hash_from_client, big_hash_size);
+			for(_u32 pos=0;pos<block_size;pos+=c_chunk_size)
+			{
+				_u32 adler = little_endian(urb_adler32(urb_adler32(0, NULL, 0), &probe_buf[pos], (std::min)(c_chunk_size, block_size-pos)));
+				writeFileRepeat(m_hashoutput, reinterpret_cast<char*>(&adler), small_hash_size);
+			}
+		}
+
+		addReceivedBlock(block_start);
+		addChunkSourceBytes(block_size);
+		pending_chunks.erase(it);
+		decrQueuedChunks();
+		return;
+	}
+
+	char buf[2*sizeof(char)+sizeof(_i64)];
+	buf[0]=ID_BLOCK_REQUEST;
+	*((_i64*)(buf+1))=little_endian(block_start);
+	buf[1+sizeof(_i64)]=1;
+
+	if(stack->Send(getPipe(), buf, sizeof(buf), c_default_timeout, false)!=sizeof(buf))
+	{
+		Server->Log("Timeout during whole block request of probed block "+convert(block_start), LL_DEBUG);
+	}
+	else
+	{
+		needs_flush=true;
+	}
+}
+
+bool FileClientChunked::probeBlock(_i64 block_start)
+{
+	return chunk_source_callback!=NULL
+		&& !patch_mode
+		&& !curr_is_script
+		&& remote_filesize>=c_probe_min_filesize
+		&& block_start+c_checkpoint_dist<=remote_filesize;
+}
+
 void FileClientChunked::State_Block(void)
 {
 	size_t rbytes=(std::min)(remaining_bufptr_bytes, (size_t)whole_block_remaining);
@@ -2185,6 +2523,19 @@ void FileClientChunked::addReceivedBytes( size_t bytes )
 	}
 }
 
+void FileClientChunked::addChunkSourceBytes(_i64 bytes)
+{
+	if (parent)
+	{
+		parent->addChunkSourceBytes(bytes);
+	}
+	else
+	{
+		IScopedLock lock(mutex);
+		chunk_source_bytes += bytes;
+	}
+}
+
 void FileClientChunked::addSparseBytes(_i64 bytes)
 {
 	if (parent)
@@ -2250,6 +2601,17 @@ void FileClientChunked::setProgressLogCallback( FileClient::ProgressLogCallback*
 	progress_log_callback=cb;
 }
 
+void FileClientChunked::setChunkSourceCallback(FileClientChunked::ChunkSourceCallback* cb)
+{
+	chunk_source_callback=cb;
+}
+
+_i64 FileClientChunked::getChunkSourceBytes()
+{
+	IScopedLock lock(mutex);
+	return chunk_source_bytes;
+}
+
 void FileClientChunked::setPipe(IPipe* p)
 {
 	if(parent)
@@ -7,6 +7,7 @@
 #include "../../md5.h"
 #include "../../fileservplugin/chunk_settings.h"
 #include "../ExtentIterator.h"
+#include "../CdcChunker.h"
 #include <map>
 #include <deque>
 
@@ -16,6 +17,8 @@ class CTCPStack;
 
 const unsigned int c_max_queued_chunks=1000;
 const unsigned int c_queued_chunks_low=100;
+//Probing costs a round trip per block, so only probe full blocks of larger files
+const _i64 c_probe_min_filesize=4*c_checkpoint_dist;
 
 enum EChunkedState
 {
@@ -52,11 +55,19 @@ public:
 	class QueueCallback
 	{
 	public:
+		//orig_file is NULL if the file should be loaded without base file into patchfile
 		virtual bool getQueuedFileChunked(std::string& remotefn, IFile*& orig_file, IFile*& patchfile, IFile*& chunkhashes, IFsFile*& hashoutput, _i64& predicted_filesize, int64& file_id, bool& is_script) = 0;
 		virtual void unqueueFileChunked(const std::string& remotefn) = 0;
 		virtual void resetQueueChunked() = 0;
 	};
 
+	class ChunkSourceCallback
+	{
+	public:
+		//Fills buf with a local block of size bsize with the given md5 hash
+		virtual bool getChunkSource(const char* big_hash, _u32 bsize, char* buf) = 0;
+	};
+
 	FileClientChunked(IPipe *pipe, bool del_pipe, CTCPStack *stack, FileClientChunked::ReconnectionCallback *reconnection_callback,
 			FileClientChunked::NoFreeSpaceCallback *nofreespace_callback, std::string identity, FileClientChunked* prev);
 	FileClientChunked(void);
@@ -64,6 +75,8 @@ public:
 
 	_u32 GetFileChunked(std::string remotefn, IFile *file, IFile *chunkhashes, IFsFile *hashoutput, _i64& predicted_filesize, int64 file_id, bool is_script, IFile** sparse_extents_f);
 	_u32 GetFilePatch(std::string remotefn, IFile *orig_file, IFile *patchfile, IFile *chunkhashes, IFsFile *hashoutput, _i64& predicted_filesize, int64 file_id, bool is_script, IFile** sparse_extents_f);
+	//Loads the whole file into outfile. Chunks the client already has in orig_file (orig_chunks) are copied from there
+	_u32 GetFileCdc(std::string remotefn, IFile *orig_file, IFile *chunkhashes, CdcChunker& chunker, const std::vector<SCdcChunk>& orig_chunks, IFile *outfile, _i64& predicted_filesize, int64 file_id);
 
 	bool hasError(void);
 
@@ -87,6 +100,10 @@ public:
 
 	void setProgressLogCallback(FileClient::ProgressLogCallback* cb);
 
+	void setChunkSourceCallback(FileClientChunked::ChunkSourceCallback* cb);
+
+	_i64 getChunkSourceBytes();
+
 	_u32 getErrorcode1();
 
 	_u32 getErrorcode2();
@@ -107,6 +124,9 @@ private:
 
 	_u32 handle_data(char* buf, size_t bsize, bool ignore_filesize, bool allow_reconnect, IFile** sparse_extents_f);
 
+	_u32 receiveCdc(CdcChunker& chunker, const std::vector<SCdcChunk>& orig_chunks, IFile *outfile, _i64& filesize_out, bool& in_sync);
+	bool readCdc(char* buf, size_t bsize);
+
 	void State_First(void);
 	void State_Acc(bool ignore_filesize, bool allow_reconnect, IFile** sparse_extents_f);
 	void State_Block(void);
@@ -116,6 +136,9 @@ private:
 	void Hash_finalize(_i64 curr_pos, const char *hash_from_client);
 	void Hash_upto(_i64 chunk_start, bool &new_block);
 	void Hash_nochange(_i64 curr_pos);
+	void Hash_probe(_i64 block_start, const char *hash_from_client);
+
+	bool probeBlock(_i64 block_start);
 
 	void writeFileRepeat(IFile *f, const char *buf, size_t bsize);
 	void writePatch(_i64 pos, unsigned int length, char *buf, bool last);
@@ -151,6 +174,8 @@ private:
 
 	void addSparseBytes(_i64 bytes);
 
+	void addChunkSourceBytes(_i64 bytes);
+
 	void addReceivedBlock(_i64 block_start);
 
 	IPipe* ofbPipe();
@@ -268,6 +293,10 @@ private:
 	int64 last_progress_log;
 	FileClient::ProgressLogCallback* progress_log_callback;
 
+	FileClientChunked::ChunkSourceCallback* chunk_source_callback;
+	std::vector<char> probe_buf;
+	_i64 chunk_source_bytes;
+
 	_u32 errorcode1;
 	_u32 errorcode2;
 	
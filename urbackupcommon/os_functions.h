@@ -125,6 +125,9 @@ bool copy_file(const std::string &src, const std::string &dst, bool flush = fals
 class IFile;
 bool copy_file(IFile *fsrc, IFile *fdst, std::string* error_str = NULL);
 
+class IFsFile;
+bool os_clone_range(IFsFile* src, int64 src_offset, IFsFile* dst, int64 dst_offset, int64 size);
+
 bool os_path_absolute(const std::string& path);
 
 bool os_sync(const std::string& path);
@@ -48,6 +48,17 @@
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <linux/fs.h>
+#ifndef FICLONERANGE
+//Kernel headers older than 4.5 only know the btrfs name of this ioctl
+struct file_clone_range
+{
+	__s64 src_fd;
+	__u64 src_offset;
+	__u64 src_length;
+	__u64 dest_offset;
+};
+#define FICLONERANGE _IOW(0x94, 13, struct file_clone_range)
+#endif
 #endif
 #include <stack>
 
@@ -340,6 +351,28 @@ bool os_create_reflink(const std::string &linkname, const std::string &fname)
 #endif
 }
 
+bool os_clone_range(IFsFile* src, int64 src_offset, IFsFile* dst, int64 dst_offset, int64 size)
+{
+#ifdef __linux__
+	file_clone_range args;
+	args.src_fd = src->getOsHandle();
+	args.src_offset = src_offset;
+	args.src_length = size;
+	args.dest_offset = dst_offset;
+
+	int rc = ioctl(dst->getOsHandle(), FICLONERANGE, &args);
+
+	if (rc)
+	{
+		Log("Clone range ioctl failed. errno=" + convert(errno), LL_INFO);
+	}
+
+	return rc == 0;
+#else
+	return false;
+#endif
+}
+
 bool os_create_hardlink(const std::string &linkname, const std::string &fname, bool use_ioref, bool* too_many_links)
 {
 	if(too_many_links!=NULL)
@@ -349,6 +382,8 @@ bool os_create_hardlink(const std::string &linkname, const std::string &fname, b
 		return os_create_reflink(linkname, fname);
 		
     int rc=link((fname).c_str(), (linkname).c_str());
+	if(rc!=0 && errno==EMLINK && too_many_links!=NULL)
+		*too_many_links=true;
 	return rc==0;
 }
 
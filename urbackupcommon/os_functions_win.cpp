@@ -711,6 +711,19 @@ bool os_create_reflink(const std::string &linkname, const std::string &fname)
 	return true;
 }
 
+bool os_clone_range(IFsFile* src, int64 src_offset, IFsFile* dst, int64 dst_offset, int64 size)
+{
+	reflink::DUPLICATE_EXTENTS_DATA reflink_data;
+	reflink_data.FileHandle = src->getOsHandle();
+	reflink_data.SourceFileOffset.QuadPart = src_offset;
+	reflink_data.TargetFileOffset.QuadPart = dst_offset;
+	reflink_data.ByteCount.QuadPart = size;
+
+	ULONG ret_bytes;
+	return DeviceIoControl(dst->getOsHandle(), reflink::LOCAL_FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+		&reflink_data, sizeof(reflink_data), NULL, 0, &ret_bytes, NULL)!=FALSE;
+}
+
 bool os_create_hardlink(const std::string &linkname, const std::string &fname, bool use_ioref, bool* too_many_links)
 {
 	if (use_ioref)
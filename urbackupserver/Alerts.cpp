@@ -128,6 +128,22 @@ namespace
 		return ret;
 	}
 
+	struct SAlertClient
+	{
+		size_t res_idx;
+		int clientid;
+		bool file_ok;
+		bool image_ok;
+		bool no_file_backups;
+		bool no_images;
+		bool complex_file_interval;
+		bool complex_image_interval;
+		int update_freq_file_incr;
+		int update_freq_file_full;
+		int update_freq_image_incr;
+		int update_freq_image_full;
+	};
+
 	class MailBridge : public ILuaInterpreter::IEMailFunction
 	{
 	public:
@@ -191,6 +207,9 @@ void Alerts::operator()()
 		db_results res = q_get_alert_clients->Read();
 		q_get_alert_clients->Reset();
 
+		std::map<int, std::vector<SAlertClient> > batch_clients;
+		std::map<int, std::vector<ILuaInterpreter::SBatchItem> > batch_items;
+
 		for (size_t i = 0; i < res.size(); ++i)
 		{
 			int clientid = watoi(res[i]["clientid"]);
@@ -205,18 +224,25 @@ void Alerts::operator()()
 
 			if (!it->second.code.empty())
 			{
-				ILuaInterpreter::Param params_raw;
-				ILuaInterpreter::Param::params_map& params = *params_raw.u.params;
+				std::vector<ILuaInterpreter::SBatchItem>& items = batch_items[script_id];
+				items.push_back(ILuaInterpreter::SBatchItem());
+				ILuaInterpreter::SBatchItem& item = items.back();
+
+				SAlertClient client;
+				client.res_idx = i;
+				client.clientid = clientid;
+
+				ILuaInterpreter::Param::params_map& params = *item.params.u.params;
 				params["clientid"] = clientid;
 				params["clientname"] = res[i]["clientname"];
-				int update_freq_file_incr = server_settings.getUpdateFreqFileIncr();
-				int update_freq_file_full = server_settings.getUpdateFreqFileFull();
-				params["incr_file_interval"] = update_freq_file_incr;
-				params["full_file_interval"] = update_freq_file_full;
-				int update_freq_image_incr = server_settings.getUpdateFreqImageIncr();
-				int update_freq_image_full = server_settings.getUpdateFreqImageFull();
-				params["incr_image_interval"] = update_freq_image_incr;
-				params["full_image_interval"] = update_freq_image_full;
+				client.update_freq_file_incr = server_settings.getUpdateFreqFileIncr();
+				client.update_freq_file_full = server_settings.getUpdateFreqFileFull();
+				params["incr_file_interval"] = client.update_freq_file_incr;
+				params["full_file_interval"] = client.update_freq_file_full;
+				client.update_freq_image_incr = server_settings.getUpdateFreqImageIncr();
+				client.update_freq_image_full = server_settings.getUpdateFreqImageFull();
+				params["incr_image_interval"] = client.update_freq_image_incr;
+				params["full_image_interval"] = client.update_freq_image_full;
 				params["no_images"] = server_settings.getSettings()->no_images;
 				params["no_file_backups"] = server_settings.getSettings()->no_file_backups;
 				params["os_simple"] = res[i]["os_simple"];
@@ -236,15 +262,17 @@ void Alerts::operator()()
 				params["image_support"] = (watoi(res[i]["capa"]) & CAPA_NO_IMAGE_BACKUPS) == 0;
 
 				SSettings* settings = server_settings.getSettings();
+				client.no_file_backups = settings->no_file_backups;
+				client.no_images = settings->no_images;
 
-				bool complex_file_interval = settings->update_freq_full.find(";") != std::string::npos
+				client.complex_file_interval = settings->update_freq_full.find(";") != std::string::npos
 					|| settings->update_freq_incr.find(";") != std::string::npos;
 
-				bool complex_image_interval = settings->update_freq_image_full.find(";") != std::string::npos
+				client.complex_image_interval = settings->update_freq_image_full.find(";") != std::string::npos
 					|| settings->update_freq_image_incr.find(";") != std::string::npos;
 
-				if ( complex_file_interval
-					|| complex_image_interval )
+				if ( client.complex_file_interval
+					|| client.complex_image_interval )
 				{
 					params["complex_interval"] = true;
 				}
@@ -253,10 +281,10 @@ void Alerts::operator()()
 					params["complex_interval"] = false;
 				}
 
-				bool file_ok = res[i]["file_ok"] == "1";
-				params["file_ok"] = file_ok;
-				bool image_ok = res[i]["image_ok"] == "1";
-				params["image_ok"] = image_ok;
+				client.file_ok = res[i]["file_ok"] == "1";
+				params["file_ok"] = client.file_ok;
+				client.image_ok = res[i]["image_ok"] == "1";
+				params["image_ok"] = client.image_ok;
 
 				str_map nondefault_params;
 				ParseParamStrHttp(server_settings.getSettings()->alert_params, &nondefault_params);
@@ -297,20 +325,58 @@ void Alerts::operator()()
 					}
 				}
 
-				std::string state = res[i]["alerts_state"];
-				std::string global_state = it->second.global;
-				int64 ret2;
-				int64 ret = lua_interpreter->runScript(it->second.code, params_raw, ret2, state, 
-					it->second.state_mem[clientid], global_state, it->second.global_mem, funcs);
+				item.state = res[i]["alerts_state"];
+				item.state_mem = it->second.state_mem[clientid];
+
+				batch_clients[script_id].push_back(client);
+			}
+		}
+
+		for (std::map<int, std::vector<ILuaInterpreter::SBatchItem> >::iterator it_batch = batch_items.begin();
+			it_batch != batch_items.end(); ++it_batch)
+		{
+			int script_id = it_batch->first;
+			SScript& script = alert_scripts[script_id];
+			std::vector<ILuaInterpreter::SBatchItem>& items = it_batch->second;
+			std::vector<SAlertClient>& clients = batch_clients[script_id];
+
+			std::string global_state = script.global;
+			int64 starttime = Server->getTimeMS();
+			if (!lua_interpreter->runScriptBatch(script.code, items, global_state, script.global_mem, funcs))
+			{
+				Server->Log("Error loading alert script id " + convert(script_id), LL_ERROR);
+				continue;
+			}
+
+			int64 max_run_time = 0;
+			for (size_t j = 0; j < items.size(); ++j)
+			{
+				max_run_time = (std::max)(max_run_time, items[j].run_time_ms);
+			}
+
+			Server->Log("Alert script id " + convert(script_id) + " evaluated " + convert(items.size()) + " clients in "
+				+ PrettyPrintTime(Server->getTimeMS() - starttime) + " (max " + convert(max_run_time) + "ms per client)", LL_DEBUG);
+
+			for (size_t j = 0; j < items.size(); ++j)
+			{
+				ILuaInterpreter::SBatchItem& item = items[j];
+				SAlertClient& client = clients[j];
+				size_t i = client.res_idx;
+				int64 ret = item.ret;
+				int64 ret2 = item.ret2;
+				bool file_ok = client.file_ok;
+				bool image_ok = client.image_ok;
 				bool needs_update = false;
+
+				script.state_mem[client.clientid] = item.state_mem;
 				
 				if (ret>=0)
 				{
 					file_ok = !(ret & 1);
 					image_ok = !(ret & 2);
 
-					if (file_ok != params["file_ok"].u.b
-						|| image_ok != params["image_ok"].u.b)
+					if (file_ok != client.file_ok
+						|| image_ok != client.image_ok)
 					{
 						needs_update = true;
 					}
@@ -340,7 +406,7 @@ void Alerts::operator()()
 					}
 				}
 
-				if (state != res[i]["alerts_state"])
+				if (item.state != res[i]["alerts_state"])
 				{
 					needs_update = true;
 				}
@@ -348,7 +414,7 @@ void Alerts::operator()()
 				int i_file_ok = file_ok ? 1 : 0;
 				int i_image_ok = image_ok ? 1 : 0;
 
-				if (settings->no_file_backups)
+				if (client.no_file_backups)
 				{
 					i_file_ok = -1;
 					if (res[i]["file_ok"] != "-1")
@@ -356,9 +422,9 @@ void Alerts::operator()()
 						needs_update = true;
 					}
 				}
-				else if (!complex_file_interval
-					&& update_freq_file_incr < 0
-					&& update_freq_file_full < 0)
+				else if (!client.complex_file_interval
+					&& client.update_freq_file_incr < 0
+					&& client.update_freq_file_full < 0)
 				{
 					i_file_ok = -1;
 					if (res[i]["file_ok"] != "-1")
@@ -367,7 +433,7 @@ void Alerts::operator()()
 					}
 				}
 
-				if (settings->no_images)
+				if (client.no_images)
 				{
 					i_image_ok = -1;
 					if (res[i]["image_ok"] != "-1")
@@ -375,9 +441,9 @@ void Alerts::operator()()
 						needs_update = true;
 					}
 				}
-				else if (!complex_image_interval
-					&& update_freq_image_full < 0
-					&& update_freq_image_incr < 0)
+				else if (!client.complex_image_interval
+					&& client.update_freq_image_full < 0
+					&& client.update_freq_image_incr < 0)
 				{
 					i_image_ok = -1;
 					if (res[i]["image_ok"] != "-1")
@@ -391,22 +457,22 @@ void Alerts::operator()()
 					q_update_client->Bind(i_file_ok);
 					q_update_client->Bind(i_image_ok);
 					q_update_client->Bind(next_check);
-					q_update_client->Bind(state.c_str(), state.size());
-					q_update_client->Bind(clientid);
+					q_update_client->Bind(item.state.c_str(), item.state.size());
+					q_update_client->Bind(client.clientid);
 					q_update_client->Write();
 					q_update_client->Reset();
 				}
+			}
 
-				if (global_state != it->second.global)
-				{
-					it->second.global = global_state;
+			if (global_state != script.global)
+			{
+				script.global = global_state;
 
-					q_update_global_state->Bind(global_state.c_str(), global_state.size());
-					q_update_global_state->Bind(script_id);
-					q_update_global_state->Write();
-					q_update_global_state->Reset();
-				}
+				q_update_global_state->Bind(global_state.c_str(), global_state.size());
+				q_update_global_state->Bind(script_id);
+				q_update_global_state->Write();
+				q_update_global_state->Reset();
 			}
 		}
 	}
-}
+}
\ No newline at end of file
@@ -0,0 +1,624 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "BandwidthScheduler.h"
+#include "ThrottleUpdater.h"
+#include "server.h"
+#include "database.h"
+#include "../Interface/Server.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/Database.h"
+#include "../Interface/Query.h"
+#include "../stringtools.h"
+#include <algorithm>
+
+namespace
+{
+	const int64 schedule_interval_ms = 100;
+	const double unlimited_bps = 1e15;
+	//Non-throttled streams may grow by this factor per interval
+	const double demand_headroom = 1.5;
+	const double min_demand_bps = 32 * 1024;
+	const double burst_ms = 50;
+	const double min_burst_bytes = 16 * 1024;
+}
+
+BandwidthScheduler* BandwidthScheduler::instance = NULL;
+
+BandwidthScheduler::SNode::SNode(SNode* parent, IPipeThrottlerUpdater* updater)
+	: parent(parent), stream(NULL), weight(1),
+	limit_bps(0), percent_max(false), updater(updater),
+	update_interval(updater!=NULL ? updater->getUpdateIntervalMs() : -1),
+	lastupdatetime(0), percent_throttler(NULL),
+	rate(0), demand(0), alloc(unlimited_bps)
+{
+}
+
+BandwidthScheduler::SNode::~SNode()
+{
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		delete children[i];
+	}
+	if (updater != NULL)
+	{
+		Server->destroy(updater);
+	}
+	if (percent_throttler != NULL)
+	{
+		Server->destroy(percent_throttler);
+	}
+}
+
+void BandwidthScheduler::init()
+{
+	instance = new BandwidthScheduler;
+	instance->ticket = Server->getThreadPool()->execute(instance, "bandwidth scheduler");
+}
+
+void BandwidthScheduler::destroy()
+{
+	if (instance == NULL)
+	{
+		return;
+	}
+
+	{
+		IScopedLock lock(instance->mutex);
+		instance->do_quit = true;
+	}
+
+	Server->getThreadPool()->waitFor(instance->ticket);
+
+	delete instance;
+	instance = NULL;
+}
+
+BandwidthScheduler* BandwidthScheduler::getInstance()
+{
+	return instance;
+}
+
+BandwidthScheduler::BandwidthScheduler()
+	: mutex(Server->createMutex()), do_quit(false),
+	ticket(ILLEGAL_THREADPOOL_TICKET), lasttime(Server->getTimeMS())
+{
+	roots[0] = new SNode(NULL, new ThrottleUpdater(-1, ThrottleScope_GlobalLocal));
+	roots[1] = new SNode(NULL, new ThrottleUpdater(-1, ThrottleScope_GlobalInternet));
+}
+
+BandwidthScheduler::~BandwidthScheduler()
+{
+	delete roots[0];
+	delete roots[1];
+	Server->destroy(mutex);
+}
+
+IPipeThrottler* BandwidthScheduler::createStreamThrottler(int clientid, bool internet)
+{
+	int groupid = 0;
+	{
+		IScopedLock lock(mutex);
+		std::map<int, int>::iterator it = client_groups.find(clientid);
+		if (it != client_groups.end())
+		{
+			groupid = it->second;
+		}
+		else
+		{
+			groupid = -1;
+		}
+	}
+
+	if (groupid == -1)
+	{
+		IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+		IQuery* q = db->Prepare("SELECT groupid FROM clients WHERE id=?", false);
+		q->Bind(clientid);
+		db_results res = q->Read();
+		db->destroyQuery(q);
+
+		groupid = res.empty() ? 0 : watoi(res[0]["groupid"]);
+	}
+
+	StreamThrottler* ret = new StreamThrottler(this, clientid);
+
+	IScopedLock lock(mutex);
+	client_groups[clientid] = groupid;
+
+	SNode* client_node = getClientNode(clientid, internet);
+	SNode* stream_node = new SNode(NULL, NULL);
+	stream_node->stream = ret;
+	attach(client_node, stream_node);
+
+	return ret;
+}
+
+void BandwidthScheduler::removeStream(StreamThrottler* stream)
+{
+	IScopedLock lock(mutex);
+
+	std::map<int, SNode*>::iterator it = client_nodes.find(stream->getClientid());
+	if (it == client_nodes.end())
+	{
+		return;
+	}
+
+	SNode* client_node = it->second;
+	for (size_t i = 0; i < client_node->children.size(); ++i)
+	{
+		SNode* node = client_node->children[i];
+		if (node->stream == stream)
+		{
+			detach(node);
+			delete node;
+			return;
+		}
+	}
+}
+
+void BandwidthScheduler::setClientInternet(int clientid, bool internet)
+{
+	IScopedLock lock(mutex);
+
+	std::map<int, bool>::iterator it = client_internet.find(clientid);
+	if (it == client_internet.end()
+		|| it->second == internet)
+	{
+		return;
+	}
+
+	it->second = internet;
+
+	SNode* client_node = client_nodes[clientid];
+	detach(client_node);
+	attach(getGroupNode(internet, client_groups[clientid]), client_node);
+
+	if (client_node->updater != NULL)
+	{
+		Server->destroy(client_node->updater);
+	}
+	client_node->updater = new ThrottleUpdater(clientid, internet ? ThrottleScope_Internet : ThrottleScope_Local);
+	client_node->lastupdatetime = 0;
+}
+
+void BandwidthScheduler::changeGlobalLimit(bool internet, int speed_bps)
+{
+	bool percent_max;
+	size_t bps = BackupServer::throttleSpeedToBps(speed_bps, percent_max);
+
+	IScopedLock lock(mutex);
+	setLimit(roots[internet ? 1 : 0], bps, percent_max);
+}
+
+void BandwidthScheduler::changeClientLimit(int clientid, size_t bps, bool percent_max)
+{
+	IScopedLock lock(mutex);
+
+	std::map<int, SNode*>::iterator it = client_nodes.find(clientid);
+	if (it != client_nodes.end())
+	{
+		setLimit(it->second, bps, percent_max);
+	}
+}
+
+void BandwidthScheduler::changeClientUpdater(int clientid, IPipeThrottlerUpdater* updater)
+{
+	IScopedLock lock(mutex);
+
+	std::map<int, SNode*>::iterator it = client_nodes.find(clientid);
+	if (it == client_nodes.end())
+	{
+		Server->destroy(updater);
+		return;
+	}
+
+	SNode* client_node = it->second;
+	if (client_node->updater != NULL)
+	{
+		Server->destroy(client_node->updater);
+	}
+	client_node->updater = updater;
+	client_node->update_interval = updater->getUpdateIntervalMs();
+	client_node->lastupdatetime = 0;
+}
+
+std::map<int, BandwidthScheduler::SClientRate> BandwidthScheduler::getClientRates()
+{
+	IScopedLock lock(mutex);
+
+	std::map<int, SClientRate> ret;
+	for (std::map<int, SNode*>::iterator it = client_nodes.begin();
+		it != client_nodes.end(); ++it)
+	{
+		if (it->second->children.empty())
+		{
+			continue;
+		}
+
+		SClientRate& rate = ret[it->first];
+		rate.rate_bps = static_cast<int64>(it->second->rate + 0.5);
+		rate.limited = it->second->alloc < unlimited_bps;
+		rate.alloc_bps = rate.limited ? static_cast<int64>(it->second->alloc + 0.5) : -1;
+	}
+
+	return ret;
+}
+
+void BandwidthScheduler::operator()()
+{
+	while (true)
+	{
+		{
+			IScopedLock lock(mutex);
+			if (do_quit)
+			{
+				break;
+			}
+
+			int64 ctime = Server->getTimeMS();
+			int64 passed_time = (std::max)(static_cast<int64>(1), ctime - lasttime);
+			lasttime = ctime;
+
+			updateLimit(roots[0], ctime);
+			updateLimit(roots[1], ctime);
+			for (std::map<int, SNode*>::iterator it = client_nodes.begin();
+				it != client_nodes.end(); ++it)
+			{
+				updateLimit(it->second, ctime);
+			}
+
+			for (size_t i = 0; i < 2; ++i)
+			{
+				collect(roots[i], passed_time);
+				computeDemand(roots[i]);
+				allocate(roots[i], unlimited_bps);
+			}
+		}
+
+		Server->wait(schedule_interval_ms);
+	}
+}
+
+BandwidthScheduler::SNode* BandwidthScheduler::getGroupNode(bool internet, int groupid)
+{
+	std::pair<bool, int> key(internet, groupid);
+	std::map<std::pair<bool, int>, SNode*>::iterator it = group_nodes.find(key);
+	if (it != group_nodes.end())
+	{
+		return it->second;
+	}
+
+	SNode* node = new SNode(NULL, NULL);
+	attach(roots[internet ? 1 : 0], node);
+	group_nodes[key] = node;
+	return node;
+}
+
+BandwidthScheduler::SNode* BandwidthScheduler::getClientNode(int clientid, bool internet)
+{
+	std::map<int, SNode*>::iterator it = client_nodes.find(clientid);
+	if (it != client_nodes.end())
+	{
+		return it->second;
+	}
+
+	SNode* node = new SNode(NULL, new ThrottleUpdater(clientid,
+		internet ? ThrottleScope_Internet : ThrottleScope_Local));
+	attach(getGroupNode(internet, client_groups[clientid]), node);
+	client_nodes[clientid] = node;
+	client_internet[clientid] = internet;
+	return node;
+}
+
+void BandwidthScheduler::attach(SNode* parent, SNode* node)
+{
+	node->parent = parent;
+	parent->children.push_back(node);
+}
+
+void BandwidthScheduler::detach(SNode* node)
+{
+	std::vector<SNode*>& siblings = node->parent->children;
+	siblings.erase(std::remove(siblings.begin(), siblings.end(), node), siblings.end());
+	node->parent = NULL;
+}
+
+void BandwidthScheduler::updateLimit(SNode* node, int64 ctime)
+{
+	if (node->updater == NULL
+		|| node->update_interval < 0
+		|| (node->lastupdatetime != 0
+			&& ctime - node->lastupdatetime <= node->update_interval))
+	{
+		return;
+	}
+
+	bool percent_max;
+	size_t bps = node->updater->getThrottleLimit(percent_max);
+	if (bps == std::string::npos)
+	{
+		bps = 0;
+	}
+	setLimit(node, bps, percent_max);
+	node->lastupdatetime = ctime;
+}
+
+void BandwidthScheduler::setLimit(SNode* node, size_t bps, bool percent_max)
+{
+	node->limit_bps = bps;
+	node->percent_max = percent_max;
+
+	//Limits relative to the probed maximum speed are left to the probing throttler
+	if (percent_max && bps > 0)
+	{
+		if (node->percent_throttler == NULL)
+		{
+			node->percent_throttler = Server->createPipeThrottler(bps, true);
+		}
+		else
+		{
+			node->percent_throttler->changeThrottleLimit(bps, true);
+		}
+	}
+}
+
+void BandwidthScheduler::collect(SNode* node, int64 passed_time)
+{
+	if (node->stream != NULL)
+	{
+		bool throttled;
+		double curr_rate = node->stream->collectBytes(throttled)*1000.0 / passed_time;
+
+		node->demand = throttled ? unlimited_bps
+			: (std::max)((std::max)(curr_rate, node->rate)*demand_headroom, min_demand_bps);
+		node->rate = 0.5*node->rate + 0.5*curr_rate;
+		return;
+	}
+
+	node->rate = 0;
+	for (size_t i = 0; i < node->children.size(); ++i)
+	{
+		collect(node->children[i], passed_time);
+		node->rate += node->children[i]->rate;
+	}
+}
+
+double BandwidthScheduler::computeDemand(SNode* node)
+{
+	if (node->stream != NULL)
+	{
+		return node->demand;
+	}
+
+	double demand = 0;
+	for (size_t i = 0; i < node->children.size(); ++i)
+	{
+		demand += computeDemand(node->children[i]);
+	}
+
+	if (!node->percent_max && node->limit_bps > 0)
+	{
+		demand = (std::min)(demand, static_cast<double>(node->limit_bps));
+	}
+
+	node->demand = (std::min)(demand, unlimited_bps);
+	return node->demand;
+}
+
+void BandwidthScheduler::allocate(SNode* node, double cap)
+{
+	if (!node->percent_max && node->limit_bps > 0)
+	{
+		cap = (std::min)(cap, static_cast<double>(node->limit_bps));
+	}
+
+	node->alloc = cap;
+
+	if (node->stream != NULL)
+	{
+		applyAllocation(node);
+		return;
+	}
+
+	size_t n = node->children.size();
+	std::vector<double> child_alloc(n, unlimited_bps);
+
+	if (cap < unlimited_bps && n > 0)
+	{
+		//Weighted max-min fairness: children wanting less than their share
+		//get what they want, the rest is split between the others
+		std::vector<bool> open(n, true);
+		size_t n_open = n;
+		double remaining = cap;
+		bool changed = true;
+		while (changed && n_open > 0)
+		{
+			changed = false;
+
+			double wsum = 0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (open[i]) wsum += node->children[i]->weight;
+			}
+
+			double pass_remaining = remaining;
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (!open[i]) continue;
+
+				double share = pass_remaining*node->children[i]->weight / wsum;
+				if (node->children[i]->demand <= share)
+				{
+					child_alloc[i] = node->children[i]->demand;
+					remaining -= child_alloc[i];
+					open[i] = false;
+					--n_open;
+					changed = true;
+				}
+			}
+		}
+
+		double wsum = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (open[i] || n_open == 0) wsum += node->children[i]->weight;
+		}
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (open[i])
+			{
+				child_alloc[i] = remaining*node->children[i]->weight / wsum;
+			}
+			else if (n_open == 0 && remaining > 0)
+			{
+				//Everyone is satisfied. Hand out the rest so that nobody
+				//is throttled below the limit.
+				child_alloc[i] += remaining*node->children[i]->weight / wsum;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		allocate(node->children[i], child_alloc[i]);
+	}
+}
+
+void BandwidthScheduler::applyAllocation(SNode* node)
+{
+	SNode* client_node = node->parent;
+	SNode* root_node = client_node->parent->parent;
+
+	node->stream->setAllocation(node->alloc,
+		(root_node->percent_max && root_node->limit_bps>0) ? root_node->percent_throttler : NULL,
+		(client_node->percent_max && client_node->limit_bps>0) ? client_node->percent_throttler : NULL);
+}
+
+StreamThrottler::StreamThrottler(BandwidthScheduler* scheduler, int clientid)
+	: scheduler(scheduler), clientid(clientid),
+	mutex(Server->createMutex()), bytes(0), throttled(false),
+	alloc_bps(unlimited_bps), tokens(0), lastrefilltime(Server->getTimeMS())
+{
+	percent_throttlers[0] = NULL;
+	percent_throttlers[1] = NULL;
+}
+
+StreamThrottler::~StreamThrottler()
+{
+	scheduler->removeStream(this);
+	Server->destroy(mutex);
+}
+
+bool StreamThrottler::addBytes(size_t n_bytes, bool wait)
+{
+	unsigned int sleeptime = 0;
+	IPipeThrottler* curr_percent_throttlers[2];
+	{
+		IScopedLock lock(mutex);
+
+		bytes += n_bytes;
+
+		if (alloc_bps < unlimited_bps)
+		{
+			int64 ctime = Server->getTimeMS();
+			tokens += alloc_bps*(ctime - lastrefilltime) / 1000.0;
+			lastrefilltime = ctime;
+
+			double burst = (std::max)(alloc_bps*burst_ms / 1000.0, min_burst_bytes);
+			if (tokens > burst)
+			{
+				tokens = burst;
+			}
+
+			tokens -= n_bytes;
+
+			if (tokens < 0)
+			{
+				throttled = true;
+				sleeptime = static_cast<unsigned int>(-tokens*1000.0 / (std::max)(alloc_bps, 1.0)) + 1;
+			}
+		}
+
+		curr_percent_throttlers[0] = percent_throttlers[0];
+		curr_percent_throttlers[1] = percent_throttlers[1];
+	}
+
+	bool ret = true;
+	for (size_t i = 0; i < 2; ++i)
+	{
+		if (curr_percent_throttlers[i] != NULL
+			&& !curr_percent_throttlers[i]->addBytes(n_bytes, wait))
+		{
+			ret = false;
+		}
+	}
+
+	if (sleeptime > 0)
+	{
+		if (wait)
+		{
+			Server->wait(sleeptime);
+		}
+		return false;
+	}
+
+	return ret;
+}
+
+void StreamThrottler::changeThrottleLimit(size_t bps, bool p_percent_max)
+{
+	scheduler->changeClientLimit(clientid, bps, p_percent_max);
+}
+
+void StreamThrottler::changeThrottleUpdater(IPipeThrottlerUpdater* new_updater)
+{
+	scheduler->changeClientUpdater(clientid, new_updater);
+}
+
+int StreamThrottler::getClientid()
+{
+	return clientid;
+}
+
+int64 StreamThrottler::collectBytes(bool& p_throttled)
+{
+	IScopedLock lock(mutex);
+	int64 ret = bytes;
+	bytes = 0;
+	p_throttled = throttled;
+	throttled = false;
+	return ret;
+}
+
+void StreamThrottler::setAllocation(double bps, IPipeThrottler* percent_global, IPipeThrottler* percent_client)
+{
+	IScopedLock lock(mutex);
+
+	if (alloc_bps >= unlimited_bps
+		&& bps < unlimited_bps)
+	{
+		tokens = 0;
+		lastrefilltime = Server->getTimeMS();
+	}
+
+	alloc_bps = bps;
+	percent_throttlers[0] = percent_global;
+	percent_throttlers[1] = percent_client;
+}
@@ -0,0 +1,152 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+
+#include "../Interface/PipeThrottler.h"
+#include "../Interface/Thread.h"
+#include "../Interface/Mutex.h"
+#include <map>
+#include <vector>
+#include <string>
+
+enum EBandwidthStream
+{
+	EBandwidthStream_Commands = 0,
+	EBandwidthStream_Files,
+	EBandwidthStream_Chunked,
+	EBandwidthStream_Count
+};
+
+class StreamThrottler;
+
+/**
+* Shares the backup bandwidth with a hierarchy of token buckets
+* (global -> client group -> client -> stream). A scheduler thread measures
+* the rate of every stream each interval and splits the limit of every node
+* with weighted max-min fairness between its children that want more, so
+* that idle clients do not hold back bandwidth and busy clients get equal
+* shares. Writes only take the lock of their own stream and never sleep
+* while holding a lock.
+*/
+class BandwidthScheduler : public IThread
+{
+public:
+	struct SClientRate
+	{
+		int64 rate_bps;
+		int64 alloc_bps;
+		bool limited;
+	};
+
+	static void init();
+	static void destroy();
+	static BandwidthScheduler* getInstance();
+
+	IPipeThrottler* createStreamThrottler(int clientid, bool internet);
+
+	void setClientInternet(int clientid, bool internet);
+
+	void changeGlobalLimit(bool internet, int speed_bps);
+
+	std::map<int, SClientRate> getClientRates();
+
+	void operator()();
+
+	void removeStream(StreamThrottler* stream);
+	void changeClientLimit(int clientid, size_t bps, bool percent_max);
+	void changeClientUpdater(int clientid, IPipeThrottlerUpdater* updater);
+
+private:
+	struct SNode
+	{
+		SNode(SNode* parent, IPipeThrottlerUpdater* updater);
+		~SNode();
+
+		SNode* parent;
+		std::vector<SNode*> children;
+		StreamThrottler* stream;
+		double weight;
+
+		size_t limit_bps;
+		bool percent_max;
+		IPipeThrottlerUpdater* updater;
+		int64 update_interval;
+		int64 lastupdatetime;
+		IPipeThrottler* percent_throttler;
+
+		double rate;
+		double demand;
+		double alloc;
+	};
+
+	BandwidthScheduler();
+	virtual ~BandwidthScheduler();
+
+	SNode* getGroupNode(bool internet, int groupid);
+	SNode* getClientNode(int clientid, bool internet);
+	void attach(SNode* parent, SNode* node);
+	void detach(SNode* node);
+	void updateLimit(SNode* node, int64 ctime);
+	void setLimit(SNode* node, size_t bps, bool percent_max);
+	void collect(SNode* node, int64 passed_time);
+	double computeDemand(SNode* node);
+	void allocate(SNode* node, double cap);
+	void applyAllocation(SNode* node);
+
+	static BandwidthScheduler* instance;
+
+	IMutex* mutex;
+	bool do_quit;
+	THREADPOOL_TICKET ticket;
+	int64 lasttime;
+
+	SNode* roots[2];
+	std::map<std::pair<bool, int>, SNode*> group_nodes;
+	std::map<int, SNode*> client_nodes;
+	std::map<int, bool> client_internet;
+	std::map<int, int> client_groups;
+};
+
+class StreamThrottler : public IPipeThrottler
+{
+public:
+	StreamThrottler(BandwidthScheduler* scheduler, int clientid);
+	~StreamThrottler();
+
+	virtual bool addBytes(size_t n_bytes, bool wait);
+	virtual void changeThrottleLimit(size_t bps, bool p_percent_max);
+	virtual void changeThrottleUpdater(IPipeThrottlerUpdater* new_updater);
+
+	int getClientid();
+
+	int64 collectBytes(bool& throttled);
+	void setAllocation(double bps, IPipeThrottler* percent_global, IPipeThrottler* percent_client);
+
+private:
+	BandwidthScheduler* scheduler;
+	int clientid;
+
+	IMutex* mutex;
+	int64 bytes;
+	bool throttled;
+	double alloc_bps;
+	double tokens;
+	int64 lastrefilltime;
+	IPipeThrottler* percent_throttlers[2];
+};
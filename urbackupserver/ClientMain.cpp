@@ -61,6 +61,7 @@
 #include "ImageBackup.h"
 #include "ContinuousBackup.h"
 #include "ThrottleUpdater.h"
+#include "BandwidthScheduler.h"
 #include "../fileservplugin/IFileServ.h"
 #include "DataplanDb.h"
 #include "ImageMount.h"
@@ -101,7 +102,7 @@ bool ClientMain::running_backups_allowed=true;
 ClientMain::ClientMain(IPipe *pPipe, FileClient::SAddrHint pAddr, const std::string &pName,
 	const std::string& pSubName, const std::string& pMainName, int filebackup_group_offset, bool internet_connection,
 	bool use_file_snapshots, bool use_image_snapshots, bool use_reflink)
-	: internet_connection(internet_connection), server_settings(NULL), client_throttler(NULL),
+	: internet_connection(internet_connection), server_settings(NULL),
 	  use_file_snapshots(use_file_snapshots), use_image_snapshots(use_image_snapshots), use_reflink(use_reflink),
 	  backup_dao(NULL), client_updated_time(0), continuous_backup(NULL),
 	  clientsubname(pSubName), filebackup_group_offset(filebackup_group_offset), needs_authentification(false),
@@ -143,6 +144,10 @@ ClientMain::ClientMain(IPipe *pPipe, FileClient::SAddrHint pAddr, const std::str
 
 	continuous_mutex=Server->createMutex();
 	throttle_mutex=Server->createMutex();	
+	for (size_t i = 0; i < EBandwidthStream_Count; ++i)
+	{
+		stream_throttlers[i] = NULL;
+	}
 
 	curr_image_version=1;
 	last_incr_freq=-1;
@@ -166,9 +171,12 @@ ClientMain::~ClientMain(void)
 
 	Server->destroy(clientaddr_mutex);
 
-	if(client_throttler!=NULL)
+	for (size_t i = 0; i < EBandwidthStream_Count; ++i)
 	{
-		Server->destroy(client_throttler);
+		if (stream_throttlers[i] != NULL)
+		{
+			Server->destroy(stream_throttlers[i]);
+		}
 	}
 
 	Server->destroy(continuous_mutex);
@@ -2322,24 +2330,24 @@ bool ClientMain::tooManyClients(IDatabase * db, const std::string & clientname,
 	return false;
 }
 
-IPipeThrottler *ClientMain::getThrottler(int speed_bps)
+IPipeThrottler *ClientMain::getThrottler(int speed_bps, int global_speed_bps, EBandwidthStream stream)
 {
 	IScopedLock lock(throttle_mutex);
 
-	if(client_throttler==NULL)
-	{
-		client_throttler=Server->createPipeThrottler(new ThrottleUpdater(clientid,
-			internet_connection?ThrottleScope_Internet:ThrottleScope_Local));
-	}
-	else
+	BandwidthScheduler::getInstance()->changeGlobalLimit(internet_connection, global_speed_bps);
+
+	IPipeThrottler*& throttler = stream_throttlers[stream];
+	if(throttler==NULL)
 	{
-		bool percent_max;
-		size_t bps = BackupServer::throttleSpeedToBps(speed_bps, percent_max);
-		client_throttler->changeThrottleLimit(bps,
-			percent_max);
+		throttler=BandwidthScheduler::getInstance()->createStreamThrottler(clientid, internet_connection);
 	}
 
-	return client_throttler;
+	bool percent_max;
+	size_t bps = BackupServer::throttleSpeedToBps(speed_bps, percent_max);
+	throttler->changeThrottleLimit(bps,
+		percent_max);
+
+	return throttler;
 }
 
 void ClientMain::updateClientAccessKey()
@@ -2497,18 +2505,8 @@ IPipe *ClientMain::getClientCommandConnection(ServerSettings* server_settings, i
 		IPipe *ret=InternetServiceConnector::getConnection(curr_clientname, SERVICE_COMMANDS, timeoutms);
 		if(server_settings!=NULL && ret!=NULL)
 		{
-			int internet_speed=server_settings->getInternetSpeed();
-			if(internet_speed!=0
-				&& internet_speed!=-1)
-			{
-				ret->addThrottler(getThrottler(internet_speed));
-			}
-			int global_internet_speed=server_settings->getGlobalInternetSpeed();
-			if(global_internet_speed!=0
-				&& global_internet_speed!=-1)
-			{
-				ret->addThrottler(BackupServer::getGlobalInternetThrottler(global_internet_speed));
-			}
+			ret->addThrottler(getThrottler(server_settings->getInternetSpeed(),
+				server_settings->getGlobalInternetSpeed(), EBandwidthStream_Commands));
 		}
 		return ret;
 	}
@@ -2517,18 +2515,8 @@ IPipe *ClientMain::getClientCommandConnection(ServerSettings* server_settings, i
 		IPipe *ret=Server->ConnectStream(getClientaddr().toString(), serviceport, timeoutms);
 		if(server_settings!=NULL && ret!=NULL)
 		{
-			int local_speed=server_settings->getLocalSpeed();
-			if(local_speed!=0
-				&& local_speed!=-1)
-			{
-				ret->addThrottler(getThrottler(local_speed));
-			}
-			int global_local_speed=server_settings->getGlobalLocalSpeed();
-			if(global_local_speed!=0
-				&& global_local_speed!=-1)
-			{
-				ret->addThrottler(BackupServer::getGlobalLocalThrottler(global_local_speed));
-			}
+			ret->addThrottler(getThrottler(server_settings->getLocalSpeed(),
+				server_settings->getGlobalLocalSpeed(), EBandwidthStream_Commands));
 		}
 		return ret;
 	}
@@ -2551,18 +2539,8 @@ _u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* serv
 
 		if(server_settings!=NULL)
 		{
-			int internet_speed=server_settings->getInternetSpeed();
-			if(internet_speed!=0
-				&& internet_speed!=-1)
-			{
-				fc->addThrottler(getThrottler(internet_speed));
-			}
-			int global_internet_speed=server_settings->getGlobalInternetSpeed();
-			if(global_internet_speed!=0
-				&& global_internet_speed!=-1)
-			{
-				fc->addThrottler(BackupServer::getGlobalInternetThrottler(global_internet_speed));
-			}
+			fc->addThrottler(getThrottler(server_settings->getInternetSpeed(),
+				server_settings->getGlobalInternetSpeed(), EBandwidthStream_Files));
 		}
 
 		fc->setReconnectionTimeout(c_internet_fileclient_timeout);
@@ -2575,18 +2553,8 @@ _u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* serv
 
 		if(server_settings!=NULL)
 		{
-			int local_speed=server_settings->getLocalSpeed();
-			if(local_speed!=0
-				&& local_speed!=-1)
-			{
-				fc->addThrottler(getThrottler(local_speed));
-			}
-			int global_local_speed=server_settings->getGlobalLocalSpeed();
-			if(global_local_speed!=0
-				&& global_local_speed!=-1)
-			{
-				fc->addThrottler(BackupServer::getGlobalLocalThrottler(global_local_speed));
-			}
+			fc->addThrottler(getThrottler(server_settings->getLocalSpeed(),
+				server_settings->getGlobalLocalSpeed(), EBandwidthStream_Files));
 		}
 
 		return ret;
@@ -2637,38 +2605,19 @@ bool ClientMain::getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunk
 	if(fc_chunked->getPipe()!=NULL && server_settings!=NULL)
 	{
 		int speed;
+		int global_speed;
 		if(internet_connection)
 		{
 			speed=server_settings->getInternetSpeed();
+			global_speed=server_settings->getGlobalInternetSpeed();
 		}
 		else
 		{
 			speed=server_settings->getLocalSpeed();
-		}
-		if(speed!=0
-			&& speed!=-1)
-		{
-			fc_chunked->addThrottler(getThrottler(speed));
+			global_speed=server_settings->getGlobalLocalSpeed();
 		}
 
-		if(internet_connection)
-		{
-			int global_speed=server_settings->getGlobalInternetSpeed();
-			if(global_speed!=0
-				&& global_speed!=-1)
-			{
-				fc_chunked->addThrottler(BackupServer::getGlobalInternetThrottler(global_speed));
-			}
-		}
-		else
-		{
-			int global_speed=server_settings->getGlobalLocalSpeed();
-			if(global_speed!=0
-				&& global_speed!=-1)
-			{
-				fc_chunked->addThrottler(BackupServer::getGlobalLocalThrottler(global_speed));
-			}
-		}
+		fc_chunked->addThrottler(getThrottler(speed, global_speed, EBandwidthStream_Chunked));
 	}
 
 	return true;
@@ -3143,14 +3092,7 @@ void ClientMain::updateClientAddress(const std::string& address_data)
 
 	if (prev_internet_connection != internet_connection)
 	{
-		IScopedLock lock(throttle_mutex);
-
-		if (client_throttler != NULL)
-		{
-			client_throttler->changeThrottleUpdater(new
-				ThrottleUpdater(clientid, internet_connection ?
-					ThrottleScope_Internet : ThrottleScope_Local));
-		}
+		BandwidthScheduler::getInstance()->setClientInternet(clientid, internet_connection);
 	}
 }
 
@@ -16,6 +16,7 @@
 #include "../urbackupcommon/sha2/sha2.h"
 #include "../urbackupcommon/fileclient/tcpstack.h"
 #include "server_settings.h"
+#include "BandwidthScheduler.h"
 
 #include <memory>
 #include "server_log.h"
@@ -285,7 +286,7 @@ private:
 	bool sendFile(IPipe *cc, IFile *f, int timeout);
 	bool isBackupsRunningOkay(bool file, bool incr=false);	
 	bool updateCapabilities(bool* needs_restart);
-	IPipeThrottler *getThrottler(int speed_bps);
+	IPipeThrottler *getThrottler(int speed_bps, int global_speed_bps, EBandwidthStream stream);
 	bool inBackupWindow(Backup* backup);
 	void updateClientAccessKey();
 	bool isDataplanOkay(bool file);
@@ -382,7 +383,7 @@ private:
 	CTCPStack tcpstack;
 
 	IMutex* throttle_mutex;
-	IPipeThrottler *client_throttler;
+	IPipeThrottler *stream_throttlers[EBandwidthStream_Count];
 
 	int64 last_backup_try;
 	
@@ -40,6 +40,9 @@
 #include "../urbackupcommon/TreeHash.h"
 #include "../common/data.h"
 #include "PhashLoad.h"
+#include "PathIndex.h"
+#include "InFlightContent.h"
+#include "PerfCounters.h"
 
 #ifndef NAME_MAX
 #define NAME_MAX _POSIX_NAME_MAX
@@ -589,6 +592,16 @@ void FileBackup::createHashThreads(bool use_reflink, bool ignore_hash_mismatches
 
 	bsh=new BackupServerHash(hashpipe, clientid, use_snapshots, use_reflink, use_tmpfiles, logid, use_snapshots, max_file_id);
 	bsh_prepare=new BackupServerPrepareHash(hashpipe_prepare, hashpipe, clientid, logid, ignore_hash_mismatches);
+
+	if(InlineVerification::isEnabled())
+	{
+		if(inline_verification.get()==NULL)
+		{
+			inline_verification.reset(new InlineVerification);
+		}
+		bsh->setInlineVerification(inline_verification.get());
+	}
+
 	bsh_ticket = Server->getThreadPool()->execute(bsh, "fbackup write");
 	bsh_prepare_ticket = Server->getThreadPool()->execute(bsh_prepare, "fbackup hash");
 }
@@ -830,6 +843,8 @@ bool FileBackup::doBackup()
 
 	bool backup_result = doFileBackup();
 
+	InFlightContent::releaseOwner(backupid);
+
 	if(pingthread!=NULL)
 	{
 		pingthread->setStop(true);
@@ -861,6 +876,12 @@ bool FileBackup::doBackup()
 	{
 		backup_dao->updateClientLastFileBackup(backupid, static_cast<int>(num_issues), clientid);
 		backup_dao->updateFileBackupSetComplete(backupid);
+
+		if (PathIndex::isEnabled()
+			&& Server->fileExists(clientlistName(backupid)))
+		{
+			PathIndex::build(clientlistName(backupid), backupid, logid);
+		}
 	}
 
 
@@ -1106,7 +1127,8 @@ std::string FileBackup::systemErrorInfo()
 }
 
 bool FileBackup::link_file(const std::string &fn, const std::string &short_fn, const std::string &curr_path,
-	const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata)
+	const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata,
+	bool* inflight_deferred)
 {
 	std::string os_curr_path=convertToOSPathFromFileClient(os_path+"/"+short_fn);
 	std::string os_curr_hash_path=convertToOSPathFromFileClient(os_path+"/"+escape_metadata_fn(short_fn));
@@ -1126,6 +1148,21 @@ bool FileBackup::link_file(const std::string &fn, const std::string &short_fn, c
 		tries_once, ff_last, hardlink_limit, copied_file, entryid, entryclientid, rsize, next_entryid,
 		metadata, true, NULL);
 
+	if(!ok
+		&& filesize>=InFlightContent::getMinSize()
+		&& InFlightContent::isEnabled())
+	{
+		int curr_owner_id;
+		if(!InFlightContent::tryAcquire(sha2, filesize, backupid, curr_owner_id)
+			&& curr_owner_id!=backupid
+			&& inflight_deferred!=NULL)
+		{
+			ServerLogger::Log(logid, "GT: Deferring \""+fn+"\" until the concurrent transfer by another backup is done", LL_DEBUG);
+			*inflight_deferred=true;
+			return false;
+		}
+	}
+
 	if(ok && add_sql)
 	{
 		local_hash->addFileSQL(backupid, clientid, 0, dstpath, hashpath, sha2, filesize,
@@ -1148,6 +1185,46 @@ bool FileBackup::link_file(const std::string &fn, const std::string &short_fn, c
 	return ok;
 }
 
+bool FileBackup::link_inflight_file(const std::string &fn, const std::string &short_fn, const std::string &curr_path,
+	const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata,
+	int64 deferred_time)
+{
+	PerfCounters::observe(EPerfHistogram_InFlightWait, Server->getTimeMS()-deferred_time);
+
+	if(InFlightContent::isInFlight(sha2, filesize))
+	{
+		ServerLogger::Log(logid, "GT: Concurrent transfer of \""+fn+"\" did not finish in time. Downloading it.", LL_DEBUG);
+		PerfCounters::add(EPerfCounter_InFlightWaitTimeouts, 1);
+	}
+
+	//If the other transfer was aborted this acquires the content, so
+	//later backups defer to our download instead
+	bool ok = link_file(fn, short_fn, curr_path, os_path, sha2, filesize, add_sql, metadata);
+
+	if(ok)
+	{
+		PerfCounters::add(EPerfCounter_InFlightLinkedFiles, 1);
+		PerfCounters::add(EPerfCounter_InFlightAvoidedBytes, filesize);
+	}
+
+	return ok;
+}
+
+bool FileBackup::isInFlightLinkPending(const std::string& sha2, _i64 filesize, int64 deferred_time)
+{
+	return Server->getTimeMS()-deferred_time < InFlightContent::getWaitTimeout()
+		&& InFlightContent::isInFlight(sha2, filesize);
+}
+
+void FileBackup::waitInFlightLink(const std::string& sha2, _i64 filesize, int64 deferred_time)
+{
+	int64 timeout = InFlightContent::getWaitTimeout() - (Server->getTimeMS()-deferred_time);
+	if(timeout>0)
+	{
+		InFlightContent::wait(sha2, filesize, timeout);
+	}
+}
+
 void FileBackup::sendBackupOkay(bool b_okay)
 {
 	if(b_okay)
@@ -1235,6 +1312,15 @@ bool FileBackup::verify_file_backup(IFile *fileentries)
 
 	log << "Verification of file backup with id " << backupid << ". Path=" << (backuppath) << " Tree-hashing=" << convert(BackupServer::useTreeHashing()) << std::endl;
 
+	if(inline_verification.get()!=NULL)
+	{
+		ServerLogger::Log(logid, "Using hashes calculated while storing "+convert(inline_verification->size())+" files for verification", LL_INFO);
+		log << "Inline verification with " << inline_verification->size() << " stored files" << std::endl;
+	}
+
+	size_t read_back_files=0;
+	size_t unverified_files=0;
+
 	unsigned int read;
 	char buffer[4096];
 	std::string curr_path=backuppath;
@@ -1320,6 +1406,12 @@ bool FileBackup::verify_file_backup(IFile *fileentries)
 						else
 						{
 							std::string local_sha = getSHADef(curr_path+os_file_sep()+cfn);
+							++read_back_files;
+
+							if(local_sha.empty() && !is_symlink)
+							{
+								++unverified_files;
+							}
 
 							if( !(local_sha.empty() && is_symlink) && local_sha!=base64_decode_dash(shabase64))
 							{
@@ -1337,7 +1429,19 @@ bool FileBackup::verify_file_backup(IFile *fileentries)
 					}
 					else
 					{
-						std::string local_sha = getSHA256(curr_path+os_file_sep()+cfn);
+						std::string local_sha;
+						if(inline_verification.get()==NULL
+							|| !inline_verification->get(curr_path+os_file_sep()+cfn, local_sha))
+						{
+							//Not stored by this backup (linked or unchanged) or no hash of the written data
+							local_sha = getSHA256(curr_path+os_file_sep()+cfn);
+							++read_back_files;
+
+							if(local_sha.empty() && !is_symlink)
+							{
+								++unverified_files;
+							}
+						}
 
 						if( !(local_sha.empty() && is_symlink) && local_sha!=sha256hex )
 						{
@@ -1384,6 +1488,17 @@ bool FileBackup::verify_file_backup(IFile *fileentries)
 		ServerLogger::Log(logid, "Verified "+convert(verified_files)+" files", LL_DEBUG);
 	}
 
+	if(inline_verification.get()!=NULL)
+	{
+		ServerLogger::Log(logid, "Read back "+convert(read_back_files)+" of "+convert(verified_files)+" verified files without a hash recorded while storing them", LL_INFO);
+	}
+
+	if(unverified_files>0)
+	{
+		ServerLogger::Log(logid, "Could not read "+convert(unverified_files)+" files for verification", LL_WARNING);
+		log << "Unverified files: " << unverified_files << std::endl;
+	}
+
 	return verify_ok;
 }
 
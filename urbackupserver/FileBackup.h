@@ -10,6 +10,7 @@
 #include "../urbackupcommon/file_metadata.h"
 #include "server_log.h"
 #include "FileMetadataDownloadThread.h"
+#include "InlineVerification.h"
 #include <set>
 
 class ClientMain;
@@ -195,6 +196,8 @@ public:
 
 	static std::string convertToOSPathFromFileClient(std::string path);
 
+	static std::string clientlistName(int ref_backupid);
+
 	static std::string fixFilenameForOS(std::string fn, std::set<std::string>& samedir_filenames, const std::string& curr_path, bool log_warnings, logid_t logid, FilePathCorrections& filepath_corrections);
 
 	virtual void log_progress(const std::string& fn, int64 total, int64 downloaded, int64 speed_bps);
@@ -215,7 +218,6 @@ protected:
 	bool request_client_write_tokens();
 	void logVssLogdata(int64 vss_duration_s);
 	bool getTokenFile(FileClient &fc, bool hashed_transfer, bool request);
-	std::string clientlistName(int ref_backupid);
 	void createHashThreads(bool use_reflink, bool ignore_hash_mismatches);
 	void destroyHashThreads();
 	_i64 getIncrementalSize(IFile *f, const std::vector<size_t> &diffs, bool& backup_with_components, bool all=false);
@@ -224,7 +226,13 @@ protected:
 		int64 linked_bytes, int64 &last_eta_received_bytes, double &eta_estimated_speed, _i64 files_size );
 	bool hasChange(size_t line, const std::vector<size_t> &diffs);
 	bool link_file(const std::string &fn, const std::string &short_fn, const std::string &curr_path,
-		const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata);
+		const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata,
+		bool* inflight_deferred=NULL);
+	bool link_inflight_file(const std::string &fn, const std::string &short_fn, const std::string &curr_path,
+		const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata,
+		int64 deferred_time);
+	bool isInFlightLinkPending(const std::string& sha2, _i64 filesize, int64 deferred_time);
+	void waitInFlightLink(const std::string& sha2, _i64 filesize, int64 deferred_time);
 	void sendBackupOkay(bool b_okay);
 	void notifyClientBackupSuccessful(void);
 	void notifyClientBackupFailed();
@@ -272,6 +280,7 @@ protected:
 	THREADPOOL_TICKET bsh_prepare_ticket;
 	std::auto_ptr<BackupServerHash> local_hash;
 	std::auto_ptr<BackupServerHash> local_hash2;
+	std::auto_ptr<InlineVerification> inline_verification;
 
 	std::string filelist_async_id;
 
@@ -0,0 +1,176 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "FileChunkIndex.h"
+#include "HashContainer.h"
+#include "../Interface/Server.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../md5.h"
+#include <memory.h>
+
+namespace
+{
+	const size_t read_chunks = 128;
+}
+
+FileChunkIndex::FileChunkIndex(IDatabase* db, logid_t logid)
+	: db(db), logid(logid), curr_fileid(0)
+{
+	q_get_chunk = db->Prepare("SELECT fileid, offset FROM file_chunks WHERE hash=?", false);
+	q_add_chunk = db->Prepare("INSERT OR REPLACE INTO file_chunks (hash, fileid, offset) VALUES (?, ?, ?)", false);
+	q_del_chunk = db->Prepare("DELETE FROM file_chunks WHERE hash=?", false);
+	q_get_fullpath = db->Prepare("SELECT fullpath FROM files WHERE id=?", false);
+}
+
+FileChunkIndex::~FileChunkIndex()
+{
+	db->destroyQuery(q_get_chunk);
+	db->destroyQuery(q_add_chunk);
+	db->destroyQuery(q_del_chunk);
+	db->destroyQuery(q_get_fullpath);
+}
+
+bool FileChunkIndex::isEnabled()
+{
+	return Server->getServerParameter("file_chunk_index") == "true";
+}
+
+bool FileChunkIndex::addFile(int64 fileid, const std::string& hashpath, int64 filesize)
+{
+	if (filesize < c_checkpoint_dist)
+	{
+		return true;
+	}
+
+	std::auto_ptr<IFile> hashfile(HashContainer::openHashFile(hashpath));
+	if (hashfile.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening hash file \"" + hashpath + "\" for chunk index. " + os_last_error_str(), LL_DEBUG);
+		return false;
+	}
+
+	int64 hashfilesize;
+	if (hashfile->Read(0, reinterpret_cast<char*>(&hashfilesize), sizeof(hashfilesize)) != sizeof(hashfilesize)
+		|| little_endian(hashfilesize) != filesize)
+	{
+		//metadata only or from a different file version
+		return false;
+	}
+
+	int64 num_chunks = (filesize + c_checkpoint_dist - 1) / c_checkpoint_dist;
+	std::vector<char> buf(read_chunks*chunkhash_single_size);
+	const char zero_hash[big_hash_size] = {};
+
+	db->BeginWriteTransaction();
+
+	for (int64 i = 0; i < num_chunks; i += read_chunks)
+	{
+		int64 curr_chunks = (std::min)(static_cast<int64>(read_chunks), num_chunks - i);
+		_u32 toread = static_cast<_u32>(curr_chunks*chunkhash_single_size);
+		_u32 r = hashfile->Read(chunkhash_file_off + i*chunkhash_single_size, buf.data(), toread);
+
+		//small hashes of the last chunk are shorter
+		int64 avail_chunks = (r + chunkhash_single_size - big_hash_size) / chunkhash_single_size;
+		if (avail_chunks < curr_chunks)
+		{
+			curr_chunks = avail_chunks;
+			num_chunks = i + curr_chunks;
+		}
+
+		for (int64 j = 0; j < curr_chunks; ++j)
+		{
+			const char* big_hash = &buf[static_cast<size_t>(j*chunkhash_single_size)];
+			if (memcmp(big_hash, zero_hash, big_hash_size) == 0)
+			{
+				continue;
+			}
+
+			q_add_chunk->Bind(big_hash, big_hash_size);
+			q_add_chunk->Bind(fileid);
+			q_add_chunk->Bind((i + j)*c_checkpoint_dist);
+			q_add_chunk->Write();
+			q_add_chunk->Reset();
+		}
+	}
+
+	db->EndTransaction();
+
+	return true;
+}
+
+bool FileChunkIndex::getChunkSource(const char* big_hash, _u32 bsize, char* buf)
+{
+	q_get_chunk->Bind(big_hash, big_hash_size);
+	db_results res = q_get_chunk->Read();
+	q_get_chunk->Reset();
+
+	if (res.empty())
+	{
+		return false;
+	}
+
+	int64 fileid = watoi64(res[0]["fileid"]);
+	int64 offset = watoi64(res[0]["offset"]);
+
+	if (curr_file.get() == NULL
+		|| curr_fileid != fileid)
+	{
+		curr_file.reset();
+		curr_fileid = fileid;
+
+		q_get_fullpath->Bind(fileid);
+		db_results res_path = q_get_fullpath->Read();
+		q_get_fullpath->Reset();
+
+		if (!res_path.empty())
+		{
+			curr_file.reset(Server->openFile(os_file_prefix(res_path[0]["fullpath"]), MODE_READ));
+		}
+
+		if (curr_file.get() == NULL)
+		{
+			ServerLogger::Log(logid, "File with id " + convert(fileid) + " from chunk index not available", LL_DEBUG);
+			removeChunk(big_hash);
+			return false;
+		}
+	}
+
+	if (curr_file->Read(offset, buf, bsize) != bsize)
+	{
+		removeChunk(big_hash);
+		return false;
+	}
+
+	MD5 md5(reinterpret_cast<unsigned char*>(buf), bsize);
+	if (memcmp(md5.raw_digest_int(), big_hash, big_hash_size) != 0)
+	{
+		ServerLogger::Log(logid, "Chunk at offset " + convert(offset) + " in \"" + curr_file->getFilename() + "\" changed. Removing it from chunk index.", LL_DEBUG);
+		removeChunk(big_hash);
+		return false;
+	}
+
+	return true;
+}
+
+void FileChunkIndex::removeChunk(const char* big_hash)
+{
+	q_del_chunk->Bind(big_hash, big_hash_size);
+	q_del_chunk->Write();
+	q_del_chunk->Reset();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../Interface/Database.h"
+#include "../Interface/File.h"
+#include "../urbackupcommon/fileclient/FileClientChunked.h"
+#include "server_log.h"
+#include <memory>
+#include <string>
+
+/**
+* Server wide index from the md5 hashes of 512KB file chunks (as stored in
+* the chunk hash files of file backups) to a file entry containing the chunk.
+* Internet transfers of new files use it to load chunks from any file already
+* stored on the server instead of transferring them. Entries are removed with
+* their file entry; entries whose data changed are dropped once a lookup fails.
+*/
+class FileChunkIndex : public FileClientChunked::ChunkSourceCallback
+{
+public:
+	FileChunkIndex(IDatabase* db, logid_t logid);
+	virtual ~FileChunkIndex();
+
+	static bool isEnabled();
+
+	bool addFile(int64 fileid, const std::string& hashpath, int64 filesize);
+
+	virtual bool getChunkSource(const char* big_hash, _u32 bsize, char* buf);
+
+private:
+	void removeChunk(const char* big_hash);
+
+	IDatabase* db;
+	logid_t logid;
+
+	IQuery* q_get_chunk;
+	IQuery* q_add_chunk;
+	IQuery* q_del_chunk;
+	IQuery* q_get_fullpath;
+
+	int64 curr_fileid;
+	std::auto_ptr<IFile> curr_file;
+};
@@ -35,6 +35,9 @@ const _u32 ID_METADATA_NOP = 0;
 const _u32 ID_METADATA_V1 = 1<<3;
 const _u32 ID_RAW_FILE = 1 << 4;
 
+const int64 METADATA_EATTR_DICT_DEFINE = -2;
+const int64 METADATA_EATTR_DICT_REF = -3;
+
 FileMetadataDownloadThread::FileMetadataDownloadThread(FileClient* fc, const std::string& server_token, logid_t logid,
 	int backupid, int clientid, bool use_tmpfiles, std::string tmpfile_path)
 	: fc(fc), server_token(server_token), logid(logid), has_error(false), dry_run(false),
@@ -59,7 +62,7 @@ void FileMetadataDownloadThread::operator()()
 	std::auto_ptr<IFsFile> tmp_f(ClientMain::getTemporaryFileRetry(use_tmpfiles, tmpfile_path, logid));
 	metadata_tmp_fn = tmp_f->getFilename();
 
-	std::string remote_fn = "SCRIPT|urbackup/FILE_METADATA|"+server_token+"|"+convert(backupid);
+	std::string remote_fn = "SCRIPT|urbackup/FILE_METADATA|"+server_token+"|"+convert(backupid)+"|eattr_dict";
 
 	fc->setProgressLogCallback(NULL);
 	fc->setNoFreeSpaceCallback(NULL);
@@ -110,6 +113,8 @@ bool FileMetadataDownloadThread::applyMetadata( const std::string& backup_metada
 
 	last_metadata_ids.reserve(8000);
 
+	eattr_dict.clear();
+
 	size_t metadata_n_files = 0;
 
 	do 
@@ -1170,15 +1175,77 @@ bool FileMetadataDownloadThread::applyUnixMetadata(IFile* metadata_f, IFile* out
 	metadataf_pos += sizeof(num_eattr_keys);
 	data_checksum = urb_adler32(data_checksum, reinterpret_cast<char*>(&num_eattr_keys), sizeof(num_eattr_keys));
 
-    if(!dry_run && output_f != NULL && !writeRepeatFreeSpace(output_f, reinterpret_cast<char*>(&num_eattr_keys), sizeof(num_eattr_keys), cb))
-    {
-        ServerLogger::Log(logid, "Error writing to  \"" + output_f->getFilename() + "\" (num_eattr_keys)", LL_ERROR);
-        return false;
-    }
+    num_eattr_keys = little_endian(num_eattr_keys);
+
+	//Identical extended attribute sets are only sent once. They are stored expanded
+	std::string* eattr_dict_entry = NULL;
+	bool eattr_dict_ref = false;
+	if (num_eattr_keys == METADATA_EATTR_DICT_DEFINE
+		|| num_eattr_keys == METADATA_EATTR_DICT_REF)
+	{
+		int64 dict_id;
+		if (!readRetry(metadata_f, reinterpret_cast<char*>(&dict_id), sizeof(dict_id)))
+		{
+			ServerLogger::Log(logid, "Error reading eattr dictionary id from \"" + metadata_f->getFilename() + "\"", isComplete() ? LL_ERROR : LL_DEBUG);
+			return false;
+		}
 
-    metadata_size+=sizeof(num_eattr_keys);
+		metadataf_pos += sizeof(dict_id);
+		data_checksum = urb_adler32(data_checksum, reinterpret_cast<char*>(&dict_id), sizeof(dict_id));
+		dict_id = little_endian(dict_id);
 
-    num_eattr_keys = little_endian(num_eattr_keys);
+		if (num_eattr_keys == METADATA_EATTR_DICT_REF)
+		{
+			std::map<int64, std::string>::iterator it = eattr_dict.find(dict_id);
+			if (it == eattr_dict.end())
+			{
+				ServerLogger::Log(logid, "Unknown eattr dictionary id " + convert(dict_id) + " in \"" + metadata_f->getFilename() + "\"", LL_ERROR);
+				return false;
+			}
+
+			if (!dry_run && output_f != NULL && !writeRepeatFreeSpace(output_f, it->second.data(), it->second.size(), cb))
+			{
+				ServerLogger::Log(logid, "Error writing to  \"" + output_f->getFilename() + "\" (eattr_dict)", LL_ERROR);
+				return false;
+			}
+
+			metadata_size += it->second.size();
+			num_eattr_keys = 0;
+			eattr_dict_ref = true;
+		}
+		else
+		{
+			if (!readRetry(metadata_f, reinterpret_cast<char*>(&num_eattr_keys), sizeof(num_eattr_keys)))
+			{
+				ServerLogger::Log(logid, "Error reading eattr num from \"" + metadata_f->getFilename() + "\" (dict)", isComplete() ? LL_ERROR : LL_DEBUG);
+				return false;
+			}
+
+			metadataf_pos += sizeof(num_eattr_keys);
+			data_checksum = urb_adler32(data_checksum, reinterpret_cast<char*>(&num_eattr_keys), sizeof(num_eattr_keys));
+			num_eattr_keys = little_endian(num_eattr_keys);
+
+			eattr_dict_entry = &eattr_dict[dict_id];
+			eattr_dict_entry->clear();
+		}
+	}
+
+	if (!eattr_dict_ref)
+	{
+		int64 endian_num_eattr_keys = little_endian(num_eattr_keys);
+		if (!dry_run && output_f != NULL && !writeRepeatFreeSpace(output_f, reinterpret_cast<char*>(&endian_num_eattr_keys), sizeof(endian_num_eattr_keys), cb))
+		{
+			ServerLogger::Log(logid, "Error writing to  \"" + output_f->getFilename() + "\" (num_eattr_keys)", LL_ERROR);
+			return false;
+		}
+
+		if (eattr_dict_entry != NULL)
+		{
+			eattr_dict_entry->append(reinterpret_cast<char*>(&endian_num_eattr_keys), sizeof(endian_num_eattr_keys));
+		}
+
+		metadata_size += sizeof(num_eattr_keys);
+	}
 
     for(int64 i=0;i<num_eattr_keys;++i)
     {
@@ -1199,6 +1266,12 @@ bool FileMetadataDownloadThread::applyUnixMetadata(IFile* metadata_f, IFile* out
         }
 
         metadata_size+=sizeof(key_size);
+
+		if (eattr_dict_entry != NULL)
+		{
+			eattr_dict_entry->append(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+		}
+
         key_size = little_endian(key_size);
 
 		if (key_size > 1 * 1024 * 1024)
@@ -1228,6 +1301,11 @@ bool FileMetadataDownloadThread::applyUnixMetadata(IFile* metadata_f, IFile* out
 
         metadata_size+=eattr_key.size();
 
+		if (eattr_dict_entry != NULL)
+		{
+			eattr_dict_entry->append(eattr_key);
+		}
+
         unsigned int val_size;
 		if (!readRetry(metadata_f, reinterpret_cast<char*>(&val_size), sizeof(val_size)))
         {
@@ -1245,6 +1323,12 @@ bool FileMetadataDownloadThread::applyUnixMetadata(IFile* metadata_f, IFile* out
         }
 
         metadata_size+=sizeof(val_size);
+
+		if (eattr_dict_entry != NULL)
+		{
+			eattr_dict_entry->append(reinterpret_cast<char*>(&val_size), sizeof(val_size));
+		}
+
         val_size = little_endian(val_size);
 
 		if (val_size == UINT_MAX)
@@ -1278,6 +1362,11 @@ bool FileMetadataDownloadThread::applyUnixMetadata(IFile* metadata_f, IFile* out
         }
 
         metadata_size+=eattr_val.size();
+
+		if (eattr_dict_entry != NULL)
+		{
+			eattr_dict_entry->append(eattr_val);
+		}
     }
 
 	unsigned int read_data_checksum =0;
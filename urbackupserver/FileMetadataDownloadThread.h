@@ -5,6 +5,7 @@
 #include "../urbackupcommon/chunk_hasher.h"
 #include "server_log.h"
 #include <memory>
+#include <map>
 
 class BackupServerHash;
 class FilePathCorrections;
@@ -127,6 +128,8 @@ private:
 	int64 max_metadata_id;
 	std::vector<int64> last_metadata_ids;
 
+	std::map<int64, std::string> eattr_dict;
+
 	bool dry_run;
 
 	int backupid;
@@ -33,9 +33,43 @@
 #include <stack>
 #include "PhashLoad.h"
 #include "server.h"
+#include <deque>
 
 extern std::string server_identity;
 
+namespace
+{
+	const size_t c_max_inflight_links = 10000;
+}
+
+struct SFullInFlightLink
+{
+	size_t line;
+	SFile cf;
+	std::string osspecific_name;
+	std::string curr_path;
+	std::string curr_os_path;
+	std::string curr_sha2;
+	FileMetadata metadata;
+	bool script_dir;
+	bool write_file_metadata;
+	int64 inflight_time;
+};
+
+struct SFullInFlightState
+{
+	SFullInFlightState(ServerDownloadThread* server_download, bool queue_downloads,
+		int64& linked_bytes, size_t& max_ok_id)
+		: server_download(server_download), queue_downloads(queue_downloads),
+		linked_bytes(linked_bytes), max_ok_id(max_ok_id)
+	{}
+
+	std::deque<SFullInFlightLink> pending;
+	ServerDownloadThread* server_download;
+	bool queue_downloads;
+	int64& linked_bytes;
+	size_t& max_ok_id;
+};
 
 FullFileBackup::FullFileBackup( ClientMain* client_main, int clientid, std::string clientname, std::string clientsubname,
 	LogAction log_action, int group, bool use_tmpfiles, std::string tmpfile_path, bool use_reflink, bool use_snapshots,
@@ -47,6 +81,50 @@ FullFileBackup::FullFileBackup( ClientMain* client_main, int clientid, std::stri
 }
 
 
+void FullFileBackup::finishInFlightLinks(SFullInFlightState& inflight_state, bool wait_all)
+{
+	while (!inflight_state.pending.empty())
+	{
+		SFullInFlightLink& pending = inflight_state.pending.front();
+
+		if (isInFlightLinkPending(pending.curr_sha2, pending.cf.size, pending.inflight_time))
+		{
+			if (!wait_all
+				&& inflight_state.pending.size() < c_max_inflight_links)
+			{
+				return;
+			}
+
+			waitInFlightLink(pending.curr_sha2, pending.cf.size, pending.inflight_time);
+		}
+
+		SFile& cf = pending.cf;
+		if (link_inflight_file(cf.name, pending.osspecific_name, pending.curr_path, pending.curr_os_path, pending.curr_sha2, cf.size,
+			true, pending.metadata, pending.inflight_time))
+		{
+			inflight_state.linked_bytes += cf.size;
+			if (pending.line > inflight_state.max_ok_id)
+			{
+				inflight_state.max_ok_id = pending.line;
+			}
+
+			if (client_main->getProtocolVersions().file_meta>0)
+			{
+				inflight_state.server_download->addToQueueFull(pending.line, cf.name, pending.osspecific_name, pending.curr_path, pending.curr_os_path,
+					inflight_state.queue_downloads ? 0 : -1, pending.metadata, pending.script_dir, true, 0, pending.curr_sha2, false, 0, std::string(),
+					pending.write_file_metadata);
+			}
+		}
+		else
+		{
+			inflight_state.server_download->addToQueueFull(pending.line, cf.name, pending.osspecific_name, pending.curr_path, pending.curr_os_path,
+				inflight_state.queue_downloads ? cf.size : -1, pending.metadata, pending.script_dir, false, 0, pending.curr_sha2);
+		}
+
+		inflight_state.pending.pop_front();
+	}
+}
+
 SBackup FullFileBackup::getLastFullDurations( void )
 {
 	std::vector<ServerBackupDao::SDuration> durations = 
@@ -255,6 +333,8 @@ bool FullFileBackup::doFileBackup()
 	std::vector<size_t> folder_items;
 	folder_items.push_back(0);
 
+	SFullInFlightState inflight_state(server_download.get(), queue_downloads, linked_bytes, max_ok_id);
+
 	bool has_read_error = false;
 	while( (read=tmp_filelist->Read(buffer, 4096, &has_read_error))>0 && !r_offline && !c_has_error)
 	{
@@ -444,6 +524,8 @@ bool FullFileBackup::doFileBackup()
 						--depth;
 						if(depth==0)
 						{
+							finishInFlightLinks(inflight_state, true);
+
 							std::string t=curr_path;
 							t.erase(0,1);
 							if(t=="urbackup_backup_scripts")
@@ -561,11 +643,12 @@ bool FullFileBackup::doFileBackup()
 						}
 					}
 
+					bool inflight_deferred=false;
 					if(!curr_sha2.empty())
 					{						
 						if(cf.size>= link_file_min_size
 							&& link_file(cf.name, osspecific_name, curr_path, curr_os_path, curr_sha2, cf.size,
-							             true, metadata))
+							             true, metadata, depth>0 ? &inflight_deferred : NULL))
 						{
 							file_ok=true;
 							linked_bytes+=cf.size;
@@ -576,7 +659,22 @@ bool FullFileBackup::doFileBackup()
 						}
 					}
 
-                    if(file_ok)
+                    if(inflight_deferred)
+                    {
+						SFullInFlightLink pending;
+						pending.line = line;
+						pending.cf = cf;
+						pending.osspecific_name = osspecific_name;
+						pending.curr_path = curr_path;
+						pending.curr_os_path = curr_os_path;
+						pending.curr_sha2 = curr_sha2;
+						pending.metadata = metadata;
+						pending.script_dir = script_dir;
+						pending.write_file_metadata = write_file_metadata;
+						pending.inflight_time = Server->getTimeMS();
+						inflight_state.pending.push_back(pending);
+                    }
+                    else if(file_ok)
                     {
 						if(client_main->getProtocolVersions().file_meta>0)
 						{
@@ -596,7 +694,16 @@ bool FullFileBackup::doFileBackup()
 					}
 				}
 
-				max_file_id.setMaxPreProcessed(line);
+				finishInFlightLinks(inflight_state, false);
+
+				if(inflight_state.pending.empty())
+				{
+					max_file_id.setMaxPreProcessed(line);
+				}
+				else if(inflight_state.pending.front().line>0)
+				{
+					max_file_id.setMaxPreProcessed(inflight_state.pending.front().line-1);
+				}
 				++line;
 			}
 		}
@@ -605,6 +712,16 @@ bool FullFileBackup::doFileBackup()
 			break;
 	}
 
+	if(!r_offline && !c_has_error && !has_read_error)
+	{
+		finishInFlightLinks(inflight_state, true);
+
+		if(line>0)
+		{
+			max_file_id.setMaxPreProcessed(line-1);
+		}
+	}
+
 	if (has_read_error)
 	{
 		ServerLogger::Log(logid, "Error reading from file " + tmp_filelist->getFilename() + ". " + os_last_error_str(), LL_ERROR);
@@ -2,6 +2,8 @@
 
 #include "FileBackup.h"
 
+struct SFullInFlightState;
+
 class FullFileBackup : public FileBackup
 {
 public:
@@ -12,6 +14,8 @@ public:
 protected:
 	virtual bool doFileBackup();
 
+	void finishInFlightLinks(SFullInFlightState& inflight_state, bool wait_all);
+
 
 	SBackup getLastFullDurations();
 };
\ No newline at end of file
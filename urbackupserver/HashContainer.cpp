@@ -0,0 +1,950 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "HashContainer.h"
+#include "../Interface/Server.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../common/data.h"
+#include "../stringtools.h"
+#include <algorithm>
+#include <memory>
+#include <memory.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+IMutex* HashContainer::mutex = NULL;
+IMutex* HashContainer::ref_mutex = NULL;
+std::map<std::string, HashContainer::SContainer*> HashContainer::containers;
+std::list<std::string> HashContainer::lru;
+
+namespace
+{
+	const char pack_fn[] = ".packed";
+	const char idx_fn[] = ".packed.idx";
+	const char refs_fn[] = ".packed_refs";
+	const char pack_magic[] = "URBACKUP HASH PACK V1";
+	const char idx_magic[] = "URBACKUP HASH PACK INDEX V1";
+	const char idx_magic_v2[] = "URBACKUP HASH PACK INDEX V2";
+	const size_t max_open_containers = 8;
+	const size_t max_ref_chain = 4;
+	const size_t max_ref_hops = 16;
+	const _u32 copy_bufsize = 32768;
+
+	std::string hashesDir(const std::string& backuppath)
+	{
+		return backuppath + os_file_sep() + ".hashes";
+	}
+
+	std::string backupName(const std::string& backuppath)
+	{
+		return ExtractFileName(backuppath, os_file_sep());
+	}
+
+	std::string siblingBackup(const std::string& backuppath, const std::string& name)
+	{
+		return ExtractFilePath(backuppath, os_file_sep()) + os_file_sep() + name;
+	}
+
+	size_t linkCount(const std::string& path, const SFile& file)
+	{
+#ifdef _WIN32
+		return file.nlinks;
+#else
+		struct stat st;
+		if (lstat(path.c_str(), &st) != 0)
+		{
+			return 0;
+		}
+		return static_cast<size_t>(st.st_nlink);
+#endif
+	}
+
+	bool sameContent(const std::string& fn1, const std::string& fn2)
+	{
+		std::auto_ptr<IFile> f1(Server->openFile(os_file_prefix(fn1), MODE_READ_SEQUENTIAL));
+		std::auto_ptr<IFile> f2(Server->openFile(os_file_prefix(fn2), MODE_READ_SEQUENTIAL));
+		if (f1.get() == NULL
+			|| f2.get() == NULL
+			|| f1->Size() != f2->Size())
+		{
+			return false;
+		}
+
+		std::vector<char> buf1(copy_bufsize);
+		std::vector<char> buf2(copy_bufsize);
+		_u32 read1;
+		do
+		{
+			bool has_error = false;
+			read1 = f1->Read(&buf1[0], copy_bufsize, &has_error);
+			_u32 read2 = f2->Read(&buf2[0], copy_bufsize, &has_error);
+			if (has_error
+				|| read1 != read2
+				|| memcmp(&buf1[0], &buf2[0], read1) != 0)
+			{
+				return false;
+			}
+		} while (read1 > 0);
+
+		return true;
+	}
+
+	std::vector<std::string> readRefs(const std::string& hashes_dir)
+	{
+		std::vector<std::string> toks;
+		Tokenize(getFile(os_file_prefix(hashes_dir + os_file_sep() + refs_fn)), toks, "\n");
+
+		std::vector<std::string> ret;
+		for (size_t i = 0; i < toks.size(); ++i)
+		{
+			std::string name = trim(toks[i]);
+			if (!name.empty()
+				&& std::find(ret.begin(), ret.end(), name) == ret.end())
+			{
+				ret.push_back(name);
+			}
+		}
+		return ret;
+	}
+
+	size_t findTarget(const std::vector<std::string>& targets, const std::string& name)
+	{
+		std::vector<std::string>::const_iterator it = std::find(targets.begin(), targets.end(), name);
+		if (it == targets.end())
+		{
+			return 0;
+		}
+		return it - targets.begin() + 1;
+	}
+}
+
+void HashContainer::init_mutex()
+{
+	mutex = Server->createMutex();
+	ref_mutex = Server->createMutex();
+}
+
+bool HashContainer::isEnabled()
+{
+	return Server->getServerParameter("packed_hashes") == "true";
+}
+
+IFile* HashContainer::openHashFile(const std::string & hashpath)
+{
+	return openHashFileInt(hashpath, 0);
+}
+
+IFile* HashContainer::openHashFileInt(const std::string & hashpath, size_t hops)
+{
+	IFile* f = Server->openFile(os_file_prefix(hashpath), MODE_READ);
+	if (f != NULL)
+	{
+		return f;
+	}
+
+	std::string hashes_sep = os_file_sep() + ".hashes" + os_file_sep();
+	size_t hashes_pos = hashpath.find(hashes_sep);
+	if (hashes_pos == std::string::npos)
+	{
+		return NULL;
+	}
+
+	std::string backuppath = hashpath.substr(0, hashes_pos);
+	SIndexEntry search_entry;
+	search_entry.path = hashpath.substr(hashes_pos + hashes_sep.size());
+
+	SContainer* container = acquireContainer(backuppath);
+	if (container == NULL)
+	{
+		return NULL;
+	}
+
+	std::vector<SIndexEntry>::iterator it = std::lower_bound(container->index.begin(),
+		container->index.end(), search_entry);
+
+	if (it == container->index.end()
+		|| it->path != search_entry.path)
+	{
+		releaseContainer(container);
+		return NULL;
+	}
+
+	if (it->target != 0)
+	{
+		std::string target_hashpath = siblingBackup(backuppath, container->targets[it->target - 1])
+			+ hashes_sep + it->path;
+
+		releaseContainer(container);
+
+		if (hops >= max_ref_hops)
+		{
+			Server->Log("Too many references while opening hash file \"" + hashpath + "\"", LL_ERROR);
+			return NULL;
+		}
+
+		return openHashFileInt(target_hashpath, hops + 1);
+	}
+
+	bool has_error = false;
+	std::string data = container->pack->Read(it->offset, static_cast<_u32>(it->size), &has_error);
+	if (has_error || data.size() != static_cast<size_t>(it->size))
+	{
+		Server->Log("Error reading \"" + it->path + "\" from hash container of \"" + backuppath + "\". " + os_last_error_str(), LL_ERROR);
+		releaseContainer(container);
+		return NULL;
+	}
+
+	releaseContainer(container);
+
+	IFile* ret = Server->openMemoryFile();
+	if (ret == NULL)
+	{
+		return NULL;
+	}
+
+	if (ret->Write(data) != data.size())
+	{
+		Server->destroy(ret);
+		return NULL;
+	}
+
+	ret->Seek(0);
+	return ret;
+}
+
+bool HashContainer::readMetadata(const std::string & hashpath, FileMetadata & metadata)
+{
+	std::auto_ptr<IFile> f(openHashFile(hashpath));
+	if (f.get() == NULL)
+	{
+		return false;
+	}
+
+	return read_metadata(f.get(), metadata);
+}
+
+bool HashContainer::isPacked(const std::string & backuppath)
+{
+	return FileExists(hashesDir(backuppath) + os_file_sep() + idx_fn);
+}
+
+bool HashContainer::pack(const std::string & backuppath, logid_t logid, const std::string& next_backuppath)
+{
+	IScopedLock ref_lock(ref_mutex);
+
+	std::string hashes_dir = hashesDir(backuppath);
+
+	if (isPacked(backuppath))
+	{
+		ServerLogger::Log(logid, "Hashes of backup at \"" + backuppath + "\" are already packed", LL_DEBUG);
+		return true;
+	}
+
+	std::string next_hashes_dir;
+	if (!next_backuppath.empty()
+		&& !isPacked(next_backuppath))
+	{
+		next_hashes_dir = hashesDir(next_backuppath);
+	}
+
+	std::map<std::string, size_t> incoming_chains;
+	readIncomingChains(backuppath, incoming_chains);
+
+	std::auto_ptr<IFile> pack_file(Server->openFile(os_file_prefix(hashes_dir + os_file_sep() + pack_fn + ".new"), MODE_WRITE));
+	if (pack_file.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening hash container at \"" + hashes_dir + os_file_sep() + pack_fn + ".new\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	std::string magic(pack_magic, sizeof(pack_magic) - 1);
+	if (pack_file->Write(magic) != magic.size())
+	{
+		ServerLogger::Log(logid, "Error writing to hash container. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	std::vector<SIndexEntry> index;
+
+	bool has_error = false;
+	std::vector<SFile> files = getFiles(os_file_prefix(hashes_dir), &has_error);
+	if (has_error)
+	{
+		ServerLogger::Log(logid, "Error listing files in \"" + hashes_dir + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (files[i].isdir && !files[i].issym)
+		{
+			if (!packDir(hashes_dir, files[i].name, pack_file.get(), next_hashes_dir, incoming_chains, index, logid))
+			{
+				return false;
+			}
+		}
+	}
+
+	std::sort(index.begin(), index.end());
+
+	size_t n_refs = 0;
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		if (index[i].target != 0)
+		{
+			++n_refs;
+		}
+	}
+
+	std::vector<std::string> targets;
+	if (n_refs > 0)
+	{
+		targets.push_back(backupName(next_backuppath));
+
+		//Register as referer before the hash files are removed from the tree
+		std::vector<std::string> referers = readRefs(next_hashes_dir);
+		if (std::find(referers.begin(), referers.end(), backupName(backuppath)) == referers.end())
+		{
+			std::auto_ptr<IFile> refs_file(Server->openFile(os_file_prefix(next_hashes_dir + os_file_sep() + refs_fn), MODE_APPEND));
+			std::string line = backupName(backuppath) + "\n";
+			if (refs_file.get() == NULL
+				|| refs_file->Write(line) != line.size()
+				|| !refs_file->Sync())
+			{
+				ServerLogger::Log(logid, "Error adding referer to \"" + next_hashes_dir + os_file_sep() + refs_fn + "\". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+		}
+	}
+
+	if (!pack_file->Sync())
+	{
+		ServerLogger::Log(logid, "Error syncing hash container to disk. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	pack_file.reset();
+
+	if (!writeIndex(hashes_dir + os_file_sep() + idx_fn + ".new", index, targets, logid))
+	{
+		return false;
+	}
+
+	if (!os_rename_file(os_file_prefix(hashes_dir + os_file_sep() + pack_fn + ".new"), os_file_prefix(hashes_dir + os_file_sep() + pack_fn))
+		|| !os_rename_file(os_file_prefix(hashes_dir + os_file_sep() + idx_fn + ".new"), os_file_prefix(hashes_dir + os_file_sep() + idx_fn)))
+	{
+		ServerLogger::Log(logid, "Error renaming hash container files in \"" + hashes_dir + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		Server->deleteFile(os_file_prefix(hashes_dir + os_file_sep() + index[i].path));
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (files[i].isdir && !files[i].issym)
+		{
+			removePackedDir(hashes_dir + os_file_sep() + files[i].name);
+		}
+	}
+
+	ServerLogger::Log(logid, "Packed " + convert(index.size()) + " hash files of backup at \"" + backuppath + "\" ("
+		+ convert(n_refs) + " as references to the next backup)", LL_INFO);
+
+	return true;
+}
+
+bool HashContainer::unpack(const std::string & backuppath, logid_t logid)
+{
+	IScopedLock ref_lock(ref_mutex);
+
+	std::string hashes_dir = hashesDir(backuppath);
+
+	close(backuppath);
+
+	std::vector<SIndexEntry> index;
+	std::vector<std::string> targets;
+	if (!readIndex(hashes_dir + os_file_sep() + idx_fn, index, targets))
+	{
+		ServerLogger::Log(logid, "Error reading hash container index of backup at \"" + backuppath + "\"", LL_ERROR);
+		return false;
+	}
+
+	std::auto_ptr<IFile> pack_file(Server->openFile(os_file_prefix(hashes_dir + os_file_sep() + pack_fn), MODE_READ));
+	if (pack_file.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening hash container of backup at \"" + backuppath + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	std::vector<char> buf(copy_bufsize);
+
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		std::string fn = hashes_dir + os_file_sep() + index[i].path;
+
+		os_create_dir_recursive(os_file_prefix(ExtractFilePath(fn, os_file_sep())));
+
+		std::auto_ptr<IFile> src;
+		if (index[i].target != 0)
+		{
+			std::string target_fn = hashesDir(siblingBackup(backuppath, targets[index[i].target - 1]))
+				+ os_file_sep() + index[i].path;
+
+			if (os_create_hardlink(os_file_prefix(fn), os_file_prefix(target_fn), false, NULL))
+			{
+				continue;
+			}
+
+			src.reset(openHashFileInt(target_fn, 0));
+			if (src.get() == NULL)
+			{
+				ServerLogger::Log(logid, "Error opening referenced hash file \"" + target_fn + "\"", LL_ERROR);
+				return false;
+			}
+		}
+
+		std::auto_ptr<IFile> out(Server->openFile(os_file_prefix(fn), MODE_WRITE));
+		if (out.get() == NULL)
+		{
+			ServerLogger::Log(logid, "Error creating hash file \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		if (src.get() != NULL)
+		{
+			SIndexEntry out_entry;
+			out_entry.offset = 0;
+			out_entry.size = 0;
+			if (!copyToPack(src.get(), out.get(), out_entry))
+			{
+				ServerLogger::Log(logid, "Error unpacking hash file \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+			continue;
+		}
+
+		int64 pos = index[i].offset;
+		int64 end = index[i].offset + index[i].size;
+		while (pos < end)
+		{
+			_u32 toread = static_cast<_u32>((std::min)(end - pos, static_cast<int64>(copy_bufsize)));
+			bool has_error = false;
+			_u32 read = pack_file->Read(pos, &buf[0], toread, &has_error);
+			if (has_error || read != toread
+				|| out->Write(&buf[0], read) != read)
+			{
+				ServerLogger::Log(logid, "Error unpacking hash file \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+			pos += read;
+		}
+	}
+
+	pack_file.reset();
+
+	if (!Server->deleteFile(os_file_prefix(hashes_dir + os_file_sep() + idx_fn)))
+	{
+		ServerLogger::Log(logid, "Error deleting hash container index of backup at \"" + backuppath + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	Server->deleteFile(os_file_prefix(hashes_dir + os_file_sep() + pack_fn));
+
+	ServerLogger::Log(logid, "Unpacked " + convert(index.size()) + " hash files of backup at \"" + backuppath + "\"", LL_INFO);
+
+	return true;
+}
+
+bool HashContainer::removeReferences(const std::string & backuppath, logid_t logid)
+{
+	IScopedLock ref_lock(ref_mutex);
+
+	std::string hashes_dir = hashesDir(backuppath);
+	std::string name = backupName(backuppath);
+	std::vector<std::string> referers = readRefs(hashes_dir);
+
+	for (size_t i = 0; i < referers.size(); ++i)
+	{
+		std::string ref_path = siblingBackup(backuppath, referers[i]);
+		if (!isPacked(ref_path))
+		{
+			continue;
+		}
+
+		std::string ref_hashes_dir = hashesDir(ref_path);
+
+		close(ref_path);
+
+		std::vector<SIndexEntry> index;
+		std::vector<std::string> targets;
+		if (!readIndex(ref_hashes_dir + os_file_sep() + idx_fn, index, targets))
+		{
+			ServerLogger::Log(logid, "Error reading hash container index of backup at \"" + ref_path + "\"", LL_ERROR);
+			return false;
+		}
+
+		size_t target = findTarget(targets, name);
+		if (target == 0)
+		{
+			continue;
+		}
+
+		std::auto_ptr<IFile> pack_file(Server->openFile(os_file_prefix(ref_hashes_dir + os_file_sep() + pack_fn), MODE_RW));
+		if (pack_file.get() == NULL)
+		{
+			ServerLogger::Log(logid, "Error opening hash container of backup at \"" + ref_path + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		size_t n_copied = 0;
+		for (size_t j = 0; j < index.size(); ++j)
+		{
+			if (index[j].target != target)
+			{
+				continue;
+			}
+
+			std::auto_ptr<IFile> src(openHashFileInt(hashes_dir + os_file_sep() + index[j].path, 0));
+			if (src.get() == NULL)
+			{
+				ServerLogger::Log(logid, "Error opening referenced hash file \"" + hashes_dir + os_file_sep() + index[j].path + "\"", LL_ERROR);
+				return false;
+			}
+
+			index[j].offset = pack_file->Size();
+			index[j].size = 0;
+			index[j].target = 0;
+			index[j].chain = 0;
+
+			if (!copyToPack(src.get(), pack_file.get(), index[j]))
+			{
+				ServerLogger::Log(logid, "Error copying \"" + hashes_dir + os_file_sep() + index[j].path + "\" to hash container of backup at \"" + ref_path + "\". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+
+			++n_copied;
+		}
+
+		if (!pack_file->Sync())
+		{
+			ServerLogger::Log(logid, "Error syncing hash container to disk. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		pack_file.reset();
+
+		if (!writeIndex(ref_hashes_dir + os_file_sep() + idx_fn + ".new", index, targets, logid))
+		{
+			return false;
+		}
+
+		if (!os_rename_file(os_file_prefix(ref_hashes_dir + os_file_sep() + idx_fn + ".new"), os_file_prefix(ref_hashes_dir + os_file_sep() + idx_fn)))
+		{
+			ServerLogger::Log(logid, "Error renaming hash container index in \"" + ref_hashes_dir + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		close(ref_path);
+
+		ServerLogger::Log(logid, "Copied " + convert(n_copied) + " referenced hash files into hash container of backup at \"" + ref_path + "\"", LL_INFO);
+	}
+
+	return true;
+}
+
+void HashContainer::close(const std::string & backuppath)
+{
+	IScopedLock lock(mutex);
+
+	std::map<std::string, SContainer*>::iterator it = containers.find(backuppath);
+	if (it != containers.end())
+	{
+		evictContainer(it);
+	}
+}
+
+HashContainer::SContainer* HashContainer::acquireContainer(const std::string & backuppath)
+{
+	{
+		IScopedLock lock(mutex);
+
+		std::map<std::string, SContainer*>::iterator it = containers.find(backuppath);
+		if (it != containers.end())
+		{
+			SContainer* container = it->second;
+			lru.splice(lru.begin(), lru, container->lru_it);
+			++container->refcount;
+			return container;
+		}
+	}
+
+	SContainer* container = loadContainer(backuppath);
+	if (container == NULL)
+	{
+		return NULL;
+	}
+
+	IScopedLock lock(mutex);
+
+	std::map<std::string, SContainer*>::iterator it = containers.find(backuppath);
+	if (it != containers.end())
+	{
+		//Loaded concurrently by another reader
+		destroyContainer(container);
+		container = it->second;
+		lru.splice(lru.begin(), lru, container->lru_it);
+		++container->refcount;
+		return container;
+	}
+
+	while (!containers.empty()
+		&& containers.size() >= max_open_containers)
+	{
+		evictContainer(containers.find(lru.back()));
+	}
+
+	lru.push_front(backuppath);
+	container->lru_it = lru.begin();
+	container->refcount = 1;
+	containers[backuppath] = container;
+
+	return container;
+}
+
+void HashContainer::releaseContainer(SContainer * container)
+{
+	IScopedLock lock(mutex);
+
+	--container->refcount;
+	if (container->evicted
+		&& container->refcount == 0)
+	{
+		destroyContainer(container);
+	}
+}
+
+HashContainer::SContainer* HashContainer::loadContainer(const std::string & backuppath)
+{
+	std::string hashes_dir = hashesDir(backuppath);
+
+	std::auto_ptr<SContainer> container(new SContainer);
+	container->pack = NULL;
+	container->refcount = 0;
+	container->evicted = false;
+	if (!readIndex(hashes_dir + os_file_sep() + idx_fn, container->index, container->targets))
+	{
+		return NULL;
+	}
+
+	container->pack = Server->openFile(os_file_prefix(hashes_dir + os_file_sep() + pack_fn), MODE_READ);
+	if (container->pack == NULL)
+	{
+		Server->Log("Error opening hash container at \"" + hashes_dir + os_file_sep() + pack_fn + "\". " + os_last_error_str(), LL_ERROR);
+		return NULL;
+	}
+
+	return container.release();
+}
+
+void HashContainer::evictContainer(std::map<std::string, SContainer*>::iterator it)
+{
+	SContainer* container = it->second;
+	lru.erase(container->lru_it);
+	containers.erase(it);
+
+	if (container->refcount == 0)
+	{
+		destroyContainer(container);
+	}
+	else
+	{
+		container->evicted = true;
+	}
+}
+
+void HashContainer::destroyContainer(SContainer * container)
+{
+	Server->destroy(container->pack);
+	delete container;
+}
+
+bool HashContainer::readIndex(const std::string & idx_fn, std::vector<SIndexEntry>& index, std::vector<std::string>& targets)
+{
+	std::auto_ptr<IFile> idx_file(Server->openFile(os_file_prefix(idx_fn), MODE_READ));
+	if (idx_file.get() == NULL)
+	{
+		return false;
+	}
+
+	bool has_error = false;
+	std::string data = idx_file->Read(0LL, static_cast<_u32>(idx_file->Size()), &has_error);
+	if (has_error)
+	{
+		return false;
+	}
+
+	CRData idx_data(data.data(), data.size());
+	std::string magic;
+	if (!idx_data.getStr(&magic)
+		|| (magic != idx_magic && magic != idx_magic_v2))
+	{
+		Server->Log("Hash container index \"" + idx_fn + "\" is corrupt", LL_ERROR);
+		return false;
+	}
+
+	bool with_refs = magic == idx_magic_v2;
+
+	targets.clear();
+	if (with_refs)
+	{
+		int64 num_targets;
+		if (!idx_data.getVarInt(&num_targets)
+			|| num_targets < 0
+			|| num_targets > static_cast<int64>(idx_data.getLeft()))
+		{
+			Server->Log("Hash container index \"" + idx_fn + "\" is corrupt", LL_ERROR);
+			return false;
+		}
+
+		targets.resize(static_cast<size_t>(num_targets));
+		for (size_t i = 0; i < targets.size(); ++i)
+		{
+			if (!idx_data.getStr(&targets[i]))
+			{
+				Server->Log("Hash container index \"" + idx_fn + "\" is truncated", LL_ERROR);
+				targets.clear();
+				return false;
+			}
+		}
+	}
+
+	int64 count;
+	if (!idx_data.getVarInt(&count)
+		|| count < 0
+		|| count > static_cast<int64>(idx_data.getLeft()))
+	{
+		Server->Log("Hash container index \"" + idx_fn + "\" is corrupt", LL_ERROR);
+		return false;
+	}
+
+	index.resize(static_cast<size_t>(count));
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		SIndexEntry& entry = index[i];
+		int64 target = 0;
+		int64 chain = 0;
+		if (!idx_data.getStr(&entry.path)
+			|| !idx_data.getVarInt(&entry.offset)
+			|| !idx_data.getVarInt(&entry.size)
+			|| (with_refs && (!idx_data.getVarInt(&target) || !idx_data.getVarInt(&chain)))
+			|| target < 0 || target > static_cast<int64>(targets.size()))
+		{
+			Server->Log("Hash container index \"" + idx_fn + "\" is truncated", LL_ERROR);
+			index.clear();
+			return false;
+		}
+		entry.target = static_cast<size_t>(target);
+		entry.chain = static_cast<size_t>(chain);
+	}
+
+	return true;
+}
+
+bool HashContainer::writeIndex(const std::string & idx_fn, const std::vector<SIndexEntry>& index, const std::vector<std::string>& targets, logid_t logid)
+{
+	CWData idx_data;
+	idx_data.addString(idx_magic_v2);
+	idx_data.addVarInt(targets.size());
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		idx_data.addString(targets[i]);
+	}
+	idx_data.addVarInt(index.size());
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		idx_data.addString(index[i].path);
+		idx_data.addVarInt(index[i].offset);
+		idx_data.addVarInt(index[i].size);
+		idx_data.addVarInt(index[i].target);
+		idx_data.addVarInt(index[i].chain);
+	}
+
+	std::auto_ptr<IFile> idx_file(Server->openFile(os_file_prefix(idx_fn), MODE_WRITE));
+	if (idx_file.get() == NULL
+		|| idx_file->Write(idx_data.getDataPtr(), idx_data.getDataSize()) != idx_data.getDataSize()
+		|| !idx_file->Sync())
+	{
+		ServerLogger::Log(logid, "Error writing hash container index at \"" + idx_fn + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+bool HashContainer::packDir(const std::string & hashes_dir, const std::string & rel_path, IFile * pack_file,
+	const std::string& next_hashes_dir, const std::map<std::string, size_t>& incoming_chains,
+	std::vector<SIndexEntry>& index, logid_t logid)
+{
+	std::string dir = hashes_dir + os_file_sep() + rel_path;
+
+	bool has_error = false;
+	std::vector<SFile> files = getFiles(os_file_prefix(dir), &has_error);
+	if (has_error)
+	{
+		ServerLogger::Log(logid, "Error listing files in \"" + dir + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const SFile& file = files[i];
+
+		if (file.issym || file.isspecialf)
+		{
+			continue;
+		}
+
+		std::string file_rel_path = rel_path + os_file_sep() + file.name;
+
+		if (file.isdir)
+		{
+			if (!packDir(hashes_dir, file_rel_path, pack_file, next_hashes_dir, incoming_chains, index, logid))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if (!next_hashes_dir.empty()
+			&& linkCount(os_file_prefix(hashes_dir + os_file_sep() + file_rel_path), file) > 1)
+		{
+			std::map<std::string, size_t>::const_iterator chain_it = incoming_chains.find(file_rel_path);
+			size_t chain = chain_it != incoming_chains.end() ? chain_it->second : 0;
+
+			if (chain < max_ref_chain
+				&& sameContent(hashes_dir + os_file_sep() + file_rel_path, next_hashes_dir + os_file_sep() + file_rel_path))
+			{
+				SIndexEntry entry;
+				entry.path = file_rel_path;
+				entry.offset = 0;
+				entry.size = 0;
+				entry.target = 1;
+				entry.chain = chain + 1;
+				index.push_back(entry);
+				continue;
+			}
+		}
+
+		std::auto_ptr<IFile> src(Server->openFile(os_file_prefix(hashes_dir + os_file_sep() + file_rel_path), MODE_READ_SEQUENTIAL));
+		if (src.get() == NULL)
+		{
+			ServerLogger::Log(logid, "Error opening hash file \"" + hashes_dir + os_file_sep() + file_rel_path + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		SIndexEntry entry;
+		entry.path = file_rel_path;
+		entry.offset = pack_file->Size();
+		entry.size = 0;
+		entry.target = 0;
+		entry.chain = 0;
+
+		if (!copyToPack(src.get(), pack_file, entry))
+		{
+			ServerLogger::Log(logid, "Error copying \"" + hashes_dir + os_file_sep() + file_rel_path + "\" to hash container. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		index.push_back(entry);
+	}
+
+	return true;
+}
+
+void HashContainer::readIncomingChains(const std::string & backuppath, std::map<std::string, size_t>& incoming_chains)
+{
+	std::string name = backupName(backuppath);
+	std::vector<std::string> referers = readRefs(hashesDir(backuppath));
+
+	for (size_t i = 0; i < referers.size(); ++i)
+	{
+		std::string ref_path = siblingBackup(backuppath, referers[i]);
+
+		std::vector<SIndexEntry> index;
+		std::vector<std::string> targets;
+		if (!isPacked(ref_path)
+			|| !readIndex(hashesDir(ref_path) + os_file_sep() + idx_fn, index, targets))
+		{
+			continue;
+		}
+
+		size_t target = findTarget(targets, name);
+		if (target == 0)
+		{
+			continue;
+		}
+
+		for (size_t j = 0; j < index.size(); ++j)
+		{
+			if (index[j].target == target)
+			{
+				size_t& chain = incoming_chains[index[j].path];
+				chain = (std::max)(chain, index[j].chain);
+			}
+		}
+	}
+}
+
+bool HashContainer::copyToPack(IFile * src, IFile * pack_file, SIndexEntry & entry)
+{
+	std::vector<char> buf(copy_bufsize);
+
+	_u32 read;
+	do
+	{
+		bool has_error = false;
+		read = src->Read(&buf[0], copy_bufsize, &has_error);
+		if (has_error
+			|| pack_file->Write(entry.offset + entry.size, &buf[0], read) != read)
+		{
+			return false;
+		}
+		entry.size += read;
+	} while (read > 0);
+
+	return true;
+}
+
+void HashContainer::removePackedDir(const std::string & dir)
+{
+	std::vector<SFile> files = getFiles(os_file_prefix(dir));
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (files[i].isdir && !files[i].issym)
+		{
+			removePackedDir(dir + os_file_sep() + files[i].name);
+		}
+	}
+
+	os_remove_dir(os_file_prefix(dir));
+}
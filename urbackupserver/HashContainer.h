@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../Interface/File.h"
+#include "../Interface/Mutex.h"
+#include "../urbackupcommon/file_metadata.h"
+#include "server_log.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+
+/**
+* Packed storage for the .hashes tree of a file backup. The chunk hashes and
+* metadata files of a backup are stored in one append-only container file
+* (.hashes/.packed) with a sorted offset index keyed by the path relative to
+* .hashes (.hashes/.packed.idx). Files in the top level of .hashes (sync file,
+* tokens) and symlinked pool directories stay in place.
+* Hash files shared (hardlinked) with the next backup of the chain are stored
+* as references to the same path in that backup instead of being copied. At
+* most max_ref_chain backups in a row reference each other, then the data is
+* stored again, which bounds the number of hops per read. The referenced
+* backup lists its referers in .hashes/.packed_refs and removeReferences()
+* copies the referenced data into them before it is deleted.
+* Readers should use openHashFile()/readMetadata(), which fall back to the
+* container if the hash file does not exist in the tree. At most
+* max_open_containers containers are kept open (least recently used is closed)
+* and reads from an open container happen without holding the global lock.
+*/
+class HashContainer
+{
+public:
+	static void init_mutex();
+
+	static bool isEnabled();
+
+	static IFile* openHashFile(const std::string& hashpath);
+	static bool readMetadata(const std::string& hashpath, FileMetadata& metadata);
+
+	static bool isPacked(const std::string& backuppath);
+	static bool pack(const std::string& backuppath, logid_t logid, const std::string& next_backuppath=std::string());
+	static bool unpack(const std::string& backuppath, logid_t logid);
+
+	static bool removeReferences(const std::string& backuppath, logid_t logid);
+
+	static void close(const std::string& backuppath);
+
+private:
+	struct SIndexEntry
+	{
+		std::string path;
+		int64 offset;
+		int64 size;
+		//0 if stored in this container, otherwise index+1 into targets
+		size_t target;
+		//Number of backups in a row referencing this hash file
+		size_t chain;
+
+		bool operator<(const SIndexEntry& other) const
+		{
+			return path < other.path;
+		}
+	};
+
+	struct SContainer
+	{
+		IFile* pack;
+		std::vector<SIndexEntry> index;
+		std::vector<std::string> targets;
+		std::list<std::string>::iterator lru_it;
+		size_t refcount;
+		bool evicted;
+	};
+
+	static SContainer* acquireContainer(const std::string& backuppath);
+	static void releaseContainer(SContainer* container);
+	static SContainer* loadContainer(const std::string& backuppath);
+	static void evictContainer(std::map<std::string, SContainer*>::iterator it);
+	static void destroyContainer(SContainer* container);
+	static IFile* openHashFileInt(const std::string& hashpath, size_t hops);
+	static bool readIndex(const std::string& idx_fn, std::vector<SIndexEntry>& index, std::vector<std::string>& targets);
+	static bool writeIndex(const std::string& idx_fn, const std::vector<SIndexEntry>& index, const std::vector<std::string>& targets, logid_t logid);
+	static bool packDir(const std::string& hashes_dir, const std::string& rel_path, IFile* pack_file,
+		const std::string& next_hashes_dir, const std::map<std::string, size_t>& incoming_chains,
+		std::vector<SIndexEntry>& index, logid_t logid);
+	static void readIncomingChains(const std::string& backuppath, std::map<std::string, size_t>& incoming_chains);
+	static bool copyToPack(IFile* src, IFile* pack_file, SIndexEntry& entry);
+	static void removePackedDir(const std::string& dir);
+
+	static IMutex* mutex;
+	static IMutex* ref_mutex;
+	static std::map<std::string, SContainer*> containers;
+	static std::list<std::string> lru;
+};
@@ -41,6 +41,7 @@
 #include "server_ping.h"
 #include "snapshot_helper.h"
 #include "server.h"
+#include "image_block_store.h"
 
 const unsigned int status_update_intervall=1000;
 const unsigned int eta_update_intervall=60000;
@@ -1544,6 +1545,14 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 
 							if(hashfile!=NULL) Server->destroy(hashfile);
 
+							if (!vhdfile_err
+								&& image_file_format == image_file_format_cowraw
+								&& ImageBlockStore::isEnabled())
+							{
+								ImageBlockStore block_store(db, server_settings->getSettings()->backupfolder, logid);
+								block_store.addImage(imagefn, pParentvhd, mbr_offset, vhd_blocksize*blocksize);
+							}
+
 							IFile *t_file=Server->openFile(os_file_prefix(imagefn), MODE_READ);
 							if(t_file!=NULL)
 							{
@@ -0,0 +1,160 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "InFlightContent.h"
+#include "../Interface/Server.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/fileclient/FileClient.h"
+#include <algorithm>
+#include <limits>
+
+std::map<InFlightContent::SKey, int> InFlightContent::entries;
+IMutex* InFlightContent::mutex = NULL;
+ICondition* InFlightContent::cond = NULL;
+
+void InFlightContent::init_mutex()
+{
+	mutex = Server->createMutex();
+	cond = Server->createCondition();
+}
+
+bool InFlightContent::isEnabled()
+{
+	return Server->getServerParameter("inflight_dedup") != "false";
+}
+
+int64 InFlightContent::getMinSize()
+{
+	std::string min_size = Server->getServerParameter("inflight_dedup_min_size");
+	if (!min_size.empty())
+	{
+		return watoi64(min_size);
+	}
+	return 1024 * 1024;
+}
+
+int64 InFlightContent::getWaitTimeout()
+{
+	//Deferred files are resolved at the latest before their share's
+	//snapshot is released, where the file list thread has to wait for
+	//them. Stay well below the client connection timeout there and
+	//download the file ourselves if the other transfer takes longer
+	const int64 max_timeout = SERVER_TIMEOUT / 2;
+
+	std::string timeout = Server->getServerParameter("inflight_dedup_wait_timeout");
+	if (!timeout.empty())
+	{
+		return (std::min)(watoi64(timeout) * 1000, max_timeout);
+	}
+	return 30 * 1000;
+}
+
+bool InFlightContent::tryAcquire(const std::string& sha2, int64 filesize, int owner_id, int& curr_owner_id)
+{
+	IScopedLock lock(mutex);
+
+	std::pair<std::map<SKey, int>::iterator, bool> ins =
+		entries.insert(std::make_pair(SKey(sha2, filesize), owner_id));
+
+	curr_owner_id = ins.first->second;
+	return ins.second;
+}
+
+bool InFlightContent::isInFlight(const std::string& sha2, int64 filesize)
+{
+	IScopedLock lock(mutex);
+	return entries.find(SKey(sha2, filesize)) != entries.end();
+}
+
+bool InFlightContent::wait(const std::string& sha2, int64 filesize, int64 timeout_ms)
+{
+	SKey key(sha2, filesize);
+	int64 starttime = Server->getTimeMS();
+
+	IScopedLock lock(mutex);
+	while (entries.find(key) != entries.end())
+	{
+		int64 passed = Server->getTimeMS() - starttime;
+		if (passed >= timeout_ms)
+		{
+			return false;
+		}
+
+		cond->wait(&lock, static_cast<int>((std::min)(timeout_ms - passed, static_cast<int64>(10000))));
+	}
+
+	return true;
+}
+
+void InFlightContent::finish(const std::string& sha2, int64 filesize)
+{
+	IScopedLock lock(mutex);
+	if (entries.erase(SKey(sha2, filesize)) > 0)
+	{
+		cond->notify_all();
+	}
+}
+
+void InFlightContent::abort(const std::string& sha2, int owner_id)
+{
+	IScopedLock lock(mutex);
+
+	bool removed = false;
+	std::map<SKey, int>::iterator it = entries.lower_bound(SKey(sha2, (std::numeric_limits<int64>::min)()));
+	while (it != entries.end() && it->first.first == sha2)
+	{
+		if (it->second == owner_id)
+		{
+			entries.erase(it++);
+			removed = true;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if (removed)
+	{
+		cond->notify_all();
+	}
+}
+
+void InFlightContent::releaseOwner(int owner_id)
+{
+	IScopedLock lock(mutex);
+
+	bool removed = false;
+	for (std::map<SKey, int>::iterator it = entries.begin(); it != entries.end();)
+	{
+		if (it->second == owner_id)
+		{
+			entries.erase(it++);
+			removed = true;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if (removed)
+	{
+		cond->notify_all();
+	}
+}
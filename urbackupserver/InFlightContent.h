@@ -0,0 +1,71 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include <string>
+#include <map>
+
+/**
+* Registry of file contents that file backups are currently downloading,
+* keyed by the hash and size the client reported. If a backup needs
+* content that another backup is still transferring, it defers that file
+* and keeps processing its file list. Once the other transfer is done it
+* links to the copy the other backup verified and indexed, instead of
+* downloading the same content again.
+*/
+class InFlightContent
+{
+public:
+	static void init_mutex();
+
+	static bool isEnabled();
+	static int64 getMinSize();
+	static int64 getWaitTimeout();
+
+	//Registers owner_id as downloading the content. If the content is
+	//already in flight, returns false and sets curr_owner_id
+	static bool tryAcquire(const std::string& sha2, int64 filesize, int owner_id, int& curr_owner_id);
+
+	//Returns true if another backup is still transferring the content
+	static bool isInFlight(const std::string& sha2, int64 filesize);
+
+	//Waits until the content is no longer in flight. Returns false
+	//on timeout
+	static bool wait(const std::string& sha2, int64 filesize, int64 timeout_ms);
+
+	//Called once the transfer is done and the content was verified and
+	//indexed (or storing it failed). Wakes up backups waiting for it.
+	static void finish(const std::string& sha2, int64 filesize);
+
+	//Removes the registrations of owner_id for this hash after a failed download
+	static void abort(const std::string& sha2, int owner_id);
+
+	//Removes all registrations of a backup once it is done
+	static void releaseOwner(int owner_id);
+
+private:
+	typedef std::pair<std::string, int64> SKey;
+
+	static std::map<SKey, int> entries;
+	static IMutex* mutex;
+	static ICondition* cond;
+};
@@ -37,6 +37,9 @@
 #include "database.h"
 #include <algorithm>
 #include "PhashLoad.h"
+#include "LinkFarm.h"
+#include "HashContainer.h"
+#include <deque>
 
 extern std::string server_identity;
 
@@ -44,7 +47,83 @@ const int64 c_readd_size_limit=4096;
 
 namespace
 {
-	
+	const size_t c_max_pending_links = 10000;
+}
+
+struct SIncrLinkDir
+{
+	size_t depth;
+	bool closed;
+	size_t extra_items;
+};
+
+struct SIncrPendingLink
+{
+	LinkFarm::SLinkJob* job;
+	size_t line;
+	SFile cf;
+	std::string osspecific_name;
+	std::string curr_path;
+	std::string curr_os_path;
+	std::string curr_sha2;
+	std::string srcpath;
+	std::string local_curr_os_path;
+	FileMetadata metadata;
+	bool script_dir;
+	std::vector<SIncrLinkDir*> dirs;
+
+	SIncrLinkDir* closed_dir;
+	size_t folder_items;
+	bool queue_dir_metadata;
+
+	//Set if the file waits for a concurrent transfer by another backup
+	int64 inflight_time;
+	bool inflight_download;
+};
+
+struct SIncrLinkState
+{
+	SIncrLinkState(std::vector<size_t>& folder_items, int& link_logcnt, int64& linked_bytes,
+		size_t& num_copied_file_entries, size_t& num_readded_entries)
+		: farm(NULL), server_download(NULL), download_nok_ids(NULL), folder_items(folder_items), link_logcnt(link_logcnt),
+		linked_bytes(linked_bytes), num_copied_file_entries(num_copied_file_entries),
+		num_readded_entries(num_readded_entries), intra_file_diffs(false), queue_downloads(false),
+		copy_last_file_entries(false), readd_file_entries_sparse(false),
+		copy_file_entries_sparse_modulo(1), incremental_num(0)
+	{}
+
+	LinkFarm* farm;
+	std::deque<SIncrPendingLink*> pending;
+	std::vector<SIncrLinkDir*> dirs;
+	ServerDownloadThread* server_download;
+	IdRange* download_nok_ids;
+	std::vector<size_t>& folder_items;
+	int& link_logcnt;
+	int64& linked_bytes;
+	size_t& num_copied_file_entries;
+	size_t& num_readded_entries;
+	bool intra_file_diffs;
+	bool queue_downloads;
+	bool copy_last_file_entries;
+	bool readd_file_entries_sparse;
+	int copy_file_entries_sparse_modulo;
+	int incremental_num;
+	std::string last_backuppath_hashes;
+};
+
+namespace
+{
+	void setMaxPreProcessedLinks(MaxFileId& max_file_id, SIncrLinkState& link_state, size_t line)
+	{
+		if (link_state.pending.empty())
+		{
+			max_file_id.setMaxPreProcessed(line);
+		}
+		else if (link_state.pending.front()->line > 0)
+		{
+			max_file_id.setMaxPreProcessed(link_state.pending.front()->line - 1);
+		}
+	}
 }
 
 IncrFileBackup::IncrFileBackup( ClientMain* client_main, int clientid, std::string clientname, std::string clientsubname, LogAction log_action,
@@ -567,6 +646,24 @@ bool IncrFileBackup::doFileBackup()
 	std::map<int64, int64> dir_end_ids;
 	bool phash_load_offline = false;
 
+	std::auto_ptr<LinkFarm> link_farm;
+	SIncrLinkState link_state(folder_items, link_logcnt, linked_bytes, num_copied_file_entries, num_readded_entries);
+	int64 link_starttime = Server->getTimeMS();
+	link_state.server_download = server_download.get();
+	link_state.download_nok_ids = &download_nok_ids;
+	link_state.intra_file_diffs = intra_file_diffs;
+	link_state.queue_downloads = queue_downloads;
+	link_state.copy_last_file_entries = copy_last_file_entries;
+	link_state.readd_file_entries_sparse = readd_file_entries_sparse;
+	link_state.copy_file_entries_sparse_modulo = copy_file_entries_sparse_modulo;
+	link_state.incremental_num = incremental_num;
+	link_state.last_backuppath_hashes = last_backuppath_hashes;
+	if (!use_snapshots && LinkFarm::getNumThreads()>0)
+	{
+		link_farm.reset(new LinkFarm(LinkFarm::getNumThreads(), crossvolume_links));
+		link_state.farm = link_farm.get();
+	}
+
 	bool has_read_error = false;
 	while( (read=tmp_filelist->Read(buffer, 4096, &has_read_error))>0 )
 	{
@@ -606,7 +703,7 @@ bool IncrFileBackup::doFileBackup()
 							}
 							else
 							{
-								max_file_id.setMaxPreProcessed(line);
+								setMaxPreProcessedLinks(max_file_id, link_state, line);
 							}
 						}
 						else
@@ -992,6 +1089,12 @@ bool IncrFileBackup::doFileBackup()
 						folder_items.push_back(0);
 						dir_ids.push(line);
 
+						SIncrLinkDir* link_dir = new SIncrLinkDir;
+						link_dir->depth = folder_items.size()-1;
+						link_dir->closed = false;
+						link_dir->extra_items = 0;
+						link_state.dirs.push_back(link_dir);
+
 						++depth;
 						if(depth==1)
 						{
@@ -1012,12 +1115,47 @@ bool IncrFileBackup::doFileBackup()
 					}
 					else //cf.name==".."
 					{
-						if((indirchange || dir_diff_stack.top()) && client_main->getProtocolVersions().file_meta>0 && !script_dir)
+						bool queue_dir_metadata = (indirchange || dir_diff_stack.top()) && client_main->getProtocolVersions().file_meta>0 && !script_dir;
+
+						SIncrLinkDir* link_dir = link_state.dirs.back();
+						link_state.dirs.pop_back();
+
+						if(!link_state.pending.empty())
+						{
+							//Links of files in this directory are still being created.
+							//The number of folder items is only known after they are done
+							link_dir->closed = true;
+
+							SIncrPendingLink* pending = new SIncrPendingLink;
+							pending->job = NULL;
+							pending->line = line;
+							pending->cf.name = ExtractFileName(curr_path, "/");
+							pending->osspecific_name = ExtractFileName(curr_os_path, "/");
+							pending->curr_path = ExtractFilePath(curr_path, "/");
+							pending->curr_os_path = ExtractFilePath(curr_os_path, "/");
+							pending->metadata = metadata;
+							pending->script_dir = script_dir;
+							pending->closed_dir = link_dir;
+							pending->folder_items = folder_items.back();
+							pending->queue_dir_metadata = queue_dir_metadata;
+							pending->inflight_time = 0;
+							pending->inflight_download = false;
+							link_state.pending.push_back(pending);
+						}
+						else
 						{
-							server_download->addToQueueFull(line, ExtractFileName(curr_path, "/"), ExtractFileName(curr_os_path, "/"),
-								ExtractFilePath(curr_path, "/"), ExtractFilePath(curr_os_path, "/"), queue_downloads?0:-1,
-								metadata, false, true, folder_items.back(), std::string());
+							delete link_dir;
 
+							if(queue_dir_metadata)
+							{
+								server_download->addToQueueFull(line, ExtractFileName(curr_path, "/"), ExtractFileName(curr_os_path, "/"),
+									ExtractFilePath(curr_path, "/"), ExtractFilePath(curr_os_path, "/"), queue_downloads?0:-1,
+									metadata, false, true, folder_items.back(), std::string());
+							}
+						}
+
+						if(queue_dir_metadata)
+						{
 							dir_end_ids[dir_ids.top()] = line;
 						}
 
@@ -1033,6 +1171,8 @@ bool IncrFileBackup::doFileBackup()
 						}
 						if(depth==0)
 						{
+							finishPendingLinks(link_state, true);
+
 							std::string t=curr_path;
 							t.erase(0,1);
 							if(t=="urbackup_backup_scripts")
@@ -1160,10 +1300,11 @@ bool IncrFileBackup::doFileBackup()
 					else if(indirchange || file_changed) //is changed
 					{
 						bool f_ok=false;
+						bool inflight_deferred=false;
 						if(!curr_sha2.empty() && cf.size>= link_file_min_size)
 						{
 							if(link_file(cf.name, osspecific_name, curr_path, curr_os_path, curr_sha2 , cf.size, true,
-								metadata))
+								metadata, depth>0 ? &inflight_deferred : NULL))
 							{
 								f_ok=true;
 								linked_bytes+=cf.size;
@@ -1171,7 +1312,28 @@ bool IncrFileBackup::doFileBackup()
 							}
 						}
 
-						if(!f_ok)
+						if(inflight_deferred)
+						{
+							SIncrPendingLink* pending = new SIncrPendingLink;
+							pending->job = NULL;
+							pending->line = line;
+							pending->cf = cf;
+							pending->osspecific_name = osspecific_name;
+							pending->curr_path = curr_path;
+							pending->curr_os_path = curr_os_path;
+							pending->curr_sha2 = curr_sha2;
+							pending->local_curr_os_path = local_curr_os_path;
+							pending->metadata = metadata;
+							pending->script_dir = script_dir;
+							pending->dirs = link_state.dirs;
+							pending->closed_dir = NULL;
+							pending->folder_items = 0;
+							pending->queue_dir_metadata = false;
+							pending->inflight_time = Server->getTimeMS();
+							pending->inflight_download = !r_offline || hasChange(line, modified_inplace_ids);
+							link_state.pending.push_back(pending);
+						}
+						else if(!f_ok)
 						{
 							if(!r_offline || hasChange(line, modified_inplace_ids))
 							{
@@ -1197,6 +1359,31 @@ bool IncrFileBackup::doFileBackup()
 							}
 						}
 					}
+					else if(link_farm.get()!=NULL && depth>0) //is not changed. Link via link farm
+					{
+						std::string local_curr_os_dir = convertToOSPathFromFileClient(curr_os_path);
+
+						SIncrPendingLink* pending = new SIncrPendingLink;
+						pending->job = link_farm->addLink(last_backuppath+local_curr_os_dir, backuppath+local_curr_os_dir,
+							last_backuppath_hashes+local_curr_os_dir, backuppath_hashes+local_curr_os_dir, osspecific_name);
+						pending->line = line;
+						pending->cf = cf;
+						pending->osspecific_name = osspecific_name;
+						pending->curr_path = curr_path;
+						pending->curr_os_path = curr_os_path;
+						pending->curr_sha2 = curr_sha2;
+						pending->srcpath = srcpath;
+						pending->local_curr_os_path = local_curr_os_path;
+						pending->metadata = metadata;
+						pending->script_dir = script_dir;
+						pending->dirs = link_state.dirs;
+						pending->closed_dir = NULL;
+						pending->folder_items = 0;
+						pending->queue_dir_metadata = false;
+						pending->inflight_time = 0;
+						pending->inflight_download = false;
+						link_state.pending.push_back(pending);
+					}
 					else if(!use_snapshots) //is not changed
 					{						
 						bool too_many_hardlinks;
@@ -1324,7 +1511,9 @@ bool IncrFileBackup::doFileBackup()
 					}
 				}
 
-				max_file_id.setMaxPreProcessed(line);
+				finishPendingLinks(link_state, false);
+
+				setMaxPreProcessedLinks(max_file_id, link_state, line);
 				++line;
 			}
 		}
@@ -1336,6 +1525,28 @@ bool IncrFileBackup::doFileBackup()
 			break;
 	}
 
+	if(!c_has_error && !has_read_error)
+	{
+		finishPendingLinks(link_state, true);
+
+		if(line>0)
+		{
+			max_file_id.setMaxPreProcessed(line-1);
+		}
+	}
+	abortPendingLinks(link_state);
+
+	if(link_farm.get()!=NULL)
+	{
+		int64 link_passed = (std::max)(Server->getTimeMS() - link_starttime, (int64)1);
+		int64 num_links = link_farm->getNumLinks();
+		ServerLogger::Log(logid, "Linked "+convert(num_links)+" unchanged files from last backup with "+convert(LinkFarm::getNumThreads())+" threads ("
+			+convert(num_links*1000/link_passed)+" links/s)", LL_INFO);
+
+		link_farm.reset();
+		link_state.farm = NULL;
+	}
+
 	if (has_read_error)
 	{
 		ServerLogger::Log(logid, "Error reading from file " + tmp_filelist->getFilename() + ". " + os_last_error_str(), LL_ERROR);
@@ -1779,6 +1990,14 @@ bool IncrFileBackup::doFileBackup()
 		{
 			Server->deleteFile(clientlist_name);
 		}
+
+		if (!c_has_error
+			&& !use_snapshots
+			&& HashContainer::isEnabled())
+		{
+			//The last backup is not used as link/diff source anymore
+			HashContainer::pack(last_backuppath, logid, backuppath);
+		}
 	}
 	else
 	{
@@ -2161,3 +2380,245 @@ bool IncrFileBackup::doFullBackup()
 
 	return full_backup.getResult();
 }
+
+void IncrFileBackup::finishPendingLinks(SIncrLinkState& link_state, bool wait_all)
+{
+	while (!link_state.pending.empty())
+	{
+		SIncrPendingLink* pending = link_state.pending.front();
+
+		if (pending->job != NULL
+			&& !link_state.farm->isDone(pending->job))
+		{
+			if (!wait_all
+				&& link_state.pending.size() < c_max_pending_links)
+			{
+				return;
+			}
+
+			link_state.farm->wait(pending->job);
+		}
+		else if (pending->inflight_time != 0
+			&& isInFlightLinkPending(pending->curr_sha2, pending->cf.size, pending->inflight_time))
+		{
+			if (!wait_all
+				&& link_state.pending.size() < c_max_pending_links)
+			{
+				return;
+			}
+
+			waitInFlightLink(pending->curr_sha2, pending->cf.size, pending->inflight_time);
+		}
+
+		link_state.pending.pop_front();
+		finishPendingLink(link_state, pending);
+		delete pending;
+	}
+}
+
+namespace
+{
+	void addPendingFolderItem(SIncrLinkState& link_state, SIncrPendingLink* pending)
+	{
+		++link_state.folder_items[0];
+
+		for (size_t j = 0; j < pending->dirs.size(); ++j)
+		{
+			SIncrLinkDir* dir = pending->dirs[j];
+			if (dir->closed)
+			{
+				++dir->extra_items;
+			}
+			else
+			{
+				++link_state.folder_items[dir->depth];
+			}
+		}
+	}
+}
+
+void IncrFileBackup::finishPendingLink(SIncrLinkState& link_state, SIncrPendingLink* pending)
+{
+	if (pending->inflight_time != 0)
+	{
+		finishInFlightLink(link_state, pending);
+		return;
+	}
+
+	if (pending->job == NULL)
+	{
+		if (pending->queue_dir_metadata)
+		{
+			link_state.server_download->addToQueueFull(pending->line, pending->cf.name, pending->osspecific_name,
+				pending->curr_path, pending->curr_os_path, link_state.queue_downloads ? 0 : -1,
+				pending->metadata, false, true, pending->folder_items + pending->closed_dir->extra_items, std::string());
+		}
+
+		delete pending->closed_dir;
+		return;
+	}
+
+	LinkFarm::SLinkJob* job = pending->job;
+	SFile& cf = pending->cf;
+	const std::string& srcpath = pending->srcpath;
+	const std::string& local_curr_os_path = pending->local_curr_os_path;
+
+	bool copy_curr_file_entry = false;
+	bool readd_curr_file_entry_sparse = false;
+	bool download_metadata = false;
+
+	if (job->ok)
+	{
+		copy_curr_file_entry = link_state.copy_last_file_entries;
+		readd_curr_file_entry_sparse = link_state.readd_file_entries_sparse;
+	}
+	else if (job->too_many_links)
+	{
+		ServerLogger::Log(logid, "Creating hardlink from \"" + srcpath + "\" to \"" + backuppath + local_curr_os_path + "\" failed. Hardlink limit was reached. Copying file...", LL_DEBUG);
+		copyFile(pending->line, srcpath, backuppath + local_curr_os_path,
+			link_state.last_backuppath_hashes + local_curr_os_path,
+			backuppath_hashes + local_curr_os_path,
+			pending->metadata);
+	}
+	else
+	{
+		if (link_state.link_logcnt<5)
+		{
+			ServerLogger::Log(logid, "Creating hardlink from \"" + srcpath + "\" to \"" + backuppath + local_curr_os_path + "\" failed. " + job->errmsg + ". Loading file...", LL_WARNING);
+		}
+		else
+		{
+			if (link_state.link_logcnt == 5)
+			{
+				ServerLogger::Log(logid, "More warnings of kind: Creating hardlink from \"" + srcpath + "\" to \"" + backuppath + local_curr_os_path + "\" failed. Loading file... Skipping.", LL_WARNING);
+			}
+			Server->Log("Creating hardlink from \"" + srcpath + "\" to \"" + backuppath + local_curr_os_path + "\" failed. " + job->errmsg + ". Loading file...", LL_WARNING);
+		}
+		++link_state.link_logcnt;
+
+		bool f_ok = false;
+		if (!pending->curr_sha2.empty() && cf.size >= link_file_min_size)
+		{
+			if (link_file(cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path, pending->curr_sha2, cf.size, false,
+				pending->metadata))
+			{
+				f_ok = true;
+				copy_curr_file_entry = link_state.copy_last_file_entries;
+				readd_curr_file_entry_sparse = link_state.readd_file_entries_sparse;
+				link_state.linked_bytes += cf.size;
+				download_metadata = true;
+			}
+		}
+
+		if (!f_ok)
+		{
+			addPendingFolderItem(link_state, pending);
+
+			if (link_state.intra_file_diffs)
+			{
+				link_state.server_download->addToQueueChunked(pending->line, cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path,
+					link_state.queue_downloads ? cf.size : -1, pending->metadata, pending->script_dir, pending->curr_sha2);
+			}
+			else
+			{
+				link_state.server_download->addToQueueFull(pending->line, cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path,
+					link_state.queue_downloads ? cf.size : -1, pending->metadata, pending->script_dir, false, 0, pending->curr_sha2);
+			}
+		}
+	}
+
+	link_state.farm->release(job);
+
+	if (copy_curr_file_entry)
+	{
+		ServerFilesDao::SFileEntry fileEntry = filesdao->getFileEntryFromTemporaryTable(srcpath);
+
+		if (fileEntry.exists)
+		{
+			addFileEntrySQLWithExisting(backuppath + local_curr_os_path, backuppath_hashes + local_curr_os_path,
+				fileEntry.shahash, fileEntry.filesize, fileEntry.filesize, link_state.incremental_num);
+			++link_state.num_copied_file_entries;
+
+			readd_curr_file_entry_sparse = false;
+		}
+	}
+
+	if (readd_curr_file_entry_sparse)
+	{
+		addSparseFileEntry(pending->curr_path, cf, link_state.copy_file_entries_sparse_modulo, link_state.incremental_num,
+			local_curr_os_path, link_state.num_readded_entries);
+	}
+
+	if (download_metadata && client_main->getProtocolVersions().file_meta>0)
+	{
+		addPendingFolderItem(link_state, pending);
+
+		link_state.server_download->addToQueueFull(pending->line, cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path,
+			link_state.queue_downloads ? 0 : -1, pending->metadata, pending->script_dir, true, 0, std::string(), false, 0, std::string(), false);
+	}
+}
+
+void IncrFileBackup::finishInFlightLink(SIncrLinkState& link_state, SIncrPendingLink* pending)
+{
+	SFile& cf = pending->cf;
+
+	if (link_inflight_file(cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path, pending->curr_sha2, cf.size, true,
+		pending->metadata, pending->inflight_time))
+	{
+		link_state.linked_bytes += cf.size;
+
+		if (client_main->getProtocolVersions().file_meta>0)
+		{
+			addPendingFolderItem(link_state, pending);
+
+			link_state.server_download->addToQueueFull(pending->line, cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path,
+				link_state.queue_downloads ? 0 : -1, pending->metadata, pending->script_dir, true, 0, std::string(), false, 0, std::string(), false);
+		}
+	}
+	else if (pending->inflight_download)
+	{
+		addPendingFolderItem(link_state, pending);
+
+		if (link_state.intra_file_diffs)
+		{
+			link_state.server_download->addToQueueChunked(pending->line, cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path,
+				link_state.queue_downloads ? cf.size : -1, pending->metadata, pending->script_dir, pending->curr_sha2);
+		}
+		else
+		{
+			link_state.server_download->addToQueueFull(pending->line, cf.name, pending->osspecific_name, pending->curr_path, pending->curr_os_path,
+				link_state.queue_downloads ? cf.size : -1, pending->metadata, pending->script_dir, false, 0, pending->curr_sha2);
+		}
+	}
+	else
+	{
+		link_state.download_nok_ids->add(pending->line);
+	}
+}
+
+void IncrFileBackup::abortPendingLinks(SIncrLinkState& link_state)
+{
+	while (!link_state.pending.empty())
+	{
+		SIncrPendingLink* pending = link_state.pending.front();
+		link_state.pending.pop_front();
+
+		if (pending->job != NULL)
+		{
+			link_state.farm->wait(pending->job);
+			link_state.farm->release(pending->job);
+		}
+		else
+		{
+			delete pending->closed_dir;
+		}
+
+		delete pending;
+	}
+
+	for (size_t i = 0; i < link_state.dirs.size(); ++i)
+	{
+		delete link_state.dirs[i];
+	}
+	link_state.dirs.clear();
+}
@@ -7,6 +7,8 @@
 
 struct SFile;
 class FileMetadata;
+struct SIncrLinkState;
+struct SIncrPendingLink;
 
 class IncrFileBackup : public FileBackup
 {
@@ -25,6 +27,10 @@ protected:
 	void copyFile(size_t fileid, const std::string& source, const std::string& dest,
 		const std::string& hash_src, const std::string& hash_dest,
 		const FileMetadata& metadata);
+	void finishPendingLinks(SIncrLinkState& link_state, bool wait_all);
+	void finishPendingLink(SIncrLinkState& link_state, SIncrPendingLink* pending);
+	void finishInFlightLink(SIncrLinkState& link_state, SIncrPendingLink* pending);
+	void abortPendingLinks(SIncrLinkState& link_state);
 	bool doFullBackup();
 
 	IMutex* hash_existing_mutex;
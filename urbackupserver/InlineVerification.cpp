@@ -0,0 +1,72 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "InlineVerification.h"
+#include "../Interface/Server.h"
+#include "../md5.h"
+
+InlineVerification::InlineVerification()
+	: mutex(Server->createMutex())
+{
+}
+
+InlineVerification::~InlineVerification()
+{
+	Server->destroy(mutex);
+}
+
+bool InlineVerification::isEnabled()
+{
+	return Server->getServerParameter("inline_file_backup_verification") == "true";
+}
+
+void InlineVerification::add(const std::string& fn, const std::string& sha256hex)
+{
+	std::string key = fnKey(fn);
+
+	IScopedLock lock(mutex);
+	hashes[key] = sha256hex;
+}
+
+bool InlineVerification::get(const std::string& fn, std::string& sha256hex)
+{
+	std::string key = fnKey(fn);
+
+	IScopedLock lock(mutex);
+	std::map<std::string, std::string>::iterator it = hashes.find(key);
+	if (it == hashes.end())
+	{
+		return false;
+	}
+
+	sha256hex = it->second;
+	return true;
+}
+
+size_t InlineVerification::size()
+{
+	IScopedLock lock(mutex);
+	return hashes.size();
+}
+
+std::string InlineVerification::fnKey(const std::string& fn)
+{
+	//Only store the md5 of the path to keep the memory usage for large backups low
+	MD5 md(reinterpret_cast<unsigned char*>(const_cast<char*>(fn.data())), static_cast<unsigned int>(fn.size()));
+	return std::string(reinterpret_cast<char*>(md.raw_digest_int()), 16);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../Interface/Mutex.h"
+#include <string>
+#include <map>
+
+/**
+* sha256 of the file data of a file backup, recorded by BackupServerHash
+* from the bytes it writes to (or reads back from) the final backup file
+* while storing it. With inline verification the end-to-end verification
+* compares the client sha256 against these instead of reading the finished
+* backup a second time. Files without a record (linked, unchanged, patched)
+* are still read back.
+*/
+class InlineVerification
+{
+public:
+	InlineVerification();
+	~InlineVerification();
+
+	static bool isEnabled();
+
+	void add(const std::string& fn, const std::string& sha256hex);
+
+	bool get(const std::string& fn, std::string& sha256hex);
+
+	size_t size();
+
+private:
+	std::string fnKey(const std::string& fn);
+
+	IMutex* mutex;
+	std::map<std::string, std::string> hashes;
+};
@@ -236,19 +236,8 @@ bool InternetServiceConnector::Run(IRunOtherCallback* run_other)
 		return true;
 	}
 
-	if(do_connect && !pinging && state==ISS_AUTHED )
-	{
-		CWData data;
-		{
-			IScopedLock lock(local_mutex);
-			data.addChar(ID_ISC_CONNECT);
-			data.addChar(target_service);
-			state=ISS_CONNECTING;
-		}
-		tcpstack.Send(comm_pipe, data);
-		Server->Log("Connecting to target service...", LL_DEBUG);		
-		starttime=Server->getTimeMS();
-	}
+	IScopedLock lock(local_mutex);
+	sendConnect();
 
 	if(state==ISS_AUTHED && Server->getTimeMS()-lastpingtime>client_ping_interval && !pinging)
 	{
@@ -263,7 +252,7 @@ bool InternetServiceConnector::Run(IRunOtherCallback* run_other)
 		if(Server->getTimeMS()-lastpingtime>ping_timeout)
 		{
 			Server->Log("Ping timeout in InternetServiceConnector::Run", LL_DEBUG);
-			IScopedLock lock(mutex);
+			lock.relock(mutex);
 			if(!connect_start)
 			{
 				has_timeout=true;
@@ -603,7 +592,11 @@ void InternetServiceConnector::ReceivePackets(IRunOtherCallback* run_other)
 				{
 					if(id==ID_ISC_PONG)
 					{
-						pinging=false;
+						{
+							IScopedLock lock(local_mutex);
+							pinging=false;
+							sendConnect();
+						}
 						IScopedLock lock(mutex);
 						client_data[clientname].last_seen=Server->getTimeMS();
 					} 
@@ -764,6 +757,13 @@ bool InternetServiceConnector::wantReceive(void)
 		return false;
 }
 
+bool InternetServiceConnector::wantPeriodicRun(void)
+{
+	//Handshake, pings and connects are driven by received packets or
+	//Connect(). Timeouts and freeing are handled by the coarse idle run.
+	return do_connect && state==ISS_AUTHED;
+}
+
 bool InternetServiceConnector::closeSocket(void)
 {
 	if(free_connection)
@@ -793,6 +793,9 @@ bool InternetServiceConnector::Connect(char service, int timems)
 	target_service=service;
 	do_connect=true;
 
+	//Send the request right away instead of waiting for the next Run()
+	sendConnect();
+
 	connection_done_cond->wait(&lock, timems);
 
 	if(!is_connected)
@@ -807,6 +810,24 @@ bool InternetServiceConnector::Connect(char service, int timems)
 	}
 }
 
+void InternetServiceConnector::sendConnect(void)
+{
+	//local_mutex must be locked
+	if(!do_connect || pinging || state!=ISS_AUTHED)
+	{
+		return;
+	}
+
+	state=ISS_CONNECTING;
+	starttime=Server->getTimeMS();
+
+	CWData data;
+	data.addChar(ID_ISC_CONNECT);
+	data.addChar(target_service);
+	tcpstack.Send(comm_pipe, data);
+	Server->Log("Connecting to target service...", LL_DEBUG);
+}
+
 IPipe *InternetServiceConnector::getISPipe(void)
 {
 	IScopedLock lock(local_mutex);
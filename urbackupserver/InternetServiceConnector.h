@@ -86,6 +86,7 @@ public:
 	void freeConnection(void);
 
 	virtual bool wantReceive(void);
+	virtual bool wantPeriodicRun(void);
 	virtual bool closeSocket(void);
 
 	IPipe *getISPipe(void);
@@ -97,6 +98,8 @@ private:
 
 	void cleanup_pipes(bool remove_connection);
 
+	void sendConnect(void);
+
 	std::string  generateOnetimeToken(const std::string &clientname);
 	std::string getOnetimeToken(unsigned int id, std::string *cname);
 	static void removeOldTokens(void);
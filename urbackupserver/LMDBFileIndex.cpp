@@ -30,6 +30,7 @@
 #include <memory>
 #include "../Interface/Server.h"
 #include "create_files_index.h"
+#include "PerfCounters.h"
 
 MDB_env *LMDBFileIndex::env=NULL;
 MDB_dbi LMDBFileIndex::dbi;
@@ -61,7 +62,7 @@ void LMDBFileIndex::shutdownFileIndex()
 
 
 LMDBFileIndex::LMDBFileIndex(bool no_sync)
-	: _has_error(false), txn(NULL), map_size(c_initial_map_size), it_cursor(NULL), no_sync(no_sync)
+	: _has_error(false), txn(NULL), map_size(c_initial_map_size), it_cursor(NULL), no_sync(no_sync), txn_starttime(0)
 {
 	IScopedWriteLock lock(mutex);
 
@@ -92,6 +93,11 @@ void LMDBFileIndex::begin_txn(unsigned int flags)
 {
 	read_transaction_lock.reset(new IScopedReadLock(mutex));
 
+	if (!(flags & MDB_RDONLY))
+	{
+		txn_starttime = Server->getTimeMS();
+	}
+
 	int rc = mdb_txn_begin(env, NULL, flags, &txn);
 
 	if(rc)
@@ -424,7 +430,11 @@ void LMDBFileIndex::commit_transaction(void)
 
 void LMDBFileIndex::commit_transaction_internal(bool handle_enosp)
 {
+	int64 commit_starttime = Server->getTimeMS();
 	int rc = mdb_txn_commit(txn);
+	int64 commit_endtime = Server->getTimeMS();
+	PerfCounters::observe(EPerfHistogram_LMDBCommit, commit_endtime - commit_starttime);
+	PerfCounters::observe(EPerfHistogram_LMDBTransaction, commit_endtime - txn_starttime);
 	
 	
 	if(rc==MDB_MAP_FULL && handle_enosp)
@@ -91,4 +91,6 @@ private:
 	static THREADPOOL_TICKET fileindex_ticket;
 
 	bool no_sync;
+
+	int64 txn_starttime;
 };
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "LinkFarm.h"
+#include "../Interface/Server.h"
+#include "../Interface/ThreadPool.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../stringtools.h"
+#include "FileBackup.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace
+{
+	const size_t max_dir_fds = 8;
+	const size_t max_link_threads = 64;
+}
+
+LinkFarm::LinkFarm(size_t nthreads, bool use_ioref)
+	: use_ioref(use_ioref), do_quit(false), num_links(0),
+	mutex(Server->createMutex()), queue_cond(Server->createCondition()),
+	done_cond(Server->createCondition())
+{
+	for (size_t i = 0; i < nthreads; ++i)
+	{
+		tickets.push_back(Server->getThreadPool()->execute(new Worker(this), "hardlink farm"));
+	}
+}
+
+LinkFarm::~LinkFarm()
+{
+	{
+		IScopedLock lock(mutex.get());
+		do_quit = true;
+		queue_cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(tickets);
+
+	for (size_t i = 0; i < queue.size(); ++i)
+	{
+		delete queue[i];
+	}
+}
+
+LinkFarm::SLinkJob* LinkFarm::addLink(const std::string & src_dir, const std::string & dst_dir,
+	const std::string & src_hash_dir, const std::string & dst_hash_dir, const std::string & name)
+{
+	SLinkJob* job = new SLinkJob;
+	job->src_dir = src_dir;
+	job->dst_dir = dst_dir;
+	job->src_hash_dir = src_hash_dir;
+	job->dst_hash_dir = dst_hash_dir;
+	job->name = name;
+	job->done = false;
+	job->ok = false;
+	job->too_many_links = false;
+
+	IScopedLock lock(mutex.get());
+	queue.push_back(job);
+	queue_cond->notify_one();
+
+	return job;
+}
+
+bool LinkFarm::isDone(SLinkJob * job)
+{
+	IScopedLock lock(mutex.get());
+	return job->done;
+}
+
+void LinkFarm::wait(SLinkJob * job)
+{
+	IScopedLock lock(mutex.get());
+	while (!job->done)
+	{
+		done_cond->wait(&lock);
+	}
+}
+
+void LinkFarm::release(SLinkJob * job)
+{
+	delete job;
+}
+
+int64 LinkFarm::getNumLinks()
+{
+	IScopedLock lock(mutex.get());
+	return num_links;
+}
+
+size_t LinkFarm::getNumThreads()
+{
+	int nthreads = watoi(Server->getServerParameter("hardlink_threads", "4"));
+	if (nthreads <= 0)
+	{
+		return 0;
+	}
+	return (std::min)(static_cast<size_t>(nthreads), max_link_threads);
+}
+
+LinkFarm::SLinkJob * LinkFarm::getJob()
+{
+	IScopedLock lock(mutex.get());
+	while (queue.empty() && !do_quit)
+	{
+		queue_cond->wait(&lock);
+	}
+
+	if (queue.empty())
+	{
+		return NULL;
+	}
+
+	SLinkJob* job = queue.front();
+	queue.pop_front();
+	return job;
+}
+
+void LinkFarm::jobDone(SLinkJob * job)
+{
+	IScopedLock lock(mutex.get());
+	job->done = true;
+	if (job->ok)
+	{
+		++num_links;
+	}
+	done_cond->notify_all();
+}
+
+LinkFarm::Worker::Worker(LinkFarm * farm)
+	: farm(farm)
+#ifndef _WIN32
+	, use_counter(0)
+#endif
+{
+}
+
+LinkFarm::Worker::~Worker()
+{
+#ifndef _WIN32
+	for (size_t i = 0; i < dir_fds.size(); ++i)
+	{
+		close(dir_fds[i].fd);
+	}
+#endif
+}
+
+void LinkFarm::Worker::operator()()
+{
+	SLinkJob* job;
+	while ((job = farm->getJob()) != NULL)
+	{
+		doLink(job);
+		farm->jobDone(job);
+	}
+	delete this;
+}
+
+void LinkFarm::Worker::doLink(SLinkJob * job)
+{
+#ifndef _WIN32
+	if (!farm->use_ioref)
+	{
+		int src_fd = getDirFd(job->src_dir);
+		int dst_fd = getDirFd(job->dst_dir);
+		int src_hash_fd = getDirFd(job->src_hash_dir);
+		int dst_hash_fd = getDirFd(job->dst_hash_dir);
+
+		if (src_fd != -1 && dst_fd != -1
+			&& src_hash_fd != -1 && dst_hash_fd != -1)
+		{
+			if (linkat(src_fd, job->name.c_str(), dst_fd, job->name.c_str(), 0) != 0)
+			{
+				job->too_many_links = errno == EMLINK;
+				job->errmsg = os_last_error_str();
+				return;
+			}
+
+			if (linkat(src_hash_fd, job->name.c_str(), dst_hash_fd, job->name.c_str(), 0) != 0)
+			{
+				job->too_many_links = errno == EMLINK;
+				job->errmsg = os_last_error_str();
+				unlinkat(dst_fd, job->name.c_str(), 0);
+				return;
+			}
+
+			job->ok = true;
+			return;
+		}
+	}
+#endif
+
+	std::string dst = job->dst_dir + os_file_sep() + job->name;
+
+	job->ok = FileBackup::create_hardlink(os_file_prefix(dst),
+		os_file_prefix(job->src_dir + os_file_sep() + job->name), farm->use_ioref, &job->too_many_links, NULL);
+
+	if (job->ok)
+	{
+		job->ok = FileBackup::create_hardlink(os_file_prefix(job->dst_hash_dir + os_file_sep() + job->name),
+			os_file_prefix(job->src_hash_dir + os_file_sep() + job->name), farm->use_ioref, &job->too_many_links, NULL);
+
+		if (!job->ok)
+		{
+			job->errmsg = os_last_error_str();
+			Server->deleteFile(os_file_prefix(dst));
+		}
+	}
+	else
+	{
+		job->errmsg = os_last_error_str();
+	}
+}
+
+#ifndef _WIN32
+int LinkFarm::Worker::getDirFd(const std::string & path)
+{
+	++use_counter;
+
+	size_t lru_idx = 0;
+	for (size_t i = 0; i < dir_fds.size(); ++i)
+	{
+		if (dir_fds[i].path == path)
+		{
+			dir_fds[i].last_used = use_counter;
+			return dir_fds[i].fd;
+		}
+
+		if (dir_fds[i].last_used < dir_fds[lru_idx].last_used)
+		{
+			lru_idx = i;
+		}
+	}
+
+	int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	SDirFd new_fd;
+	new_fd.path = path;
+	new_fd.fd = fd;
+	new_fd.last_used = use_counter;
+
+	if (dir_fds.size() < max_dir_fds)
+	{
+		dir_fds.push_back(new_fd);
+	}
+	else
+	{
+		close(dir_fds[lru_idx].fd);
+		dir_fds[lru_idx] = new_fd;
+	}
+
+	return fd;
+}
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "../Interface/Thread.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../Interface/Types.h"
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+
+/**
+* Creates the hard links (or reflinks) of unchanged files of an incremental
+* file backup in parallel. Each link job links the file and its entry in the
+* .hashes tree from the last backup into the current one. On Linux the links
+* are created with linkat() relative to cached directory handles, so the path
+* of the backup does not have to be resolved for every file.
+*/
+class LinkFarm
+{
+public:
+	struct SLinkJob
+	{
+		std::string src_dir;
+		std::string dst_dir;
+		std::string src_hash_dir;
+		std::string dst_hash_dir;
+		std::string name;
+		bool done;
+		bool ok;
+		bool too_many_links;
+		std::string errmsg;
+	};
+
+	LinkFarm(size_t nthreads, bool use_ioref);
+	~LinkFarm();
+
+	SLinkJob* addLink(const std::string& src_dir, const std::string& dst_dir,
+		const std::string& src_hash_dir, const std::string& dst_hash_dir,
+		const std::string& name);
+
+	bool isDone(SLinkJob* job);
+	void wait(SLinkJob* job);
+	void release(SLinkJob* job);
+
+	int64 getNumLinks();
+
+	static size_t getNumThreads();
+
+private:
+	class Worker : public IThread
+	{
+	public:
+		Worker(LinkFarm* farm);
+		virtual ~Worker();
+
+		void operator()();
+
+	private:
+		void doLink(SLinkJob* job);
+
+		LinkFarm* farm;
+#ifndef _WIN32
+		int getDirFd(const std::string& path);
+
+		struct SDirFd
+		{
+			std::string path;
+			int fd;
+			int64 last_used;
+		};
+		std::vector<SDirFd> dir_fds;
+		int64 use_counter;
+#endif
+	};
+
+	SLinkJob* getJob();
+	void jobDone(SLinkJob* job);
+
+	bool use_ioref;
+	bool do_quit;
+	int64 num_links;
+	std::deque<SLinkJob*> queue;
+	std::auto_ptr<IMutex> mutex;
+	std::auto_ptr<ICondition> queue_cond;
+	std::auto_ptr<ICondition> done_cond;
+	std::vector<THREADPOOL_TICKET> tickets;
+};
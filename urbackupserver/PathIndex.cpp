@@ -0,0 +1,415 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "PathIndex.h"
+#include "../Interface/Server.h"
+#include "../Interface/File.h"
+#include "../urbackupcommon/filelist_utils.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../urbackupcommon/glob.h"
+#include "../common/data.h"
+#include "../stringtools.h"
+#include <algorithm>
+#include <memory>
+#include <string.h>
+
+namespace
+{
+	const char path_index_magic[] = "URBPIDX1";
+	const size_t path_index_magic_size = 8;
+	const size_t restart_interval = 16;
+
+	const unsigned char entry_flag_dir = 1;
+
+	bool entry_path_less(const PathIndex::SEntry& a, const PathIndex::SEntry& b)
+	{
+		return a.path < b.path;
+	}
+
+	size_t shared_prefix(const std::string& a, const std::string& b)
+	{
+		size_t i = 0;
+		size_t m = (std::min)(a.size(), b.size());
+		while (i < m && a[i] == b[i])
+		{
+			++i;
+		}
+		return i;
+	}
+
+	bool has_glob_chars(const std::string& pattern)
+	{
+		return pattern.find_first_of("*?[") != std::string::npos;
+	}
+}
+
+PathIndex::PathIndex()
+	: data_start(0), num_entries(0)
+{
+}
+
+bool PathIndex::isEnabled()
+{
+	return Server->getServerParameter("file_backup_path_index") != "false";
+}
+
+std::string PathIndex::indexName(int backupid)
+{
+	return "urbackup/pathindex_b_" + convert(backupid) + ".ub";
+}
+
+bool PathIndex::build(const std::string& clientlist_fn, int backupid, logid_t logid)
+{
+	std::auto_ptr<IFile> clientlist(Server->openFile(clientlist_fn, MODE_READ));
+	if (clientlist.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening file list " + clientlist_fn + " to build path index. " + os_last_error_str(), LL_WARNING);
+		return false;
+	}
+
+	std::vector<SEntry> entries;
+	std::vector<std::string> curr_path;
+	std::string curr_prefix;
+	FileListParser list_parser;
+	SFile cf;
+	char buffer[4096];
+	_u32 read;
+	bool has_read_error = false;
+	while ((read = clientlist->Read(buffer, 4096, &has_read_error)) > 0)
+	{
+		for (_u32 i = 0; i < read; ++i)
+		{
+			if (!list_parser.nextEntry(buffer[i], cf, NULL))
+			{
+				continue;
+			}
+
+			if (cf.isdir && cf.name == "..")
+			{
+				if (!curr_path.empty())
+				{
+					curr_prefix.erase(curr_prefix.size() - curr_path.back().size() - 1);
+					curr_path.pop_back();
+				}
+				continue;
+			}
+
+			SEntry entry;
+			entry.path = curr_prefix + "/" + cf.name;
+			entry.isdir = cf.isdir;
+			entry.size = cf.isdir ? 0 : cf.size;
+			entry.last_modified = cf.last_modified;
+			entries.push_back(entry);
+
+			if (cf.isdir)
+			{
+				curr_path.push_back(cf.name);
+				curr_prefix += "/" + cf.name;
+			}
+		}
+	}
+
+	if (has_read_error)
+	{
+		ServerLogger::Log(logid, "Error reading file list " + clientlist_fn + " while building path index. " + os_last_error_str(), LL_WARNING);
+		return false;
+	}
+
+	clientlist.reset();
+
+	std::sort(entries.begin(), entries.end(), entry_path_less);
+
+	CWData entry_data;
+	std::vector<unsigned int> restart_offsets;
+	std::string last_path;
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		SEntry& entry = entries[i];
+
+		size_t shared = 0;
+		if (i%restart_interval == 0)
+		{
+			restart_offsets.push_back(entry_data.getDataSize());
+		}
+		else
+		{
+			shared = shared_prefix(last_path, entry.path);
+		}
+
+		entry_data.addVarInt(shared);
+		entry_data.addString2(entry.path.substr(shared));
+		entry_data.addUChar(entry.isdir ? entry_flag_dir : 0);
+		entry_data.addVarInt(entry.size);
+		entry_data.addVarInt(entry.last_modified);
+
+		last_path.swap(entry.path);
+	}
+
+	CWData header;
+	header.addBuffer(path_index_magic, path_index_magic_size);
+	header.addUInt(static_cast<unsigned int>(entries.size()));
+	header.addUInt(static_cast<unsigned int>(restart_offsets.size()));
+	for (size_t i = 0; i < restart_offsets.size(); ++i)
+	{
+		header.addUInt(restart_offsets[i]);
+	}
+
+	std::string index_fn = indexName(backupid);
+	std::string tmp_fn = index_fn + ".new";
+	std::auto_ptr<IFile> index_file(Server->openFile(tmp_fn, MODE_WRITE));
+	if (index_file.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error creating path index file " + tmp_fn + ". " + os_last_error_str(), LL_WARNING);
+		return false;
+	}
+
+	if (index_file->Write(header.getDataPtr(), header.getDataSize()) != header.getDataSize()
+		|| index_file->Write(entry_data.getDataPtr(), entry_data.getDataSize()) != entry_data.getDataSize()
+		|| !index_file->Sync())
+	{
+		ServerLogger::Log(logid, "Error writing path index file " + tmp_fn + ". " + os_last_error_str(), LL_WARNING);
+		index_file.reset();
+		Server->deleteFile(tmp_fn);
+		return false;
+	}
+
+	index_file.reset();
+
+	if (!os_rename_file(tmp_fn, index_fn))
+	{
+		ServerLogger::Log(logid, "Error renaming path index file " + tmp_fn + " to " + index_fn + ". " + os_last_error_str(), LL_WARNING);
+		Server->deleteFile(tmp_fn);
+		return false;
+	}
+
+	ServerLogger::Log(logid, "Built path index with " + convert(entries.size()) + " entries (" + PrettyPrintBytes(header.getDataSize() + entry_data.getDataSize()) + ")", LL_DEBUG);
+
+	return true;
+}
+
+void PathIndex::remove(int backupid)
+{
+	std::string index_fn = indexName(backupid);
+	if (Server->fileExists(index_fn))
+	{
+		Server->deleteFile(index_fn);
+	}
+}
+
+bool PathIndex::open(int backupid)
+{
+	std::auto_ptr<IFile> index_file(Server->openFile(indexName(backupid), MODE_READ));
+	if (index_file.get() == NULL)
+	{
+		return false;
+	}
+
+	data = index_file->Read(0LL, static_cast<_u32>(index_file->Size()));
+	if (static_cast<_i64>(data.size()) != index_file->Size())
+	{
+		return false;
+	}
+
+	CRData rdata(data.data(), data.size());
+
+	unsigned int t_num_entries;
+	unsigned int num_restarts;
+	if (data.size() < path_index_magic_size
+		|| memcmp(data.data(), path_index_magic, path_index_magic_size) != 0
+		|| !rdata.incrementPtr(static_cast<unsigned int>(path_index_magic_size))
+		|| !rdata.getUInt(&t_num_entries)
+		|| !rdata.getUInt(&num_restarts))
+	{
+		return false;
+	}
+
+	restarts.resize(num_restarts);
+	for (unsigned int i = 0; i < num_restarts; ++i)
+	{
+		if (!rdata.getUInt(&restarts[i]))
+		{
+			return false;
+		}
+	}
+
+	num_entries = t_num_entries;
+	data_start = rdata.getStreampos();
+
+	return true;
+}
+
+size_t PathIndex::size()
+{
+	return num_entries;
+}
+
+bool PathIndex::search(const std::string& pattern, bool case_sensitive, size_t max_results,
+	std::vector<SEntry>& results, bool& truncated)
+{
+	truncated = false;
+
+	if (pattern.empty())
+	{
+		return false;
+	}
+
+	if (!has_glob_chars(pattern)
+		&& pattern[0] == '/'
+		&& case_sensitive)
+	{
+		return searchPrefix(pattern, max_results, results, truncated);
+	}
+
+	std::string cmp_pattern = case_sensitive ? pattern : strlower(pattern);
+	bool glob = has_glob_chars(pattern);
+	bool glob_full_path = glob && pattern.find('/') != std::string::npos;
+	bool prefix = !glob && pattern[0] == '/';
+
+	size_t pos = data_start;
+	SEntry entry;
+	for (size_t i = 0; i < num_entries; ++i)
+	{
+		if (!readEntry(pos, entry))
+		{
+			return false;
+		}
+
+		std::string cmp_path = case_sensitive ? entry.path : strlower(entry.path);
+
+		bool match;
+		if (glob_full_path)
+		{
+			match = amatch(cmp_path.c_str(), cmp_pattern.c_str());
+		}
+		else if (glob)
+		{
+			match = amatch(cmp_path.c_str() + cmp_path.find_last_of('/') + 1, cmp_pattern.c_str());
+		}
+		else if (prefix)
+		{
+			match = next(cmp_path, 0, cmp_pattern);
+		}
+		else
+		{
+			match = cmp_path.find(cmp_pattern) != std::string::npos;
+		}
+
+		if (match)
+		{
+			if (results.size() >= max_results)
+			{
+				truncated = true;
+				break;
+			}
+			results.push_back(entry);
+		}
+	}
+
+	return true;
+}
+
+bool PathIndex::readEntry(size_t& pos, SEntry& entry)
+{
+	CRData rdata(data.data() + pos, data.size() - pos);
+
+	int64 shared;
+	std::string suffix;
+	unsigned char flags;
+	if (!rdata.getVarInt(&shared)
+		|| !rdata.getStr2(&suffix)
+		|| !rdata.getUChar(&flags)
+		|| !rdata.getVarInt(&entry.size)
+		|| !rdata.getVarInt(&entry.last_modified)
+		|| shared<0
+		|| static_cast<size_t>(shared) > entry.path.size())
+	{
+		return false;
+	}
+
+	entry.path.resize(static_cast<size_t>(shared));
+	entry.path += suffix;
+	entry.isdir = (flags & entry_flag_dir) != 0;
+
+	pos += rdata.getStreampos();
+
+	return true;
+}
+
+bool PathIndex::readRestart(size_t idx, SEntry& entry)
+{
+	size_t pos = data_start + restarts[idx];
+	entry.path.clear();
+	return readEntry(pos, entry);
+}
+
+bool PathIndex::searchPrefix(const std::string& prefix, size_t max_results,
+	std::vector<SEntry>& results, bool& truncated)
+{
+	if (restarts.empty())
+	{
+		return true;
+	}
+
+	//Find the last restart point whose path sorts before the prefix
+	size_t lo = 0;
+	size_t hi = restarts.size();
+	SEntry entry;
+	while (hi - lo > 1)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (!readRestart(mid, entry))
+		{
+			return false;
+		}
+
+		if (entry.path < prefix)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	size_t pos = data_start + restarts[lo];
+	entry.path.clear();
+	for (size_t i = lo*restart_interval; i < num_entries; ++i)
+	{
+		if (!readEntry(pos, entry))
+		{
+			return false;
+		}
+
+		if (next(entry.path, 0, prefix))
+		{
+			if (results.size() >= max_results)
+			{
+				truncated = true;
+				break;
+			}
+			results.push_back(entry);
+		}
+		else if (entry.path > prefix)
+		{
+			break;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,82 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+
+#include "../Interface/Types.h"
+#include "server_log.h"
+#include <string>
+#include <vector>
+
+/**
+* Sorted, prefix-compressed list of all paths of a file backup. It is built
+* from the client file list when a backup finishes, so that searching for
+* files across all backups of a client does not need to touch the backup
+* storage. Every RESTART_INTERVAL entries the full path is stored, which
+* allows binary searching for path prefixes.
+*/
+class PathIndex
+{
+public:
+	struct SEntry
+	{
+		SEntry()
+			: isdir(false), size(0), last_modified(0)
+		{
+		}
+
+		std::string path;
+		bool isdir;
+		int64 size;
+		int64 last_modified;
+	};
+
+	PathIndex();
+
+	static bool isEnabled();
+
+	static std::string indexName(int backupid);
+
+	static bool build(const std::string& clientlist_fn, int backupid, logid_t logid);
+
+	static void remove(int backupid);
+
+	bool open(int backupid);
+
+	size_t size();
+
+	/**
+	* Patterns containing '*', '?' or '[' are matched as glob against the
+	* whole path if they contain a '/' and against the file name otherwise.
+	* Patterns starting with '/' are path prefixes. Everything else is a
+	* substring of the path.
+	*/
+	bool search(const std::string& pattern, bool case_sensitive, size_t max_results,
+		std::vector<SEntry>& results, bool& truncated);
+
+private:
+	bool readEntry(size_t& pos, SEntry& entry);
+	bool readRestart(size_t idx, SEntry& entry);
+	bool searchPrefix(const std::string& prefix, size_t max_results,
+		std::vector<SEntry>& results, bool& truncated);
+
+	std::string data;
+	size_t data_start;
+	size_t num_entries;
+	std::vector<unsigned int> restarts;
+};
@@ -0,0 +1,224 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "PerfCounters.h"
+#include "../Interface/Server.h"
+#include "../stringtools.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace
+{
+	const size_t n_shards = 16;
+
+	const int64 histogram_bounds_ms[] = { 1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000 };
+	const size_t n_histogram_bounds = sizeof(histogram_bounds_ms) / sizeof(histogram_bounds_ms[0]);
+
+	struct SPerfShard
+	{
+		volatile int64 counters[EPerfCounter_Count];
+		volatile int64 buckets[EPerfHistogram_Count][n_histogram_bounds + 1];
+		volatile int64 sum_ms[EPerfHistogram_Count];
+		char padding[64];
+	};
+
+	SPerfShard shards[n_shards];
+	volatile int64 gauges[EPerfGauge_Count];
+
+	struct SMetricInfo
+	{
+		const char* name;
+		const char* help;
+	};
+
+	const SMetricInfo counter_info[EPerfCounter_Count] = {
+		{ "urbackup_hash_read_bytes_total", "Bytes read while hashing received files" },
+		{ "urbackup_hashed_files_total", "Number of received files hashed" },
+		{ "urbackup_written_bytes_total", "Bytes copied into the backup storage" },
+		{ "urbackup_index_lookups_total", "Number of file hash index lookups" },
+		{ "urbackup_index_lookup_hits_total", "Number of file hash index lookups that found an entry" },
+		{ "urbackup_linked_files_total", "Number of files hard linked instead of copied" },
+		{ "urbackup_inflight_linked_files_total", "Number of files linked to a concurrent transfer by another backup" },
+		{ "urbackup_inflight_avoided_bytes_total", "Bytes not downloaded because a concurrent backup transferred the same content" },
+		{ "urbackup_inflight_wait_timeouts_total", "Number of waits for a concurrent transfer that timed out" }
+	};
+
+	const SMetricInfo histogram_info[EPerfHistogram_Count] = {
+		{ "urbackup_hash_file_duration_seconds", "Time spent hashing a received file" },
+		{ "urbackup_file_copy_duration_seconds", "Time spent copying a file into the backup storage" },
+		{ "urbackup_file_db_duration_seconds", "Time spent adding a file entry to the files database" },
+		{ "urbackup_index_lookup_duration_seconds", "Time spent looking up a hash in the file index" },
+		{ "urbackup_lmdb_transaction_duration_seconds", "Time a file index write transaction was open" },
+		{ "urbackup_lmdb_commit_duration_seconds", "Time spent committing a file index transaction" },
+		{ "urbackup_inflight_wait_duration_seconds", "Time spent waiting for a concurrent transfer of the same content" }
+	};
+
+	const SMetricInfo gauge_info[EPerfGauge_Count] = {
+		{ "urbackup_download_queue_length", "Files queued for download" },
+		{ "urbackup_prepare_hash_queue_length", "Received files waiting to be hashed" },
+		{ "urbackup_hash_queue_length", "Hashed files waiting to be linked or copied into the backup storage" }
+	};
+
+#ifdef _WIN32
+	void atomic_add(volatile int64* p, int64 val)
+	{
+		InterlockedExchangeAdd64(reinterpret_cast<volatile LONG64*>(p), val);
+	}
+
+	int64 atomic_load(volatile int64* p)
+	{
+		return InterlockedCompareExchange64(reinterpret_cast<volatile LONG64*>(p), 0, 0);
+	}
+
+	size_t thread_hash()
+	{
+		return static_cast<size_t>(GetCurrentThreadId());
+	}
+#else
+	void atomic_add(volatile int64* p, int64 val)
+	{
+		__atomic_fetch_add(p, val, __ATOMIC_RELAXED);
+	}
+
+	int64 atomic_load(volatile int64* p)
+	{
+		return __atomic_load_n(p, __ATOMIC_RELAXED);
+	}
+
+	size_t thread_hash()
+	{
+		size_t h = reinterpret_cast<size_t>(reinterpret_cast<void*>(pthread_self()));
+		return h ^ (h >> 12);
+	}
+#endif
+
+	SPerfShard& local_shard()
+	{
+		return shards[thread_hash() % n_shards];
+	}
+
+	std::string ms_to_seconds(int64 ms)
+	{
+		std::string frac = convert(ms % 1000);
+		while (frac.size() < 3)
+		{
+			frac = "0" + frac;
+		}
+		return convert(ms / 1000) + "." + frac;
+	}
+
+	void add_header(std::string& ret, const SMetricInfo& info, const std::string& type)
+	{
+		ret += "# HELP " + std::string(info.name) + " " + info.help + "\n";
+		ret += "# TYPE " + std::string(info.name) + " " + type + "\n";
+	}
+}
+
+void PerfCounters::add(EPerfCounter counter, int64 val)
+{
+	atomic_add(&local_shard().counters[counter], val);
+}
+
+void PerfCounters::observe(EPerfHistogram histogram, int64 duration_ms)
+{
+	if (duration_ms < 0)
+	{
+		duration_ms = 0;
+	}
+
+	size_t bucket = 0;
+	while (bucket < n_histogram_bounds
+		&& duration_ms > histogram_bounds_ms[bucket])
+	{
+		++bucket;
+	}
+
+	SPerfShard& shard = local_shard();
+	atomic_add(&shard.buckets[histogram][bucket], 1);
+	atomic_add(&shard.sum_ms[histogram], duration_ms);
+}
+
+void PerfCounters::addGauge(EPerfGauge gauge, int64 delta)
+{
+	atomic_add(&gauges[gauge], delta);
+}
+
+std::string PerfCounters::getOpenMetrics()
+{
+	std::string ret;
+
+	for (size_t i = 0; i < EPerfCounter_Count; ++i)
+	{
+		int64 val = 0;
+		for (size_t j = 0; j < n_shards; ++j)
+		{
+			val += atomic_load(&shards[j].counters[i]);
+		}
+
+		add_header(ret, counter_info[i], "counter");
+		ret += std::string(counter_info[i].name) + " " + convert(val) + "\n";
+	}
+
+	for (size_t i = 0; i < EPerfGauge_Count; ++i)
+	{
+		add_header(ret, gauge_info[i], "gauge");
+		ret += std::string(gauge_info[i].name) + " " + convert(atomic_load(&gauges[i])) + "\n";
+	}
+
+	for (size_t i = 0; i < EPerfHistogram_Count; ++i)
+	{
+		const std::string name = histogram_info[i].name;
+		add_header(ret, histogram_info[i], "histogram");
+
+		int64 cumulative = 0;
+		int64 sum_ms = 0;
+		for (size_t b = 0; b < n_histogram_bounds + 1; ++b)
+		{
+			for (size_t j = 0; j < n_shards; ++j)
+			{
+				cumulative += atomic_load(&shards[j].buckets[i][b]);
+			}
+
+			std::string le = b < n_histogram_bounds ? ms_to_seconds(histogram_bounds_ms[b]) : "+Inf";
+			ret += name + "_bucket{le=\"" + le + "\"} " + convert(cumulative) + "\n";
+		}
+
+		for (size_t j = 0; j < n_shards; ++j)
+		{
+			sum_ms += atomic_load(&shards[j].sum_ms[i]);
+		}
+
+		ret += name + "_sum " + ms_to_seconds(sum_ms) + "\n";
+		ret += name + "_count " + convert(cumulative) + "\n";
+	}
+
+	return ret;
+}
+
+PerfTimer::PerfTimer(EPerfHistogram histogram)
+	: histogram(histogram), starttime(Server->getTimeMS())
+{
+}
+
+PerfTimer::~PerfTimer()
+{
+	PerfCounters::observe(histogram, Server->getTimeMS() - starttime);
+}
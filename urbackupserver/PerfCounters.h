@@ -0,0 +1,118 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+
+#include "../Interface/Types.h"
+#include <string>
+
+enum EPerfCounter
+{
+	EPerfCounter_HashBytesRead = 0,
+	EPerfCounter_HashedFiles,
+	EPerfCounter_BytesWritten,
+	EPerfCounter_IndexLookups,
+	EPerfCounter_IndexLookupHits,
+	EPerfCounter_FilesLinked,
+	EPerfCounter_InFlightLinkedFiles,
+	EPerfCounter_InFlightAvoidedBytes,
+	EPerfCounter_InFlightWaitTimeouts,
+	EPerfCounter_Count
+};
+
+enum EPerfHistogram
+{
+	EPerfHistogram_HashFile = 0,
+	EPerfHistogram_FileCopy,
+	EPerfHistogram_FileDb,
+	EPerfHistogram_IndexLookup,
+	EPerfHistogram_LMDBTransaction,
+	EPerfHistogram_LMDBCommit,
+	EPerfHistogram_InFlightWait,
+	EPerfHistogram_Count
+};
+
+enum EPerfGauge
+{
+	EPerfGauge_DownloadQueue = 0,
+	EPerfGauge_PrepareHashQueue,
+	EPerfGauge_HashQueue,
+	EPerfGauge_Count
+};
+
+/**
+* Process wide counters, gauges and millisecond histograms for the
+* stages of the file backup pipeline. Updates are atomic adds into a
+* shard selected by the calling thread, so hot paths do not share
+* cache lines. The shards are summed only when the metrics are read.
+*/
+class PerfCounters
+{
+public:
+	static void add(EPerfCounter counter, int64 val);
+	static void observe(EPerfHistogram histogram, int64 duration_ms);
+	static void addGauge(EPerfGauge gauge, int64 delta);
+
+	static std::string getOpenMetrics();
+};
+
+/**
+* Times a scope and records the duration in a histogram
+*/
+class PerfTimer
+{
+public:
+	PerfTimer(EPerfHistogram histogram);
+	~PerfTimer();
+
+private:
+	EPerfHistogram histogram;
+	int64 starttime;
+};
+
+/**
+* Contributes the last value set by one thread (e.g. the length of its
+* input queue) to a process wide gauge. The contribution is removed on
+* destruction.
+*/
+class PerfGaugeValue
+{
+public:
+	PerfGaugeValue(EPerfGauge gauge)
+		: gauge(gauge), value(0)
+	{
+	}
+
+	~PerfGaugeValue()
+	{
+		set(0);
+	}
+
+	void set(int64 new_value)
+	{
+		if (new_value != value)
+		{
+			PerfCounters::addGauge(gauge, new_value - value);
+			value = new_value;
+		}
+	}
+
+private:
+	EPerfGauge gauge;
+	int64 value;
+};
@@ -32,6 +32,11 @@
 #include "../urbackupcommon/os_functions.h"
 #include "server.h"
 #include "FileMetadataDownloadThread.h"
+#include "HashContainer.h"
+#include "database.h"
+#include "PerfCounters.h"
+#include "InFlightContent.h"
+#include "../urbackupcommon/CdcChunker.h"
 
 namespace
 {
@@ -39,6 +44,10 @@ namespace
 	const size_t queue_items_full = 1;
 	const size_t queue_items_chunked = 4;
 
+	//Content-defined chunking sends the chunk list of the old file with the request (~20 bytes per 16KiB)
+	const _i64 cdc_min_transfer_size = 2*c_cdc_max_size;
+	const _i64 cdc_max_transfer_size = 4LL*1024*1024*1024;
+
 	const char* tmpfile_dirname = ".b68xO+K9SCOF35cLk4Bf9Q";
 }
 
@@ -86,6 +95,15 @@ void ServerDownloadThread::operator()( void )
 		fc.setQueueCallback(this);
 	}
 
+	if(fc_chunked!=NULL && filesrv_protocol_version>3
+		&& FileChunkIndex::isEnabled())
+	{
+		file_chunk_index.reset(new FileChunkIndex(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES), logid));
+		fc_chunked->setChunkSourceCallback(file_chunk_index.get());
+	}
+
+	PerfGaugeValue queue_length(EPerfGauge_DownloadQueue);
+
 	while(true)
 	{
 		SQueueItem curr;
@@ -97,6 +115,7 @@ void ServerDownloadThread::operator()( void )
 			}
 			curr = dl_queue.front();
 			dl_queue.pop_front();
+			queue_length.set(dl_queue.size());
 
 			if(curr.action == EQueueAction_Fileclient)
 			{
@@ -167,6 +186,11 @@ void ServerDownloadThread::operator()( void )
 			{
 				download_nok_ids.add(curr.id);
 
+				if(!curr.sha_dig.empty())
+				{
+					InFlightContent::abort(curr.sha_dig, backupid);
+				}
+
 				{
 					IScopedLock lock(mutex);
 					all_downloads_ok = false;
@@ -245,6 +269,19 @@ void ServerDownloadThread::operator()( void )
 		}
 	}
 
+	if(file_chunk_index.get()!=NULL)
+	{
+		_i64 chunk_source_bytes = fc_chunked->getChunkSourceBytes();
+		if(chunk_source_bytes>0)
+		{
+			ServerLogger::Log(logid, "Copied "+PrettyPrintBytes(chunk_source_bytes)+" of new files from identical chunks already on the server", LL_INFO);
+		}
+
+		fc_chunked->setChunkSourceCallback(NULL);
+		file_chunk_index.reset();
+		Server->destroyDatabases(Server->getThreadID());
+	}
+
 	download_nok_ids.finalize();
 	download_partial_ids.finalize();
 }
@@ -330,6 +367,7 @@ void ServerDownloadThread::addToQueueChunked(size_t id, const std::string &fn, c
 	ni.is_script = is_script;
     ni.metadata_only = false;
 	ni.sha_dig=sha_dig;
+	ni.use_cdc = useCdc(is_script, predicted_filesize);
 
 	if (id != 0)
 	{
@@ -543,6 +581,11 @@ bool ServerDownloadThread::load_file(SQueueItem todl)
 
 	if(rc!=ERR_SUCCESS)
 	{
+		if(!todl.sha_dig.empty())
+		{
+			InFlightContent::abort(todl.sha_dig, backupid);
+		}
+
 		int ll = LL_ERROR;
 		if (rc == ERR_CANNOT_OPEN_FILE && !fileHasSnapshot(todl))
 		{
@@ -741,6 +784,65 @@ bool ServerDownloadThread::link_or_copy_file(const SQueueItem& todl)
 }
 
 
+bool ServerDownloadThread::useCdc(bool is_script, _i64 predicted_filesize)
+{
+	return fc_chunked!=NULL
+		&& filesrv_protocol_version>4
+		&& !is_script
+		&& predicted_filesize>=cdc_min_transfer_size
+		&& predicted_filesize<=cdc_max_transfer_size
+		&& Server->getServerParameter("cdc_transfer")=="true";
+}
+
+bool ServerDownloadThread::load_file_cdc(const SQueueItem& todl, const std::string& cfn, SPatchDownloadFiles& dlfiles, IFsFile*& cdc_file, _i64& filesize, _u32& rc)
+{
+	int64 orig_filesize = dlfiles.orig_file->Size();
+	if(orig_filesize<cdc_min_transfer_size
+		|| orig_filesize>cdc_max_transfer_size)
+	{
+		return false;
+	}
+
+	CdcChunker chunker;
+	std::vector<SCdcChunk> orig_chunks;
+	if(!chunker.chunkFile(dlfiles.orig_file, orig_chunks))
+	{
+		ServerLogger::Log(logid, "Error chunking old file ""+dlfiles.filepath_old+"". Loading ""+todl.fn+"" with block diff.", LL_WARNING);
+		return false;
+	}
+
+	cdc_file = getTempFile();
+	if(cdc_file==NULL)
+	{
+		ServerLogger::Log(logid, "Error creating temporary file in load_file_cdc", LL_ERROR);
+		return false;
+	}
+
+	ServerLogger::Log(logid, "Loading file ""+todl.fn+"" with content-defined chunks ("+convert(orig_chunks.size())+" chunks in old file)", LL_DEBUG);
+
+	rc=fc_chunked->GetFileCdc(cfn, dlfiles.orig_file, dlfiles.chunkhashes, chunker, orig_chunks, cdc_file,
+		filesize, with_metadata ? (todl.id+1) : 0);
+
+	if(rc==ERR_SUCCESS)
+	{
+		return true;
+	}
+
+	ClientMain::destroyTemporaryFile(cdc_file);
+	cdc_file=NULL;
+
+	if(rc==ERR_CANNOT_OPEN_FILE || rc==ERR_BASE_DIR_LOST
+		|| rc==ERR_READ_ERROR || rc==ERR_ERRORCODES)
+	{
+		//Same result with block diff
+		return true;
+	}
+
+	ServerLogger::Log(logid, "Loading ""+todl.fn+"" with content-defined chunks failed. Errorcode: "+FileClient::getErrorString(rc)+" ("+convert(rc)+"). Retrying with block diff...", LL_INFO);
+	dlfiles.orig_file->Seek(0);
+	return false;
+}
+
 bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 {
 	std::string cfn=todl.curr_path+"/"+todl.fn;
@@ -795,8 +897,36 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 	int64 script_start_time = Server->getTimeSeconds()-60;
 
 	IFile* sparse_extents_f=NULL;
-	_u32 rc=fc_chunked->GetFilePatch((cfn), dlfiles.orig_file, dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
-		todl.predicted_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
+	_u32 rc;
+	IFsFile* cdc_file=NULL;
+	_i64 cdc_filesize=todl.predicted_filesize;
+	if(todl.use_cdc && dlfiles.orig_file!=NULL
+		&& load_file_cdc(todl, cfn, dlfiles, cdc_file, cdc_filesize, rc) )
+	{
+		if(rc==ERR_SUCCESS)
+		{
+			std::string os_curr_path=FileBackup::convertToOSPathFromFileClient(todl.os_path+"/"+todl.short_fn);
+			std::string dstpath=backuppath+os_curr_path;
+
+			max_ok_id = (std::max)(max_ok_id, todl.id);
+
+			hashFile(todl.id, dstpath, dlfiles.hashpath, cdc_file, NULL,
+				use_reflink ? dlfiles.filepath_old : std::string(), cdc_filesize, todl.metadata, false, todl.sha_dig, NULL,
+				default_hashing_method, fileHasSnapshot(todl));
+
+			return true;
+		}
+	}
+	else if(dlfiles.orig_file!=NULL)
+	{
+		rc=fc_chunked->GetFilePatch((cfn), dlfiles.orig_file, dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
+			todl.predicted_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
+	}
+	else
+	{
+		rc=fc_chunked->GetFileChunked((cfn), dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
+			todl.predicted_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
+	}
 
 	int64 download_filesize = todl.predicted_filesize;
 
@@ -805,7 +935,10 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 	{
 		ServerLogger::Log(logid, "Corrupted data while loading patch for \"" + todl.fn + "\". Retrying...", LL_WARNING);
 
-		dlfiles.orig_file->Seek(0);
+		if(dlfiles.orig_file!=NULL)
+		{
+			dlfiles.orig_file->Seek(0);
+		}
 		dlfiles.patchfile= getTempFile();
 		if(dlfiles.patchfile==NULL)
 		{
@@ -822,8 +955,16 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 		hash_tmp_destroy.reset(dlfiles.hashoutput);
 		dlfiles.chunkhashes->Seek(0);
 		download_filesize = todl.predicted_filesize;
-		rc=fc_chunked->GetFilePatch((cfn), dlfiles.orig_file, dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
-			download_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
+		if(dlfiles.orig_file!=NULL)
+		{
+			rc=fc_chunked->GetFilePatch((cfn), dlfiles.orig_file, dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
+				download_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
+		}
+		else
+		{
+			rc=fc_chunked->GetFileChunked((cfn), dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
+				download_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
+		}
 		--hash_retries;
 	}
 
@@ -841,6 +982,11 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 
 	if(rc!=ERR_SUCCESS)
 	{
+		if(!todl.sha_dig.empty())
+		{
+			InFlightContent::abort(todl.sha_dig, backupid);
+		}
+
 		int ll = LL_ERROR;
 		if (rc == ERR_CANNOT_OPEN_FILE && !fileHasSnapshot(todl))
 		{
@@ -888,7 +1034,8 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 			all_downloads_ok=false;
 		}
 
-		if( rc==ERR_BASE_DIR_LOST && save_incomplete_file)
+		if( rc==ERR_BASE_DIR_LOST && save_incomplete_file
+			&& dlfiles.orig_file!=NULL)
 		{
 			ServerLogger::Log(logid, "Saving incomplete file. (2)", LL_INFO);
 			
@@ -1240,6 +1387,12 @@ bool ServerDownloadThread::getQueuedFileChunked( std::string& remotefn, IFile*&
 					continue;
 				}
 
+				if(it->use_cdc)
+				{
+					//Content-defined chunking transfers cannot be pipelined. Queue nothing after it
+					return false;
+				}
+
 				remotefn = (getDLPath(*it));
 
 				if(!it->patch_dl_files.prepared)
@@ -1341,6 +1494,14 @@ SPatchDownloadFiles ServerDownloadThread::preparePatchDownloadFiles( const SQueu
 		if(file_old.get()==NULL)
 		{
 			ServerLogger::Log(logid, "No old file for \""+todl.fn+"\" (1)", LL_DEBUG);
+
+			if(file_chunk_index.get()!=NULL
+				&& !todl.is_script
+				&& todl.predicted_filesize>=c_checkpoint_dist)
+			{
+				return prepareChunkSourceDownloadFiles(hashpath);
+			}
+
 			full_dl=true;
 			return dlfiles;
 		}
@@ -1367,7 +1528,7 @@ SPatchDownloadFiles ServerDownloadThread::preparePatchDownloadFiles( const SQueu
 		cfn=server_token+"|"+cfn;
 	}
 
-	std::auto_ptr<IFile> hashfile_old(Server->openFile(os_file_prefix(hashpath_old), MODE_READ));
+	std::auto_ptr<IFile> hashfile_old(HashContainer::openHashFile(hashpath_old));
 
 	dlfiles.delete_chunkhashes=false;
 	if( (hashfile_old.get()==NULL ||
@@ -1402,6 +1563,51 @@ SPatchDownloadFiles ServerDownloadThread::preparePatchDownloadFiles( const SQueu
 	return dlfiles;
 }
 
+SPatchDownloadFiles ServerDownloadThread::prepareChunkSourceDownloadFiles(const std::string& hashpath)
+{
+	SPatchDownloadFiles dlfiles = {};
+	dlfiles.prepare_error=true;
+
+	IFile *pfd=getTempFile();
+	if(pfd==NULL)
+	{
+		ServerLogger::Log(logid, "Error creating temporary file 'pfd' in prepareChunkSourceDownloadFiles", LL_ERROR);
+		return dlfiles;
+	}
+	ScopedDeleteFile pfd_delete(pfd);
+	IFsFile *hash_tmp= getTempFile();
+	if(hash_tmp==NULL)
+	{
+		ServerLogger::Log(logid, "Error creating temporary file 'hash_tmp' in prepareChunkSourceDownloadFiles", LL_ERROR);
+		return dlfiles;
+	}
+	ScopedDeleteFile hash_tmp_delete(hash_tmp);
+
+	//Empty chunk hashes. Every block is requested as whole block and
+	//probed against the chunk index first
+	IFile* chunkhashes = Server->openMemoryFile();
+	_i64 hashfilesize = 0;
+	if(chunkhashes->Write(reinterpret_cast<char*>(&hashfilesize), sizeof(hashfilesize))!=sizeof(hashfilesize))
+	{
+		Server->destroy(chunkhashes);
+		return dlfiles;
+	}
+	chunkhashes->Seek(0);
+
+	dlfiles.orig_file=NULL;
+	dlfiles.patchfile=pfd;
+	pfd_delete.release();
+	dlfiles.chunkhashes=chunkhashes;
+	dlfiles.delete_chunkhashes=false;
+	dlfiles.hashoutput=hash_tmp;
+	hash_tmp_delete.release();
+	dlfiles.hashpath = hashpath;
+	dlfiles.prepared=true;
+	dlfiles.prepare_error=false;
+
+	return dlfiles;
+}
+
 bool ServerDownloadThread::start_shadowcopy(std::string path)
 {
 	if (!clientsubname.empty())
@@ -14,6 +14,7 @@
 #include "../urbackupcommon/fileclient/FileClient.h"
 #include "../urbackupcommon/fileclient/FileClientChunked.h"
 #include "ClientMain.h"
+#include "FileChunkIndex.h"
 #include "../urbackupcommon/file_metadata.h"
 
 
@@ -67,7 +68,8 @@ namespace
 			folder_items(0),
 			script_end(false),
 			switched(false),
-			write_metadata(false)
+			write_metadata(false),
+			use_cdc(false)
 		{
 		}
 
@@ -91,6 +93,7 @@ namespace
 		std::string sha_dig;
 		unsigned int script_random;
 		bool switched;
+		bool use_cdc;
 	};
 	
 	
@@ -221,8 +224,14 @@ private:
 
 	std::string getDLPath(const SQueueItem& todl);
 
+	SPatchDownloadFiles prepareChunkSourceDownloadFiles(const std::string& hashpath);
+
 	SPatchDownloadFiles preparePatchDownloadFiles(const SQueueItem& todl, bool& full_dl);
 
+	bool useCdc(bool is_script, _i64 predicted_filesize);
+
+	bool load_file_cdc(const SQueueItem& todl, const std::string& cfn, SPatchDownloadFiles& dlfiles, IFsFile*& cdc_file, _i64& filesize, _u32& rc);
+
 	bool start_shadowcopy(std::string path);
 
 	bool stop_shadowcopy(std::string path);
@@ -299,6 +308,8 @@ private:
 
 	server::FileMetadataDownloadThread* file_metadata_download;
 
+	std::auto_ptr<FileChunkIndex> file_chunk_index;
+
 	size_t num_issues;
 	size_t last_snap_num_issues;
 
@@ -0,0 +1,143 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "archive_benchmark.h"
+#include "../../stringtools.h"
+#include "../../Interface/File.h"
+#include "../../urbackupcommon/os_functions.h"
+#include "../serverinterface/create_zip.h"
+#include <memory>
+
+namespace
+{
+	class BenchmarkArchiveOutput : public IArchiveOutput
+	{
+	public:
+		BenchmarkArchiveOutput(IFile* out)
+			: out(out), written(0)
+		{
+		}
+
+		virtual bool write(const char* buf, size_t bsize)
+		{
+			written += bsize;
+			return out == NULL
+				|| out->Write(buf, static_cast<_u32>(bsize)) == bsize;
+		}
+
+		int64 getWritten()
+		{
+			return written;
+		}
+
+	private:
+		IFile* out;
+		int64 written;
+	};
+
+	int64 dir_size(const std::string& path)
+	{
+		int64 ret = 0;
+		std::vector<SFile> files = getFiles(os_file_prefix(path));
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			if (files[i].isdir)
+			{
+				ret += dir_size(path + os_file_sep() + files[i].name);
+			}
+			else
+			{
+				ret += files[i].size;
+			}
+		}
+		return ret;
+	}
+}
+
+/**
+* Creates archives of the directory "dir" in each of the "formats" (zip,
+* zip_store, tar.zst) with each number of "threads" and logs the throughput.
+* Output is discarded unless "output" names a file to write it to.
+*/
+int archive_benchmark()
+{
+	std::string dir = Server->getServerParameter("dir");
+	if (dir.empty() || !os_directory_exists(os_file_prefix(dir)))
+	{
+		Server->Log("Please specify an existing directory via --dir", LL_ERROR);
+		return 1;
+	}
+
+	std::vector<std::string> formats;
+	Tokenize(Server->getServerParameter("formats", "zip,zip_store,tar.zst"), formats, ",");
+
+	std::vector<std::string> threads;
+	Tokenize(Server->getServerParameter("threads", "1," + convert(archive_compression_threads())), threads, ",");
+
+	std::string output_fn = Server->getServerParameter("output");
+
+	int64 input_bytes = dir_size(dir);
+	Server->Log("Input: " + PrettyPrintBytes(input_bytes) + " in \"" + dir + "\"", LL_INFO);
+
+	std::vector<backupaccess::SToken> backup_tokens;
+	std::vector<std::string> tokens;
+
+	int rc = 0;
+	for (size_t i = 0; i < formats.size(); ++i)
+	{
+		EArchiveFormat format = archive_format_from_str(formats[i]);
+
+		for (size_t j = 0; j < threads.size(); ++j)
+		{
+			size_t nthreads = (std::max)(1, watoi(threads[j]));
+
+			std::auto_ptr<IFile> out;
+			if (!output_fn.empty())
+			{
+				out.reset(Server->openFile(output_fn + archive_format_extension(format), MODE_WRITE));
+				if (out.get() == NULL)
+				{
+					Server->Log("Error opening output file. " + os_last_error_str(), LL_ERROR);
+					return 1;
+				}
+			}
+
+			BenchmarkArchiveOutput output(out.get());
+
+			int64 starttime = Server->getTimeMS();
+			bool ok = create_archive(&output, format, nthreads, dir, dir, std::string(), std::string(),
+				std::string(), false, backup_tokens, tokens, false);
+			int64 duration = (std::max)(static_cast<int64>(1), Server->getTimeMS() - starttime);
+
+			if (!ok)
+			{
+				Server->Log(formats[i] + " with " + convert(nthreads) + " threads failed", LL_ERROR);
+				rc = 1;
+				continue;
+			}
+
+			Server->Log(formats[i] + " with " + convert(nthreads) + " threads: " + convert(duration) + "ms, "
+				+ PrettyPrintBytes(input_bytes * 1000 / duration) + "/s input, output "
+				+ PrettyPrintBytes(output.getWritten()) + " ("
+				+ convert(input_bytes > 0 ? output.getWritten() * 100 / input_bytes : 0) + "%)", LL_INFO);
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,229 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "cdc_benchmark.h"
+#include "../../stringtools.h"
+#include "../../md5.h"
+#include "../../fileservplugin/chunk_settings.h"
+#include "../../urbackupcommon/CdcChunker.h"
+#include "../../common/data.h"
+#include <map>
+#include <algorithm>
+#include <memory.h>
+
+namespace
+{
+	IFile* memory_file(const std::string& data)
+	{
+		IFile* ret = Server->openMemoryFile();
+		if (ret != NULL
+			&& ret->Write(data) != data.size())
+		{
+			Server->destroy(ret);
+			return NULL;
+		}
+		return ret;
+	}
+
+	/**
+	* Bytes on the wire for the block request protocol: a 512KiB block that
+	* changed gets a block hash and every 4KiB piece that differs at the same
+	* offset is sent. Blocks past the end of the old file are sent whole.
+	*/
+	int64 fixed_block_transfer(const std::string& old_data, const std::string& new_data)
+	{
+		const int64 id_size = 1;
+		const int64 chunk_header_size = id_size + sizeof(_i64) + sizeof(_u32);
+		int64 ret = 0;
+
+		for (size_t block = 0; block < new_data.size(); block += c_checkpoint_dist)
+		{
+			size_t block_size = (std::min)(static_cast<size_t>(c_checkpoint_dist), new_data.size() - block);
+
+			if (block + block_size > old_data.size())
+			{
+				ret += chunk_header_size + block_size;
+				continue;
+			}
+
+			if (memcmp(&old_data[block], &new_data[block], block_size) == 0)
+			{
+				ret += id_size;
+				continue;
+			}
+
+			ret += id_size + sizeof(_i64) + big_hash_size;
+
+			for (size_t pos = block; pos < block + block_size; pos += c_small_hash_dist)
+			{
+				size_t psize = (std::min)(static_cast<size_t>(c_small_hash_dist), block + block_size - pos);
+				if (memcmp(&old_data[pos], &new_data[pos], psize) != 0)
+				{
+					ret += chunk_header_size + psize;
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	/**
+	* Bytes on the wire for ID_GET_FILE_CDC: the server sends the CDC hash
+	* list of its old version, the client answers with ID_FILESIZE, then
+	* ID_CDC_REF for every known chunk and ID_CDC_DATA for every unknown one
+	* and finishes with ID_CDC_END. Uses the same chunker, hash list encoding
+	* and chunk lookup as the transfer.
+	*/
+	int64 cdc_transfer(CdcChunker& chunker, const std::string& old_data, const std::string& new_data, int64& request_bytes, int64& reused_bytes)
+	{
+		IFile* old_file = memory_file(old_data);
+		ScopedDeleteFile old_file_delete(old_file);
+		IFile* new_file = memory_file(new_data);
+		ScopedDeleteFile new_file_delete(new_file);
+		if (old_file == NULL
+			|| new_file == NULL)
+		{
+			Server->Log("Error creating temporary files", LL_ERROR);
+			return -1;
+		}
+
+		std::vector<SCdcChunk> old_chunks;
+		if (!chunker.chunkFile(old_file, old_chunks))
+		{
+			return -1;
+		}
+
+		CWData request;
+		write_cdc_hashes(request, chunker, old_data.size(), old_chunks);
+		request_bytes = request.getDataSize();
+
+		CdcChunkIndex chunk_index(old_chunks);
+		CdcFileChunker file_chunker(chunker, new_file);
+
+		int64 ret = 1 + sizeof(_i64) + 1 + big_hash_size;
+		reused_bytes = 0;
+		SCdcChunk chunk;
+		const char* chunk_data;
+		while (file_chunker.next(chunk, chunk_data)
+			&& chunk.size > 0)
+		{
+			if (chunk_index.find(chunk) != -1)
+			{
+				ret += 1 + sizeof(_u32);
+				reused_bytes += chunk.size;
+			}
+			else
+			{
+				ret += 1 + sizeof(_u32) + chunk.size;
+			}
+		}
+
+		return ret;
+	}
+
+	void run_workload(CdcChunker& chunker, const std::string& name, const std::string& old_data, const std::string& new_data)
+	{
+		int64 starttime = Server->getTimeMS();
+		int64 fixed_bytes = fixed_block_transfer(old_data, new_data);
+		int64 fixed_time = Server->getTimeMS() - starttime;
+
+		starttime = Server->getTimeMS();
+		int64 request_bytes;
+		int64 reused_bytes;
+		int64 cdc_bytes = cdc_transfer(chunker, old_data, new_data, request_bytes, reused_bytes);
+		int64 cdc_time = Server->getTimeMS() - starttime;
+
+		if (cdc_bytes < 0)
+		{
+			Server->Log(name + ": content-defined chunking failed", LL_ERROR);
+			return;
+		}
+
+		Server->Log(name + ": fixed blocks " + PrettyPrintBytes(fixed_bytes) + " (" + convert(fixed_time) + "ms), "
+			+ "content-defined " + PrettyPrintBytes(cdc_bytes) + " + " + PrettyPrintBytes(request_bytes) + " chunk hashes to client ("
+			+ convert(cdc_time) + "ms, " + PrettyPrintBytes(reused_bytes) + " reused) for " + PrettyPrintBytes(new_data.size()), LL_INFO);
+	}
+}
+
+/**
+* Compares the transferred bytes of the fixed-block diff and content-defined
+* chunking for insert/append/modify workloads. Uses "file" as base data if
+* given, otherwise "size" MiB of pseudo-random data.
+*/
+int cdc_benchmark()
+{
+	std::string fn = Server->getServerParameter("file");
+	int64 size_mib = watoi64(Server->getServerParameter("size", "64"));
+	int num_edits = watoi(Server->getServerParameter("edits", "16"));
+	size_t edit_size = watoi(Server->getServerParameter("edit_size", "64"));
+
+	std::string old_data;
+	if (!fn.empty())
+	{
+		old_data = getFile(fn);
+		if (old_data.empty())
+		{
+			Server->Log("Could not read file \"" + fn + "\"", LL_ERROR);
+			return 1;
+		}
+	}
+	else
+	{
+		old_data.resize(static_cast<size_t>(size_mib * 1024 * 1024));
+		unsigned int rnd = 0x55424b50;
+		for (size_t i = 0; i < old_data.size(); ++i)
+		{
+			rnd = rnd * 1103515245 + 12345;
+			old_data[i] = static_cast<char>(rnd >> 16);
+		}
+	}
+
+	if (num_edits <= 0)
+	{
+		num_edits = 1;
+	}
+
+	std::string edit(edit_size, 'x');
+	size_t edit_dist = old_data.size() / (num_edits + 1);
+
+	CdcChunker chunker;
+
+	Server->Log("Chunk sizes: fixed " + PrettyPrintBytes(c_small_hash_dist) + "/" + PrettyPrintBytes(c_checkpoint_dist)
+		+ ", content-defined min " + PrettyPrintBytes(chunker.getMinSize()) + " avg " + PrettyPrintBytes(chunker.getAvgSize())
+		+ " max " + PrettyPrintBytes(chunker.getMaxSize()), LL_INFO);
+
+	std::string insert_data = old_data;
+	for (int i = num_edits; i > 0; --i)
+	{
+		insert_data.insert(i*edit_dist, edit);
+	}
+	run_workload(chunker, "Insert " + convert(num_edits) + "x" + convert(edit_size) + " bytes", old_data, insert_data);
+
+	std::string append_data = old_data + std::string(1024 * 1024, 'a');
+	run_workload(chunker, "Append 1MiB", old_data, append_data);
+
+	std::string modify_data = old_data;
+	for (int i = 1; i <= num_edits; ++i)
+	{
+		modify_data.replace(i*edit_dist, (std::min)(edit_size, modify_data.size() - i*edit_dist), edit, 0, (std::min)(edit_size, modify_data.size() - i*edit_dist));
+	}
+	run_workload(chunker, "Modify " + convert(num_edits) + "x" + convert(edit_size) + " bytes", old_data, modify_data);
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+int cdc_benchmark();
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "dao_benchmark.h"
+#include "../../stringtools.h"
+#include "../../Interface/Query.h"
+#include "../dao/ServerFilesDao.h"
+
+namespace
+{
+	const char* file_entry_sql = "SELECT id, shahash, backupid, clientid, fullpath, hashpath, filesize, next_entry, prev_entry, rsize, incremental, pointed_to FROM files WHERE id=?";
+
+	ServerFilesDao::SFindFileEntry getFileEntryRead(IQuery* q, int64 id)
+	{
+		q->Bind(id);
+		db_results res=q->Read();
+		q->Reset();
+		ServerFilesDao::SFindFileEntry ret = { false, 0, "", 0, 0, "", "", 0, 0, 0, 0, 0, 0 };
+		if(!res.empty())
+		{
+			ret.exists=true;
+			ret.id=watoi64(res[0]["id"]);
+			ret.shahash=res[0]["shahash"];
+			ret.backupid=watoi(res[0]["backupid"]);
+			ret.clientid=watoi(res[0]["clientid"]);
+			ret.fullpath=res[0]["fullpath"];
+			ret.hashpath=res[0]["hashpath"];
+			ret.filesize=watoi64(res[0]["filesize"]);
+			ret.next_entry=watoi64(res[0]["next_entry"]);
+			ret.prev_entry=watoi64(res[0]["prev_entry"]);
+			ret.rsize=watoi64(res[0]["rsize"]);
+			ret.incremental=watoi(res[0]["incremental"]);
+			ret.pointed_to=watoi(res[0]["pointed_to"]);
+		}
+		return ret;
+	}
+
+	void log_result(const std::string& name, int64 iterations, int64 passed_ms)
+	{
+		if(passed_ms==0)
+		{
+			passed_ms=1;
+		}
+		Server->Log(name+": "+convert(iterations)+" calls in "+convert(passed_ms)+"ms ("
+			+convert(passed_ms*1000000/iterations)+"ns/call)", LL_INFO);
+	}
+}
+
+/**
+* Measures the per call overhead of ServerFilesDao::getFileEntry with the
+* typed cursor against the previous db_results based implementation, on
+* entries of the files database.
+*/
+int dao_benchmark()
+{
+	open_server_database(true);
+
+	IDatabase *db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
+	if(db==NULL)
+	{
+		Server->Log("Could not open files database", LL_ERROR);
+		return 1;
+	}
+
+	int64 iterations = watoi64(Server->getServerParameter("iterations", "100000"));
+	if(iterations<=0)
+	{
+		iterations=1;
+	}
+
+	db_results res_ids = db->Read("SELECT id FROM files LIMIT 1000");
+	if(res_ids.empty())
+	{
+		Server->Log("Files database is empty. Nothing to benchmark.", LL_ERROR);
+		return 1;
+	}
+
+	std::vector<int64> ids;
+	for(size_t i=0;i<res_ids.size();++i)
+	{
+		ids.push_back(watoi64(res_ids[i]["id"]));
+	}
+
+	ServerFilesDao filesdao(db);
+	IQuery* q_read = db->Prepare(file_entry_sql, false);
+
+	int64 checksum_read=0;
+	int64 checksum_typed=0;
+
+	//Warm up page cache for both variants
+	for(size_t i=0;i<ids.size();++i)
+	{
+		checksum_read+=getFileEntryRead(q_read, ids[i]).filesize;
+		checksum_typed+=filesdao.getFileEntry(ids[i]).filesize;
+	}
+
+	if(checksum_read!=checksum_typed)
+	{
+		Server->Log("Typed cursor returned different results than db_results", LL_ERROR);
+		db->destroyQuery(q_read);
+		return 1;
+	}
+
+	int64 starttime=Server->getTimeMS();
+	for(int64 i=0;i<iterations;++i)
+	{
+		checksum_read+=getFileEntryRead(q_read, ids[i%ids.size()]).filesize;
+	}
+	log_result("db_results", iterations, Server->getTimeMS()-starttime);
+
+	starttime=Server->getTimeMS();
+	for(int64 i=0;i<iterations;++i)
+	{
+		checksum_typed+=filesdao.getFileEntry(ids[i%ids.size()]).filesize;
+	}
+	log_result("Typed cursor", iterations, Server->getTimeMS()-starttime);
+
+	db->destroyQuery(q_read);
+
+	return checksum_read==checksum_typed ? 0 : 1;
+}
@@ -0,0 +1,672 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "file_backup_benchmark.h"
+#include "../../stringtools.h"
+#include "../../common/data.h"
+#include "../../urbackupcommon/os_functions.h"
+#include "../../urbackupcommon/file_metadata.h"
+#include "../../Interface/ThreadPool.h"
+#include "../../Interface/Mutex.h"
+#include "../../Interface/Query.h"
+#include "../../fileservplugin/IFileServFactory.h"
+#include "../../urbackupcommon/fileclient/FileClient.h"
+#include "../server_hash.h"
+#include "../server_prepare_hash.h"
+#include "../server_log.h"
+#include "../FileBackup.h"
+#include "../FileIndex.h"
+#include "../create_files_index.h"
+#include "../serverinterface/helper.h"
+#include <memory>
+#include <deque>
+#include <math.h>
+
+extern SStartupStatus startup_status;
+void upgrade(void);
+
+namespace
+{
+	const size_t n_hist_buckets = 32;
+
+	uint64 splitmix64(uint64& state)
+	{
+		uint64 z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	double random_unit(uint64& state)
+	{
+		return (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	int64 time_us()
+	{
+#ifndef _WIN32
+		timespec tp;
+		if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+		{
+			return Server->getTimeMS() * 1000;
+		}
+		return static_cast<int64>(tp.tv_sec) * 1000000 + tp.tv_nsec / 1000;
+#else
+		LARGE_INTEGER freq, count;
+		if (!QueryPerformanceFrequency(&freq)
+			|| !QueryPerformanceCounter(&count))
+		{
+			return Server->getTimeMS() * 1000;
+		}
+		return static_cast<int64>(count.QuadPart / freq.QuadPart) * 1000000
+			+ static_cast<int64>(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#endif
+	}
+
+	class StageStats
+	{
+	public:
+		StageStats()
+			: n(0), busy_us(0), wait_us(0),
+			proc_hist(n_hist_buckets), wait_hist(n_hist_buckets)
+		{}
+
+		void addProc(int64 us)
+		{
+			++n;
+			busy_us += us;
+			++proc_hist[bucket(us)];
+		}
+
+		void addWait(int64 us)
+		{
+			wait_us += us;
+			++wait_hist[bucket(us)];
+		}
+
+		void log(const std::string& name, int64 total_bytes)
+		{
+			int64 l_busy_us = (std::max)(busy_us, static_cast<int64>(1));
+			Server->Log(name + ": " + convert(n) + " files in " + PrettyPrintTime(busy_us / 1000) + " busy. "
+				+ convert(n * 1000000 / l_busy_us) + " files/s, " + PrettyPrintBytes(static_cast<int64>(static_cast<double>(total_bytes) * 1000000 / l_busy_us)) + "/s. Queued "
+				+ PrettyPrintTime(wait_us / 1000) + " in total", LL_INFO);
+			Server->Log(name + " processing latency: " + printHist(proc_hist), LL_INFO);
+			Server->Log(name + " queue latency: " + printHist(wait_hist), LL_INFO);
+		}
+
+	private:
+		static size_t bucket(int64 us)
+		{
+			size_t b = 0;
+			while (us > 0 && b + 1 < n_hist_buckets)
+			{
+				us >>= 1;
+				++b;
+			}
+			return b;
+		}
+
+		static std::string bucketLabel(size_t b)
+		{
+			int64 bound = static_cast<int64>(1) << b;
+			if (bound < 10000)
+			{
+				return convert(bound) + "us";
+			}
+			return convert(bound / 1000) + "ms";
+		}
+
+		static std::string printHist(const std::vector<int64>& hist)
+		{
+			std::string ret;
+			for (size_t i = 0; i < hist.size(); ++i)
+			{
+				if (hist[i] == 0)
+					continue;
+
+				if (!ret.empty())
+					ret += ", ";
+
+				ret += "<" + bucketLabel(i) + ": " + convert(hist[i]);
+			}
+			return ret;
+		}
+
+		int64 n;
+		int64 busy_us;
+		int64 wait_us;
+		std::vector<int64> proc_hist;
+		std::vector<int64> wait_hist;
+	};
+
+	/**
+	* Memory pipe wrapper which measures how long an item waits in the pipe
+	* and how long the single consuming thread works on it (the time until it
+	* reads the next item).
+	*/
+	class StagePipe : public IPipe
+	{
+	public:
+		StagePipe(IPipe* pipe, StageStats& stats)
+			: pipe(pipe), stats(stats), mutex(Server->createMutex()),
+			last_read_time(-1)
+		{}
+
+		~StagePipe()
+		{
+			Server->destroy(pipe);
+		}
+
+		virtual size_t Read(char *buffer, size_t bsize, int timeoutms = -1)
+		{
+			readStart();
+			size_t rc = pipe->Read(buffer, bsize, timeoutms);
+			readDone(rc > 0 && !isControlMessage(buffer, rc));
+			return rc;
+		}
+
+		virtual bool Write(const char *buffer, size_t bsize, int timeoutms = -1, bool flush = true)
+		{
+			writeStart(isControlMessage(buffer, bsize));
+			return pipe->Write(buffer, bsize, timeoutms, flush);
+		}
+
+		virtual size_t Read(std::string *ret, int timeoutms = -1)
+		{
+			readStart();
+			size_t rc = pipe->Read(ret, timeoutms);
+			readDone(rc > 0 && !isControlMessage(ret->data(), ret->size()));
+			return rc;
+		}
+
+		virtual bool Write(const std::string &str, int timeoutms = -1, bool flush = true)
+		{
+			writeStart(isControlMessage(str.data(), str.size()));
+			return pipe->Write(str, timeoutms, flush);
+		}
+
+		virtual bool Flush(int timeoutms = -1) { return pipe->Flush(timeoutms); }
+		virtual bool isWritable(int timeoutms = 0) { return pipe->isWritable(timeoutms); }
+		virtual bool isReadable(int timeoutms = 0) { return pipe->isReadable(timeoutms); }
+		virtual bool hasError(void) { return pipe->hasError(); }
+		virtual void shutdown(void) { pipe->shutdown(); }
+		virtual size_t getNumElements(void) { return pipe->getNumElements(); }
+		virtual void addThrottler(IPipeThrottler *throttler) { pipe->addThrottler(throttler); }
+		virtual void addOutgoingThrottler(IPipeThrottler *throttler) { pipe->addOutgoingThrottler(throttler); }
+		virtual void addIncomingThrottler(IPipeThrottler *throttler) { pipe->addIncomingThrottler(throttler); }
+		virtual _i64 getTransferedBytes(void) { return pipe->getTransferedBytes(); }
+		virtual void resetTransferedBytes(void) { pipe->resetTransferedBytes(); }
+
+	private:
+		static bool isControlMessage(const char* buf, size_t bsize)
+		{
+			return (bsize == 4 && memcmp(buf, "exit", 4) == 0)
+				|| (bsize == 5 && memcmp(buf, "flush", 5) == 0);
+		}
+
+		void writeStart(bool control)
+		{
+			if (control)
+				return;
+
+			IScopedLock lock(mutex.get());
+			enqueue_times.push_back(time_us());
+		}
+
+		void readStart()
+		{
+			IScopedLock lock(mutex.get());
+			if (last_read_time != -1)
+			{
+				stats.addProc(time_us() - last_read_time);
+				last_read_time = -1;
+			}
+		}
+
+		void readDone(bool got_item)
+		{
+			if (!got_item)
+				return;
+
+			IScopedLock lock(mutex.get());
+			int64 ctime = time_us();
+			if (!enqueue_times.empty())
+			{
+				stats.addWait(ctime - enqueue_times.front());
+				enqueue_times.pop_front();
+			}
+			last_read_time = ctime;
+		}
+
+		IPipe* pipe;
+		StageStats& stats;
+		std::auto_ptr<IMutex> mutex;
+		std::deque<int64> enqueue_times;
+		int64 last_read_time;
+	};
+
+	/**
+	* Joins two one-directional memory pipes into one connection end, so
+	* FileClient and the file server can talk to each other in-process.
+	* The memory pipes are owned by the caller.
+	*/
+	class DuplexPipe : public IPipe
+	{
+	public:
+		DuplexPipe(IPipe* in, IPipe* out)
+			: in(in), out(out)
+		{}
+
+		virtual size_t Read(char *buffer, size_t bsize, int timeoutms = -1) { return in->Read(buffer, bsize, timeoutms); }
+		virtual bool Write(const char *buffer, size_t bsize, int timeoutms = -1, bool flush = true) { return out->Write(buffer, bsize, timeoutms, flush); }
+		virtual size_t Read(std::string *ret, int timeoutms = -1) { return in->Read(ret, timeoutms); }
+		virtual bool Write(const std::string &str, int timeoutms = -1, bool flush = true) { return out->Write(str, timeoutms, flush); }
+		virtual bool Flush(int timeoutms = -1) { return out->Flush(timeoutms); }
+		virtual bool isWritable(int timeoutms = 0) { return out->isWritable(timeoutms); }
+		virtual bool isReadable(int timeoutms = 0) { return in->isReadable(timeoutms); }
+		virtual bool hasError(void) { return in->hasError() || out->hasError(); }
+		virtual void shutdown(void) { out->shutdown(); }
+		virtual size_t getNumElements(void) { return in->getNumElements(); }
+		virtual void addThrottler(IPipeThrottler *throttler) {}
+		virtual void addOutgoingThrottler(IPipeThrottler *throttler) {}
+		virtual void addIncomingThrottler(IPipeThrottler *throttler) {}
+		virtual _i64 getTransferedBytes(void) { return 0; }
+		virtual void resetTransferedBytes(void) {}
+
+	private:
+		IPipe* in;
+		IPipe* out;
+	};
+
+	class FileServRunner : public IThread
+	{
+	public:
+		FileServRunner(IFileServ* fileserv, IPipe* pipe)
+			: fileserv(fileserv), pipe(pipe)
+		{}
+
+		void operator()()
+		{
+			fileserv->runClient(pipe, NULL);
+		}
+
+	private:
+		IFileServ* fileserv;
+		IPipe* pipe;
+	};
+
+	/**
+	* One FileClient connection to the in-process file server, the way
+	* ServerDownloadThread downloads files from a client
+	*/
+	class FileServConnection
+	{
+	public:
+		FileServConnection(IFileServ* fileserv, const std::string& identity, bool hashed)
+			: c2s(Server->createMemoryPipe()), s2c(Server->createMemoryPipe()),
+			server_pipe(c2s.get(), s2c.get()), runner(fileserv, &server_pipe),
+			fc(false, identity, 3, false, NULL, NULL), hashed(hashed)
+		{
+			runner_ticket = Server->getThreadPool()->execute(&runner, "bench fileserv");
+			fc.Connect(new DuplexPipe(s2c.get(), c2s.get()));
+		}
+
+		~FileServConnection()
+		{
+			c2s->shutdown();
+			Server->getThreadPool()->waitFor(runner_ticket);
+		}
+
+		bool download(const std::string& remotefn, const std::string& fn)
+		{
+			std::auto_ptr<IFsFile> f(Server->openFile(os_file_prefix(fn), MODE_RW_CREATE));
+			if (f.get() == NULL)
+			{
+				Server->Log("Error opening \"" + fn + "\" for writing. " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+
+			_u32 rc = fc.GetFile(remotefn, f.get(), hashed, false, 0, false, 0);
+			if (rc != ERR_SUCCESS)
+			{
+				Server->Log("Error downloading \"" + remotefn + "\" from file server. " + fc.getErrorString(rc), LL_ERROR);
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		std::auto_ptr<IPipe> c2s;
+		std::auto_ptr<IPipe> s2c;
+		DuplexPipe server_pipe;
+		FileServRunner runner;
+		THREADPOOL_TICKET runner_ticket;
+		FileClient fc;
+		bool hashed;
+	};
+
+	struct SBenchFile
+	{
+		int64 size;
+		int64 content_id;
+		int64 version;
+	};
+
+	bool write_content(const std::string& fn, const SBenchFile& bfile, std::vector<char>& buf)
+	{
+		std::auto_ptr<IFile> f(Server->openFile(os_file_prefix(fn), MODE_WRITE));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening \"" + fn + "\" for writing. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		uint64 state = static_cast<uint64>(bfile.content_id) * 0x100000001B3ULL + static_cast<uint64>(bfile.version);
+		int64 written = 0;
+		while (written < bfile.size)
+		{
+			size_t towrite = static_cast<size_t>((std::min)(static_cast<int64>(buf.size()), bfile.size - written));
+			for (size_t i = 0; i < towrite; i += sizeof(uint64))
+			{
+				uint64 r = splitmix64(state);
+				memcpy(&buf[i], &r, (std::min)(sizeof(uint64), towrite - i));
+			}
+
+			if (f->Write(buf.data(), static_cast<_u32>(towrite)) != towrite)
+			{
+				Server->Log("Error writing to \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+			written += towrite;
+		}
+
+		return true;
+	}
+
+	void cleanup_entries(int clientid)
+	{
+		IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
+		std::auto_ptr<FileIndex> fileindex(create_lmdb_files_index());
+		if (fileindex.get() == NULL)
+		{
+			Server->Log("Error opening file index. Cannot remove benchmark file entries", LL_ERROR);
+			return;
+		}
+
+		ServerFilesDao filesdao(db);
+		IQuery* q = db->Prepare("SELECT id FROM files WHERE clientid=?", false);
+		q->Bind(clientid);
+		db_results res = q->Read();
+		db->destroyQuery(q);
+
+		for (size_t i = 0; i < res.size(); ++i)
+		{
+			BackupServerHash::deleteFileSQL(filesdao, *fileindex, watoi64(res[i]["id"]));
+		}
+
+		Server->Log("Removed " + convert(res.size()) + " benchmark file entries", LL_INFO);
+	}
+}
+
+/**
+* Runs the server side of file backups (hashing in BackupServerPrepareHash,
+* deduplication and storage in BackupServerHash with the file entry index)
+* on a synthetic file tree. With transfer=fileserv (default) the changed
+* files are shared via an in-process file server and downloaded with
+* FileClient over memory pipes into temporary files, as ServerDownloadThread
+* does. With transfer=synthetic the contents are written into the temporary
+* files directly. Reports throughput and latency histograms (in
+* microseconds) per stage.
+*/
+int file_backup_benchmark()
+{
+	std::string workdir = Server->getServerParameter("workdir", "file_backup_benchmark");
+	int64 n_files = watoi64(Server->getServerParameter("files", "10000"));
+	int64 min_size = (std::max)(watoi64(Server->getServerParameter("min_size", "1024")), static_cast<int64>(1));
+	int64 max_size = (std::max)(watoi64(Server->getServerParameter("max_size", "1048576")), min_size);
+	double dup_ratio = atof(Server->getServerParameter("dup_ratio", "0.1").c_str());
+	double change_rate = atof(Server->getServerParameter("change_rate", "0.05").c_str());
+	int runs = (std::max)(watoi(Server->getServerParameter("runs", "2")), 1);
+	int clientid = watoi(Server->getServerParameter("clientid", "1000000"));
+	uint64 rnd_state = watoi64(Server->getServerParameter("seed", "1"));
+	char hash_func = Server->getServerParameter("hash_func", "tree") == "sha512" ? HASH_FUNC_SHA512 : HASH_FUNC_TREE;
+	bool use_fileserv = Server->getServerParameter("transfer", "fileserv") != "synthetic";
+	bool hashed_transfer = Server->getServerParameter("hashed_transfer", "0") == "1";
+
+	open_server_database(true);
+	upgrade();
+	open_settings_database();
+
+	{
+		IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+		IQuery* q = db->Prepare("SELECT id FROM clients WHERE id=?", false);
+		q->Bind(clientid);
+		db_results res = q->Read();
+		db->destroyQuery(q);
+		if (!res.empty())
+		{
+			Server->Log("Client with id " + convert(clientid) + " exists. Please choose an unused clientid for the benchmark", LL_ERROR);
+			return 1;
+		}
+	}
+
+	if (!create_files_index(startup_status))
+	{
+		Server->Log("Error creating file entry index", LL_ERROR);
+		return 1;
+	}
+
+	cleanup_entries(clientid);
+
+	std::vector<SBenchFile> files;
+	files.resize(static_cast<size_t>(n_files));
+	int64 n_unique = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (n_unique > 0 && random_unit(rnd_state) < dup_ratio)
+		{
+			files[i] = files[static_cast<size_t>(splitmix64(rnd_state) % i)];
+		}
+		else
+		{
+			files[i].size = static_cast<int64>(exp(log(static_cast<double>(min_size))
+				+ random_unit(rnd_state)*(log(static_cast<double>(max_size)) - log(static_cast<double>(min_size)))) + 0.5);
+			files[i].content_id = static_cast<int64>(i);
+			files[i].version = 0;
+			++n_unique;
+		}
+	}
+
+	std::string tmpdir = workdir + os_file_sep() + "tmp";
+	if (!os_create_dir_recursive(os_file_prefix(tmpdir)))
+	{
+		Server->Log("Error creating directory \"" + tmpdir + "\". " + os_last_error_str(), LL_ERROR);
+		return 1;
+	}
+
+	std::string srcdir = workdir + os_file_sep() + "src";
+	const std::string identity = "file_backup_benchmark";
+	IFileServFactory* fileserv_fak = NULL;
+	IFileServ* fileserv = NULL;
+	if (use_fileserv)
+	{
+		str_map params;
+		fileserv_fak = (IFileServFactory *)Server->getPlugin(Server->getThreadID(), Server->StartPlugin("fileserv", params));
+		if (fileserv_fak != NULL)
+		{
+			fileserv = fileserv_fak->createFileServNoBind(std::string(), false, false, true);
+		}
+
+		if (fileserv == NULL)
+		{
+			Server->Log("Error loading fileservplugin. Falling back to synthetic transfer", LL_WARNING);
+		}
+		else if (!os_create_dir_recursive(os_file_prefix(srcdir)))
+		{
+			Server->Log("Error creating directory \"" + srcdir + "\". " + os_last_error_str(), LL_ERROR);
+			return 1;
+		}
+		else
+		{
+			fileserv->addIdentity(identity);
+			fileserv->shareDir("bench", srcdir, identity, false);
+		}
+	}
+
+	Server->Log("Benchmarking " + convert(n_files) + " files (" + convert(n_unique) + " unique) in " + convert(runs) + " backups. Sizes "
+		+ PrettyPrintBytes(min_size) + " - " + PrettyPrintBytes(max_size) + ", change rate " + convert(change_rate), LL_INFO);
+
+	logid_t logid = ServerLogger::getLogId(clientid);
+	std::vector<char> buf(32768);
+	int64 fileid = 0;
+
+	for (int run = 0; run < runs; ++run)
+	{
+		std::vector<size_t> run_files;
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			if (run == 0)
+			{
+				run_files.push_back(i);
+			}
+			else if (random_unit(rnd_state) < change_rate)
+			{
+				files[i].content_id = static_cast<int64>(i);
+				++files[i].version;
+				run_files.push_back(i);
+			}
+		}
+
+		std::string backuppath = workdir + os_file_sep() + "backup_" + convert(run);
+		std::string hashpath = backuppath + os_file_sep() + ".hashes";
+		for (size_t i = 0; i < files.size(); i += 256)
+		{
+			std::string subdir = os_file_sep() + "d" + convert(i / 256);
+			if (!os_create_dir_recursive(os_file_prefix(backuppath + subdir))
+				|| !os_create_dir_recursive(os_file_prefix(hashpath + subdir)))
+			{
+				Server->Log("Error creating directories in \"" + backuppath + "\". " + os_last_error_str(), LL_ERROR);
+				return 1;
+			}
+		}
+
+		StageStats transfer_stats;
+		StageStats prepare_stats;
+		StageStats hash_stats;
+
+		if (fileserv != NULL)
+		{
+			for (size_t j = 0; j < run_files.size(); ++j)
+			{
+				size_t i = run_files[j];
+				if (!write_content(srcdir + os_file_sep() + "f" + convert(i), files[i], buf))
+				{
+					return 1;
+				}
+			}
+		}
+
+		MaxFileId max_file_id;
+		StagePipe* hashpipe = new StagePipe(Server->createMemoryPipe(), hash_stats);
+		StagePipe* hashpipe_prepare = new StagePipe(Server->createMemoryPipe(), prepare_stats);
+		BackupServerHash* bsh = new BackupServerHash(hashpipe, clientid, false, false, false, logid, false, max_file_id);
+		BackupServerPrepareHash* bsh_prepare = new BackupServerPrepareHash(hashpipe_prepare, hashpipe, clientid, logid, false);
+		THREADPOOL_TICKET bsh_ticket = Server->getThreadPool()->execute(bsh, "fbackup write");
+		THREADPOOL_TICKET bsh_prepare_ticket = Server->getThreadPool()->execute(bsh_prepare, "fbackup hash");
+
+		std::auto_ptr<FileServConnection> fileserv_conn;
+		if (fileserv != NULL)
+		{
+			fileserv_conn.reset(new FileServConnection(fileserv, identity, hashed_transfer));
+		}
+
+		int64 run_starttime = Server->getTimeMS();
+		int64 run_bytes = 0;
+		for (size_t j = 0; j < run_files.size(); ++j)
+		{
+			size_t i = run_files[j];
+			std::string subfn = os_file_sep() + "d" + convert(i / 256) + os_file_sep() + "f" + convert(i);
+			std::string temp_fn = tmpdir + os_file_sep() + convert(fileid);
+
+			int64 starttime = time_us();
+			if (fileserv_conn.get() != NULL)
+			{
+				if (!fileserv_conn->download("bench/f" + convert(i), temp_fn))
+				{
+					break;
+				}
+			}
+			else if (!write_content(temp_fn, files[i], buf))
+			{
+				break;
+			}
+			transfer_stats.addProc(time_us() - starttime);
+			run_bytes += files[i].size;
+
+			CWData data;
+			data.addVarInt(fileid);
+			data.addString(temp_fn);
+			data.addInt(run);
+			data.addInt(run > 0 ? 1 : 0);
+			data.addChar(1);
+			data.addString(backuppath + subfn);
+			data.addString(hashpath + subfn);
+			data.addString(std::string());
+			data.addString(std::string());
+			data.addInt64(files[i].size);
+			data.addString(std::string());
+			data.addString(std::string());
+			data.addChar(hash_func);
+			data.addChar(0);
+			FileMetadata metadata;
+			metadata.serialize(data);
+
+			hashpipe_prepare->Write(data.getDataPtr(), data.getDataSize());
+			++fileid;
+		}
+
+		fileserv_conn.reset();
+
+		hashpipe_prepare->Write("exit");
+		Server->getThreadPool()->waitFor(bsh_prepare_ticket);
+		Server->getThreadPool()->waitFor(bsh_ticket);
+
+		int64 run_ms = (std::max)(Server->getTimeMS() - run_starttime, static_cast<int64>(1));
+
+		Server->Log("Backup " + convert(run) + ": " + convert(run_files.size()) + " files, " + PrettyPrintBytes(run_bytes) + " in "
+			+ PrettyPrintTime(run_ms) + ". " + convert(static_cast<int64>(run_files.size()) * 1000 / run_ms) + " files/s, "
+			+ PrettyPrintBytes(run_bytes * 1000 / run_ms) + "/s", LL_INFO);
+		transfer_stats.log(fileserv != NULL ? "Transfer (file server)" : "Transfer (synthetic)", run_bytes);
+		prepare_stats.log("Hashing", run_bytes);
+		hash_stats.log("Dedup and index", run_bytes);
+	}
+
+	if (fileserv != NULL)
+	{
+		fileserv_fak->destroyFileServ(fileserv);
+	}
+
+	if (Server->getServerParameter("keep") != "1")
+	{
+		cleanup_entries(clientid);
+		os_remove_nonempty_dir(os_file_prefix(workdir));
+	}
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+int file_backup_benchmark();
@@ -0,0 +1,282 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "idle_connections_benchmark.h"
+#include "../../stringtools.h"
+#include "../../Interface/Service.h"
+#include "../../Interface/Pipe.h"
+#include "../../Interface/Mutex.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <time.h>
+#else
+#include <Windows.h>
+#endif
+#include <memory>
+#include <algorithm>
+
+namespace
+{
+	IMutex* counter_mutex;
+	int64 run_count = 0;
+	int64 receive_count = 0;
+
+	class IdleClient : public ICustomClient
+	{
+	public:
+		IdleClient(bool periodic)
+			: periodic(periodic), pipe(NULL), do_quit(false)
+		{
+		}
+
+		virtual void Init(THREAD_ID pTID, IPipe *pPipe, const std::string& pEndpointName)
+		{
+			pipe = pPipe;
+		}
+
+		virtual bool Run(IRunOtherCallback* run_other)
+		{
+			IScopedLock lock(counter_mutex);
+			++run_count;
+			return !do_quit;
+		}
+
+		virtual void ReceivePackets(IRunOtherCallback* run_other)
+		{
+			std::string data;
+			if (pipe->Read(&data, 0) == 0)
+			{
+				do_quit = true;
+			}
+			else if (!pipe->Write(data))
+			{
+				do_quit = true;
+			}
+			IScopedLock lock(counter_mutex);
+			++receive_count;
+		}
+
+		virtual bool wantPeriodicRun(void)
+		{
+			return periodic || do_quit;
+		}
+
+	private:
+		bool periodic;
+		IPipe* pipe;
+		bool do_quit;
+	};
+
+	class IdleService : public IService
+	{
+	public:
+		IdleService(bool periodic)
+			: periodic(periodic)
+		{
+		}
+
+		virtual ICustomClient* createClient()
+		{
+			return new IdleClient(periodic);
+		}
+
+		virtual void destroyClient(ICustomClient * pClient)
+		{
+			delete pClient;
+		}
+
+	private:
+		bool periodic;
+	};
+
+	int64 process_cpu_time_ms()
+	{
+#ifndef _WIN32
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0;
+		}
+		return static_cast<int64>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+			+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+#else
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+		{
+			return 0;
+		}
+		ULARGE_INTEGER kernel, user;
+		kernel.LowPart = kernel_time.dwLowDateTime;
+		kernel.HighPart = kernel_time.dwHighDateTime;
+		user.LowPart = user_time.dwLowDateTime;
+		user.HighPart = user_time.dwHighDateTime;
+		return static_cast<int64>((kernel.QuadPart + user.QuadPart) / 10000);
+#endif
+	}
+
+	int64 time_us()
+	{
+#ifndef _WIN32
+		timespec tp;
+		if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+		{
+			return Server->getTimeMS() * 1000;
+		}
+		return static_cast<int64>(tp.tv_sec) * 1000000 + tp.tv_nsec / 1000;
+#else
+		LARGE_INTEGER freq, count;
+		if (!QueryPerformanceFrequency(&freq)
+			|| !QueryPerformanceCounter(&count))
+		{
+			return Server->getTimeMS() * 1000;
+		}
+		return static_cast<int64>(count.QuadPart / freq.QuadPart) * 1000000
+			+ static_cast<int64>(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#endif
+	}
+
+	void raise_fd_limit(int connections)
+	{
+#ifndef _WIN32
+		//Client and server side of every connection plus some slack
+		rlim_t needed = static_cast<rlim_t>(connections) * 2 + 100;
+		rlimit lim;
+		if (getrlimit(RLIMIT_NOFILE, &lim) == 0
+			&& lim.rlim_cur < needed)
+		{
+			lim.rlim_cur = (std::min)(needed, lim.rlim_max);
+			if (setrlimit(RLIMIT_NOFILE, &lim) != 0
+				|| lim.rlim_cur < needed)
+			{
+				Server->Log("Could only raise the open file limit to " + convert(static_cast<int64>(lim.rlim_cur))
+					+ ". Connections may fail.", LL_WARNING);
+			}
+		}
+#endif
+	}
+
+	int64 percentile(const std::vector<int64>& sorted, size_t p)
+	{
+		if (sorted.empty())
+		{
+			return 0;
+		}
+		return sorted[(std::min)(sorted.size() - 1, sorted.size() * p / 100)];
+	}
+}
+
+/**
+* Opens "connections" idle connections to a stream service on "port" and
+* logs the CPU time the service workers use for them during "duration"
+* seconds. With "periodic" set to 1 every client asks to be Run() each tick
+* (the behaviour of clients that do not implement wantPeriodicRun()).
+* Meanwhile one request is echoed every "request_interval" ms, cycling over
+* the connections, and the request latency percentiles are logged.
+*/
+int idle_connections_benchmark()
+{
+	int connections = (std::max)(1, watoi(Server->getServerParameter("connections", "20000")));
+	int request_interval = (std::max)(1, watoi(Server->getServerParameter("request_interval", "10")));
+	int duration = (std::max)(1, watoi(Server->getServerParameter("duration", "10")));
+	unsigned short port = static_cast<unsigned short>(watoi(Server->getServerParameter("port", "35699")));
+	bool periodic = Server->getServerParameter("periodic") == "1";
+
+	counter_mutex = Server->createMutex();
+
+	raise_fd_limit(connections);
+
+	Server->StartCustomStreamService(new IdleService(periodic), "idle_benchmark", port, connections, IServer::BindTarget_Localhost);
+	Server->wait(500);
+
+	std::vector<IPipe*> pipes;
+	for (int i = 0; i < connections; ++i)
+	{
+		IPipe* pipe = Server->ConnectStream("127.0.0.1", port, 10000);
+		if (pipe == NULL)
+		{
+			Server->Log("Connecting to port " + convert(port) + " failed after " + convert(i) + " connections", LL_ERROR);
+			break;
+		}
+		pipes.push_back(pipe);
+	}
+
+	if (pipes.empty())
+	{
+		return 1;
+	}
+
+	//Let the worker pick up all new connections
+	Server->wait(1000);
+
+	int64 run_count_start;
+	{
+		IScopedLock lock(counter_mutex);
+		run_count_start = run_count;
+	}
+	int64 cpu_start = process_cpu_time_ms();
+	int64 starttime = Server->getTimeMS();
+
+	std::vector<int64> latencies;
+	size_t failed_requests = 0;
+	size_t next_pipe = 0;
+	while (Server->getTimeMS() - starttime < duration * 1000)
+	{
+		IPipe* pipe = pipes[next_pipe];
+		next_pipe = (next_pipe + 1) % pipes.size();
+
+		int64 request_start = time_us();
+		char ch = 'r';
+		if (pipe->Write(&ch, sizeof(ch), 10000)
+			&& pipe->Read(&ch, sizeof(ch), 10000) == sizeof(ch))
+		{
+			latencies.push_back(time_us() - request_start);
+		}
+		else
+		{
+			++failed_requests;
+		}
+
+		Server->wait(request_interval);
+	}
+
+	int64 cpu_used = process_cpu_time_ms() - cpu_start;
+	int64 passed = (std::max)(static_cast<int64>(1), Server->getTimeMS() - starttime);
+	int64 runs;
+	{
+		IScopedLock lock(counter_mutex);
+		runs = run_count - run_count_start;
+	}
+
+	Server->Log(convert(pipes.size()) + " idle connections (periodic=" + convert(periodic) + "): "
+		+ convert(cpu_used) + "ms CPU in " + convert(passed) + "ms ("
+		+ convert(cpu_used * 1000 / passed) + " per mille), "
+		+ convert(runs * 1000 / passed) + " Run() calls/s", LL_INFO);
+
+	std::sort(latencies.begin(), latencies.end());
+	Server->Log("Request latency: " + convert(latencies.size()) + " requests, " + convert(failed_requests) + " failed, "
+		+ "p50=" + convert(percentile(latencies, 50)) + "us p99=" + convert(percentile(latencies, 99)) + "us "
+		+ "max=" + convert(latencies.empty() ? static_cast<int64>(0) : latencies[latencies.size() - 1]) + "us", LL_INFO);
+
+	for (size_t i = 0; i < pipes.size(); ++i)
+	{
+		Server->destroy(pipes[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+int idle_connections_benchmark();
@@ -0,0 +1,114 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "pack_hashes.h"
+#include "../../stringtools.h"
+#include "../../urbackupcommon/os_functions.h"
+#include "../server_settings.h"
+#include "../HashContainer.h"
+
+/**
+* Migrates the .hashes trees of existing file backups into hash containers
+* (or back with unpack=true). The last finished backup of each client and
+* group is skipped when packing, because the next incremental backup links
+* and diffs against its hash files. Backups are packed oldest first, so hash
+* files shared with the next backup become references.
+*/
+int pack_hashes()
+{
+	open_server_database(true);
+	open_settings_database();
+
+	IDatabase *db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	if(db==NULL)
+	{
+		Server->Log("Could not open main database", LL_ERROR);
+		return 1;
+	}
+
+	bool unpack = Server->getServerParameter("unpack")=="true";
+	int backupid = watoi(Server->getServerParameter("backupid", "0"));
+
+	ServerSettings server_settings(db);
+	std::string backupfolder = server_settings.getSettings()->backupfolder;
+
+	std::string sql = "SELECT b.id AS id, b.path AS path, c.name AS clientname, "
+		"(SELECT n.path FROM backups n WHERE n.clientid=b.clientid AND n.tgroup=b.tgroup AND n.done=1 AND n.id>b.id ORDER BY n.id ASC LIMIT 1) AS next_path "
+		"FROM backups b INNER JOIN clients c ON b.clientid=c.id WHERE b.done=1";
+	if(backupid>0)
+	{
+		sql += " AND b.id="+convert(backupid);
+	}
+	else if(!unpack)
+	{
+		sql += " AND b.id NOT IN (SELECT MAX(id) FROM backups WHERE done=1 GROUP BY clientid, tgroup)";
+	}
+
+	sql += " ORDER BY b.id ASC";
+
+	db_results res = db->Read(sql);
+
+	int64 n_done=0;
+	bool has_error=false;
+	for(size_t i=0;i<res.size();++i)
+	{
+		std::string backuppath = backupfolder + os_file_sep() + res[i]["clientname"] + os_file_sep() + res[i]["path"];
+
+		if(!os_directory_exists(os_file_prefix(backuppath + os_file_sep() + ".hashes")))
+		{
+			continue;
+		}
+
+		if(unpack)
+		{
+			if(!HashContainer::isPacked(backuppath))
+			{
+				continue;
+			}
+
+			Server->Log("Unpacking hashes of backup "+res[i]["id"]+" at \""+backuppath+"\"...", LL_INFO);
+			if(!HashContainer::unpack(backuppath, logid_t()))
+			{
+				has_error=true;
+				continue;
+			}
+		}
+		else
+		{
+			Server->Log("Packing hashes of backup "+res[i]["id"]+" at \""+backuppath+"\"...", LL_INFO);
+			std::string next_backuppath;
+			if(!res[i]["next_path"].empty())
+			{
+				next_backuppath = backupfolder + os_file_sep() + res[i]["clientname"] + os_file_sep() + res[i]["next_path"];
+			}
+
+			if(!HashContainer::pack(backuppath, logid_t(), next_backuppath))
+			{
+				has_error=true;
+				continue;
+			}
+		}
+
+		++n_done;
+	}
+
+	Server->Log(std::string(unpack ? "Unpacked" : "Packed")+" hashes of "+convert(n_done)+" backups", LL_INFO);
+
+	return has_error ? 2 : 0;
+}
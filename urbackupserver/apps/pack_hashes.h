@@ -0,0 +1,3 @@
+#pragma once
+
+int pack_hashes();
\ No newline at end of file
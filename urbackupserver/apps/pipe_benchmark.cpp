@@ -0,0 +1,215 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "pipe_benchmark.h"
+#include "../../stringtools.h"
+#include "../../Interface/Pipe.h"
+#include "../../urbackupcommon/InternetServicePipe2.h"
+#include "../../urbackupcommon/CompressedPipe2.h"
+#ifndef NO_ZSTD_COMPRESSION
+#include "../../urbackupcommon/CompressedPipeZstd.h"
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#else
+#include <Windows.h>
+#endif
+#include <memory>
+#include <algorithm>
+#include <memory.h>
+
+namespace
+{
+	int64 process_cpu_time_ms()
+	{
+#ifndef _WIN32
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0;
+		}
+		return static_cast<int64>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+			+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+#else
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+		{
+			return 0;
+		}
+		ULARGE_INTEGER kernel, user;
+		kernel.LowPart = kernel_time.dwLowDateTime;
+		kernel.HighPart = kernel_time.dwHighDateTime;
+		user.LowPart = user_time.dwLowDateTime;
+		user.HighPart = user_time.dwHighDateTime;
+		return static_cast<int64>((kernel.QuadPart + user.QuadPart) / 10000);
+#endif
+	}
+
+	//Half random, half repeated runs, so that compression has something to do
+	void fill_block(std::string& block, unsigned int& seed)
+	{
+		for (size_t i = 0; i < block.size();)
+		{
+			seed = seed * 1103515245 + 12345;
+			size_t len = (std::min)(block.size() - i, static_cast<size_t>(64 + (seed >> 16) % 448));
+			if ((seed >> 8) & 1)
+			{
+				memset(&block[i], static_cast<char>(seed >> 24), len);
+			}
+			else
+			{
+				for (size_t j = 0; j < len; ++j)
+				{
+					seed = seed * 1103515245 + 12345;
+					block[i + j] = static_cast<char>(seed >> 16);
+				}
+			}
+			i += len;
+		}
+	}
+
+	IPipe* create_pipe(const std::string& compression, IPipe* is_pipe)
+	{
+		if (compression == "zlib")
+		{
+			return new CompressedPipe2(is_pipe, 6);
+		}
+#ifndef NO_ZSTD_COMPRESSION
+		else if (compression == "zstd")
+		{
+			return new CompressedPipeZstd(is_pipe, 3, -1);
+		}
+#endif
+		return NULL;
+	}
+
+	bool read_fully(IPipe* pipe, char* buf, size_t bsize)
+	{
+		size_t read = 0;
+		while (read < bsize)
+		{
+			size_t r = pipe->Read(buf + read, bsize - read, 10000);
+			if (r == 0)
+			{
+				return false;
+			}
+			read += r;
+		}
+		return true;
+	}
+}
+
+/**
+* Pushes "size_mb" MB of semi-compressible data through the internet pipe
+* stack (compression "none", "zlib" or "zstd" on top of AES-GCM encryption)
+* into a memory pipe, reads it back through a second stack and verifies it.
+* Logs the throughput and the process CPU time per GB for both directions.
+*/
+int pipe_benchmark()
+{
+	int64 size_mb = (std::max)(1, watoi(Server->getServerParameter("size_mb", "1024")));
+	size_t block_size = (std::max)(1, watoi(Server->getServerParameter("block_size", "32768")));
+	std::string compression = Server->getServerParameter("compression", "zstd");
+
+	IPipe* mem_pipe = Server->createMemoryPipe();
+	std::string key = "pipe_benchmark_key";
+
+	InternetServicePipe2* is_write = new InternetServicePipe2(mem_pipe, key);
+	InternetServicePipe2* is_read = new InternetServicePipe2(mem_pipe, key);
+
+	std::auto_ptr<IPipe> write_pipe;
+	std::auto_ptr<IPipe> read_pipe;
+	if (compression == "none")
+	{
+		write_pipe.reset(is_write);
+		read_pipe.reset(is_read);
+	}
+	else
+	{
+		write_pipe.reset(create_pipe(compression, is_write));
+		read_pipe.reset(create_pipe(compression, is_read));
+		if (write_pipe.get() == NULL || read_pipe.get() == NULL)
+		{
+			Server->Log("Unknown compression \"" + compression + "\". Available: none, zlib, zstd", LL_ERROR);
+			delete is_write;
+			delete is_read;
+			Server->destroy(mem_pipe);
+			return 1;
+		}
+		static_cast<ICompressedPipe*>(write_pipe.get())->destroyBackendPipeOnDelete(true);
+		static_cast<ICompressedPipe*>(read_pipe.get())->destroyBackendPipeOnDelete(true);
+	}
+
+	std::string block;
+	block.resize(block_size);
+	std::string read_buf;
+	read_buf.resize(block_size);
+	unsigned int seed = 1;
+
+	int64 total = size_mb * 1024 * 1024;
+	int64 transferred = 0;
+	int rc = 0;
+
+	int64 cpu_start = process_cpu_time_ms();
+	int64 starttime = Server->getTimeMS();
+
+	while (transferred < total)
+	{
+		fill_block(block, seed);
+		size_t curr = static_cast<size_t>((std::min)(static_cast<int64>(block.size()), total - transferred));
+
+		if (!write_pipe->Write(block.data(), curr, -1, true))
+		{
+			Server->Log("Writing to pipe failed", LL_ERROR);
+			rc = 1;
+			break;
+		}
+
+		if (!read_fully(read_pipe.get(), &read_buf[0], curr))
+		{
+			Server->Log("Reading from pipe failed after " + convert(transferred) + " bytes", LL_ERROR);
+			rc = 1;
+			break;
+		}
+
+		if (memcmp(block.data(), read_buf.data(), curr) != 0)
+		{
+			Server->Log("Data read from pipe differs at block starting at " + convert(transferred), LL_ERROR);
+			rc = 1;
+			break;
+		}
+
+		transferred += curr;
+	}
+
+	int64 cpu_used = process_cpu_time_ms() - cpu_start;
+	int64 passed = (std::max)(static_cast<int64>(1), Server->getTimeMS() - starttime);
+
+	Server->Log("Pipe benchmark (compression=" + compression + ", block_size=" + convert(block_size) + "): "
+		+ PrettyPrintBytes(transferred) + " in " + convert(passed) + "ms ("
+		+ convert(transferred / 1024 / 1024 * 1000 / passed) + " MB/s), "
+		+ convert(cpu_used) + "ms CPU ("
+		+ convert(transferred>0 ? cpu_used * 1024 * 1024 * 1024 / transferred : 0) + "ms CPU per GB)", LL_INFO);
+
+	write_pipe.reset();
+	read_pipe.reset();
+	Server->destroy(mem_pipe);
+
+	return rc;
+}
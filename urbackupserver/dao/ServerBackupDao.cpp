@@ -18,6 +18,7 @@
 
 #include "ServerBackupDao.h"
 #include "../../stringtools.h"
+#include "../../Interface/DatabaseCursor.h"
 #include <assert.h>
 #include <string.h>
 
@@ -72,13 +73,13 @@ std::vector<std::string> ServerBackupDao::getOldBackupfolders(void)
 	{
 		q_getOldBackupfolders=db->Prepare("SELECT backupfolder FROM settings_db.old_backupfolders", false);
 	}
-	db_results res=q_getOldBackupfolders->Read();
 	std::vector<std::string> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getOldBackupfolders->Cursor();
+	while(cur->next())
 	{
-		ret[i]=res[i]["backupfolder"];
+		ret.push_back(cur->getString(0));
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -95,13 +96,13 @@ std::vector<std::string> ServerBackupDao::getDeletePendingClientNames(void)
 	{
 		q_getDeletePendingClientNames=db->Prepare("SELECT name FROM clients WHERE delete_pending=1", false);
 	}
-	db_results res=q_getDeletePendingClientNames->Read();
 	std::vector<std::string> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getDeletePendingClientNames->Cursor();
+	while(cur->next())
 	{
-		ret[i]=res[i]["name"];
+		ret.push_back(cur->getString(0));
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -119,14 +120,15 @@ ServerBackupDao::CondString ServerBackupDao::getGroupName(int groupid)
 		q_getGroupName=db->Prepare("SELECT name FROM settings_db.si_client_groups WHERE id=?", false);
 	}
 	q_getGroupName->Bind(groupid);
-	db_results res=q_getGroupName->Read();
-	q_getGroupName->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getGroupName->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["name"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getGroupName->Reset();
 	return ret;
 }
 
@@ -144,14 +146,15 @@ ServerBackupDao::CondInt ServerBackupDao::getClientGroup(int clientid)
 		q_getClientGroup=db->Prepare("SELECT groupid FROM clients WHERE id=?", false);
 	}
 	q_getClientGroup->Bind(clientid);
-	db_results res=q_getClientGroup->Read();
-	q_getClientGroup->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getClientGroup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["groupid"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getClientGroup->Reset();
 	return ret;
 }
 
@@ -170,16 +173,17 @@ ServerBackupDao::SSetting ServerBackupDao::getServerSetting(const std::string& k
 	}
 	q_getServerSetting->Bind(key);
 	q_getServerSetting->Bind(clientid);
-	db_results res=q_getServerSetting->Read();
-	q_getServerSetting->Reset();
 	SSetting ret = { false, "", "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getServerSetting->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["value"];
-		ret.value_client=res[0]["value_client"];
-		ret.use=watoi(res[0]["use"]);
+		ret.value=cur->getString(0);
+		ret.value_client=cur->getString(1);
+		ret.use=cur->getInt(2);
 	}
+	cur->shutdown();
+	q_getServerSetting->Reset();
 	return ret;
 }
 
@@ -198,15 +202,16 @@ ServerBackupDao::SClientName ServerBackupDao::getVirtualMainClientname(int clien
 		q_getVirtualMainClientname=db->Prepare("SELECT virtualmain, name FROM clients WHERE id=?", false);
 	}
 	q_getVirtualMainClientname->Bind(clientid);
-	db_results res=q_getVirtualMainClientname->Read();
-	q_getVirtualMainClientname->Reset();
 	SClientName ret = { false, "", "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getVirtualMainClientname->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.virtualmain=res[0]["virtualmain"];
-		ret.name=res[0]["name"];
+		ret.virtualmain=cur->getString(0);
+		ret.name=cur->getString(1);
 	}
+	cur->shutdown();
+	q_getVirtualMainClientname->Reset();
 	return ret;
 }
 
@@ -228,15 +233,17 @@ std::vector<ServerBackupDao::SDuration> ServerBackupDao::getLastIncrementalDurat
 		q_getLastIncrementalDurations=db->Prepare("SELECT indexing_time_ms, (strftime('%s',running)-strftime('%s',backuptime)) AS duration FROM backups  WHERE clientid=? AND done=1 AND complete=1 AND incremental<>0 AND resumed=0 ORDER BY backuptime DESC LIMIT 10", false);
 	}
 	q_getLastIncrementalDurations->Bind(clientid);
-	db_results res=q_getLastIncrementalDurations->Read();
-	q_getLastIncrementalDurations->Reset();
 	std::vector<ServerBackupDao::SDuration> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getLastIncrementalDurations->Cursor();
+	while(cur->next())
 	{
-		ret[i].indexing_time_ms=watoi64(res[i]["indexing_time_ms"]);
-		ret[i].duration=watoi64(res[i]["duration"]);
+		ret.push_back(ServerBackupDao::SDuration());
+		ServerBackupDao::SDuration& curr=ret.back();
+		curr.indexing_time_ms=cur->getInt64(0);
+		curr.duration=cur->getInt64(1);
 	}
+	cur->shutdown();
+	q_getLastIncrementalDurations->Reset();
 	return ret;
 }
 
@@ -257,15 +264,17 @@ std::vector<ServerBackupDao::SDuration> ServerBackupDao::getLastFullDurations(in
 		q_getLastFullDurations=db->Prepare("SELECT indexing_time_ms, (strftime('%s',running)-strftime('%s',backuptime)) AS duration FROM backups  WHERE clientid=? AND done=1 AND complete=1 AND incremental=0 AND resumed=0 ORDER BY backuptime DESC LIMIT 1", false);
 	}
 	q_getLastFullDurations->Bind(clientid);
-	db_results res=q_getLastFullDurations->Read();
-	q_getLastFullDurations->Reset();
 	std::vector<ServerBackupDao::SDuration> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getLastFullDurations->Cursor();
+	while(cur->next())
 	{
-		ret[i].indexing_time_ms=watoi64(res[i]["indexing_time_ms"]);
-		ret[i].duration=watoi64(res[i]["duration"]);
+		ret.push_back(ServerBackupDao::SDuration());
+		ServerBackupDao::SDuration& curr=ret.back();
+		curr.indexing_time_ms=cur->getInt64(0);
+		curr.duration=cur->getInt64(1);
 	}
+	cur->shutdown();
+	q_getLastFullDurations->Reset();
 	return ret;
 }
 
@@ -285,14 +294,15 @@ ServerBackupDao::CondString ServerBackupDao::getClientSetting(const std::string&
 	}
 	q_getClientSetting->Bind(key);
 	q_getClientSetting->Bind(clientid);
-	db_results res=q_getClientSetting->Read();
-	q_getClientSetting->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getClientSetting->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["value"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getClientSetting->Reset();
 	return ret;
 }
 
@@ -310,13 +320,13 @@ std::vector<int> ServerBackupDao::getClientIds(void)
 	{
 		q_getClientIds=db->Prepare("SELECT id FROM clients", false);
 	}
-	db_results res=q_getClientIds->Read();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientIds->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -334,14 +344,14 @@ std::vector<int> ServerBackupDao::getClientsByUid(const std::string& uid)
 		q_getClientsByUid=db->Prepare("SELECT id FROM clients WHERE uid=?", false);
 	}
 	q_getClientsByUid->Bind(uid);
-	db_results res=q_getClientsByUid->Read();
-	q_getClientsByUid->Reset();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientsByUid->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
+	q_getClientsByUid->Reset();
 	return ret;
 }
 
@@ -449,14 +459,14 @@ std::vector<std::string> ServerBackupDao::getClientMovedLimit5(const std::string
 		q_getClientMovedLimit5=db->Prepare("SELECT from_name FROM moved_clients WHERE to_name=? LIMIT 5", false);
 	}
 	q_getClientMovedLimit5->Bind(to_name);
-	db_results res=q_getClientMovedLimit5->Read();
-	q_getClientMovedLimit5->Reset();
 	std::vector<std::string> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientMovedLimit5->Cursor();
+	while(cur->next())
 	{
-		ret[i]=res[i]["from_name"];
+		ret.push_back(cur->getString(0));
 	}
+	cur->shutdown();
+	q_getClientMovedLimit5->Reset();
 	return ret;
 }
 
@@ -474,14 +484,14 @@ std::vector<std::string> ServerBackupDao::getClientMovedFrom(const std::string&
 		q_getClientMovedFrom=db->Prepare("SELECT to_name FROM moved_clients WHERE from_name=?", false);
 	}
 	q_getClientMovedFrom->Bind(from_name);
-	db_results res=q_getClientMovedFrom->Read();
-	q_getClientMovedFrom->Reset();
 	std::vector<std::string> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientMovedFrom->Cursor();
+	while(cur->next())
 	{
-		ret[i]=res[i]["to_name"];
+		ret.push_back(cur->getString(0));
 	}
+	cur->shutdown();
+	q_getClientMovedFrom->Reset();
 	return ret;
 }
 
@@ -501,14 +511,15 @@ ServerBackupDao::CondString ServerBackupDao::getSetting(int clientid, const std:
 	}
 	q_getSetting->Bind(clientid);
 	q_getSetting->Bind(key);
-	db_results res=q_getSetting->Read();
-	q_getSetting->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getSetting->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["value"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getSetting->Reset();
 	return ret;
 }
 
@@ -526,10 +537,17 @@ int ServerBackupDao::hasFileBackups(int clientid)
 		q_hasFileBackups=db->Prepare("SELECT COUNT(*) AS c FROM backups WHERE clientid=? AND done=1 LIMIT 1", false);
 	}
 	q_hasFileBackups->Bind(clientid);
-	db_results res=q_hasFileBackups->Read();
+	int ret=0;
+	IDatabaseCursor* cur=q_hasFileBackups->Cursor();
+	bool has_row=cur->next();
+	assert(has_row);
+	if(has_row)
+	{
+		ret=cur->getInt(0);
+	}
+	cur->shutdown();
 	q_hasFileBackups->Reset();
-	assert(!res.empty());
-	return watoi(res[0]["c"]);
+	return ret;
 }
 
 /**
@@ -584,14 +602,15 @@ ServerBackupDao::CondString ServerBackupDao::getMiscValue(const std::string& tke
 		q_getMiscValue=db->Prepare("SELECT tvalue FROM misc WHERE tkey=?", false);
 	}
 	q_getMiscValue->Bind(tkey);
-	db_results res=q_getMiscValue->Read();
-	q_getMiscValue->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getMiscValue->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["tvalue"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getMiscValue->Reset();
 	return ret;
 }
 
@@ -738,18 +757,19 @@ ServerBackupDao::SLastIncremental ServerBackupDao::getLastIncrementalFileBackup(
 	}
 	q_getLastIncrementalFileBackup->Bind(clientid);
 	q_getLastIncrementalFileBackup->Bind(tgroup);
-	db_results res=q_getLastIncrementalFileBackup->Read();
-	q_getLastIncrementalFileBackup->Reset();
 	SLastIncremental ret = { false, 0, "", 0, 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getLastIncrementalFileBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.incremental=watoi(res[0]["incremental"]);
-		ret.path=res[0]["path"];
-		ret.resumed=watoi(res[0]["resumed"]);
-		ret.complete=watoi(res[0]["complete"]);
-		ret.id=watoi(res[0]["id"]);
+		ret.incremental=cur->getInt(0);
+		ret.path=cur->getString(1);
+		ret.resumed=cur->getInt(2);
+		ret.complete=cur->getInt(3);
+		ret.id=cur->getInt(4);
 	}
+	cur->shutdown();
+	q_getLastIncrementalFileBackup->Reset();
 	return ret;
 }
 
@@ -769,18 +789,19 @@ ServerBackupDao::SLastIncremental ServerBackupDao::getLastIncrementalCompleteFil
 	}
 	q_getLastIncrementalCompleteFileBackup->Bind(clientid);
 	q_getLastIncrementalCompleteFileBackup->Bind(tgroup);
-	db_results res=q_getLastIncrementalCompleteFileBackup->Read();
-	q_getLastIncrementalCompleteFileBackup->Reset();
 	SLastIncremental ret = { false, 0, "", 0, 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getLastIncrementalCompleteFileBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.incremental=watoi(res[0]["incremental"]);
-		ret.path=res[0]["path"];
-		ret.resumed=watoi(res[0]["resumed"]);
-		ret.complete=watoi(res[0]["complete"]);
-		ret.id=watoi(res[0]["id"]);
+		ret.incremental=cur->getInt(0);
+		ret.path=cur->getString(1);
+		ret.resumed=cur->getInt(2);
+		ret.complete=cur->getInt(3);
+		ret.id=cur->getInt(4);
 	}
+	cur->shutdown();
+	q_getLastIncrementalCompleteFileBackup->Reset();
 	return ret;
 }
 
@@ -858,13 +879,13 @@ std::vector<int> ServerBackupDao::getMailableUserIds(void)
 	{
 		q_getMailableUserIds=db->Prepare("SELECT id FROM settings_db.si_users WHERE report_mail IS NOT NULL AND report_mail<>''", false);
 	}
-	db_results res=q_getMailableUserIds->Read();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getMailableUserIds->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -883,14 +904,15 @@ ServerBackupDao::CondString ServerBackupDao::getUserRight(int clientid, const st
 	}
 	q_getUserRight->Bind(clientid);
 	q_getUserRight->Bind(t_domain);
-	db_results res=q_getUserRight->Read();
-	q_getUserRight->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getUserRight->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["t_right"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getUserRight->Reset();
 	return ret;
 }
 
@@ -908,16 +930,17 @@ ServerBackupDao::SReportSettings ServerBackupDao::getUserReportSettings(int user
 		q_getUserReportSettings=db->Prepare("SELECT report_mail, report_loglevel, report_sendonly FROM settings_db.si_users WHERE id=?", false);
 	}
 	q_getUserReportSettings->Bind(userid);
-	db_results res=q_getUserReportSettings->Read();
-	q_getUserReportSettings->Reset();
 	SReportSettings ret = { false, "", 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getUserReportSettings->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.report_mail=res[0]["report_mail"];
-		ret.report_loglevel=watoi(res[0]["report_loglevel"]);
-		ret.report_sendonly=watoi(res[0]["report_sendonly"]);
+		ret.report_mail=cur->getString(0);
+		ret.report_loglevel=cur->getInt(1);
+		ret.report_sendonly=cur->getInt(2);
 	}
+	cur->shutdown();
+	q_getUserReportSettings->Reset();
 	return ret;
 }
 
@@ -963,17 +986,18 @@ ServerBackupDao::SImageBackup ServerBackupDao::getLastFullImage(int clientid, in
 	q_getLastFullImage->Bind(clientid);
 	q_getLastFullImage->Bind(image_version);
 	q_getLastFullImage->Bind(letter);
-	db_results res=q_getLastFullImage->Read();
-	q_getLastFullImage->Reset();
 	SImageBackup ret = { false, 0, 0, "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getLastFullImage->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi64(res[0]["id"]);
-		ret.incremental=watoi(res[0]["incremental"]);
-		ret.path=res[0]["path"];
-		ret.duration=watoi64(res[0]["duration"]);
+		ret.id=cur->getInt64(0);
+		ret.incremental=cur->getInt(1);
+		ret.path=cur->getString(2);
+		ret.duration=cur->getInt64(3);
 	}
+	cur->shutdown();
+	q_getLastFullImage->Reset();
 	return ret;
 }
 
@@ -994,17 +1018,18 @@ ServerBackupDao::SImageBackup ServerBackupDao::getLastImage(int clientid, int im
 	q_getLastImage->Bind(clientid);
 	q_getLastImage->Bind(image_version);
 	q_getLastImage->Bind(letter);
-	db_results res=q_getLastImage->Read();
-	q_getLastImage->Reset();
 	SImageBackup ret = { false, 0, 0, "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getLastImage->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi64(res[0]["id"]);
-		ret.incremental=watoi(res[0]["incremental"]);
-		ret.path=res[0]["path"];
-		ret.duration=watoi64(res[0]["duration"]);
+		ret.id=cur->getInt64(0);
+		ret.incremental=cur->getInt(1);
+		ret.path=cur->getString(2);
+		ret.duration=cur->getInt64(3);
 	}
+	cur->shutdown();
+	q_getLastImage->Reset();
 	return ret;
 }
 
@@ -1349,14 +1374,15 @@ ServerBackupDao::CondInt64 ServerBackupDao::hasRecentFullOrIncrFileBackup(const
 	q_hasRecentFullOrIncrFileBackup->Bind(backup_interval_incr);
 	q_hasRecentFullOrIncrFileBackup->Bind(clientid);
 	q_hasRecentFullOrIncrFileBackup->Bind(tgroup);
-	db_results res=q_hasRecentFullOrIncrFileBackup->Read();
-	q_hasRecentFullOrIncrFileBackup->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_hasRecentFullOrIncrFileBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["id"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_hasRecentFullOrIncrFileBackup->Reset();
 	return ret;
 }
 
@@ -1378,14 +1404,15 @@ ServerBackupDao::CondInt64 ServerBackupDao::hasRecentIncrFileBackup(const std::s
 	q_hasRecentIncrFileBackup->Bind(backup_interval);
 	q_hasRecentIncrFileBackup->Bind(clientid);
 	q_hasRecentIncrFileBackup->Bind(tgroup);
-	db_results res=q_hasRecentIncrFileBackup->Read();
-	q_hasRecentIncrFileBackup->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_hasRecentIncrFileBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["id"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_hasRecentIncrFileBackup->Reset();
 	return ret;
 }
 
@@ -1415,14 +1442,15 @@ ServerBackupDao::CondInt64 ServerBackupDao::hasRecentFullOrIncrImageBackup(const
 	q_hasRecentFullOrIncrImageBackup->Bind(clientid);
 	q_hasRecentFullOrIncrImageBackup->Bind(image_version);
 	q_hasRecentFullOrIncrImageBackup->Bind(letter);
-	db_results res=q_hasRecentFullOrIncrImageBackup->Read();
-	q_hasRecentFullOrIncrImageBackup->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_hasRecentFullOrIncrImageBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["id"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_hasRecentFullOrIncrImageBackup->Reset();
 	return ret;
 }
 
@@ -1446,14 +1474,15 @@ ServerBackupDao::CondInt64 ServerBackupDao::hasRecentIncrImageBackup(const std::
 	q_hasRecentIncrImageBackup->Bind(clientid);
 	q_hasRecentIncrImageBackup->Bind(image_version);
 	q_hasRecentIncrImageBackup->Bind(letter);
-	db_results res=q_hasRecentIncrImageBackup->Read();
-	q_hasRecentIncrImageBackup->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_hasRecentIncrImageBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["id"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_hasRecentIncrImageBackup->Reset();
 	return ret;
 }
 
@@ -1495,14 +1524,15 @@ ServerBackupDao::CondString ServerBackupDao::getRestorePath(int64 restore_id, in
 	}
 	q_getRestorePath->Bind(restore_id);
 	q_getRestorePath->Bind(clientid);
-	db_results res=q_getRestorePath->Read();
-	q_getRestorePath->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getRestorePath->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["path"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getRestorePath->Reset();
 	return ret;
 }
 
@@ -1521,14 +1551,15 @@ ServerBackupDao::CondString ServerBackupDao::getRestoreIdentity(int64 restore_id
 	}
 	q_getRestoreIdentity->Bind(restore_id);
 	q_getRestoreIdentity->Bind(clientid);
-	db_results res=q_getRestoreIdentity->Read();
-	q_getRestoreIdentity->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getRestoreIdentity->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["identity"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getRestoreIdentity->Reset();
 	return ret;
 }
 
@@ -1582,28 +1613,29 @@ ServerBackupDao::SFileBackupInfo ServerBackupDao::getFileBackupInfo(int backupid
 		q_getFileBackupInfo=db->Prepare("SELECT id, clientid, strftime('%s',backuptime) AS backuptime, incremental, path, complete, strftime('%s',running) AS running, size_bytes, done, archived, archive_timeout, size_calculated, resumed, indexing_time_ms, tgroup FROM backups WHERE id=?", false);
 	}
 	q_getFileBackupInfo->Bind(backupid);
-	db_results res=q_getFileBackupInfo->Read();
-	q_getFileBackupInfo->Reset();
 	SFileBackupInfo ret = { false, 0, 0, 0, 0, "", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getFileBackupInfo->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi64(res[0]["id"]);
-		ret.clientid=watoi(res[0]["clientid"]);
-		ret.backuptime=watoi64(res[0]["backuptime"]);
-		ret.incremental=watoi(res[0]["incremental"]);
-		ret.path=res[0]["path"];
-		ret.complete=watoi(res[0]["complete"]);
-		ret.running=watoi64(res[0]["running"]);
-		ret.size_bytes=watoi64(res[0]["size_bytes"]);
-		ret.done=watoi(res[0]["done"]);
-		ret.archived=watoi(res[0]["archived"]);
-		ret.archive_timeout=watoi64(res[0]["archive_timeout"]);
-		ret.size_calculated=watoi64(res[0]["size_calculated"]);
-		ret.resumed=watoi(res[0]["resumed"]);
-		ret.indexing_time_ms=watoi64(res[0]["indexing_time_ms"]);
-		ret.tgroup=watoi(res[0]["tgroup"]);
-	}
+		ret.id=cur->getInt64(0);
+		ret.clientid=cur->getInt(1);
+		ret.backuptime=cur->getInt64(2);
+		ret.incremental=cur->getInt(3);
+		ret.path=cur->getString(4);
+		ret.complete=cur->getInt(5);
+		ret.running=cur->getInt64(6);
+		ret.size_bytes=cur->getInt64(7);
+		ret.done=cur->getInt(8);
+		ret.archived=cur->getInt(9);
+		ret.archive_timeout=cur->getInt64(10);
+		ret.size_calculated=cur->getInt64(11);
+		ret.resumed=cur->getInt(12);
+		ret.indexing_time_ms=cur->getInt64(13);
+		ret.tgroup=cur->getInt(14);
+	}
+	cur->shutdown();
+	q_getFileBackupInfo->Reset();
 	return ret;
 }
 
@@ -1656,14 +1688,15 @@ ServerBackupDao::CondInt ServerBackupDao::hasUsedAccessToken(const std::string&
 		q_hasUsedAccessToken=db->Prepare("SELECT clientid FROM settings_db.access_tokens WHERE tokenhash=?", false);
 	}
 	q_hasUsedAccessToken->Bind(tokenhash.c_str(), (_u32)tokenhash.size());
-	db_results res=q_hasUsedAccessToken->Read();
-	q_hasUsedAccessToken->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_hasUsedAccessToken->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["clientid"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_hasUsedAccessToken->Reset();
 	return ret;
 }
 
@@ -1700,14 +1733,15 @@ ServerBackupDao::CondString ServerBackupDao::getClientnameByImageid(int backupid
 		q_getClientnameByImageid=db->Prepare("SELECT name FROM clients WHERE id = (SELECT clientid FROM backup_images WHERE id=? )", false);
 	}
 	q_getClientnameByImageid->Bind(backupid);
-	db_results res=q_getClientnameByImageid->Read();
-	q_getClientnameByImageid->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getClientnameByImageid->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["name"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getClientnameByImageid->Reset();
 	return ret;
 }
 
@@ -1725,14 +1759,15 @@ ServerBackupDao::CondInt ServerBackupDao::getClientidByImageid(int backupid)
 		q_getClientidByImageid=db->Prepare("SELECT clientid FROM backup_images WHERE id=?", false);
 	}
 	q_getClientidByImageid->Bind(backupid);
-	db_results res=q_getClientidByImageid->Read();
-	q_getClientidByImageid->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getClientidByImageid->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["clientid"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getClientidByImageid->Reset();
 	return ret;
 }
 
@@ -1750,14 +1785,15 @@ ServerBackupDao::CondInt ServerBackupDao::getImageMounttime(int backupid)
 		q_getImageMounttime=db->Prepare("SELECT mounttime FROM backup_images WHERE id=?", false);
 	}
 	q_getImageMounttime->Bind(backupid);
-	db_results res=q_getImageMounttime->Read();
-	q_getImageMounttime->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageMounttime->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["mounttime"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getImageMounttime->Reset();
 	return ret;
 }
 
@@ -1831,19 +1867,20 @@ ServerBackupDao::SMountedImage ServerBackupDao::getMountedImage(int backupid, in
 	}
 	q_getMountedImage->Bind(backupid);
 	q_getMountedImage->Bind(partition);
-	db_results res=q_getMountedImage->Read();
-	q_getMountedImage->Reset();
 	SMountedImage ret = { false, 0, 0, "", 0, 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getMountedImage->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi(res[0]["id"]);
-		ret.backupid=watoi(res[0]["backupid"]);
-		ret.path=res[0]["path"];
-		ret.mounttime=watoi64(res[0]["mounttime"]);
-		ret.partition=watoi(res[0]["partition"]);
-		ret.clientid=watoi(res[0]["clientid"]);
-	}
+		ret.id=cur->getInt(1);
+		ret.backupid=cur->getInt(0);
+		ret.path=cur->getString(2);
+		ret.mounttime=cur->getInt64(3);
+		ret.partition=cur->getInt(4);
+		ret.clientid=cur->getInt(5);
+	}
+	cur->shutdown();
+	q_getMountedImage->Reset();
 	return ret;
 }
 
@@ -1863,17 +1900,18 @@ ServerBackupDao::SMountedImage ServerBackupDao::getImageInfo(int backupid)
 		q_getImageInfo=db->Prepare("SELECT 0 AS id, id AS backupid, path, clientid FROM backup_images WHERE id=?", false);
 	}
 	q_getImageInfo->Bind(backupid);
-	db_results res=q_getImageInfo->Read();
-	q_getImageInfo->Reset();
 	SMountedImage ret = { false, 0, 0, "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageInfo->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi(res[0]["id"]);
-		ret.backupid=watoi(res[0]["backupid"]);
-		ret.path=res[0]["path"];
-		ret.clientid=watoi(res[0]["clientid"]);
+		ret.id=cur->getInt(0);
+		ret.backupid=cur->getInt(1);
+		ret.path=cur->getString(2);
+		ret.clientid=cur->getInt(3);
 	}
+	cur->shutdown();
+	q_getImageInfo->Reset();
 	return ret;
 }
 
@@ -1892,19 +1930,21 @@ std::vector<ServerBackupDao::SMountedImage> ServerBackupDao::getOldMountedImages
 		q_getOldMountedImages=db->Prepare("SELECT b.id AS backupid, m.id AS id, path, m.mounttime AS mounttime, partition FROM (mounted_backup_images m INNER JOIN backup_images b ON m.backupid=b.id)  WHERE m.mounttime!=0 AND m.mounttime<(strftime('%s','now')-?)", false);
 	}
 	q_getOldMountedImages->Bind(times);
-	db_results res=q_getOldMountedImages->Read();
-	q_getOldMountedImages->Reset();
 	std::vector<ServerBackupDao::SMountedImage> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].exists=true;
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].backupid=watoi(res[i]["backupid"]);
-		ret[i].path=res[i]["path"];
-		ret[i].mounttime=watoi64(res[i]["mounttime"]);
-		ret[i].partition=watoi(res[i]["partition"]);
-	}
+	IDatabaseCursor* cur=q_getOldMountedImages->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerBackupDao::SMountedImage());
+		ServerBackupDao::SMountedImage& curr=ret.back();
+		curr.exists=true;
+		curr.id=cur->getInt(1);
+		curr.backupid=cur->getInt(0);
+		curr.path=cur->getString(2);
+		curr.mounttime=cur->getInt64(3);
+		curr.partition=cur->getInt(4);
+	}
+	cur->shutdown();
+	q_getOldMountedImages->Reset();
 	return ret;
 }
 
@@ -1940,14 +1980,15 @@ ServerBackupDao::CondInt ServerBackupDao::getCapa(int clientid)
 		q_getCapa=db->Prepare("SELECT capa FROM clients WHERE id=?", false);
 	}
 	q_getCapa->Bind(clientid);
-	db_results res=q_getCapa->Read();
-	q_getCapa->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getCapa->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["capa"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getCapa->Reset();
 	return ret;
 }
 
@@ -18,6 +18,7 @@
 
 #include "ServerCleanupDao.h"
 #include "../../stringtools.h"
+#include "../../Interface/DatabaseCursor.h"
 #include <assert.h>
 
 ServerCleanupDao::ServerCleanupDao(IDatabase *db)
@@ -53,15 +54,17 @@ std::vector<ServerCleanupDao::SIncompleteImages> ServerCleanupDao::getIncomplete
 	{
 		q_getIncompleteImages=db->Prepare("SELECT b.id AS id, b.path AS path, c.name AS clientname FROM backup_images b, clients c WHERE  complete=0 AND archived=0 AND running<datetime('now','-300 seconds') AND b.clientid=c.id", false);
 	}
-	db_results res=q_getIncompleteImages->Read();
 	std::vector<ServerCleanupDao::SIncompleteImages> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getIncompleteImages->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].path=res[i]["path"];
-		ret[i].clientname=res[i]["clientname"];
+		ret.push_back(ServerCleanupDao::SIncompleteImages());
+		ServerCleanupDao::SIncompleteImages& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.path=cur->getString(1);
+		curr.clientname=cur->getString(2);
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -83,14 +86,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::getIncompleteImage(int id)
 		q_getIncompleteImage=db->Prepare("SELECT id FROM backup_images WHERE complete=0 AND (archived & 1)=0 AND running<datetime('now','-300 seconds') AND id=?", false);
 	}
 	q_getIncompleteImage->Bind(id);
-	db_results res=q_getIncompleteImage->Read();
-	q_getIncompleteImage->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getIncompleteImage->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["id"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getIncompleteImage->Reset();
 	return ret;
 }
 
@@ -111,15 +115,17 @@ std::vector<ServerCleanupDao::SIncompleteImages> ServerCleanupDao::getDeletePend
 	{
 		q_getDeletePendingImages=db->Prepare("SELECT b.id AS id, b.path AS path, c.name AS clientname FROM backup_images b, clients c WHERE b.delete_pending=1 AND b.clientid=c.id ORDER BY backuptime DESC", false);
 	}
-	db_results res=q_getDeletePendingImages->Read();
 	std::vector<ServerCleanupDao::SIncompleteImages> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getDeletePendingImages->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].path=res[i]["path"];
-		ret[i].clientname=res[i]["clientname"];
+		ret.push_back(ServerCleanupDao::SIncompleteImages());
+		ServerCleanupDao::SIncompleteImages& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.path=cur->getString(1);
+		curr.clientname=cur->getString(2);
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -155,13 +161,13 @@ std::vector<int> ServerCleanupDao::getClientsSortFilebackups(void)
 	{
 		q_getClientsSortFilebackups=db->Prepare("SELECT DISTINCT c.id AS id FROM clients c INNER JOIN backups b ON c.id=b.clientid ORDER BY b.backuptime ASC", false);
 	}
-	db_results res=q_getClientsSortFilebackups->Read();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientsSortFilebackups->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -181,13 +187,13 @@ std::vector<int> ServerCleanupDao::getClientsSortImagebackups(void)
 	{
 		q_getClientsSortImagebackups=db->Prepare("SELECT DISTINCT c.id AS id FROM clients c  INNER JOIN (SELECT * FROM backup_images WHERE letter!='SYSVOL' AND letter!='ESP') b ON c.id=b.clientid ORDER BY b.backuptime ASC", false);
 	}
-	db_results res=q_getClientsSortImagebackups->Read();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientsSortImagebackups->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -207,15 +213,17 @@ std::vector<ServerCleanupDao::SImageLetter> ServerCleanupDao::getFullNumImages(i
 		q_getFullNumImages=db->Prepare("SELECT id, letter FROM backup_images  WHERE clientid=? AND incremental=0 AND complete=1 AND letter!='SYSVOL' AND letter!='ESP' AND archived=0 ORDER BY backuptime ASC", false);
 	}
 	q_getFullNumImages->Bind(clientid);
-	db_results res=q_getFullNumImages->Read();
-	q_getFullNumImages->Reset();
 	std::vector<ServerCleanupDao::SImageLetter> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getFullNumImages->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].letter=res[i]["letter"];
+		ret.push_back(ServerCleanupDao::SImageLetter());
+		ServerCleanupDao::SImageLetter& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.letter=cur->getString(1);
 	}
+	cur->shutdown();
+	q_getFullNumImages->Reset();
 	return ret;
 }
 
@@ -234,16 +242,18 @@ std::vector<ServerCleanupDao::SImageRef> ServerCleanupDao::getImageRefs(int incr
 		q_getImageRefs=db->Prepare("SELECT id, complete, archived FROM backup_images WHERE incremental<>0 AND incremental_ref=?", false);
 	}
 	q_getImageRefs->Bind(incremental_ref);
-	db_results res=q_getImageRefs->Read();
-	q_getImageRefs->Reset();
 	std::vector<ServerCleanupDao::SImageRef> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getImageRefs->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].complete=watoi(res[i]["complete"]);
-		ret[i].archived=watoi(res[i]["archived"]);
+		ret.push_back(ServerCleanupDao::SImageRef());
+		ServerCleanupDao::SImageRef& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.complete=cur->getInt(1);
+		curr.archived=cur->getInt(2);
 	}
+	cur->shutdown();
+	q_getImageRefs->Reset();
 	return ret;
 }
 
@@ -262,16 +272,18 @@ std::vector<ServerCleanupDao::SImageRef> ServerCleanupDao::getImageRefsReverse(i
 		q_getImageRefsReverse=db->Prepare("SELECT id, complete, archived FROM backup_images WHERE id = (SELECT incremental_ref FROM backup_images WHERE id=?)", false);
 	}
 	q_getImageRefsReverse->Bind(backupid);
-	db_results res=q_getImageRefsReverse->Read();
-	q_getImageRefsReverse->Reset();
 	std::vector<ServerCleanupDao::SImageRef> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getImageRefsReverse->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].complete=watoi(res[i]["complete"]);
-		ret[i].archived=watoi(res[i]["archived"]);
+		ret.push_back(ServerCleanupDao::SImageRef());
+		ServerCleanupDao::SImageRef& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.complete=cur->getInt(1);
+		curr.archived=cur->getInt(2);
 	}
+	cur->shutdown();
+	q_getImageRefsReverse->Reset();
 	return ret;
 }
 
@@ -289,14 +301,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::getImageClientId(int id)
 		q_getImageClientId=db->Prepare("SELECT clientid FROM backup_images WHERE id=?", false);
 	}
 	q_getImageClientId->Bind(id);
-	db_results res=q_getImageClientId->Read();
-	q_getImageClientId->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageClientId->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["clientid"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getImageClientId->Reset();
 	return ret;
 }
 
@@ -314,14 +327,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::getFileBackupClientId(int id)
 		q_getFileBackupClientId=db->Prepare("SELECT clientid FROM backups WHERE id=?", false);
 	}
 	q_getFileBackupClientId->Bind(id);
-	db_results res=q_getFileBackupClientId->Read();
-	q_getFileBackupClientId->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getFileBackupClientId->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["clientid"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getFileBackupClientId->Reset();
 	return ret;
 }
 
@@ -339,14 +353,15 @@ ServerCleanupDao::CondString ServerCleanupDao::getImageClientname(int id)
 		q_getImageClientname=db->Prepare("SELECT name FROM clients WHERE id=(SELECT clientid FROM backup_images WHERE id=? )", false);
 	}
 	q_getImageClientname->Bind(id);
-	db_results res=q_getImageClientname->Read();
-	q_getImageClientname->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageClientname->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["name"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getImageClientname->Reset();
 	return ret;
 }
 
@@ -365,14 +380,15 @@ ServerCleanupDao::CondString ServerCleanupDao::getImagePath(int id)
 		q_getImagePath=db->Prepare("SELECT path FROM backup_images WHERE id=?", false);
 	}
 	q_getImagePath->Bind(id);
-	db_results res=q_getImagePath->Read();
-	q_getImagePath->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImagePath->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["path"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getImagePath->Reset();
 	return ret;
 }
 
@@ -392,15 +408,17 @@ std::vector<ServerCleanupDao::SImageLetter> ServerCleanupDao::getIncrNumImages(i
 		q_getIncrNumImages=db->Prepare("SELECT id,letter FROM backup_images WHERE clientid=? AND incremental<>0 AND complete=1 AND letter!='SYSVOL' AND letter!='ESP' AND archived=0 ORDER BY backuptime ASC", false);
 	}
 	q_getIncrNumImages->Bind(clientid);
-	db_results res=q_getIncrNumImages->Read();
-	q_getIncrNumImages->Reset();
 	std::vector<ServerCleanupDao::SImageLetter> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getIncrNumImages->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].letter=res[i]["letter"];
+		ret.push_back(ServerCleanupDao::SImageLetter());
+		ServerCleanupDao::SImageLetter& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.letter=cur->getString(1);
 	}
+	cur->shutdown();
+	q_getIncrNumImages->Reset();
 	return ret;
 }
 
@@ -421,10 +439,17 @@ int ServerCleanupDao::getIncrNumImagesForBackup(int backupid)
 	}
 	q_getIncrNumImagesForBackup->Bind(backupid);
 	q_getIncrNumImagesForBackup->Bind(backupid);
-	db_results res=q_getIncrNumImagesForBackup->Read();
+	int ret=0;
+	IDatabaseCursor* cur=q_getIncrNumImagesForBackup->Cursor();
+	bool has_row=cur->next();
+	assert(has_row);
+	if(has_row)
+	{
+		ret=cur->getInt(0);
+	}
+	cur->shutdown();
 	q_getIncrNumImagesForBackup->Reset();
-	assert(!res.empty());
-	return watoi(res[0]["c"]);
+	return ret;
 }
 
 /**
@@ -443,14 +468,14 @@ std::vector<int> ServerCleanupDao::getFullNumFiles(int clientid)
 		q_getFullNumFiles=db->Prepare("SELECT id FROM backups WHERE clientid=? AND incremental=0 AND running<datetime('now','-300 seconds') AND archived=0 ORDER BY backuptime ASC", false);
 	}
 	q_getFullNumFiles->Bind(clientid);
-	db_results res=q_getFullNumFiles->Read();
-	q_getFullNumFiles->Reset();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getFullNumFiles->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
+	q_getFullNumFiles->Reset();
 	return ret;
 }
 
@@ -470,14 +495,14 @@ std::vector<int> ServerCleanupDao::getIncrNumFiles(int clientid)
 		q_getIncrNumFiles=db->Prepare("SELECT id FROM backups WHERE clientid=? AND incremental<>0 AND running<datetime('now','-300 seconds') AND archived=0 ORDER BY backuptime ASC", false);
 	}
 	q_getIncrNumFiles->Bind(clientid);
-	db_results res=q_getIncrNumFiles->Read();
-	q_getIncrNumFiles->Reset();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getIncrNumFiles->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
+	q_getIncrNumFiles->Reset();
 	return ret;
 }
 
@@ -495,14 +520,15 @@ ServerCleanupDao::CondString ServerCleanupDao::getClientName(int clientid)
 		q_getClientName=db->Prepare("SELECT name FROM clients WHERE id=?", false);
 	}
 	q_getClientName->Bind(clientid);
-	db_results res=q_getClientName->Read();
-	q_getClientName->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getClientName->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["name"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getClientName->Reset();
 	return ret;
 }
 
@@ -520,14 +546,15 @@ ServerCleanupDao::CondString ServerCleanupDao::getFileBackupPath(int backupid)
 		q_getFileBackupPath=db->Prepare("SELECT path FROM backups WHERE id=?", false);
 	}
 	q_getFileBackupPath->Bind(backupid);
-	db_results res=q_getFileBackupPath->Read();
-	q_getFileBackupPath->Reset();
 	CondString ret = { false, "" };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getFileBackupPath->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=res[0]["path"];
+		ret.value=cur->getString(0);
 	}
+	cur->shutdown();
+	q_getFileBackupPath->Reset();
 	return ret;
 }
 
@@ -580,17 +607,18 @@ ServerCleanupDao::SFileBackupInfo ServerCleanupDao::getFileBackupInfo(int backup
 		q_getFileBackupInfo=db->Prepare("SELECT id, backuptime, path, done FROM backups WHERE id=?", false);
 	}
 	q_getFileBackupInfo->Bind(backupid);
-	db_results res=q_getFileBackupInfo->Read();
-	q_getFileBackupInfo->Reset();
 	SFileBackupInfo ret = { false, 0, "", "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getFileBackupInfo->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi(res[0]["id"]);
-		ret.backuptime=res[0]["backuptime"];
-		ret.path=res[0]["path"];
-		ret.done=watoi(res[0]["done"]);
+		ret.id=cur->getInt(0);
+		ret.backuptime=cur->getString(1);
+		ret.path=cur->getString(2);
+		ret.done=cur->getInt(3);
 	}
+	cur->shutdown();
+	q_getFileBackupInfo->Reset();
 	return ret;
 }
 
@@ -608,18 +636,19 @@ ServerCleanupDao::SImageBackupInfo ServerCleanupDao::getImageBackupInfo(int back
 		q_getImageBackupInfo=db->Prepare("SELECT id, backuptime, path, letter, complete FROM backup_images WHERE id=?", false);
 	}
 	q_getImageBackupInfo->Bind(backupid);
-	db_results res=q_getImageBackupInfo->Read();
-	q_getImageBackupInfo->Reset();
 	SImageBackupInfo ret = { false, 0, "", "", "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageBackupInfo->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi(res[0]["id"]);
-		ret.backuptime=res[0]["backuptime"];
-		ret.path=res[0]["path"];
-		ret.letter=res[0]["letter"];
-		ret.complete=watoi(res[0]["complete"]);
+		ret.id=cur->getInt(0);
+		ret.backuptime=cur->getString(1);
+		ret.path=cur->getString(2);
+		ret.letter=cur->getString(3);
+		ret.complete=cur->getInt(4);
 	}
+	cur->shutdown();
+	q_getImageBackupInfo->Reset();
 	return ret;
 }
 
@@ -708,16 +737,18 @@ std::vector<ServerCleanupDao::SImageBackupInfo> ServerCleanupDao::getClientImage
 		q_getClientImages=db->Prepare("SELECT id, path FROM backup_images WHERE clientid=?", false);
 	}
 	q_getClientImages->Bind(clientid);
-	db_results res=q_getClientImages->Read();
-	q_getClientImages->Reset();
 	std::vector<ServerCleanupDao::SImageBackupInfo> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientImages->Cursor();
+	while(cur->next())
 	{
-		ret[i].exists=true;
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].path=res[i]["path"];
+		ret.push_back(ServerCleanupDao::SImageBackupInfo());
+		ServerCleanupDao::SImageBackupInfo& curr=ret.back();
+		curr.exists=true;
+		curr.id=cur->getInt(0);
+		curr.path=cur->getString(1);
 	}
+	cur->shutdown();
+	q_getClientImages->Reset();
 	return ret;
 }
 
@@ -735,14 +766,14 @@ std::vector<int> ServerCleanupDao::getClientFileBackups(int clientid)
 		q_getClientFileBackups=db->Prepare("SELECT id FROM backups WHERE clientid=?", false);
 	}
 	q_getClientFileBackups->Bind(clientid);
-	db_results res=q_getClientFileBackups->Read();
-	q_getClientFileBackups->Reset();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClientFileBackups->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
+	q_getClientFileBackups->Reset();
 	return ret;
 }
 
@@ -760,14 +791,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::getParentImageBackup(int assoc_id)
 		q_getParentImageBackup=db->Prepare("SELECT img_id FROM assoc_images WHERE assoc_id=?", false);
 	}
 	q_getParentImageBackup->Bind(assoc_id);
-	db_results res=q_getParentImageBackup->Read();
-	q_getParentImageBackup->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getParentImageBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["img_id"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getParentImageBackup->Reset();
 	return ret;
 }
 
@@ -785,14 +817,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::getImageArchived(int backupid)
 		q_getImageArchived=db->Prepare("SELECT archived FROM backup_images WHERE id=?", false);
 	}
 	q_getImageArchived->Bind(backupid);
-	db_results res=q_getImageArchived->Read();
-	q_getImageArchived->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageArchived->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["archived"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_getImageArchived->Reset();
 	return ret;
 }
 
@@ -810,14 +843,14 @@ std::vector<int> ServerCleanupDao::getAssocImageBackups(int img_id)
 		q_getAssocImageBackups=db->Prepare("SELECT assoc_id FROM assoc_images WHERE img_id=?", false);
 	}
 	q_getAssocImageBackups->Bind(img_id);
-	db_results res=q_getAssocImageBackups->Read();
-	q_getAssocImageBackups->Reset();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getAssocImageBackups->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["assoc_id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
+	q_getAssocImageBackups->Reset();
 	return ret;
 }
 
@@ -835,14 +868,14 @@ std::vector<int> ServerCleanupDao::getAssocImageBackupsReverse(int assoc_id)
 		q_getAssocImageBackupsReverse=db->Prepare("SELECT img_id FROM assoc_images WHERE assoc_id=?", false);
 	}
 	q_getAssocImageBackupsReverse->Bind(assoc_id);
-	db_results res=q_getAssocImageBackupsReverse->Read();
-	q_getAssocImageBackupsReverse->Reset();
 	std::vector<int> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getAssocImageBackupsReverse->Cursor();
+	while(cur->next())
 	{
-		ret[i]=watoi(res[i]["img_id"]);
+		ret.push_back(cur->getInt(0));
 	}
+	cur->shutdown();
+	q_getAssocImageBackupsReverse->Reset();
 	return ret;
 }
 
@@ -861,14 +894,15 @@ ServerCleanupDao::CondInt64 ServerCleanupDao::getImageSize(int backupid)
 		q_getImageSize=db->Prepare("SELECT size_bytes FROM backup_images WHERE id=?", false);
 	}
 	q_getImageSize->Bind(backupid);
-	db_results res=q_getImageSize->Read();
-	q_getImageSize->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getImageSize->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["size_bytes"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_getImageSize->Reset();
 	return ret;
 }
 
@@ -885,14 +919,16 @@ std::vector<ServerCleanupDao::SClientInfo> ServerCleanupDao::getClients(void)
 	{
 		q_getClients=db->Prepare("SELECT id, name FROM clients", false);
 	}
-	db_results res=q_getClients->Read();
 	std::vector<ServerCleanupDao::SClientInfo> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
+	IDatabaseCursor* cur=q_getClients->Cursor();
+	while(cur->next())
 	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].name=res[i]["name"];
+		ret.push_back(ServerCleanupDao::SClientInfo());
+		ServerCleanupDao::SClientInfo& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.name=cur->getString(1);
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -911,18 +947,20 @@ std::vector<ServerCleanupDao::SFileBackupInfo> ServerCleanupDao::getFileBackupsO
 		q_getFileBackupsOfClient=db->Prepare("SELECT id, backuptime, path, done FROM backups WHERE clientid=? ORDER BY backuptime DESC", false);
 	}
 	q_getFileBackupsOfClient->Bind(clientid);
-	db_results res=q_getFileBackupsOfClient->Read();
-	q_getFileBackupsOfClient->Reset();
 	std::vector<ServerCleanupDao::SFileBackupInfo> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].exists=true;
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].backuptime=res[i]["backuptime"];
-		ret[i].path=res[i]["path"];
-		ret[i].done=watoi(res[i]["done"]);
-	}
+	IDatabaseCursor* cur=q_getFileBackupsOfClient->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerCleanupDao::SFileBackupInfo());
+		ServerCleanupDao::SFileBackupInfo& curr=ret.back();
+		curr.exists=true;
+		curr.id=cur->getInt(0);
+		curr.backuptime=cur->getString(1);
+		curr.path=cur->getString(2);
+		curr.done=cur->getInt(3);
+	}
+	cur->shutdown();
+	q_getFileBackupsOfClient->Reset();
 	return ret;
 }
 
@@ -941,18 +979,20 @@ std::vector<ServerCleanupDao::SImageBackupInfo> ServerCleanupDao::getOldImageBac
 		q_getOldImageBackupsOfClient=db->Prepare("SELECT id, backuptime, letter, path FROM backup_images WHERE clientid=? AND running<datetime('now','-12 hours')", false);
 	}
 	q_getOldImageBackupsOfClient->Bind(clientid);
-	db_results res=q_getOldImageBackupsOfClient->Read();
-	q_getOldImageBackupsOfClient->Reset();
 	std::vector<ServerCleanupDao::SImageBackupInfo> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].exists=true;
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].backuptime=res[i]["backuptime"];
-		ret[i].letter=res[i]["letter"];
-		ret[i].path=res[i]["path"];
-	}
+	IDatabaseCursor* cur=q_getOldImageBackupsOfClient->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerCleanupDao::SImageBackupInfo());
+		ServerCleanupDao::SImageBackupInfo& curr=ret.back();
+		curr.exists=true;
+		curr.id=cur->getInt(0);
+		curr.backuptime=cur->getString(1);
+		curr.letter=cur->getString(2);
+		curr.path=cur->getString(3);
+	}
+	cur->shutdown();
+	q_getOldImageBackupsOfClient->Reset();
 	return ret;
 }
 
@@ -970,19 +1010,21 @@ std::vector<ServerCleanupDao::SImageBackupInfo> ServerCleanupDao::getImageBackup
 		q_getImageBackupsOfClient=db->Prepare("SELECT id, backuptime, letter, path, complete FROM backup_images WHERE clientid=?", false);
 	}
 	q_getImageBackupsOfClient->Bind(clientid);
-	db_results res=q_getImageBackupsOfClient->Read();
-	q_getImageBackupsOfClient->Reset();
 	std::vector<ServerCleanupDao::SImageBackupInfo> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].exists=true;
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].backuptime=res[i]["backuptime"];
-		ret[i].letter=res[i]["letter"];
-		ret[i].path=res[i]["path"];
-		ret[i].complete=watoi(res[i]["complete"]);
-	}
+	IDatabaseCursor* cur=q_getImageBackupsOfClient->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerCleanupDao::SImageBackupInfo());
+		ServerCleanupDao::SImageBackupInfo& curr=ret.back();
+		curr.exists=true;
+		curr.id=cur->getInt(0);
+		curr.backuptime=cur->getString(1);
+		curr.letter=cur->getString(2);
+		curr.path=cur->getString(3);
+		curr.complete=cur->getInt(4);
+	}
+	cur->shutdown();
+	q_getImageBackupsOfClient->Reset();
 	return ret;
 }
 
@@ -1001,14 +1043,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::findFileBackup(int clientid, const s
 	}
 	q_findFileBackup->Bind(clientid);
 	q_findFileBackup->Bind(path);
-	db_results res=q_findFileBackup->Read();
-	q_findFileBackup->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_findFileBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["id"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_findFileBackup->Reset();
 	return ret;
 }
 
@@ -1026,14 +1069,15 @@ ServerCleanupDao::CondInt64 ServerCleanupDao::getUsedStorage(int clientid)
 		q_getUsedStorage=db->Prepare("SELECT (bytes_used_files+bytes_used_images) AS used_storage FROM clients WHERE id=?", false);
 	}
 	q_getUsedStorage->Bind(clientid);
-	db_results res=q_getUsedStorage->Read();
-	q_getUsedStorage->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getUsedStorage->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["used_storage"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_getUsedStorage->Reset();
 	return ret;
 }
 
@@ -1084,18 +1128,20 @@ std::vector<ServerCleanupDao::SIncompleteFileBackup> ServerCleanupDao::getIncomp
 	{
 		q_getIncompleteFileBackups=db->Prepare("SELECT b.id, b.clientid, b.incremental, b.backuptime, b.path, c.name AS clientname FROM backups b INNER JOIN clients c ON b.clientid=c.id WHERE complete=0 AND archived=0 AND EXISTS ( SELECT * FROM backups e WHERE b.clientid = e.clientid AND e.backuptime>b.backuptime AND e.done=1)", false);
 	}
-	db_results res=q_getIncompleteFileBackups->Read();
 	std::vector<ServerCleanupDao::SIncompleteFileBackup> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].clientid=watoi(res[i]["clientid"]);
-		ret[i].incremental=watoi(res[i]["incremental"]);
-		ret[i].backuptime=res[i]["backuptime"];
-		ret[i].path=res[i]["path"];
-		ret[i].clientname=res[i]["clientname"];
-	}
+	IDatabaseCursor* cur=q_getIncompleteFileBackups->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerCleanupDao::SIncompleteFileBackup());
+		ServerCleanupDao::SIncompleteFileBackup& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.clientid=cur->getInt(1);
+		curr.incremental=cur->getInt(2);
+		curr.backuptime=cur->getString(3);
+		curr.path=cur->getString(4);
+		curr.clientname=cur->getString(5);
+	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -1114,18 +1160,20 @@ std::vector<ServerCleanupDao::SIncompleteFileBackup> ServerCleanupDao::getDelete
 	{
 		q_getDeletePendingFileBackups=db->Prepare("SELECT b.id, b.clientid, b.incremental, b.backuptime, b.path, c.name AS clientname FROM backups b INNER JOIN clients c ON b.clientid=c.id WHERE b.delete_pending=1", false);
 	}
-	db_results res=q_getDeletePendingFileBackups->Read();
 	std::vector<ServerCleanupDao::SIncompleteFileBackup> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].clientid=watoi(res[i]["clientid"]);
-		ret[i].incremental=watoi(res[i]["incremental"]);
-		ret[i].backuptime=res[i]["backuptime"];
-		ret[i].path=res[i]["path"];
-		ret[i].clientname=res[i]["clientname"];
-	}
+	IDatabaseCursor* cur=q_getDeletePendingFileBackups->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerCleanupDao::SIncompleteFileBackup());
+		ServerCleanupDao::SIncompleteFileBackup& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.clientid=cur->getInt(1);
+		curr.incremental=cur->getInt(2);
+		curr.backuptime=cur->getString(3);
+		curr.path=cur->getString(4);
+		curr.clientname=cur->getString(5);
+	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -1150,22 +1198,24 @@ std::vector<ServerCleanupDao::SHistItem> ServerCleanupDao::getClientHistory(cons
 	q_getClientHistory->Bind(back_start);
 	q_getClientHistory->Bind(back_stop);
 	q_getClientHistory->Bind(date_grouping);
-	db_results res=q_getClientHistory->Read();
-	q_getClientHistory->Reset();
 	std::vector<ServerCleanupDao::SHistItem> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].id=watoi(res[i]["id"]);
-		ret[i].name=res[i]["name"];
-		ret[i].lastbackup=res[i]["lastbackup"];
-		ret[i].lastseen=res[i]["lastseen"];
-		ret[i].lastbackup_image=res[i]["lastbackup_image"];
-		ret[i].bytes_used_files=watoi64(res[i]["bytes_used_files"]);
-		ret[i].bytes_used_images=watoi64(res[i]["bytes_used_images"]);
-		ret[i].max_created=res[i]["max_created"];
-		ret[i].hist_id=watoi64(res[i]["hist_id"]);
-	}
+	IDatabaseCursor* cur=q_getClientHistory->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerCleanupDao::SHistItem());
+		ServerCleanupDao::SHistItem& curr=ret.back();
+		curr.id=cur->getInt(0);
+		curr.name=cur->getString(1);
+		curr.lastbackup=cur->getString(2);
+		curr.lastseen=cur->getString(3);
+		curr.lastbackup_image=cur->getString(4);
+		curr.bytes_used_files=cur->getInt64(5);
+		curr.bytes_used_images=cur->getInt64(6);
+		curr.max_created=cur->getString(7);
+		curr.hist_id=cur->getInt64(8);
+	}
+	cur->shutdown();
+	q_getClientHistory->Reset();
 	return ret;
 }
 
@@ -1272,14 +1322,15 @@ ServerCleanupDao::CondInt ServerCleanupDao::hasMoreRecentFileBackup(int backupid
 		q_hasMoreRecentFileBackup=db->Prepare("SELECT id FROM backups b WHERE id=? AND EXISTS  (SELECT * FROM backups WHERE backuptime>b.backuptime  AND tgroup=b.tgroup AND clientid=b.clientid AND done=1)", false);
 	}
 	q_hasMoreRecentFileBackup->Bind(backupid);
-	db_results res=q_hasMoreRecentFileBackup->Read();
-	q_hasMoreRecentFileBackup->Reset();
 	CondInt ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_hasMoreRecentFileBackup->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi(res[0]["id"]);
+		ret.value=cur->getInt(0);
 	}
+	cur->shutdown();
+	q_hasMoreRecentFileBackup->Reset();
 	return ret;
 }
 
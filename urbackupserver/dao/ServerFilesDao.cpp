@@ -18,6 +18,7 @@
 
 #include "ServerFilesDao.h"
 #include "../../stringtools.h"
+#include "../../Interface/DatabaseCursor.h"
 #include <assert.h>
 #include <string.h>
 
@@ -148,14 +149,15 @@ ServerFilesDao::CondInt64 ServerFilesDao::getPointedTo(int64 id)
 		q_getPointedTo=db->Prepare("SELECT pointed_to FROM files WHERE id=?", false);
 	}
 	q_getPointedTo->Bind(id);
-	db_results res=q_getPointedTo->Read();
-	q_getPointedTo->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getPointedTo->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["pointed_to"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_getPointedTo->Reset();
 	return ret;
 }
 
@@ -176,6 +178,23 @@ void ServerFilesDao::delFileEntry(int64 id)
 	q_delFileEntry->Reset();
 }
 
+/**
+* @-SQLGenAccess
+* @func void ServerFilesDao::delFileChunks
+* @sql
+*	   DELETE FROM file_chunks WHERE fileid=:fileid(int64)
+*/
+void ServerFilesDao::delFileChunks(int64 fileid)
+{
+	if(q_delFileChunks==NULL)
+	{
+		q_delFileChunks=db->Prepare("DELETE FROM file_chunks WHERE fileid=?", false);
+	}
+	q_delFileChunks->Bind(fileid);
+	q_delFileChunks->Write();
+	q_delFileChunks->Reset();
+}
+
 /**
 * @-SQLGenAccess
 * @func SFindFileEntry ServerFilesDao::getFileEntry
@@ -191,25 +210,26 @@ ServerFilesDao::SFindFileEntry ServerFilesDao::getFileEntry(int64 id)
 		q_getFileEntry=db->Prepare("SELECT id, shahash, backupid, clientid, fullpath, hashpath, filesize, next_entry, prev_entry, rsize, incremental, pointed_to FROM files WHERE id=?", false);
 	}
 	q_getFileEntry->Bind(id);
-	db_results res=q_getFileEntry->Read();
-	q_getFileEntry->Reset();
 	SFindFileEntry ret = { false, 0, "", 0, 0, "", "", 0, 0, 0, 0, 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getFileEntry->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi64(res[0]["id"]);
-		ret.shahash=res[0]["shahash"];
-		ret.backupid=watoi(res[0]["backupid"]);
-		ret.clientid=watoi(res[0]["clientid"]);
-		ret.fullpath=res[0]["fullpath"];
-		ret.hashpath=res[0]["hashpath"];
-		ret.filesize=watoi64(res[0]["filesize"]);
-		ret.next_entry=watoi64(res[0]["next_entry"]);
-		ret.prev_entry=watoi64(res[0]["prev_entry"]);
-		ret.rsize=watoi64(res[0]["rsize"]);
-		ret.incremental=watoi(res[0]["incremental"]);
-		ret.pointed_to=watoi(res[0]["pointed_to"]);
-	}
+		ret.id=cur->getInt64(0);
+		ret.shahash=cur->getString(1);
+		ret.backupid=cur->getInt(2);
+		ret.clientid=cur->getInt(3);
+		ret.fullpath=cur->getString(4);
+		ret.hashpath=cur->getString(5);
+		ret.filesize=cur->getInt64(6);
+		ret.next_entry=cur->getInt64(7);
+		ret.prev_entry=cur->getInt64(8);
+		ret.rsize=cur->getInt64(9);
+		ret.incremental=cur->getInt(10);
+		ret.pointed_to=cur->getInt(11);
+	}
+	cur->shutdown();
+	q_getFileEntry->Reset();
 	return ret;
 }
 
@@ -228,21 +248,22 @@ ServerFilesDao::SStatFileEntry ServerFilesDao::getStatFileEntry(int64 id)
 		q_getStatFileEntry=db->Prepare("SELECT id, backupid, clientid, filesize, rsize, shahash, next_entry, prev_entry FROM files WHERE id=?", false);
 	}
 	q_getStatFileEntry->Bind(id);
-	db_results res=q_getStatFileEntry->Read();
-	q_getStatFileEntry->Reset();
 	SStatFileEntry ret = { false, 0, 0, 0, 0, 0, "", 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getStatFileEntry->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.id=watoi64(res[0]["id"]);
-		ret.backupid=watoi(res[0]["backupid"]);
-		ret.clientid=watoi(res[0]["clientid"]);
-		ret.filesize=watoi64(res[0]["filesize"]);
-		ret.rsize=watoi64(res[0]["rsize"]);
-		ret.shahash=res[0]["shahash"];
-		ret.next_entry=watoi64(res[0]["next_entry"]);
-		ret.prev_entry=watoi64(res[0]["prev_entry"]);
-	}
+		ret.id=cur->getInt64(0);
+		ret.backupid=cur->getInt(1);
+		ret.clientid=cur->getInt(2);
+		ret.filesize=cur->getInt64(3);
+		ret.rsize=cur->getInt64(4);
+		ret.shahash=cur->getString(5);
+		ret.next_entry=cur->getInt64(6);
+		ret.prev_entry=cur->getInt64(7);
+	}
+	cur->shutdown();
+	q_getStatFileEntry->Reset();
 	return ret;
 }
 
@@ -370,14 +391,15 @@ ServerFilesDao::CondInt64 ServerFilesDao::lookupEntryIdByPath(const std::string&
 		q_lookupEntryIdByPath=db->Prepare("SELECT entryid FROM files_cont_path_lookup WHERE fullpath=?", false);
 	}
 	q_lookupEntryIdByPath->Bind(fullpath);
-	db_results res=q_lookupEntryIdByPath->Read();
-	q_lookupEntryIdByPath->Reset();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_lookupEntryIdByPath->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["entryid"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
+	q_lookupEntryIdByPath->Reset();
 	return ret;
 }
 
@@ -418,13 +440,14 @@ ServerFilesDao::CondInt64 ServerFilesDao::getIncomingStatsCount(void)
 	{
 		q_getIncomingStatsCount=db->Prepare("SELECT COUNT(*) AS c FROM files_incoming_stat", false);
 	}
-	db_results res=q_getIncomingStatsCount->Read();
 	CondInt64 ret = { false, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getIncomingStatsCount->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.value=watoi64(res[0]["c"]);
+		ret.value=cur->getInt64(0);
 	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -459,19 +482,21 @@ std::vector<ServerFilesDao::SIncomingStat> ServerFilesDao::getIncomingStats(void
 	{
 		q_getIncomingStats=db->Prepare("SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental FROM files_incoming_stat LIMIT 10000", false);
 	}
-	db_results res=q_getIncomingStats->Read();
 	std::vector<ServerFilesDao::SIncomingStat> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].id=watoi64(res[i]["id"]);
-		ret[i].filesize=watoi64(res[i]["filesize"]);
-		ret[i].clientid=watoi(res[i]["clientid"]);
-		ret[i].backupid=watoi(res[i]["backupid"]);
-		ret[i].existing_clients=res[i]["existing_clients"];
-		ret[i].direction=watoi(res[i]["direction"]);
-		ret[i].incremental=watoi(res[i]["incremental"]);
-	}
+	IDatabaseCursor* cur=q_getIncomingStats->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerFilesDao::SIncomingStat());
+		ServerFilesDao::SIncomingStat& curr=ret.back();
+		curr.id=cur->getInt64(0);
+		curr.filesize=cur->getInt64(1);
+		curr.clientid=cur->getInt(2);
+		curr.backupid=cur->getInt(3);
+		curr.existing_clients=cur->getString(4);
+		curr.direction=cur->getInt(5);
+		curr.incremental=cur->getInt(6);
+	}
+	cur->shutdown();
 	return ret;
 }
 
@@ -492,6 +517,23 @@ void ServerFilesDao::deleteFiles(int backupid)
 	q_deleteFiles->Reset();
 }
 
+/**
+* @-SQLGenAccess
+* @func void ServerFilesDao::deleteFileChunks
+* @sql
+*	DELETE FROM file_chunks WHERE fileid IN (SELECT id FROM files WHERE backupid=:backupid(int))
+*/
+void ServerFilesDao::deleteFileChunks(int backupid)
+{
+	if(q_deleteFileChunks==NULL)
+	{
+		q_deleteFileChunks=db->Prepare("DELETE FROM file_chunks WHERE fileid IN (SELECT id FROM files WHERE backupid=?)", false);
+	}
+	q_deleteFileChunks->Bind(backupid);
+	q_deleteFileChunks->Write();
+	q_deleteFileChunks->Reset();
+}
+
 /**
 * @-SQLGenAccess
 * @func void ServerFilesDao::removeDanglingFiles
@@ -507,6 +549,21 @@ void ServerFilesDao::removeDanglingFiles(void)
 	q_removeDanglingFiles->Write();
 }
 
+/**
+* @-SQLGenAccess
+* @func void ServerFilesDao::removeDanglingFileChunks
+* @sql
+*	DELETE FROM file_chunks WHERE fileid NOT IN (SELECT id FROM files)
+*/
+void ServerFilesDao::removeDanglingFileChunks(void)
+{
+	if(q_removeDanglingFileChunks==NULL)
+	{
+		q_removeDanglingFileChunks=db->Prepare("DELETE FROM file_chunks WHERE fileid NOT IN (SELECT id FROM files)", false);
+	}
+	q_removeDanglingFileChunks->Write();
+}
+
 /**
 * @-SQLGenAccessNoCheck
 * @func bool ServerFilesDao::createTemporaryLastFilesTable
@@ -605,17 +662,18 @@ ServerFilesDao::SFileEntry ServerFilesDao::getFileEntryFromTemporaryTable(const
 		q_getFileEntryFromTemporaryTable=db->Prepare("SELECT fullpath, hashpath, shahash, filesize FROM files_last WHERE fullpath = ?", false);
 	}
 	q_getFileEntryFromTemporaryTable->Bind(fullpath);
-	db_results res=q_getFileEntryFromTemporaryTable->Read();
-	q_getFileEntryFromTemporaryTable->Reset();
 	SFileEntry ret = { false, "", "", "", 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getFileEntryFromTemporaryTable->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.fullpath=res[0]["fullpath"];
-		ret.hashpath=res[0]["hashpath"];
-		ret.shahash=res[0]["shahash"];
-		ret.filesize=watoi64(res[0]["filesize"]);
+		ret.fullpath=cur->getString(0);
+		ret.hashpath=cur->getString(1);
+		ret.shahash=cur->getString(2);
+		ret.filesize=cur->getInt64(3);
 	}
+	cur->shutdown();
+	q_getFileEntryFromTemporaryTable->Reset();
 	return ret;
 }
 
@@ -635,18 +693,20 @@ std::vector<ServerFilesDao::SFileEntry> ServerFilesDao::getFileEntriesFromTempor
 		q_getFileEntriesFromTemporaryTableGlob=db->Prepare("SELECT fullpath, hashpath, shahash, filesize FROM files_last WHERE fullpath GLOB ?", false);
 	}
 	q_getFileEntriesFromTemporaryTableGlob->Bind(fullpath_glob);
-	db_results res=q_getFileEntriesFromTemporaryTableGlob->Read();
-	q_getFileEntriesFromTemporaryTableGlob->Reset();
 	std::vector<ServerFilesDao::SFileEntry> ret;
-	ret.resize(res.size());
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret[i].exists=true;
-		ret[i].fullpath=res[i]["fullpath"];
-		ret[i].hashpath=res[i]["hashpath"];
-		ret[i].shahash=res[i]["shahash"];
-		ret[i].filesize=watoi64(res[i]["filesize"]);
-	}
+	IDatabaseCursor* cur=q_getFileEntriesFromTemporaryTableGlob->Cursor();
+	while(cur->next())
+	{
+		ret.push_back(ServerFilesDao::SFileEntry());
+		ServerFilesDao::SFileEntry& curr=ret.back();
+		curr.exists=true;
+		curr.fullpath=cur->getString(0);
+		curr.hashpath=cur->getString(1);
+		curr.shahash=cur->getString(2);
+		curr.filesize=cur->getInt64(3);
+	}
+	cur->shutdown();
+	q_getFileEntriesFromTemporaryTableGlob->Reset();
 	return ret;
 }
 
@@ -664,15 +724,16 @@ ServerFilesDao::SBackupIdMinMax ServerFilesDao::getBackupIdMinMax(int backupid)
 		q_getBackupIdMinMax=db->Prepare("SELECT MIN(id) AS tmin, MAX(id) AS tmax FROM files WHERE backupid=?", false);
 	}
 	q_getBackupIdMinMax->Bind(backupid);
-	db_results res=q_getBackupIdMinMax->Read();
-	q_getBackupIdMinMax->Reset();
 	SBackupIdMinMax ret = { false, 0, 0 };
-	if(!res.empty())
+	IDatabaseCursor* cur=q_getBackupIdMinMax->Cursor();
+	if(cur->next())
 	{
 		ret.exists=true;
-		ret.tmin=watoi64(res[0]["tmin"]);
-		ret.tmax=watoi64(res[0]["tmax"]);
+		ret.tmin=cur->getInt64(0);
+		ret.tmax=cur->getInt64(1);
 	}
+	cur->shutdown();
+	q_getBackupIdMinMax->Reset();
 	return ret;
 }
 
@@ -684,6 +745,7 @@ void ServerFilesDao::prepareQueries()
 	q_setPointedTo=NULL;
 	q_getPointedTo=NULL;
 	q_delFileEntry=NULL;
+	q_delFileChunks=NULL;
 	q_getFileEntry=NULL;
 	q_getStatFileEntry=NULL;
 	q_addFileEntry=NULL;
@@ -698,7 +760,9 @@ void ServerFilesDao::prepareQueries()
 	q_delIncomingStatEntry=NULL;
 	q_getIncomingStats=NULL;
 	q_deleteFiles=NULL;
+	q_deleteFileChunks=NULL;
 	q_removeDanglingFiles=NULL;
+	q_removeDanglingFileChunks=NULL;
 	q_createTemporaryLastFilesTable=NULL;
 	q_dropTemporaryLastFilesTable=NULL;
 	q_createTemporaryLastFilesTableIndex=NULL;
@@ -717,6 +781,7 @@ void ServerFilesDao::destroyQueries()
 	db->destroyQuery(q_setPointedTo);
 	db->destroyQuery(q_getPointedTo);
 	db->destroyQuery(q_delFileEntry);
+	db->destroyQuery(q_delFileChunks);
 	db->destroyQuery(q_getFileEntry);
 	db->destroyQuery(q_getStatFileEntry);
 	db->destroyQuery(q_addFileEntry);
@@ -731,7 +796,9 @@ void ServerFilesDao::destroyQueries()
 	db->destroyQuery(q_delIncomingStatEntry);
 	db->destroyQuery(q_getIncomingStats);
 	db->destroyQuery(q_deleteFiles);
+	db->destroyQuery(q_deleteFileChunks);
 	db->destroyQuery(q_removeDanglingFiles);
+	db->destroyQuery(q_removeDanglingFileChunks);
 	db->destroyQuery(q_createTemporaryLastFilesTable);
 	db->destroyQuery(q_dropTemporaryLastFilesTable);
 	db->destroyQuery(q_createTemporaryLastFilesTableIndex);
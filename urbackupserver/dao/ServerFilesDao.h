@@ -83,6 +83,7 @@ public:
 	void setPointedTo(int64 pointed_to, int64 id);
 	CondInt64 getPointedTo(int64 id);
 	void delFileEntry(int64 id);
+	void delFileChunks(int64 fileid);
 	SFindFileEntry getFileEntry(int64 id);
 	SStatFileEntry getStatFileEntry(int64 id);
 	void addFileEntry(int backupid, const std::string& fullpath, const std::string& hashpath, const std::string& shahash, int64 filesize, int64 rsize, int clientid, int incremental, int64 next_entry, int64 prev_entry, int pointed_to);
@@ -97,7 +98,9 @@ public:
 	void delIncomingStatEntry(int64 id);
 	std::vector<SIncomingStat> getIncomingStats(void);
 	void deleteFiles(int backupid);
+	void deleteFileChunks(int backupid);
 	void removeDanglingFiles(void);
+	void removeDanglingFileChunks(void);
 	bool createTemporaryLastFilesTable(void);
 	void dropTemporaryLastFilesTable(void);
 	bool createTemporaryLastFilesTableIndex(void);
@@ -123,6 +126,7 @@ private:
 	IQuery* q_setPointedTo;
 	IQuery* q_getPointedTo;
 	IQuery* q_delFileEntry;
+	IQuery* q_delFileChunks;
 	IQuery* q_getFileEntry;
 	IQuery* q_getStatFileEntry;
 	IQuery* q_addFileEntry;
@@ -137,7 +141,9 @@ private:
 	IQuery* q_delIncomingStatEntry;
 	IQuery* q_getIncomingStats;
 	IQuery* q_deleteFiles;
+	IQuery* q_deleteFileChunks;
 	IQuery* q_removeDanglingFiles;
+	IQuery* q_removeDanglingFileChunks;
 	IQuery* q_createTemporaryLastFilesTable;
 	IQuery* q_dropTemporaryLastFilesTable;
 	IQuery* q_createTemporaryLastFilesTableIndex;
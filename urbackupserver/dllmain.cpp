@@ -61,6 +61,8 @@ extern IServer* Server;
 #include "serverinterface/helper.h"
 SStartupStatus startup_status;
 #include "server.h"
+#include "BandwidthScheduler.h"
+#include "InFlightContent.h"
 #include "ImageMount.h"
 
 
@@ -71,6 +73,8 @@ SStartupStatus startup_status;
 #include "ClientMain.h"
 #include "server_archive.h"
 #include "server_settings.h"
+#include "image_block_store.h"
+#include "HashContainer.h"
 #include "server_update_stats.h"
 #include "../urbackupcommon/os_functions.h"
 #include "InternetServiceConnector.h"
@@ -91,10 +95,19 @@ SStartupStatus startup_status;
 #include "../Interface/DatabaseCursor.h"
 #include <set>
 #include "apps/check_files_index.h"
+#include "apps/pack_hashes.h"
+#include "apps/cdc_benchmark.h"
+#include "apps/dao_benchmark.h"
+#include "apps/file_backup_benchmark.h"
+#include "apps/archive_benchmark.h"
+#include "apps/idle_connections_benchmark.h"
+#include "apps/pipe_benchmark.h"
+#include "serverinterface/create_zip.h"
 #include "../fileservplugin/IFileServ.h"
 #include "../fileservplugin/IFileServFactory.h"
 #include "restore_client.h"
 #include "../urbackupcommon/WalCheckpointThread.h"
+#include "../urbackupcommon/PipeBufferPool.h"
 #include "FileMetadataDownloadThread.h"
 #include "../urbackupcommon/chunk_hasher.h"
 #include "LogReport.h"
@@ -454,6 +467,10 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	ServerLogger::init_mutex();
 	init_dir_link_mutex();
 	WalCheckpointThread::init_mutex();
+	PipeBufferPool::init_mutex();
+	archive_init_mutex();
+	HashContainer::init_mutex();
+	InFlightContent::init_mutex();
 
 	std::string app=Server->getServerParameter("app", "");
 
@@ -522,10 +539,38 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		{
 			rc = blockalign();
 		}
+		else if (app == "pack_hashes")
+		{
+			rc = pack_hashes();
+		}
+		else if (app == "cdc_benchmark")
+		{
+			rc = cdc_benchmark();
+		}
+		else if (app == "dao_benchmark")
+		{
+			rc = dao_benchmark();
+		}
+		else if (app == "file_backup_benchmark")
+		{
+			rc = file_backup_benchmark();
+		}
+		else if (app == "archive_benchmark")
+		{
+			rc = archive_benchmark();
+		}
+		else if (app == "idle_connections_benchmark")
+		{
+			rc = idle_connections_benchmark();
+		}
+		else if (app == "pipe_benchmark")
+		{
+			rc = pipe_benchmark();
+		}
 		else
 		{
 			rc=100;
-			Server->Log("App not found. Available apps: cleanup, remove_unknown, cleanup_database, repair_database, defrag_database, export_auth_log, check_fileindex, skiphash_copy, md5sum_check, hash, blockalign");
+			Server->Log("App not found. Available apps: cleanup, remove_unknown, cleanup_database, repair_database, defrag_database, export_auth_log, check_fileindex, skiphash_copy, md5sum_check, hash, blockalign, pack_hashes, cdc_benchmark, dao_benchmark, file_backup_benchmark, archive_benchmark, idle_connections_benchmark, pipe_benchmark");
 		}
 		exit(rc);
 	}
@@ -646,6 +691,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 
 	ServerStatus::init_mutex();
 	ServerSettings::init_mutex();
+	ImageBlockStore::init_mutex();
 	ClientMain::init_mutex();
 	DataplanDb::init();
 	init_log_report();
@@ -821,6 +867,8 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	ADD_ACTION(scripts);
 	ADD_ACTION(status_check);
 	ADD_ACTION(restore_image);
+	ADD_ACTION(search);
+	ADD_ACTION(metrics);
 
 	if(Server->getServerParameter("allow_shutdown")=="true")
 	{
@@ -849,6 +897,8 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		exit(1);
 	}
 
+	BandwidthScheduler::init();
+
 	server_exit_pipe=Server->createMemoryPipe();
 	BackupServer *backup_server=new BackupServer(server_exit_pipe);
 	Server->createThread(backup_server, "client discovery");
@@ -2224,6 +2274,33 @@ bool upgrade61_62()
 	return b;
 }
 
+bool upgrade62_63()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	bool b = db->Write("CREATE TABLE image_blocks (hash BLOB PRIMARY KEY, pack INTEGER, offset INTEGER, refcount INTEGER)");
+	b &= db->Write("CREATE INDEX image_blocks_pack_idx ON image_blocks (pack)");
+	b &= db->Write("CREATE TABLE image_blocks_images (path TEXT PRIMARY KEY, num_blocks INTEGER)");
+	return b;
+}
+
+bool upgrade63_64()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	return db->Write("CREATE TABLE files_db.file_chunks (hash BLOB PRIMARY KEY, fileid INTEGER, offset INTEGER)");
+}
+
+bool upgrade64_65()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	return db->Write("CREATE INDEX files_db.file_chunks_fileid_idx ON file_chunks (fileid)");
+}
+
+bool upgrade65_66()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	return db->Write("CREATE TABLE image_blocks_refs (path TEXT, idx INTEGER, hash BLOB, PRIMARY KEY(path, idx))");
+}
+
 void upgrade(void)
 {
 	Server->destroyAllDatabases();
@@ -2245,7 +2322,7 @@ void upgrade(void)
 	
 	int ver=watoi(res_v[0]["tvalue"]);
 	int old_v;
-	int max_v=62;
+	int max_v=66;
 	{
 		IScopedLock lock(startup_status.mutex);
 		startup_status.target_db_version=max_v;
@@ -2622,6 +2699,34 @@ void upgrade(void)
 					has_error = true;
 				}
 				++ver;
+				break;
+			case 62:
+				if (!upgrade62_63())
+				{
+					has_error = true;
+				}
+				++ver;
+				break;
+			case 63:
+				if (!upgrade63_64())
+				{
+					has_error = true;
+				}
+				++ver;
+				break;
+			case 64:
+				if (!upgrade64_65())
+				{
+					has_error = true;
+				}
+				++ver;
+				break;
+			case 65:
+				if (!upgrade65_66())
+				{
+					has_error = true;
+				}
+				++ver;
 				break;				
 			default:
 				break;
@@ -0,0 +1,514 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "image_block_store.h"
+#include "../Interface/Server.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include "zero_hash.h"
+#include <memory.h>
+#include <memory>
+#include <algorithm>
+
+namespace
+{
+	const unsigned int sha_size = 32;
+	const int64 block_size = 512 * 1024;
+	const int64 pack_max_size = 1024 * 1024 * 1024; //1GB
+	const int64 commit_blocks = 256;
+}
+
+IMutex* ImageBlockStore::mutex = NULL;
+int64 ImageBlockStore::curr_pack = -1;
+
+ImageBlockStore::ImageBlockStore(IDatabase* db, const std::string& backupfolder, logid_t logid)
+	: db(db), storefolder(backupfolder + os_file_sep() + ".image_blocks"), logid(logid)
+{
+	q_get_block = db->Prepare("SELECT pack, offset, refcount FROM image_blocks WHERE hash=?", false);
+	q_add_block = db->Prepare("INSERT INTO image_blocks (hash, pack, offset, refcount) VALUES (?, ?, ?, 1)", false);
+	q_change_refcount = db->Prepare("UPDATE image_blocks SET refcount=refcount+? WHERE hash=?", false);
+	q_del_block = db->Prepare("DELETE FROM image_blocks WHERE hash=?", false);
+	q_has_pack_blocks = db->Prepare("SELECT hash FROM image_blocks WHERE pack=? LIMIT 1", false);
+	q_get_max_pack = db->Prepare("SELECT MAX(pack) AS pack FROM image_blocks", false);
+	q_get_image = db->Prepare("SELECT num_blocks FROM image_blocks_images WHERE path=?", false);
+	q_set_image = db->Prepare("INSERT OR REPLACE INTO image_blocks_images (path, num_blocks) VALUES (?, ?)", false);
+	q_del_image = db->Prepare("DELETE FROM image_blocks_images WHERE path=?", false);
+	q_add_ref = db->Prepare("INSERT OR REPLACE INTO image_blocks_refs (path, idx, hash) VALUES (?, ?, ?)", false);
+	q_get_refs = db->Prepare("SELECT hash FROM image_blocks_refs WHERE path=? AND idx>=? AND idx<?", false);
+	q_has_refs = db->Prepare("SELECT idx FROM image_blocks_refs WHERE path=? LIMIT 1", false);
+	q_del_refs = db->Prepare("DELETE FROM image_blocks_refs WHERE path=?", false);
+}
+
+ImageBlockStore::~ImageBlockStore()
+{
+	for (std::map<int64, IFsFile*>::iterator it = pack_files.begin(); it != pack_files.end(); ++it)
+	{
+		Server->destroy(it->second);
+	}
+
+	db->destroyQuery(q_get_block);
+	db->destroyQuery(q_add_block);
+	db->destroyQuery(q_change_refcount);
+	db->destroyQuery(q_del_block);
+	db->destroyQuery(q_has_pack_blocks);
+	db->destroyQuery(q_get_max_pack);
+	db->destroyQuery(q_get_image);
+	db->destroyQuery(q_set_image);
+	db->destroyQuery(q_del_image);
+	db->destroyQuery(q_add_ref);
+	db->destroyQuery(q_get_refs);
+	db->destroyQuery(q_has_refs);
+	db->destroyQuery(q_del_refs);
+}
+
+void ImageBlockStore::init_mutex()
+{
+	mutex = Server->createMutex();
+}
+
+bool ImageBlockStore::isEnabled()
+{
+	return Server->getServerParameter("image_block_store") == "true";
+}
+
+bool ImageBlockStore::addImage(const std::string& imagefn, const std::string& parent_imagefn, int64 data_offset, int64 hash_blocksize)
+{
+	if (hash_blocksize != block_size)
+	{
+		ServerLogger::Log(logid, "Image hash block size " + convert(hash_blocksize) + " not supported by image block store", LL_WARNING);
+		return false;
+	}
+
+	std::auto_ptr<IFsFile> image(Server->openFile(os_file_prefix(imagefn), MODE_RW));
+	if (image.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening image \"" + imagefn + "\" for adding it to the image block store. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	std::auto_ptr<IFile> hashfile(Server->openFile(os_file_prefix(imagefn + ".hash"), MODE_READ));
+	if (hashfile.get() == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening hash file of image \"" + imagefn + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	std::auto_ptr<IFile> parent_hashfile;
+	if (!parent_imagefn.empty())
+	{
+		parent_hashfile.reset(Server->openFile(os_file_prefix(parent_imagefn + ".hash"), MODE_READ));
+	}
+
+	if (!os_create_dir_recursive(os_file_prefix(storefolder)))
+	{
+		ServerLogger::Log(logid, "Error creating image block store folder \"" + storefolder + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	//Only whole blocks are added. The number of processed hashes is stored
+	//and removeImage() releases exactly those, so both use the same bound
+	int64 num_hashes = (std::min)(hashfile->Size() / sha_size,
+		(std::max)(static_cast<int64>(0), image->Size() - data_offset) / hash_blocksize);
+	int64 stored_bytes = 0;
+	int64 dedup_bytes = 0;
+	bool ret = true;
+
+	char hash[sha_size];
+	char parent_hash[sha_size];
+
+	ServerLogger::Log(logid, "Adding image to image block store...", LL_INFO);
+
+	db->BeginWriteTransaction();
+	q_del_refs->Bind(imagefn);
+	q_del_refs->Write();
+	q_del_refs->Reset();
+	setImageBlocks(imagefn, 0);
+	db->EndTransaction();
+
+	//The clone I/O of a batch runs outside of any database transaction. The
+	//store mutex is held until the batch is committed, so no other image can
+	//add or release its blocks in between.
+	std::map<std::string, SBlockChange> changes;
+	std::vector<std::pair<int64, std::string> > refs;
+
+	int64 i = 0;
+	while (ret && i < num_hashes)
+	{
+		IScopedLock lock(mutex);
+
+		changes.clear();
+		refs.clear();
+
+		int64 batch_end = (std::min)(num_hashes, i + commit_blocks);
+		for (; i < batch_end; ++i)
+		{
+			if (hashfile->Read(i*sha_size, hash, sha_size) != sha_size)
+			{
+				ServerLogger::Log(logid, "Error reading from hash file of image \"" + imagefn + "\". " + os_last_error_str(), LL_ERROR);
+				ret = false;
+				break;
+			}
+
+			int64 image_offset = data_offset + i*hash_blocksize;
+
+			if (memcmp(hash, zero_hash, sha_size) == 0)
+			{
+				continue;
+			}
+
+			bool same_as_parent = parent_hashfile.get() != NULL
+				&& parent_hashfile->Read(i*sha_size, parent_hash, sha_size) == sha_size
+				&& memcmp(hash, parent_hash, sha_size) == 0;
+
+			std::string hash_str(hash, sha_size);
+			std::map<std::string, SBlockChange>::iterator it = changes.find(hash_str);
+
+			SBlock block;
+			if (it != changes.end())
+			{
+				block.exists = true;
+				block.pack = it->second.pack;
+				block.offset = it->second.offset;
+			}
+			else
+			{
+				block = getBlock(hash);
+			}
+
+			if (block.exists)
+			{
+				//Blocks unchanged from the parent already share their extents with it
+				if (!same_as_parent)
+				{
+					IFsFile* pack = getPackFile(block.pack);
+					if (pack == NULL
+						|| !os_clone_range(pack, block.offset, image.get(), image_offset, hash_blocksize))
+					{
+						ServerLogger::Log(logid, "Error cloning block from image block store into \"" + imagefn + "\". " + os_last_error_str(), LL_WARNING);
+						ret = false;
+						break;
+					}
+
+					dedup_bytes += hash_blocksize;
+				}
+
+				if (it == changes.end())
+				{
+					SBlockChange change = { false, block.pack, block.offset, 0 };
+					it = changes.insert(std::make_pair(hash_str, change)).first;
+				}
+				++it->second.add_refs;
+			}
+			else
+			{
+				SBlockChange change = { true, 0, 0, 0 };
+				if (!storeBlock(image.get(), image_offset, hash_blocksize, change.pack, change.offset))
+				{
+					ret = false;
+					break;
+				}
+
+				changes[hash_str] = change;
+				stored_bytes += hash_blocksize;
+			}
+
+			refs.push_back(std::make_pair(i, hash_str));
+		}
+
+		if (!commitBlocks(imagefn, changes, refs, i))
+		{
+			ServerLogger::Log(logid, "Error committing image block store references of image \"" + imagefn + "\"", LL_ERROR);
+			ret = false;
+		}
+	}
+
+	ServerLogger::Log(logid, "Image block store: " + PrettyPrintBytes(dedup_bytes) + " deduplicated, "
+		+ PrettyPrintBytes(stored_bytes) + " new", LL_INFO);
+
+	return ret;
+}
+
+bool ImageBlockStore::removeImage(const std::string& imagefn)
+{
+	q_get_image->Bind(imagefn);
+	db_results res = q_get_image->Read();
+	q_get_image->Reset();
+
+	if (res.empty())
+	{
+		return true;
+	}
+
+	int64 num_blocks = watoi64(res[0]["num_blocks"]);
+
+	q_has_refs->Bind(imagefn);
+	bool has_refs = !q_has_refs->Read().empty();
+	q_has_refs->Reset();
+
+	//Images added before the references were stored are released via their hash file
+	std::auto_ptr<IFile> hashfile;
+	if (!has_refs)
+	{
+		hashfile.reset(Server->openFile(os_file_prefix(imagefn + ".hash"), MODE_READ));
+		if (hashfile.get() == NULL
+			&& num_blocks > 0)
+		{
+			ServerLogger::Log(logid, "Error opening hash file of image \"" + imagefn + "\" for removing it from the image block store. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+	}
+
+	char hash[sha_size];
+
+	for (int64 i = 0; i < num_blocks; i += commit_blocks)
+	{
+		int64 batch_end = (std::min)(num_blocks, i + commit_blocks);
+
+		IScopedLock lock(mutex);
+		db->BeginWriteTransaction();
+
+		if (has_refs)
+		{
+			q_get_refs->Bind(imagefn);
+			q_get_refs->Bind(i);
+			q_get_refs->Bind(batch_end);
+			db_results res_refs = q_get_refs->Read();
+			q_get_refs->Reset();
+
+			for (size_t j = 0; j < res_refs.size(); ++j)
+			{
+				const std::string& ref_hash = res_refs[j]["hash"];
+				if (ref_hash.size() == sha_size)
+				{
+					releaseBlock(ref_hash.data());
+				}
+			}
+		}
+		else
+		{
+			for (int64 k = i; k < batch_end; ++k)
+			{
+				if (hashfile->Read(k*sha_size, hash, sha_size) != sha_size)
+				{
+					break;
+				}
+
+				if (memcmp(hash, zero_hash, sha_size) != 0)
+				{
+					releaseBlock(hash);
+				}
+			}
+		}
+
+		db->EndTransaction();
+	}
+
+	db->BeginWriteTransaction();
+	q_del_image->Bind(imagefn);
+	q_del_image->Write();
+	q_del_image->Reset();
+	q_del_refs->Bind(imagefn);
+	q_del_refs->Write();
+	q_del_refs->Reset();
+	db->EndTransaction();
+
+	return true;
+}
+
+ImageBlockStore::SBlock ImageBlockStore::getBlock(const char* hash)
+{
+	q_get_block->Bind(hash, sha_size);
+	db_results res = q_get_block->Read();
+	q_get_block->Reset();
+
+	SBlock ret = { false, 0, 0, 0 };
+	if (!res.empty())
+	{
+		ret.exists = true;
+		ret.pack = watoi64(res[0]["pack"]);
+		ret.offset = watoi64(res[0]["offset"]);
+		ret.refcount = watoi64(res[0]["refcount"]);
+	}
+	return ret;
+}
+
+std::string ImageBlockStore::getPackFn(int64 pack)
+{
+	return storefolder + os_file_sep() + "pack_" + convert(pack);
+}
+
+IFsFile* ImageBlockStore::getPackFile(int64 pack)
+{
+	std::map<int64, IFsFile*>::iterator it = pack_files.find(pack);
+	if (it != pack_files.end())
+	{
+		return it->second;
+	}
+
+	IFsFile* ret = Server->openFile(os_file_prefix(getPackFn(pack)), MODE_RW_CREATE);
+	if (ret == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening image block store pack file \"" + getPackFn(pack) + "\". " + os_last_error_str(), LL_ERROR);
+		return NULL;
+	}
+
+	pack_files[pack] = ret;
+	return ret;
+}
+
+bool ImageBlockStore::storeBlock(IFsFile* image, int64 image_offset, int64 size, int64& pack_id, int64& pack_offset)
+{
+	if (curr_pack == -1)
+	{
+		db_results res = q_get_max_pack->Read();
+		q_get_max_pack->Reset();
+
+		curr_pack = 0;
+		if (!res.empty() && !res[0]["pack"].empty())
+		{
+			curr_pack = watoi64(res[0]["pack"]);
+		}
+	}
+
+	IFsFile* pack = getPackFile(curr_pack);
+	if (pack == NULL)
+	{
+		return false;
+	}
+
+	int64 offset = pack->Size();
+
+	if (offset + size > pack_max_size)
+	{
+		++curr_pack;
+		pack = getPackFile(curr_pack);
+		if (pack == NULL)
+		{
+			return false;
+		}
+		offset = pack->Size();
+	}
+
+	if (!os_clone_range(image, image_offset, pack, offset, size))
+	{
+		ServerLogger::Log(logid, "Error cloning block into image block store pack file \"" + pack->getFilename() + "\". "
+			"The backup storage probably does not support reflinks. " + os_last_error_str(), LL_WARNING);
+		return false;
+	}
+
+	pack_id = curr_pack;
+	pack_offset = offset;
+
+	return true;
+}
+
+bool ImageBlockStore::commitBlocks(const std::string& imagefn, const std::map<std::string, SBlockChange>& changes,
+	const std::vector<std::pair<int64, std::string> >& refs, int64 num_blocks)
+{
+	bool ret = db->BeginWriteTransaction();
+
+	for (std::map<std::string, SBlockChange>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+	{
+		if (it->second.is_new)
+		{
+			//Inserted with one reference
+			q_add_block->Bind(it->first.data(), sha_size);
+			q_add_block->Bind(it->second.pack);
+			q_add_block->Bind(it->second.offset);
+			ret &= q_add_block->Write();
+			q_add_block->Reset();
+		}
+
+		if (it->second.add_refs > 0)
+		{
+			q_change_refcount->Bind(it->second.add_refs);
+			q_change_refcount->Bind(it->first.data(), sha_size);
+			ret &= q_change_refcount->Write();
+			q_change_refcount->Reset();
+		}
+	}
+
+	for (size_t i = 0; i < refs.size(); ++i)
+	{
+		q_add_ref->Bind(imagefn);
+		q_add_ref->Bind(refs[i].first);
+		q_add_ref->Bind(refs[i].second.data(), sha_size);
+		ret &= q_add_ref->Write();
+		q_add_ref->Reset();
+	}
+
+	setImageBlocks(imagefn, num_blocks);
+
+	return db->EndTransaction() && ret;
+}
+
+void ImageBlockStore::releaseBlock(const char* hash)
+{
+	SBlock block = getBlock(hash);
+
+	if (!block.exists)
+	{
+		return;
+	}
+
+	if (block.refcount > 1)
+	{
+		q_change_refcount->Bind(-1);
+		q_change_refcount->Bind(hash, sha_size);
+		q_change_refcount->Write();
+		q_change_refcount->Reset();
+		return;
+	}
+
+	q_del_block->Bind(hash, sha_size);
+	q_del_block->Write();
+	q_del_block->Reset();
+
+	q_has_pack_blocks->Bind(block.pack);
+	db_results res = q_has_pack_blocks->Read();
+	q_has_pack_blocks->Reset();
+
+	if (res.empty()
+		&& block.pack != curr_pack)
+	{
+		std::map<int64, IFsFile*>::iterator it = pack_files.find(block.pack);
+		if (it != pack_files.end())
+		{
+			Server->destroy(it->second);
+			pack_files.erase(it);
+		}
+
+		Server->deleteFile(os_file_prefix(getPackFn(block.pack)));
+		return;
+	}
+
+	IFsFile* pack = getPackFile(block.pack);
+	if (pack != NULL
+		&& !pack->PunchHole(block.offset, block_size))
+	{
+		ServerLogger::Log(logid, "Error freeing block in image block store pack file \"" + pack->getFilename() + "\". " + os_last_error_str(), LL_WARNING);
+	}
+}
+
+void ImageBlockStore::setImageBlocks(const std::string& imagefn, int64 num_blocks)
+{
+	q_set_image->Bind(imagefn);
+	q_set_image->Bind(num_blocks);
+	q_set_image->Write();
+	q_set_image->Reset();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../Interface/Database.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/File.h"
+#include "server_log.h"
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+* Server wide content addressed store for image backup blocks.
+* Blocks are identified by the per 512KB SHA256 hashes of the image .hash files
+* and kept in large pack files. Images share their blocks with the pack files
+* via reflinks, so image files stay normal raw files that can be read as before.
+*/
+class ImageBlockStore
+{
+public:
+	ImageBlockStore(IDatabase* db, const std::string& backupfolder, logid_t logid);
+	~ImageBlockStore();
+
+	static void init_mutex();
+	static bool isEnabled();
+
+	bool addImage(const std::string& imagefn, const std::string& parent_imagefn, int64 data_offset, int64 hash_blocksize);
+	bool removeImage(const std::string& imagefn);
+
+private:
+	struct SBlock
+	{
+		bool exists;
+		int64 pack;
+		int64 offset;
+		int64 refcount;
+	};
+
+	struct SBlockChange
+	{
+		bool is_new;
+		int64 pack;
+		int64 offset;
+		int64 add_refs;
+	};
+
+	SBlock getBlock(const char* hash);
+	IFsFile* getPackFile(int64 pack);
+	std::string getPackFn(int64 pack);
+	bool storeBlock(IFsFile* image, int64 image_offset, int64 size, int64& pack_id, int64& pack_offset);
+	bool commitBlocks(const std::string& imagefn, const std::map<std::string, SBlockChange>& changes,
+		const std::vector<std::pair<int64, std::string> >& refs, int64 num_blocks);
+	void releaseBlock(const char* hash);
+	void setImageBlocks(const std::string& imagefn, int64 num_blocks);
+
+	IDatabase* db;
+	std::string storefolder;
+	logid_t logid;
+
+	std::map<int64, IFsFile*> pack_files;
+
+	IQuery* q_get_block;
+	IQuery* q_add_block;
+	IQuery* q_change_refcount;
+	IQuery* q_del_block;
+	IQuery* q_has_pack_blocks;
+	IQuery* q_get_max_pack;
+	IQuery* q_get_image;
+	IQuery* q_set_image;
+	IQuery* q_del_image;
+	IQuery* q_add_ref;
+	IQuery* q_get_refs;
+	IQuery* q_has_refs;
+	IQuery* q_del_refs;
+
+	static IMutex* mutex;
+	static int64 curr_pack;
+};
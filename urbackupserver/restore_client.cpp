@@ -32,6 +32,7 @@
 #include "dao/ServerBackupDao.h"
 #include "dao/ServerCleanupDao.h"
 #include "server.h"
+#include "HashContainer.h"
 
 extern IFileServ* fileserv;
 
@@ -59,7 +60,7 @@ namespace
 		std::string orig_path_add = ExtractFileName(cp, os_file_sep());
 		FileMetadata parent_metadata;
 		while (!(cp = ExtractFilePath(cp, os_file_sep())).empty()
-			&& read_metadata(cp + os_file_sep() + metadata_dir_fn, parent_metadata))
+			&& HashContainer::readMetadata(cp + os_file_sep() + metadata_dir_fn, parent_metadata))
 		{
 			if (!parent_metadata.orig_path.empty())
 			{
@@ -108,7 +109,7 @@ namespace
 				}
 			}
 
-			std::auto_ptr<IFile> metadata_file(Server->openFile(os_file_prefix(metadata_path), MODE_READ));
+			std::auto_ptr<IFile> metadata_file(HashContainer::openHashFile(metadata_path));
 
 			if(metadata_file.get()==NULL)
 			{
@@ -406,7 +407,7 @@ namespace
 				bool has_metadata = false;
 
 				FileMetadata metadata;
-				if(!read_metadata(metadatasource, metadata))
+				if(!HashContainer::readMetadata(metadatasource, metadata))
 				{
 					ServerLogger::Log(log_id, "Cannot read file metadata of file "+filename+" from "+ metadatasource +". Cannot start restore.", LL_ERROR);
 					return false;
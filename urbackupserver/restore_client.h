@@ -8,6 +8,7 @@
 namespace
 {
 	const int64 restore_flag_ignore_permissions = 1 << 6;
+	const int64 restore_flag_local_reuse = 1 << 7;
 }
 
 bool create_clientdl_thread(const std::string& curr_clientname, int curr_clientid, int restore_clientid, std::string foldername, std::string hashfoldername,
@@ -36,12 +36,11 @@
 #include <memory.h>
 #include <algorithm>
 #include "ThrottleUpdater.h"
+#include "BandwidthScheduler.h"
 #include "../fsimageplugin/IFSImageFactory.h"
 
 const int max_offline=5;
 
-IPipeThrottler *BackupServer::global_internet_throttler=NULL;
-IPipeThrottler *BackupServer::global_local_throttler=NULL;
 IMutex *BackupServer::throttle_mutex=NULL;
 bool BackupServer::file_snapshots_enabled=false;
 bool BackupServer::image_snapshots_enabled = false;
@@ -651,68 +650,9 @@ size_t BackupServer::throttleSpeedToBps(int speed_bps, bool & percent_max)
 	return bps;
 }
 
-IPipeThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
-{
-	IScopedLock lock(throttle_mutex);
-
-	if(global_internet_throttler==NULL 
-		&& (speed_bps == 0
-			|| speed_bps == -1) )
-	{
-		return NULL;
-	}
-
-	if(global_internet_throttler==NULL)
-	{
-		global_internet_throttler=Server->createPipeThrottler(
-			new ThrottleUpdater(-1, ThrottleScope_GlobalInternet));
-	}
-	else
-	{
-		bool percent_max;
-		size_t bps = BackupServer::throttleSpeedToBps(speed_bps, percent_max);
-		global_internet_throttler->changeThrottleLimit(bps,
-			percent_max);
-	}
-	return global_internet_throttler;
-}
-
-IPipeThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
-{
-	IScopedLock lock(throttle_mutex);
-
-	if (global_local_throttler == NULL
-		&& (speed_bps == 0
-			|| speed_bps == -1) )
-	{
-		return NULL;
-	}
-
-	if(global_local_throttler==NULL)
-	{
-		global_local_throttler=Server->createPipeThrottler(
-			new ThrottleUpdater(-1, ThrottleScope_GlobalLocal));
-	}
-	else
-	{
-		bool percent_max;
-		size_t bps = BackupServer::throttleSpeedToBps(speed_bps, percent_max);
-		global_local_throttler->changeThrottleLimit(bps,
-			percent_max);
-	}
-	return global_local_throttler;
-}
-
 void BackupServer::cleanupThrottlers(void)
 {
-	if(global_internet_throttler!=NULL)
-	{
-		Server->destroy(global_internet_throttler);
-	}
-	if(global_local_throttler!=NULL)
-	{
-		Server->destroy(global_local_throttler);
-	}
+	BandwidthScheduler::destroy();
 }
 
 bool BackupServer::isFileSnapshotsEnabled()
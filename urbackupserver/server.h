@@ -29,8 +29,6 @@ public:
 	void operator()(void);
 
 	static size_t throttleSpeedToBps(int speed_bps, bool& percent_max);
-	static IPipeThrottler *getGlobalInternetThrottler(int speed_bps);
-	static IPipeThrottler *getGlobalLocalThrottler(int speed_bps);
 
 	static void cleanupThrottlers(void);
 
@@ -99,8 +97,6 @@ private:
 
 	IPipe *exitpipe;
 
-	static IPipeThrottler *global_internet_throttler;
-	static IPipeThrottler *global_local_throttler;
 	static IMutex *throttle_mutex;
 
 	bool internet_only_mode;
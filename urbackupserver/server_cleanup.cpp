@@ -42,7 +42,10 @@
 #include <algorithm>
 #include "create_files_index.h"
 #include "../urbackupcommon/WalCheckpointThread.h"
+#include "image_block_store.h"
 #include "copy_storage.h"
+#include "HashContainer.h"
+#include "PathIndex.h"
 #include <assert.h>
 #include <set>
 
@@ -522,217 +525,277 @@ bool ServerCleanupThread::do_cleanup(int64 minspace, bool do_cleanup_other)
 	return success;
 }
 
-void ServerCleanupThread::do_remove_unknown(void)
+struct SRemoveUnknownScan
 {
-	ServerSettings settings(db);
+	ServerCleanupDao::SClientInfo client;
+	std::vector<ServerCleanupDao::SFileBackupInfo> file_backups;
+	std::vector<ServerCleanupDao::SImageBackupInfo> image_backups;
 
-	replay_directory_link_journal();
+	std::vector<size_t> missing_file_backups;
+	std::vector<size_t> missing_image_backups;
+	std::vector<SFile> files;
+	std::map<std::string, std::vector<SFile> > image_dir_files;
 
-	ServerLinkDao link_dao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_LINKS));
-
-	std::string backupfolder=settings.getSettings()->backupfolder;
+	std::vector<std::string> backup_paths;
+	std::vector<std::string> image_names;
+};
 
-	std::vector<ServerCleanupDao::SClientInfo> res_clients=cleanupdao->getClients();
-
-	for(size_t i=0;i<res_clients.size();++i)
+namespace
+{
+	bool client_info_id_less(const ServerCleanupDao::SClientInfo& a, const ServerCleanupDao::SClientInfo& b)
 	{
-		int clientid=res_clients[i].id;
-		const std::string& clientname=res_clients[i].name;
+		return a.id < b.id;
+	}
 
-		Server->Log("Removing unknown for client \""+clientname+"\"");
+	class RemoveUnknownScanThread : public IThread
+	{
+	public:
+		RemoveUnknownScanThread(const std::string& backupfolder, std::vector<SRemoveUnknownScan>& scans,
+			IMutex* mutex, size_t& next_scan, bool background_prio)
+			: backupfolder(backupfolder), scans(scans), mutex(mutex),
+			next_scan(next_scan), background_prio(background_prio)
+		{}
 
-		std::vector<ServerCleanupDao::SFileBackupInfo> res_file_backups=cleanupdao->getFileBackupsOfClient(clientid);
+		virtual ~RemoveUnknownScanThread() {}
 
-		for(size_t j=0;j<res_file_backups.size();++j)
+		void operator()()
 		{
-			std::string backup_path=backupfolder+os_file_sep()+clientname+os_file_sep()+res_file_backups[j].path;
-			int backupid=res_file_backups[j].id;
-			if(!os_directory_exists(backup_path))
-			{
-				Server->Log("Path for file backup [id="+convert(res_file_backups[j].id)+" path="+res_file_backups[j].path+" clientname="+clientname+"] does not exist. Deleting it from the database.", LL_WARNING);
+			ScopedBackgroundPrio scoped_background_prio(background_prio);
 
-				removeFileBackupSql(backupid);
+			while (true)
+			{
+				SRemoveUnknownScan* scan;
+				{
+					IScopedLock lock(mutex);
+					if (next_scan >= scans.size())
+					{
+						return;
+					}
+					scan = &scans[next_scan++];
+				}
 
+				scanClient(*scan);
 			}
 		}
 
-		std::vector<ServerCleanupDao::SImageBackupInfo> res_image_backups=cleanupdao->getImageBackupsOfClient(clientid);
-
-		for(size_t j=0;j<res_image_backups.size();++j)
+	private:
+		void scanClient(SRemoveUnknownScan& scan)
 		{
-			std::string backup_path=res_image_backups[j].path;
+			std::string client_path = backupfolder + os_file_sep() + scan.client.name;
 
-			IFile *tf=Server->openFile(os_file_prefix(backup_path), MODE_READ);
-			if(tf==NULL)
+			for (size_t j = 0; j < scan.file_backups.size(); ++j)
 			{
-				Server->Log("Image backup [id="+convert(res_image_backups[j].id)+" path="+res_image_backups[j].path+" clientname="+clientname+"] does not exist. Deleting it from the database.", LL_WARNING);
-				cleanupdao->removeImage(res_image_backups[j].id);
+				if (!os_directory_exists(client_path + os_file_sep() + scan.file_backups[j].path))
+				{
+					scan.missing_file_backups.push_back(j);
+				}
 			}
-			else
+
+			for (size_t j = 0; j < scan.image_backups.size(); ++j)
 			{
-				Server->destroy(tf);
+				IFile *tf = Server->openFile(os_file_prefix(scan.image_backups[j].path), MODE_READ);
+				if (tf == NULL)
+				{
+					scan.missing_image_backups.push_back(j);
+				}
+				else
+				{
+					Server->destroy(tf);
+				}
 			}
-		}
 
-		cleanup_system_images(clientid, clientname, settings);
+			scan.files = getFiles(client_path, NULL);
+			std::sort(scan.files.begin(), scan.files.end());
 
+			for (size_t j = 0; j < scan.files.size(); ++j)
+			{
+				const SFile& cf = scan.files[j];
+				if ( (cf.isdir
+						|| cf.name.find(".") == std::string::npos)
+					&& cf.name.find("Image") != std::string::npos)
+				{
+					scan.image_dir_files[cf.name] = getFiles(client_path + os_file_sep() + cf.name);
+				}
+			}
+		}
 
-		std::vector<SFile> files=getFiles(backupfolder+os_file_sep()+clientname, NULL);
-		std::vector<ServerCleanupDao::SImageBackupInfo> res_images=cleanupdao->getClientImages(clientid);
+		std::string backupfolder;
+		std::vector<SRemoveUnknownScan>& scans;
+		IMutex* mutex;
+		size_t& next_scan;
+		bool background_prio;
+	};
+}
 
-		for(size_t j=0;j<files.size();++j)
-		{
-			SFile cf=files[j];
+//Deletes the unknown backups of the scanned clients and checks their
+//directory pools. Clients have disjoint folders and link entries.
+class RemoveUnknownDeleteThread : public IThread
+{
+public:
+	RemoveUnknownDeleteThread(ServerCleanupThread* cleanup_thread, const std::string& backupfolder,
+		std::vector<SRemoveUnknownScan>& scans, IMutex* mutex, size_t& next_scan, bool background_prio)
+		: cleanup_thread(cleanup_thread), backupfolder(backupfolder), scans(scans), mutex(mutex),
+		next_scan(next_scan), background_prio(background_prio)
+	{}
 
-			if(cf.name=="current")
-				continue;
+	virtual ~RemoveUnknownDeleteThread() {}
 
-			if(cf.name==".directory_pool")
-				continue;
+	void operator()()
+	{
+		{
+			ScopedBackgroundPrio scoped_background_prio(background_prio);
+			ServerLinkDao link_dao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_LINKS));
 
-			if(cf.isdir
-				|| ( !cf.isdir 
-						&& cf.name.find(".")==std::string::npos ) )
+			while (true)
 			{
-				if (cf.name.find("Image") == std::string::npos)
+				SRemoveUnknownScan* scan;
 				{
-					ServerCleanupDao::CondInt res_id = cleanupdao->findFileBackup(clientid, cf.name);
-
-					if (!res_id.exists)
+					IScopedLock lock(mutex);
+					if (next_scan >= scans.size())
 					{
-						Server->Log("File backup \"" + cf.name + "\" of client \"" + clientname + "\" not found in database. Deleting it.", LL_WARNING);
-						bool remove_folder = false;
-						if (!cf.isdir)
-						{
-							SnapshotHelper::removeFilesystem(false, clientname, cf.name);
-							Server->deleteFile(os_file_prefix(backupfolder
-								+ os_file_sep() + clientname + os_file_sep() + cf.name));
-						}
-						else if (BackupServer::isFileSnapshotsEnabled())
-						{
-							if (!SnapshotHelper::removeFilesystem(false, clientname, cf.name))
-							{
-								remove_folder = true;
-							}
-						}
-						else
-						{
-							remove_folder = true;
-						}
-
-						if (remove_folder)
-						{
-							std::string rm_dir = backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name;
-							if (!remove_directory_link_dir(rm_dir, link_dao, clientid))
-							{
-								Server->Log("Could not delete directory \"" + rm_dir + "\"", LL_ERROR);
-							}
-						}
+						break;
 					}
+					scan = &scans[next_scan++];
 				}
-				else
-				{
-					std::vector<SFile> image_files = getFiles(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name);
 
-					bool found_image = false;
-					for (size_t l = 0; l < image_files.size(); ++l)
-					{
-						std::string extension = findextension(image_files[l].name);
+				cleanup_thread->remove_unknown_client_files(*scan, backupfolder, link_dao);
+				cleanup_thread->check_symlinks(scan->client, backupfolder, false);
+			}
+		}
 
-						if (extension != "vhd" && extension != "vhdz" && extension != "raw")
-							continue;
+		Server->destroyDatabases(Server->getThreadID());
+	}
 
-						found_image = true;
+private:
+	ServerCleanupThread* cleanup_thread;
+	std::string backupfolder;
+	std::vector<SRemoveUnknownScan>& scans;
+	IMutex* mutex;
+	size_t& next_scan;
+	bool background_prio;
+};
 
-						bool found = false;
+void ServerCleanupThread::do_remove_unknown(void)
+{
+	ServerSettings settings(db);
 
-						for (size_t k = 0; k<res_images.size(); ++k)
-						{
-							if (ExtractFileName(res_images[k].path) == image_files[l].name)
-							{
-								found = true;
-								break;
-							}
-						}
+	replay_directory_link_journal();
 
-						if (!found)
-						{
-							Server->Log("Image backup \"" + cf.name + "\" of client \"" + clientname + "\" not found in database. Deleting it.", LL_WARNING);
-							
-							if (extension == "raw")
-							{
-								SnapshotHelper::removeFilesystem(true, clientname, cf.name);
-							}
-							else
-							{
-								os_remove_nonempty_dir(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
-							}
-						}
-					}
+	//Read only from the delete workers
+	load_old_backupfolders();
 
-					if (!found_image)
-					{
-						if (!cf.isdir)
-						{
-							SnapshotHelper::removeFilesystem(true, clientname, cf.name);
-							Server->deleteFile(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
-						}
-						else
-						{
-							os_remove_nonempty_dir(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
+	std::string backupfolder=settings.getSettings()->backupfolder;
 
-							if(os_directory_exists(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name))
-								&& BackupServer::isImageSnapshotsEnabled() )
-							{
-								SnapshotHelper::removeFilesystem(true, clientname, cf.name);
-							}
-						}
-					}
-				}
-			}
-			else
-			{
-				std::string extension=findextension(cf.name);
+	std::vector<ServerCleanupDao::SClientInfo> res_clients=cleanupdao->getClients();
+	std::sort(res_clients.begin(), res_clients.end(), client_info_id_less);
 
-				if(extension!="vhd" && extension!="vhdz" && extension!="raw")
-					continue;
+	int resume_clientid = 0;
+	ServerBackupDao::CondString progress = backupdao->getMiscValue("remove_unknown_progress");
+	if (progress.exists)
+	{
+		resume_clientid = watoi(progress.value);
+		Server->Log("Resuming removal of unknown files after client with id " + convert(resume_clientid), LL_INFO);
+	}
 
-				bool found=false;
+	size_t scan_threads = 4;
+	std::string str_scan_threads = Server->getServerParameter("remove_unknown_threads");
+	if (!str_scan_threads.empty())
+	{
+		scan_threads = (std::max)(1, watoi(str_scan_threads));
+	}
 
-				for(size_t k=0;k<res_images.size();++k)
-				{
-					if(ExtractFileName(res_images[k].path)==cf.name)
-					{
-						found=true;
-						break;
-					}
-				}
+	bool background_prio = Server->getServerParameter("remove_unknown_background_prio") != "false";
+	int64 time_limit = watoi64(Server->getServerParameter("remove_unknown_time_limit")) * 1000;
+	int64 starttime = Server->getTimeMS();
 
-				if(!found)
-				{
-					Server->Log("Image backup \""+cf.name+"\" of client \""+clientname+"\" not found in database. Deleting it.", LL_WARNING);
-					std::string rm_file=backupfolder+os_file_sep()+clientname+os_file_sep()+cf.name;
-					if(!Server->deleteFile(rm_file))
-					{
-						Server->Log("Could not delete file \""+rm_file+"\"", LL_ERROR);
-					}
-					if(!Server->deleteFile(rm_file+".mbr"))
-					{
-						Server->Log("Could not delete file \""+rm_file+".mbr\"", LL_ERROR);
-					}
-					if(!Server->deleteFile(rm_file+".hash"))
-					{
-						Server->Log("Could not delete file \""+rm_file+".hash\"", LL_ERROR);
-					}
-					Server->deleteFile(rm_file+".bitmap");
-					Server->deleteFile(rm_file+".cbitmap");
-					Server->deleteFile(rm_file + ".sync");
-				}
+	ScopedBackgroundPrio scoped_background_prio(background_prio);
+
+	IMutex* scan_mutex = Server->createMutex();
+
+	bool complete = true;
+	size_t i = 0;
+	while (i < res_clients.size())
+	{
+		std::vector<SRemoveUnknownScan> scans;
+		for (; i < res_clients.size() && scans.size() < scan_threads * 4; ++i)
+		{
+			if (res_clients[i].id <= resume_clientid)
+			{
+				continue;
 			}
+
+			SRemoveUnknownScan scan;
+			scan.client = res_clients[i];
+			scan.file_backups = cleanupdao->getFileBackupsOfClient(res_clients[i].id);
+			scan.image_backups = cleanupdao->getImageBackupsOfClient(res_clients[i].id);
+			scans.push_back(scan);
+		}
+
+		if (scans.empty())
+		{
+			continue;
+		}
+
+		size_t next_scan = 0;
+		std::vector<RemoveUnknownScanThread*> scan_workers;
+		std::vector<THREADPOOL_TICKET> scan_tickets;
+		for (size_t j = 0; j < (std::min)(scan_threads, scans.size()); ++j)
+		{
+			scan_workers.push_back(new RemoveUnknownScanThread(backupfolder, scans, scan_mutex, next_scan, background_prio));
+			scan_tickets.push_back(Server->getThreadPool()->execute(scan_workers[j], "remove unknown scan"));
+		}
+
+		Server->getThreadPool()->waitFor(scan_tickets);
+
+		for (size_t j = 0; j < scan_workers.size(); ++j)
+		{
+			delete scan_workers[j];
+		}
+
+		for (size_t j = 0; j < scans.size(); ++j)
+		{
+			remove_unknown_client(scans[j], settings);
 		}
-		check_symlinks(res_clients[i], backupfolder, false);
+
+		next_scan = 0;
+		std::vector<RemoveUnknownDeleteThread*> delete_workers;
+		std::vector<THREADPOOL_TICKET> delete_tickets;
+		for (size_t j = 0; j < (std::min)(scan_threads, scans.size()); ++j)
+		{
+			delete_workers.push_back(new RemoveUnknownDeleteThread(this, backupfolder, scans, scan_mutex, next_scan, background_prio));
+			delete_tickets.push_back(Server->getThreadPool()->execute(delete_workers[j], "remove unknown delete"));
+		}
+
+		Server->getThreadPool()->waitFor(delete_tickets);
+
+		for (size_t j = 0; j < delete_workers.size(); ++j)
+		{
+			delete delete_workers[j];
+		}
+
+		backupdao->delMiscValue("remove_unknown_progress");
+		backupdao->addMiscValue("remove_unknown_progress", convert(scans.back().client.id));
+
+		if ( (time_limit > 0
+				&& Server->getTimeMS() - starttime > time_limit)
+			|| do_quit )
+		{
+			complete = false;
+			break;
+		}
+	}
+
+	Server->destroy(scan_mutex);
+
+	if (!complete
+		&& i < res_clients.size())
+	{
+		Server->Log("Stopping removal of unknown files. It continues with the next client on the next run.", LL_INFO);
+		return;
 	}
 
+	backupdao->delMiscValue("remove_unknown_progress");
+
 	Server->Log("Removing dangling file entries...", LL_INFO);
 
 	IQuery* q_backup_ids = db->Prepare("SELECT id FROM backups", false);
@@ -760,6 +823,7 @@ void ServerCleanupThread::do_remove_unknown(void)
 	{
 		filesdao->removeDanglingFiles();
 		Server->Log("Deleted " + convert(files_db->getLastChanges()) + " file entries", LL_INFO);
+		filesdao->removeDanglingFileChunks();
 	}
 
 	files_db->Write("DROP TABLE backups");
@@ -767,6 +831,188 @@ void ServerCleanupThread::do_remove_unknown(void)
 	FileIndex::flush();
 }
 
+void ServerCleanupThread::remove_unknown_client(SRemoveUnknownScan& scan, ServerSettings& settings)
+{
+	int clientid=scan.client.id;
+	const std::string& clientname=scan.client.name;
+
+	Server->Log("Removing unknown for client \""+clientname+"\"");
+
+	for(size_t j=0;j<scan.missing_file_backups.size();++j)
+	{
+		const ServerCleanupDao::SFileBackupInfo& backup=scan.file_backups[scan.missing_file_backups[j]];
+		Server->Log("Path for file backup [id="+convert(backup.id)+" path="+backup.path+" clientname="+clientname+"] does not exist. Deleting it from the database.", LL_WARNING);
+
+		removeFileBackupSql(backup.id);
+	}
+
+	for(size_t j=0;j<scan.missing_image_backups.size();++j)
+	{
+		const ServerCleanupDao::SImageBackupInfo& backup=scan.image_backups[scan.missing_image_backups[j]];
+		Server->Log("Image backup [id="+convert(backup.id)+" path="+backup.path+" clientname="+clientname+"] does not exist. Deleting it from the database.", LL_WARNING);
+		cleanupdao->removeImage(backup.id);
+	}
+
+	cleanup_system_images(clientid, clientname, settings);
+
+	//The directory listing is compared with the sorted backup lists from the
+	//database by the delete workers
+	std::vector<ServerCleanupDao::SFileBackupInfo> res_file_backups=cleanupdao->getFileBackupsOfClient(clientid);
+	for(size_t j=0;j<res_file_backups.size();++j)
+	{
+		scan.backup_paths.push_back(res_file_backups[j].path);
+	}
+	std::sort(scan.backup_paths.begin(), scan.backup_paths.end());
+
+	std::vector<ServerCleanupDao::SImageBackupInfo> res_images=cleanupdao->getClientImages(clientid);
+	for(size_t j=0;j<res_images.size();++j)
+	{
+		scan.image_names.push_back(ExtractFileName(res_images[j].path));
+	}
+	std::sort(scan.image_names.begin(), scan.image_names.end());
+}
+
+void ServerCleanupThread::remove_unknown_client_files(SRemoveUnknownScan& scan, const std::string& backupfolder, ServerLinkDao& link_dao)
+{
+	int clientid=scan.client.id;
+	const std::string& clientname=scan.client.name;
+	const std::vector<std::string>& backup_paths=scan.backup_paths;
+	const std::vector<std::string>& image_names=scan.image_names;
+
+	for(size_t j=0;j<scan.files.size();++j)
+	{
+		SFile cf=scan.files[j];
+
+		if(cf.name=="current")
+			continue;
+
+		if(cf.name==".directory_pool")
+			continue;
+
+		if(cf.isdir
+			|| ( !cf.isdir 
+					&& cf.name.find(".")==std::string::npos ) )
+		{
+			if (cf.name.find("Image") == std::string::npos)
+			{
+				if (!std::binary_search(backup_paths.begin(), backup_paths.end(), cf.name))
+				{
+					Server->Log("File backup \"" + cf.name + "\" of client \"" + clientname + "\" not found in database. Deleting it.", LL_WARNING);
+					bool remove_folder = false;
+					if (!cf.isdir)
+					{
+						SnapshotHelper::removeFilesystem(false, clientname, cf.name);
+						Server->deleteFile(os_file_prefix(backupfolder
+							+ os_file_sep() + clientname + os_file_sep() + cf.name));
+					}
+					else if (BackupServer::isFileSnapshotsEnabled())
+					{
+						if (!SnapshotHelper::removeFilesystem(false, clientname, cf.name))
+						{
+							remove_folder = true;
+						}
+					}
+					else
+					{
+						remove_folder = true;
+					}
+
+					if (remove_folder)
+					{
+						std::string rm_dir = backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name;
+						if (!remove_directory_link_dir(rm_dir, link_dao, clientid))
+						{
+							Server->Log("Could not delete directory \"" + rm_dir + "\"", LL_ERROR);
+						}
+					}
+				}
+			}
+			else
+			{
+				const std::vector<SFile>& image_files = scan.image_dir_files[cf.name];
+
+				bool found_image = false;
+				for (size_t l = 0; l < image_files.size(); ++l)
+				{
+					std::string extension = findextension(image_files[l].name);
+
+					if (extension != "vhd" && extension != "vhdz" && extension != "raw")
+						continue;
+
+					found_image = true;
+
+					if (!std::binary_search(image_names.begin(), image_names.end(), image_files[l].name))
+					{
+						Server->Log("Image backup \"" + cf.name + "\" of client \"" + clientname + "\" not found in database. Deleting it.", LL_WARNING);
+						
+						if (extension == "raw")
+						{
+							releaseImageBlocks(logid_t(), backupfolder + os_file_sep() + clientname + os_file_sep()
+								+ cf.name + os_file_sep() + image_files[l].name);
+							SnapshotHelper::removeFilesystem(true, clientname, cf.name);
+						}
+						else
+						{
+							os_remove_nonempty_dir(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
+						}
+					}
+				}
+
+				if (!found_image)
+				{
+					if (!cf.isdir)
+					{
+						SnapshotHelper::removeFilesystem(true, clientname, cf.name);
+						Server->deleteFile(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
+					}
+					else
+					{
+						os_remove_nonempty_dir(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
+
+						if(os_directory_exists(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name))
+							&& BackupServer::isImageSnapshotsEnabled() )
+						{
+							SnapshotHelper::removeFilesystem(true, clientname, cf.name);
+						}
+					}
+				}
+			}
+		}
+		else
+		{
+			std::string extension=findextension(cf.name);
+
+			if(extension!="vhd" && extension!="vhdz" && extension!="raw")
+				continue;
+
+			if(!std::binary_search(image_names.begin(), image_names.end(), cf.name))
+			{
+				Server->Log("Image backup \""+cf.name+"\" of client \""+clientname+"\" not found in database. Deleting it.", LL_WARNING);
+				std::string rm_file=backupfolder+os_file_sep()+clientname+os_file_sep()+cf.name;
+				if(extension=="raw")
+				{
+					releaseImageBlocks(logid_t(), rm_file);
+				}
+				if(!Server->deleteFile(rm_file))
+				{
+					Server->Log("Could not delete file \""+rm_file+"\"", LL_ERROR);
+				}
+				if(!Server->deleteFile(rm_file+".mbr"))
+				{
+					Server->Log("Could not delete file \""+rm_file+".mbr\"", LL_ERROR);
+				}
+				if(!Server->deleteFile(rm_file+".hash"))
+				{
+					Server->Log("Could not delete file \""+rm_file+".hash\"", LL_ERROR);
+				}
+				Server->deleteFile(rm_file+".bitmap");
+				Server->deleteFile(rm_file+".cbitmap");
+				Server->deleteFile(rm_file + ".sync");
+			}
+		}
+	}
+}
+
 int ServerCleanupThread::hasEnoughFreeSpace(int64 minspace, ServerSettings *settings)
 {
 	if(minspace!=-1)
@@ -810,6 +1056,16 @@ bool ServerCleanupThread::deleteAndTruncateFile(logid_t logid, std::string path)
 	return true;
 }
 
+void ServerCleanupThread::releaseImageBlocks(logid_t logid, const std::string& path)
+{
+	//Not only if the block store is currently enabled, as the image may
+	//have been added to it while it was
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	ServerSettings settings(db);
+	ImageBlockStore block_store(db, settings.getSettings()->backupfolder, logid);
+	block_store.removeImage(path);
+}
+
 bool ServerCleanupThread::deleteImage(logid_t logid, std::string clientname, std::string path)
 {
 	std::string image_extension = findextension(path);
@@ -844,6 +1100,8 @@ bool ServerCleanupThread::deleteImage(logid_t logid, std::string clientname, std
 	}
 	else
 	{
+		releaseImageBlocks(logid, path);
+
 		bool b = SnapshotHelper::removeFilesystem(true, clientname, ExtractFileName(ExtractFilePath(path)));
 
 		if (b
@@ -1492,6 +1750,15 @@ bool ServerCleanupThread::deleteFileBackup(const std::string &backupfolder, int
 
 	std::string path=backupfolder+os_file_sep()+clientname+os_file_sep()+backuppath;
 
+	HashContainer::close(path);
+
+	if (os_directory_exists(os_file_prefix(path))
+		&& !HashContainer::removeReferences(path, logid))
+	{
+		ServerLogger::Log(logid, "Error copying hash files referenced by other backups out of \""+path+"\". Not deleting backup.", LL_ERROR);
+		return false;
+	}
+
 	if (!os_directory_exists(os_file_prefix(path))
 		&& os_directory_exists(os_file_prefix(path + ".startup-del")))
 	{
@@ -2168,6 +2435,12 @@ namespace
 	}
 }
 
+void ServerCleanupThread::load_old_backupfolders()
+{
+	old_backupfolders = backupdao->getOldBackupfolders();
+	old_backupfolders_exist = check_backupfolders_exist(old_backupfolders);
+}
+
 bool ServerCleanupThread::correct_poolname( const std::string& backupfolder, const std::string& clientname, const std::string& pool_name, std::string& pool_path )
 {
 	const std::string pool_root = backupfolder + os_file_sep() + clientname + os_file_sep() + ".directory_pool";
@@ -2178,12 +2451,9 @@ bool ServerCleanupThread::correct_poolname( const std::string& backupfolder, con
 		return true;
 	}
 
-	static std::vector<std::string> old_backupfolders = backupdao->getOldBackupfolders();
-	static std::vector<bool> backupfolders_exist = check_backupfolders_exist(old_backupfolders);
-
 	for(size_t i=0;i<old_backupfolders.size();++i)
 	{
-		if(backupfolders_exist[i])
+		if(old_backupfolders_exist[i])
 		{
 			pool_path = old_backupfolders[i] + os_file_sep() + clientname + os_file_sep() + ".directory_pool"
 				+ os_file_sep() + pool_name.substr(0, 2) + os_file_sep() + pool_name;
@@ -2359,8 +2629,6 @@ bool ServerCleanupThread::correct_target(const std::string& backupfolder, std::s
 		return true;
 	}
 
-	static std::vector<std::string> old_backupfolders = backupdao->getOldBackupfolders();
-
 	for(size_t i=0;i<old_backupfolders.size();++i)
 	{
 		size_t erase_size = old_backupfolders[i].size() + os_file_sep().size();
@@ -2546,6 +2814,8 @@ void ServerCleanupThread::cleanup_other()
 
 void ServerCleanupThread::removeFileBackupSql( int backupid )
 {
+	PathIndex::remove(backupid);
+
 	DBScopedSynchronous synchronous_files(filesdao->getDatabase());
 	filesdao->BeginWriteTransaction();
 
@@ -2643,6 +2913,7 @@ void ServerCleanupThread::removeFileBackupSql( int backupid )
 		filesdao->setPointedTo(it_pointed_to->second, it_pointed_to->first);
 	}
 
+	filesdao->deleteFileChunks(backupid);
 	filesdao->deleteFiles(backupid);
 
 	if (modified_file_entry_index)
@@ -14,6 +14,9 @@
 #include "server_log.h"
 
 class ServerSettings;
+class ServerLinkDao;
+struct SRemoveUnknownScan;
+class RemoveUnknownDeleteThread;
 
 enum ECleanupAction
 {
@@ -75,6 +78,7 @@ struct CleanupAction
 
 class ServerCleanupThread : public IThread
 {
+	friend class RemoveUnknownDeleteThread;
 public:
 	ServerCleanupThread(CleanupAction action);
 	~ServerCleanupThread(void);
@@ -106,6 +110,8 @@ public:
 
 	static bool deleteImage(logid_t logid, std::string clientname, std::string path);
 
+	static void releaseImageBlocks(logid_t logid, const std::string& path);
+
 	static bool findUncompleteImageRef(ServerCleanupDao* cleanupdao, int backupid);
 
 	static bool findLockedImageRef(ServerCleanupDao* cleanupdao, int backupid);
@@ -122,6 +128,12 @@ private:
 
 	void do_remove_unknown(void);
 
+	void remove_unknown_client(SRemoveUnknownScan& scan, ServerSettings& settings);
+
+	void remove_unknown_client_files(SRemoveUnknownScan& scan, const std::string& backupfolder, ServerLinkDao& link_dao);
+
+	void load_old_backupfolders();
+
 	bool correct_target(const std::string& backupfolder, std::string& target);
 
 	bool correct_poolname(const std::string& backupfolder, const std::string& clientname, const std::string& pool_name, std::string& pool_path);
@@ -214,6 +226,9 @@ private:
 
 	logid_t logid;
 
+	std::vector<std::string> old_backupfolders;
+	std::vector<bool> old_backupfolders_exist;
+
 	static IMutex* cleanup_lock_mutex;
 	static std::map<int, size_t> locked_images;
 
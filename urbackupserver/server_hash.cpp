@@ -33,6 +33,10 @@
 #include <memory.h>
 #include "../urbackupcommon/file_metadata.h"
 #include "FileBackup.h"
+#include "HashContainer.h"
+#include "PerfCounters.h"
+#include "InFlightContent.h"
+#include "InlineVerification.h"
 #include <assert.h>
 #ifdef _WIN32
 #include <Windows.h>
@@ -41,6 +45,74 @@
 const size_t freespace_mod=50*1024*1024; //50 MB
 const size_t BUFFER_SIZE=64*1024; //64KB
 
+namespace
+{
+	/**
+	* Plain sha256 of the data written to a backup file for inline
+	* verification. Sparse ranges are hashed as zeros once data after them
+	* is written or the hash is finalized.
+	*/
+	class HashSha256Written : public IHashFunc
+	{
+	public:
+		HashSha256Written()
+			: pos(0), zero_end(0)
+		{
+			sha256_init(&ctx);
+		}
+
+		virtual void hash(const char* buf, _u32 bsize)
+		{
+			hashZeros();
+			sha256_update(&ctx, reinterpret_cast<const unsigned char*>(buf), bsize);
+			pos += bsize;
+		}
+
+		virtual void sparse_hash(const char* buf, _u32 bsize)
+		{
+			if (bsize == sizeof(int64) * 2)
+			{
+				int64 ext[2];
+				memcpy(ext, buf, sizeof(ext));
+				zero_end = (std::max)(zero_end, ext[0] + ext[1]);
+			}
+		}
+
+		virtual std::string finalize()
+		{
+			hashZeros();
+			unsigned char dig[SHA256_DIGEST_SIZE];
+			sha256_final(&ctx, dig);
+			return bytesToHex(dig, SHA256_DIGEST_SIZE);
+		}
+
+		virtual void addHashAllAdler(const char* h, size_t size, size_t hashed_size)
+		{
+		}
+
+	private:
+		void hashZeros()
+		{
+			if (zero_end <= pos)
+			{
+				return;
+			}
+
+			std::vector<unsigned char> zero_buf(static_cast<size_t>((std::min)(zero_end - pos, static_cast<int64>(BUFFER_SIZE))));
+			while (pos < zero_end)
+			{
+				_u32 tohash = static_cast<_u32>((std::min)(static_cast<int64>(zero_buf.size()), zero_end - pos));
+				sha256_update(&ctx, zero_buf.data(), tohash);
+				pos += tohash;
+			}
+		}
+
+		sha256_ctx ctx;
+		int64 pos;
+		int64 zero_end;
+	};
+}
+
 IMutex * delete_mutex=NULL;
 
 void init_mutex1(void)
@@ -66,6 +138,8 @@ BackupServerHash::BackupServerHash(IPipe *pPipe, int pClientid, bool use_snapsho
 	has_error=false;
 	chunk_patcher.setCallback(this);
 	fileindex=NULL;
+	file_chunk_index=NULL;
+	inline_verification=NULL;
 
 	if(use_reflink)
 		ServerLogger::Log(logid, "Reflink copying is enabled", LL_DEBUG);
@@ -88,6 +162,11 @@ void BackupServerHash::setupDatabase(void)
 	filesdao = new ServerFilesDao(db);
 
 	fileindex=create_lmdb_files_index(); 
+
+	if(FileChunkIndex::isEnabled())
+	{
+		file_chunk_index = new FileChunkIndex(db, logid);
+	}
 }
 
 void BackupServerHash::deinitDatabase(void)
@@ -97,19 +176,30 @@ void BackupServerHash::deinitDatabase(void)
 	delete fileindex;
 	fileindex=NULL;
 
+	delete file_chunk_index;
+	file_chunk_index=NULL;
+
 	delete filesdao;
 	filesdao =NULL;
 }
 
+void BackupServerHash::setInlineVerification(InlineVerification* p_inline_verification)
+{
+	inline_verification = p_inline_verification;
+}
+
 void BackupServerHash::operator()(void)
 {
 	setupDatabase();
 
+	PerfGaugeValue queue_length(EPerfGauge_HashQueue);
+
 	while(true)
 	{
 		working=false;
 		std::string data;
 		size_t rc=pipe->Read(&data, static_cast<int>(60000) );
+		queue_length.set(pipe->getNumElements());
 		if(rc==0)
 		{
 			link_logcnt=0;
@@ -242,7 +332,7 @@ void BackupServerHash::operator()(void)
 				metadata.read(rd);
 				
 				FileMetadata src_metadata;
-				if(read_metadata(os_file_prefix(hash_src),
+				if(HashContainer::readMetadata(hash_src,
 					src_metadata))
 				{
 					metadata.set_shahash(src_metadata.shahash);
@@ -265,7 +355,7 @@ void BackupServerHash::operator()(void)
 
 					if(!hash_src.empty())
 					{
-						std::auto_ptr<IFile> hashf(Server->openFile(os_file_prefix(hash_src), MODE_READ_SEQUENTIAL));
+						std::auto_ptr<IFile> hashf(HashContainer::openHashFile(hash_src));
 						if(hashf.get())
 						{
 							copyFile(hashf.get(), hash_dest, NULL);
@@ -277,22 +367,23 @@ void BackupServerHash::operator()(void)
 	}
 }
 
-void BackupServerHash::addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex)
+int64 BackupServerHash::addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex)
 {
-	addFileSQL(*filesdao, *fileindex, backupid, clientid, incremental, fp, hash_path, shahash, filesize, rsize, prev_entry, prev_entry_clientid, next_entry, update_fileindex);
+	return addFileSQL(*filesdao, *fileindex, backupid, clientid, incremental, fp, hash_path, shahash, filesize, rsize, prev_entry, prev_entry_clientid, next_entry, update_fileindex);
 }
 
-void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, const int clientid, int incremental, const std::string &fp,
+int64 BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, const int clientid, int incremental, const std::string &fp,
 	const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex)
 {
+	PerfTimer db_timer(EPerfHistogram_FileDb);
+
 	if (filesize < link_file_min_size)
 	{
 		assert(prev_entry_clientid == 0);
 		assert(prev_entry == 0);
 		assert(next_entry == 0);
 		filesdao.addIncomingFile(filesize, clientid, backupid, std::string(), ServerFilesDao::c_direction_incoming, incremental);
-		filesdao.addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, 0);
-		return;
+		return filesdao.addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, 0);
 	}
 
 	bool new_for_client=false;
@@ -388,6 +479,8 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 			+" hash="+base64_encode(reinterpret_cast<const unsigned char*>(shahash.c_str()), bytes_in_index), LL_DEBUG));
 		fileindex.put_delayed(FileIndex::SIndexKey(shahash.c_str(), filesize, clientid), entryid);
 	}
+
+	return entryid;
 }
 
 void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int64 id)
@@ -428,6 +521,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 			if (del_entry)
 			{
 				filesdao.delFileEntry(id);
+				filesdao.delFileChunks(id);
 			}
 
 			if (use_transaction)
@@ -593,6 +687,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 	if(del_entry)
 	{
 		filesdao.delFileEntry(id);
+		filesdao.delFileChunks(id);
 	}
 
 	if(use_transaction)
@@ -703,7 +798,7 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 
 						if(!existing_file.hashpath.empty())
 						{
-							std::auto_ptr<IFile> ctf_hash(Server->openFile(os_file_prefix(existing_file.hashpath), MODE_READ));
+							std::auto_ptr<IFile> ctf_hash(HashContainer::openHashFile(existing_file.hashpath));
 
 							bool write_metadata = true;
 
@@ -800,7 +895,7 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 			}
 			else if(!existing_file.hashpath.empty())
 			{
-				std::auto_ptr<IFile> ctf(Server->openFile(os_file_prefix(existing_file.hashpath), MODE_READ));
+				std::auto_ptr<IFile> ctf(HashContainer::openHashFile(existing_file.hashpath));
 				if(ctf.get()!=NULL)
 				{
 					int64 hashfilesize = read_hashdata_size(ctf.get());
@@ -866,6 +961,7 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 		metadata, false, extent_iterator))
 	{
 		ServerLogger::Log(logid, "HT: Linked file: \""+tfn+"\" (id="+convert(fileid)+")", LL_DEBUG);
+		PerfCounters::add(EPerfCounter_FilesLinked, 1);
 		copy=false;
 		std::string temp_fn=tf->getFilename();
 		Server->destroy(tf);
@@ -977,19 +1073,28 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 			else
 			{
 				bool r;
+				//Patched, reflinked or renamed files without hash output have
+				//no hash of the written data and are read back for verification
+				std::auto_ptr<HashSha256Written> written_hash;
 				if(hashoutput_fn.empty())
 				{
 					if(!use_reflink || orig_fn.empty())
 					{
+						if(inline_verification!=NULL
+							&& (with_hashes || use_tmpfiles) )
+						{
+							written_hash.reset(new HashSha256Written);
+						}
+
 						if(with_hashes)
 						{
 							if(use_tmpfiles)
 							{
-								r=copyFileWithHashoutput(tf, tfn, hash_fn, extent_iterator);
+								r=copyFileWithHashoutput(tf, tfn, hash_fn, extent_iterator, written_hash.get());
 							}
 							else
 							{
-								r=renameFileWithHashoutput(tf, tfn, hash_fn, extent_iterator);
+								r=renameFileWithHashoutput(tf, tfn, hash_fn, extent_iterator, written_hash.get());
 								tf=NULL;
 							}
 						}
@@ -997,7 +1102,7 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 						{
 							if(use_tmpfiles)
 							{
-								r=copyFile(tf, tfn, extent_iterator);
+								r=copyFile(tf, tfn, extent_iterator, written_hash.get());
 							}
 							else
 							{
@@ -1041,6 +1146,11 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 
 				if(r)
 				{
+					if(written_hash.get()!=NULL)
+					{
+						inline_verification->add(tfn, written_hash->finalize());
+					}
+
 					if(cow_filesize>0)
 					{
 						metadata.rsize=cow_filesize;
@@ -1052,11 +1162,21 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 						has_error=true;
 					}
 
-					addFileSQL(backupid, clientid, incremental, tfn, hash_fn, sha2, t_filesize, cow_filesize>0?cow_filesize:t_filesize, 0, 0, 0, tries_once || hardlink_limit);
+					int64 fileid = addFileSQL(backupid, clientid, incremental, tfn, hash_fn, sha2, t_filesize, cow_filesize>0?cow_filesize:t_filesize, 0, 0, 0, tries_once || hardlink_limit);
+
+					if(file_chunk_index!=NULL)
+					{
+						file_chunk_index->addFile(fileid, hash_fn, t_filesize);
+					}
 				}
 			}
 		}
 	}
+
+	if(t_filesize>=link_file_min_size)
+	{
+		InFlightContent::finish(sha2, t_filesize);
+	}
 }
 
 bool BackupServerHash::freeSpace(int64 fs, const std::string &fp)
@@ -1099,7 +1219,13 @@ ServerFilesDao::SFindFileEntry BackupServerHash::findFileHash(const std::string
 	bool switch_to_next_client=false;
 	if(state.state==0)
 	{
+		PerfTimer lookup_timer(EPerfHistogram_IndexLookup);
+		PerfCounters::add(EPerfCounter_IndexLookups, 1);
 		entryid = fileindex->get_with_cache_prefer_client(FileIndex::SIndexKey(pHash.c_str(), filesize, clientid));
+		if(entryid!=0)
+		{
+			PerfCounters::add(EPerfCounter_IndexLookupHits, 1);
+		}
 		state.state=1;
 		save_orig=true;
 	}
@@ -1168,7 +1294,13 @@ ServerFilesDao::SFindFileEntry BackupServerHash::findFileHash(const std::string
 	if(switch_to_all_clients)
 	{
 		state.state=3;
+		PerfTimer lookup_timer(EPerfHistogram_IndexLookup);
+		PerfCounters::add(EPerfCounter_IndexLookups, 1);
 		state.entryids = fileindex->get_all_clients_with_cache(FileIndex::SIndexKey(pHash.c_str(), filesize, 0), false);
+		if(!state.entryids.empty())
+		{
+			PerfCounters::add(EPerfCounter_IndexLookupHits, 1);
+		}
 		state.client = state.entryids.begin();
 		if(state.client!=state.entryids.end())
 		{
@@ -1254,10 +1386,12 @@ IFsFile* BackupServerHash::openFileRetry(const std::string &dest, int mode, std:
 	return dst;
 }
 
-bool BackupServerHash::copyFile(IFile *tf, const std::string &dest, ExtentIterator* extent_iterator)
+bool BackupServerHash::copyFile(IFile *tf, const std::string &dest, ExtentIterator* extent_iterator, IHashFunc* written_hash)
 {
 	ServerLogger::Log(logid, "HT: Copying file to \""+dest+"\"", LL_DEBUG);
 
+	PerfTimer copy_timer(EPerfHistogram_FileCopy);
+
 	std::string errstr;
 	std::auto_ptr<IFsFile> dst(openFileRetry(dest, MODE_WRITE, errstr));
 	if (dst.get() == NULL)
@@ -1301,6 +1435,14 @@ bool BackupServerHash::copyFile(IFile *tf, const std::string &dest, ExtentIterat
 				return false;
 			}
 
+			if (written_hash != NULL
+				&& curr_extent.offset < tf->Size())
+			{
+				//The file is not extended past the source size below
+				int64 ext_pos[2] = { curr_extent.offset, (std::min)(curr_extent.size, tf->Size() - curr_extent.offset) };
+				written_hash->sparse_hash(reinterpret_cast<char*>(ext_pos), sizeof(ext_pos));
+			}
+
 			if (!dst->Seek(fpos))
 			{
 				ServerLogger::Log(logid, "Error seeking in \"" + dest + "\" after adding sparse extent", LL_ERROR);
@@ -1335,7 +1477,14 @@ bool BackupServerHash::copyFile(IFile *tf, const std::string &dest, ExtentIterat
 		}
 		else
 		{
+			if (written_hash != NULL
+				&& read > 0)
+			{
+				written_hash->hash(buf, read);
+			}
+
 			fpos += read;
+			PerfCounters::add(EPerfCounter_BytesWritten, read);
 		}
 	}
 	while(read>0);
@@ -1354,10 +1503,12 @@ bool BackupServerHash::copyFile(IFile *tf, const std::string &dest, ExtentIterat
 	return true;
 }
 
-bool BackupServerHash::copyFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator)
+bool BackupServerHash::copyFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator, IHashFunc* written_hash)
 {
 	ServerLogger::Log(logid, "HT: Copying file with hash output to \""+dest+"\"", LL_DEBUG);
 
+	PerfTimer copy_timer(EPerfHistogram_FileCopy);
+
 	std::string errstr;
 	IFsFile *dst=openFileRetry(dest, MODE_WRITE, errstr);
 	if(dst==NULL) return false;
@@ -1372,7 +1523,9 @@ bool BackupServerHash::copyFileWithHashoutput(IFile *tf, const std::string &dest
 		}
 		ObjectScope dst_hash_s(dst_hash);
 
-		return build_chunk_hashs(tf, dst_hash, this, dst, false, NULL, NULL, false, NULL, extent_iterator);
+		PerfCounters::add(EPerfCounter_BytesWritten, tf->Size());
+
+		return build_chunk_hashs(tf, dst_hash, this, dst, false, NULL, NULL, false, written_hash, extent_iterator);
 	}
 	
 	return true;
@@ -1789,7 +1942,7 @@ bool BackupServerHash::replaceFileWithHashoutput(IFile *tf, const std::string &d
 	return true;
 }
 
-bool BackupServerHash::renameFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator)
+bool BackupServerHash::renameFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator, IHashFunc* written_hash)
 {
 	ServerLogger::Log(logid, "HT: Renaming file to \""+dest+"\" with hash output", LL_DEBUG);
 
@@ -1804,7 +1957,8 @@ bool BackupServerHash::renameFileWithHashoutput(IFile *tf, const std::string &de
 		ObjectScope dst_hash_s(dst_hash);
 
 		//TODO: Already build hashes during hashing stage
-		if (!build_chunk_hashs(tf, dst_hash, this, NULL, false, NULL, NULL, false, NULL, extent_iterator))
+		//The data hashed here is the data of the renamed backup file
+		if (!build_chunk_hashs(tf, dst_hash, this, NULL, false, NULL, NULL, false, written_hash, extent_iterator))
 		{
 			return false;
 		}
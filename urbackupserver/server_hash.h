@@ -14,10 +14,12 @@
 #include <map>
 #include "../urbackupcommon/chunk_hasher.h"
 #include "server_log.h"
+#include "FileChunkIndex.h"
 #include "../urbackupcommon/ExtentIterator.h"
 
 class FileMetadata;
 class MaxFileId;
+class InlineVerification;
 
 const int64 link_file_min_size = 2048;
 
@@ -65,14 +67,16 @@ public:
 	void setupDatabase(void);
 	void deinitDatabase(void);
 
+	void setInlineVerification(InlineVerification* p_inline_verification);
+
 	bool findFileAndLink(const std::string &tfn, IFile *tf, std::string hash_fn, const std::string &sha2, _i64 t_filesize, const std::string &hashoutput_fn, 
 		bool copy_from_hardlink_if_failed, bool &tries_once, std::string &ff_last, bool &hardlink_limit, bool &copied_file, int64& entryid, int& entryclientid, int64& rsize, int64& next_entry,
 		FileMetadata& metadata, bool datch_dbs, ExtentIterator* extent_iterator);
 
-	void addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path,
+	int64 addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path,
 		const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex);
 
-	static void addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, int clientid, int incremental, const std::string &fp,
+	static int64 addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, int clientid, int incremental, const std::string &fp,
 		const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid,
 		int64 next_entry, bool update_fileindex);
 		
@@ -115,8 +119,8 @@ private:
 
 	ServerFilesDao::SFindFileEntry findFileHash(const std::string &pHash, _i64 filesize, int clientid, SFindState& state);
 
-	bool copyFile(IFile *tf, const std::string &dest, ExtentIterator* extent_iterator);
-	bool copyFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator);
+	bool copyFile(IFile *tf, const std::string &dest, ExtentIterator* extent_iterator, IHashFunc* written_hash=NULL);
+	bool copyFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator, IHashFunc* written_hash=NULL);
 	bool freeSpace(int64 fs, const std::string &fp);
 	
 	int countFilesInTmp(void);
@@ -127,7 +131,7 @@ private:
 	bool replaceFile(IFile *tf, const std::string &dest, const std::string &orig_fn, ExtentIterator* extent_iterator);
 	bool replaceFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, const std::string &orig_fn, ExtentIterator* extent_iterator);
 
-	bool renameFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator);
+	bool renameFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator, IHashFunc* written_hash=NULL);
 	bool renameFile(IFile *tf, const std::string &dest, bool log_info=true);
 
 	bool correctPath(std::string& ff, std::string& f_hashpath);
@@ -166,6 +170,10 @@ private:
 
 	FileIndex *fileindex;
 
+	FileChunkIndex* file_chunk_index;
+
+	InlineVerification* inline_verification;
+
 	std::string backupfolder;
 	bool old_backupfolders_loaded;
 	std::vector<std::string> old_backupfolders;
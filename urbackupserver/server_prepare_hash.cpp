@@ -30,6 +30,8 @@
 #include <memory.h>
 #include "../common/adler32.h"
 #include "../urbackupcommon/file_metadata.h"
+#include "PerfCounters.h"
+#include "InFlightContent.h"
 
 namespace
 {
@@ -69,11 +71,14 @@ BackupServerPrepareHash::~BackupServerPrepareHash(void)
 
 void BackupServerPrepareHash::operator()(void)
 {
+	PerfGaugeValue queue_length(EPerfGauge_PrepareHashQueue);
+
 	while(true)
 	{
 		working=false;
 		std::string data;
 		size_t rc=pipe->Read(&data);
+		queue_length.set(pipe->getNumElements());
 		if(data=="exit")
 		{
 			output->Write("exit");
@@ -179,6 +184,8 @@ void BackupServerPrepareHash::operator()(void)
 
 				ServerLogger::Log(logid, "PT: Hashing file \""+ExtractFileName(tfn)+"\"", LL_DEBUG);
 				std::string h;
+				std::auto_ptr<PerfTimer> hash_timer(new PerfTimer(EPerfHistogram_HashFile));
+				PerfCounters::add(EPerfCounter_HashedFiles, 1);
 				if(!diff_file)
 				{
 					if (c_hash_func == HASH_FUNC_SHA512_NO_SPARSE
@@ -229,6 +236,8 @@ void BackupServerPrepareHash::operator()(void)
 					}
 				}
 
+				hash_timer.reset();
+
 				if (h.empty())
 				{
 					ServerLogger::Log(logid, "Error while hashing file \"" + tf->getFilename() + "\" (destination: \""+ tfn+"\"). Failing backup.", LL_ERROR);
@@ -236,6 +245,9 @@ void BackupServerPrepareHash::operator()(void)
 				}
 				else if(!client_sha_dig.empty() && h!=client_sha_dig)
 				{
+					//Backups waiting for this content would not find it under the client hash
+					InFlightContent::finish(client_sha_dig, t_filesize);
+
 					if (has_snapshot)
 					{
 						ServerLogger::Log(logid, "Client calculated hash of \"" + tfn + "\" differs from server calculated hash. "
@@ -365,6 +377,8 @@ bool BackupServerPrepareHash::hash_sha(IFile *f, IExtentIterator* extent_iterato
 			return false;
 		}
 
+		PerfCounters::add(EPerfCounter_HashBytesRead, rc);
+
 		if (hash_with_sparse
 			&& rc == hash_bsize
 			&& buf_is_zero(buf.data(), hash_bsize))
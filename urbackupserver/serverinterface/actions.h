@@ -24,4 +24,6 @@ namespace Actions
 	ACTION(scripts);
 	ACTION(status_check);
 	ACTION(restore_image);
+	ACTION(search);
+	ACTION(metrics);
 }
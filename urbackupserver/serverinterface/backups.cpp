@@ -27,6 +27,7 @@
 #include "../../fsimageplugin/IVHDFile.h"
 #include "../server_settings.h"
 #include "backups.h"
+#include "create_zip.h"
 #include <memory>
 #include <algorithm>
 #include <assert.h>
@@ -39,6 +40,7 @@
 #include "../server.h"
 #include "../server_cleanup.h"
 #include "../dao/ServerCleanupDao.h"
+#include "../HashContainer.h"
 
 extern ICryptoFactory *crypto_fak;
 extern IFileServ* fileserv;
@@ -60,11 +62,6 @@ namespace backupaccess
 	}
 }
 
-
-bool create_zip_to_output(const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase, 
-	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
-	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes);
-
 namespace
 {
 	bool sendFile(Helper& helper, const std::string& filename)
@@ -98,9 +95,9 @@ namespace
 	}
 
 	bool sendZip(Helper& helper, std::string folderbase, std::string foldername, std::string hashfolderbase, std::string hashfoldername, const std::string& filter, bool token_authentication,
-		const std::vector<backupaccess::SToken>& backup_tokens, const std::vector<std::string>& tokens, bool skip_hashes)
+		const std::vector<backupaccess::SToken>& backup_tokens, const std::vector<std::string>& tokens, bool skip_hashes, EArchiveFormat format)
 	{
-		std::string zipname=ExtractFileName(foldername)+".zip";
+		std::string zipname=ExtractFileName(foldername)+archive_format_extension(format);
 
 		THREAD_ID tid = Server->getThreadID();
 		Server->setContentType(tid, "application/octet-stream");
@@ -125,7 +122,7 @@ namespace
 		}
 
 		return create_zip_to_output(folderbase, foldername, hashfolderbase, hashfoldername, filter, token_authentication,
-			backup_tokens, tokens, skip_hashes);
+			backup_tokens, tokens, skip_hashes, format);
 	}
 
 	std::vector<FileMetadata> getMetadata(std::string dir, const std::vector<SFile>& files, bool skip_special)
@@ -165,7 +162,7 @@ namespace
 				metadata_fn = dir + escape_metadata_fn(file.name);
 			}
 
-			if(!read_metadata(metadata_fn, ret[i]) )
+			if(!HashContainer::readMetadata(metadata_fn, ret[i]) )
 			{
 				Server->Log("Error reading metadata of file "+dir+os_file_sep()+ file.name, LL_ERROR);
 			}
@@ -192,7 +189,7 @@ namespace
 		}
 
 		FileMetadata ret;
-		if(!read_metadata(metadata_fn, ret) )
+		if(!HashContainer::readMetadata(metadata_fn, ret) )
 		{
 			Server->Log("Error reading metadata of path "+path, LL_ERROR);
 		}
@@ -269,7 +266,7 @@ namespace
 		}
 
 		FileMetadata metadata;
-		if(!read_metadata(filemetadatapath, metadata))
+		if(!HashContainer::readMetadata(filemetadatapath, metadata))
 		{
 			return false;
 		}
@@ -560,7 +557,7 @@ namespace backupaccess
 					}
 
 					FileMetadata dir_metadata;
-					if(!read_metadata(curr_metadata_file, dir_metadata))
+					if(!HashContainer::readMetadata(curr_metadata_file, dir_metadata))
 					{
 						ret.can_access_path=false;
 						break;
@@ -1769,7 +1766,8 @@ ACTION_IMPL(backups)
 							std::string bpath = backupfolder + os_file_sep() + clientname + os_file_sep() + backuppath;
 							sendZip(helper, bpath, path_info.full_path, backupid<0 ? "" : bpath + os_file_sep()+".hashes",
 								path_info.full_metadata_path, CURRP["filter"], token_authentication,
-								path_info.backup_tokens.tokens, tokens, backupid<0 ? false : path_info.rel_path.empty());
+								path_info.backup_tokens.tokens, tokens, backupid<0 ? false : path_info.rel_path.empty(),
+								archive_format_from_str(CURRP["format"]));
 							return;
 						}
 						else if(sa=="clientdl" && fileserv!=NULL)
@@ -1790,6 +1788,10 @@ ACTION_IMPL(backups)
 							{
 								restore_flags |= restore_flag_ignore_permissions;
 							}
+							if (CURRP["local_reuse"] == "1")
+							{
+								restore_flags |= restore_flag_local_reuse;
+							}
 
 							if(!create_clientdl_thread(clientname, t_clientid, t_clientid, path_info.full_path, path_info.full_metadata_path, CURRP["filter"],
 								path_info.rel_path.empty(), path_info.rel_path, restore_id, status_id, log_id, std::string(),
@@ -21,9 +21,17 @@
 #include "action_header.h"
 #include "../../urbackupcommon/os_functions.h"
 #include "../../Interface/File.h"
+#include "../../Interface/Thread.h"
+#include "../../Interface/ThreadPool.h"
+#include "../../Interface/Condition.h"
 #include "backups.h"
+#include "create_zip.h"
 #include <memory>
+#include <deque>
+#include <algorithm>
+#include <string.h>
 #include "../../common/data.h"
+#include "../HashContainer.h"
 
 #define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
 #include "../../common/miniz.h"
@@ -36,14 +44,63 @@
 #include <fcntl.h>
 #endif
 
+#ifndef NO_ZSTD_COMPRESSION
+#include <zstd.h>
+#endif
+
 namespace
 {
 
+//Files up to this size are read and deflated by the worker threads
+const int64 zip_parallel_max_size = 4 * 1024 * 1024;
+//Bounds the memory of files queued for or held after compression per download
+const int64 zip_max_pending_bytes = 32 * 1024 * 1024;
+const int64 zip_min_pending_cost = 4096;
+const size_t tar_block_size = 512;
+const int tar_zstd_level = 3;
+
+struct SArchiveEntry
+{
+	std::string archivename;
+	std::string filename;
+	bool isdir;
+	bool has_metadata;
+	int64 size;
+	int64 last_modified;
+	int64 accessed;
+	int64 created;
+};
+
+class IArchiveWriter
+{
+public:
+	virtual ~IArchiveWriter() {}
+	virtual bool add(const SArchiveEntry& entry) = 0;
+	virtual bool finish() = 0;
+};
+
+class HttpArchiveOutput : public IArchiveOutput
+{
+public:
+	HttpArchiveOutput()
+		: tid(Server->getThreadID())
+	{
+	}
+
+	virtual bool write(const char* buf, size_t bsize)
+	{
+		return Server->WriteRaw(tid, buf, bsize, false);
+	}
+
+private:
+	THREAD_ID tid;
+};
+
 struct MiniZFileInfo
 {
 	uint64 file_offset;
 	int64 last_writetime;
-	THREAD_ID tid;
+	IArchiveOutput* output;
 };
 
 size_t my_mz_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
@@ -58,7 +115,7 @@ size_t my_mz_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, siz
 
   fileInfo->file_offset=file_ofs+n;
   
-  bool b=Server->WriteRaw(fileInfo->tid, reinterpret_cast<const char*>(pBuf), n, false);
+  bool b=fileInfo->output->write(reinterpret_cast<const char*>(pBuf), n);
 
   if(b)
 	fileInfo->last_writetime = Server->getTimeMS();
@@ -84,7 +141,696 @@ bool my_miniz_init(mz_zip_archive *pZip, MiniZFileInfo* fileInfo)
 	return true;
 }
 
-bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername, const std::string& folderbase, const std::string& foldername, const std::string& start_foldername,
+struct SZipCompressJob
+{
+	std::string filename;
+	int64 size;
+	mz_uint level;
+	bool started;
+	bool done;
+	bool ok;
+	bool stored;
+	mz_uint32 crc;
+	std::string data;
+};
+
+/**
+* Worker threads shared by all ZIP downloads. They are started on demand
+* up to the largest thread count requested and then wait for jobs.
+*/
+class ZipCompressPool
+{
+public:
+	static void init_mutex()
+	{
+		mutex = Server->createMutex();
+		queue_cond = Server->createCondition();
+		done_cond = Server->createCondition();
+	}
+
+	static void add(SZipCompressJob* job, size_t threads);
+	static SZipCompressJob* getJob();
+	static void jobDone(SZipCompressJob* job);
+	static void waitDone(SZipCompressJob* job);
+	static void cancel(SZipCompressJob* job);
+
+private:
+	static IMutex* mutex;
+	static ICondition* queue_cond;
+	static ICondition* done_cond;
+	static std::deque<SZipCompressJob*> queue;
+	static size_t n_workers;
+};
+
+IMutex* ZipCompressPool::mutex = NULL;
+ICondition* ZipCompressPool::queue_cond = NULL;
+ICondition* ZipCompressPool::done_cond = NULL;
+std::deque<SZipCompressJob*> ZipCompressPool::queue;
+size_t ZipCompressPool::n_workers = 0;
+
+/**
+* Writes a ZIP file with miniz. Small files are read and deflated by the
+* shared worker threads into memory and then added as pre-compressed data
+* in the order they were queued, so the output is identical to adding them
+* one by one. At most zip_max_pending_bytes of them are queued per
+* download. Directories and large files are streamed on the calling thread
+* once all entries queued before them are written.
+*/
+class ZipArchiveWriter : public IArchiveWriter
+{
+public:
+	ZipArchiveWriter(IArchiveOutput* output, mz_uint level, size_t threads)
+		: level(level), threads(level==MZ_NO_COMPRESSION ? 0 : threads),
+		pending_bytes(0)
+	{
+		memset(&zip_archive, 0, sizeof(zip_archive));
+		file_info.file_offset = 0;
+		file_info.last_writetime = Server->getTimeMS();
+		file_info.output = output;
+	}
+
+	~ZipArchiveWriter()
+	{
+		while (!pending.empty())
+		{
+			ZipCompressPool::cancel(pending.front().second);
+			delete pending.front().second;
+			pending.pop_front();
+		}
+
+		mz_zip_writer_end(&zip_archive);
+	}
+
+	bool init();
+
+	virtual bool add(const SArchiveEntry& entry)
+	{
+		if (threads <= 1
+			|| entry.isdir
+			|| entry.size > zip_parallel_max_size)
+		{
+			return flushPending(true) && addDirect(entry);
+		}
+
+		SZipCompressJob* job = new SZipCompressJob;
+		job->filename = entry.filename;
+		job->size = entry.size;
+		job->level = level;
+		job->started = false;
+		job->done = false;
+		job->ok = false;
+		job->stored = false;
+		job->crc = 0;
+
+		pending.push_back(std::make_pair(entry, job));
+		pending_bytes += pendingCost(entry);
+
+		ZipCompressPool::add(job, threads);
+
+		return flushPending(false);
+	}
+
+	virtual bool finish()
+	{
+		if (!flushPending(true))
+		{
+			return false;
+		}
+
+		if (!mz_zip_writer_finalize_archive(&zip_archive))
+		{
+			Server->Log("Error while finalizing ZIP archive", LL_ERROR);
+			return false;
+		}
+
+		return true;
+	}
+
+private:
+	static int64 pendingCost(const SArchiveEntry& entry)
+	{
+		return (std::max)(entry.size, zip_min_pending_cost);
+	}
+
+	bool flushPending(bool all);
+	bool addDirect(const SArchiveEntry& entry);
+	void buildExtraData(const SArchiveEntry& entry, CWData& extra_data_local, CWData& extra_data_central);
+	bool logError(const std::string& filename, const std::string& os_err);
+
+	mz_zip_archive zip_archive;
+	MiniZFileInfo file_info;
+	mz_uint level;
+	size_t threads;
+
+	std::deque<std::pair<SArchiveEntry, SZipCompressJob*> > pending;
+	int64 pending_bytes;
+};
+
+class ZipCompressWorker : public IThread
+{
+public:
+	void operator()()
+	{
+		while (true)
+		{
+			SZipCompressJob* job = ZipCompressPool::getJob();
+			compress(job);
+			ZipCompressPool::jobDone(job);
+		}
+	}
+
+private:
+	void compress(SZipCompressJob* job)
+	{
+		std::auto_ptr<IFile> f(Server->openFile(os_file_prefix(job->filename), MODE_READ_SEQUENTIAL));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening file \"" + job->filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
+			return;
+		}
+
+		job->size = f->Size();
+
+		bool has_read_error = false;
+		std::string uncomp = f->Read(0LL, static_cast<_u32>(job->size), &has_read_error);
+		if (has_read_error)
+		{
+			Server->Log("Error reading file \"" + job->filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
+			return;
+		}
+
+		job->size = uncomp.size();
+		job->crc = static_cast<mz_uint32>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const mz_uint8*>(uncomp.data()), uncomp.size()));
+
+		size_t comp_size = 0;
+		void* comp = NULL;
+		if (!uncomp.empty())
+		{
+			comp = tdefl_compress_mem_to_heap(uncomp.data(), uncomp.size(), &comp_size,
+				tdefl_create_comp_flags_from_zip_params(job->level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY));
+		}
+
+		if (comp != NULL
+			&& comp_size < uncomp.size())
+		{
+			job->data.assign(reinterpret_cast<char*>(comp), comp_size);
+		}
+		else
+		{
+			job->stored = true;
+			job->data.swap(uncomp);
+		}
+
+		mz_free(comp);
+
+		job->ok = true;
+	}
+};
+
+void ZipCompressPool::add(SZipCompressJob* job, size_t threads)
+{
+	IScopedLock lock(mutex);
+	while (n_workers < threads)
+	{
+		Server->createThread(new ZipCompressWorker, "zip compress");
+		++n_workers;
+	}
+
+	queue.push_back(job);
+	queue_cond->notify_one();
+}
+
+SZipCompressJob* ZipCompressPool::getJob()
+{
+	IScopedLock lock(mutex);
+	while (queue.empty())
+	{
+		queue_cond->wait(&lock);
+	}
+
+	SZipCompressJob* ret = queue.front();
+	queue.pop_front();
+	ret->started = true;
+	return ret;
+}
+
+void ZipCompressPool::jobDone(SZipCompressJob* job)
+{
+	IScopedLock lock(mutex);
+	job->done = true;
+	done_cond->notify_all();
+}
+
+void ZipCompressPool::waitDone(SZipCompressJob* job)
+{
+	IScopedLock lock(mutex);
+	while (!job->done)
+	{
+		done_cond->wait(&lock);
+	}
+}
+
+void ZipCompressPool::cancel(SZipCompressJob* job)
+{
+	IScopedLock lock(mutex);
+	if (!job->started)
+	{
+		std::deque<SZipCompressJob*>::iterator it = std::find(queue.begin(), queue.end(), job);
+		if (it != queue.end())
+		{
+			queue.erase(it);
+		}
+		return;
+	}
+
+	while (!job->done)
+	{
+		done_cond->wait(&lock);
+	}
+}
+
+bool ZipArchiveWriter::init()
+{
+	if (!my_miniz_init(&zip_archive, &file_info))
+	{
+		Server->Log("Error while initializing ZIP archive", LL_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+bool ZipArchiveWriter::flushPending(bool all)
+{
+	while (!pending.empty()
+		&& (all || pending_bytes > zip_max_pending_bytes))
+	{
+		const SArchiveEntry& entry = pending.front().first;
+		SZipCompressJob* job = pending.front().second;
+
+		ZipCompressPool::waitDone(job);
+
+		if (!job->ok)
+		{
+			return false;
+		}
+
+		CWData extra_data_local;
+		CWData extra_data_central;
+		buildExtraData(entry, extra_data_local, extra_data_central);
+
+		time_t last_modified_wt = static_cast<time_t>(entry.last_modified);
+
+		mz_bool rc;
+		if (job->stored)
+		{
+			rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, entry.archivename.c_str(), job->data.data(), job->data.size(), NULL, 0,
+				MZ_NO_COMPRESSION, 0, 0, entry.has_metadata ? &last_modified_wt : NULL,
+				extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
+				extra_data_central.getDataPtr(), extra_data_central.getDataSize());
+		}
+		else
+		{
+			rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, entry.archivename.c_str(), job->data.data(), job->data.size(), NULL, 0,
+				level | MZ_ZIP_FLAG_COMPRESSED_DATA, job->size, job->crc, entry.has_metadata ? &last_modified_wt : NULL,
+				extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
+				extra_data_central.getDataPtr(), extra_data_central.getDataSize());
+		}
+
+		if (rc == MZ_FALSE)
+		{
+			return logError(entry.filename, std::string());
+		}
+
+		pending_bytes -= pendingCost(entry);
+		delete job;
+		pending.pop_front();
+	}
+
+	return true;
+}
+
+bool ZipArchiveWriter::addDirect(const SArchiveEntry& entry)
+{
+	CWData extra_data_local;
+	CWData extra_data_central;
+	buildExtraData(entry, extra_data_local, extra_data_central);
+
+	time_t last_modified_wt = static_cast<time_t>(entry.last_modified);
+	time_t* last_modified = entry.has_metadata ? &last_modified_wt : NULL;
+
+	std::string os_err;
+
+	mz_bool rc;
+	if(entry.isdir)
+	{
+		rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, (entry.archivename + "/").c_str(), NULL, 0, NULL, 0,
+										level,
+										0, 0, last_modified, extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
+										extra_data_central.getDataPtr(), extra_data_central.getDataSize());
+
+		if (rc == MZ_FALSE)
+		{
+			os_err = os_last_error_str();
+		}
+	}
+	else
+	{	
+		std::auto_ptr<IFsFile> add_file(Server->openFile(os_file_prefix(entry.filename), MODE_READ_SEQUENTIAL));
+		if (add_file.get() == NULL)
+		{
+			Server->Log("Error opening file \"" + entry.filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+		int64 fsize = add_file->Size();
+#ifndef _WIN32
+		int fd = add_file->getOsHandle(true);
+#else
+		int fd =_open_osfhandle(reinterpret_cast<intptr_t>(add_file->getOsHandle(true)), _O_RDONLY);
+		if (fd == -1)
+		{
+			Server->Log("Error opening file fd for \"" + entry.filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+#endif
+		add_file.reset();
+
+		FILE* file = _fdopen(fd, "r");
+		if (file != NULL)
+		{
+			rc = mz_zip_writer_add_cfile(&zip_archive, entry.archivename.c_str(), file, fsize, last_modified, NULL, 0,
+				level,
+				extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
+				extra_data_central.getDataPtr(), extra_data_central.getDataSize());
+
+			if (rc == MZ_FALSE)
+			{
+				os_err = os_last_error_str();
+			}
+
+			fclose(file);
+		}
+		else
+		{
+			Server->Log("Error opening FILE handle for \"" + entry.filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
+			_close(fd);
+			return false;
+		}
+	}
+
+	if(rc==MZ_FALSE)
+	{
+		return logError(entry.filename, os_err);
+	}
+
+	return true;
+}
+
+void ZipArchiveWriter::buildExtraData(const SArchiveEntry& entry, CWData& extra_data_local, CWData& extra_data_central)
+{
+	if (!entry.has_metadata)
+	{
+		return;
+	}
+
+	if (entry.created > 0)
+	{
+		//NTFS extra field
+		CWData ntfs_extra;
+		ntfs_extra.addUShort(0x000a);
+		ntfs_extra.addUShort(4 + 2 + 2 + 8 + 8 + 8);
+		ntfs_extra.addUInt(0);
+		ntfs_extra.addUShort(0x0001);
+		ntfs_extra.addUShort(3 * 8);
+		//TODO: Get higher resolution NTFS timestamps from metadata and use it here
+		ntfs_extra.addInt64(os_to_windows_filetime(entry.last_modified));
+		ntfs_extra.addInt64(os_to_windows_filetime(entry.accessed));
+		ntfs_extra.addInt64(os_to_windows_filetime(entry.created));
+
+		extra_data_local.addBuffer(ntfs_extra.getDataPtr(), ntfs_extra.getDataSize());
+		extra_data_central.addBuffer(ntfs_extra.getDataPtr(), ntfs_extra.getDataSize());
+	}
+
+	unsigned char flags = 0 << 1 | 1 << 1;
+	unsigned short local_size = 1 + sizeof(_u32) * 2;
+
+	if (entry.created > 0)
+	{
+		flags |= 1 << 2;
+		local_size += sizeof(_u32);
+	}
+
+	//Extended Timestamp Extra Field
+	extra_data_local.addUShort(0x5455);
+	extra_data_local.addUShort(local_size);
+	extra_data_local.addUChar(flags);
+	extra_data_local.addUInt(static_cast<_u32>(entry.last_modified));
+	extra_data_local.addUInt(static_cast<_u32>(entry.accessed));
+	if (entry.created>0)
+	{
+		extra_data_local.addUInt(static_cast<_u32>(entry.created));
+	}
+	
+	extra_data_central.addUShort(0x5455);
+	extra_data_central.addUShort(1 + sizeof(_u32));
+	extra_data_central.addUChar(flags);
+	extra_data_central.addUInt(static_cast<_u32>(entry.last_modified));
+
+	//TODO: ZIP has extensions for NTFS/Unix/MacOS attributes, symbolic links, NTFS ACL, ... use them
+}
+
+bool ZipArchiveWriter::logError(const std::string& filename, const std::string& os_err)
+{
+	mz_zip_error err = mz_zip_get_last_error(&zip_archive);
+	Server->Log("Error while adding file \""+filename+"\" to ZIP file. Error: "+mz_zip_get_error_string(err)+ (os_err.empty() ? "" : (". OS error: "+os_err)), LL_ERROR);
+	return false;
+}
+
+#ifndef NO_ZSTD_COMPRESSION
+/**
+* Writes a POSIX tar stream (ustar with pax headers for long names and
+* large files) compressed with zstd. Compression is parallelized by the
+* zstd worker threads, so entries are simply written in order.
+*/
+class TarZstdArchiveWriter : public IArchiveWriter
+{
+public:
+	TarZstdArchiveWriter(IArchiveOutput* output, size_t threads)
+		: output(output), threads(threads), cctx(NULL)
+	{
+	}
+
+	~TarZstdArchiveWriter()
+	{
+		if (cctx != NULL)
+		{
+			ZSTD_freeCCtx(cctx);
+		}
+	}
+
+	bool init()
+	{
+		cctx = ZSTD_createCCtx();
+		if (cctx == NULL)
+		{
+			Server->Log("Error creating zstd compression context for tar.zst download", LL_ERROR);
+			return false;
+		}
+
+		size_t err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, tar_zstd_level);
+		if (!ZSTD_isError(err) && threads > 1)
+		{
+			err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, static_cast<int>(threads));
+		}
+
+		if (ZSTD_isError(err))
+		{
+			Server->Log(std::string("Error setting up zstd compression for tar.zst download. ") + ZSTD_getErrorName(err), LL_ERROR);
+			return false;
+		}
+
+		out_buf.resize(ZSTD_CStreamOutSize());
+		return true;
+	}
+
+	virtual bool add(const SArchiveEntry& entry)
+	{
+		if (entry.isdir)
+		{
+			return writeHeader(entry.archivename + "/", '5', 0, entry.last_modified);
+		}
+
+		std::auto_ptr<IFile> f(Server->openFile(os_file_prefix(entry.filename), MODE_READ_SEQUENTIAL));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening file \"" + entry.filename + "\" for tar.zst download. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		int64 fsize = f->Size();
+		if (!writeHeader(entry.archivename, '0', fsize, entry.last_modified))
+		{
+			return false;
+		}
+
+		std::vector<char> buf(512 * 1024);
+		int64 written = 0;
+		while (written < fsize)
+		{
+			_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(buf.size()), fsize - written));
+			bool has_read_error = false;
+			_u32 read = f->Read(&buf[0], toread, &has_read_error);
+			if (has_read_error)
+			{
+				Server->Log("Error reading file \"" + entry.filename + "\" for tar.zst download. " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+
+			if (read == 0)
+			{
+				//File got shorter. The size in the header has to match.
+				read = toread;
+				memset(&buf[0], 0, read);
+			}
+
+			if (!compress(&buf[0], read, ZSTD_e_continue))
+			{
+				return false;
+			}
+
+			written += read;
+		}
+
+		return pad(fsize);
+	}
+
+	virtual bool finish()
+	{
+		char zeros[tar_block_size * 2] = {};
+		return compress(zeros, sizeof(zeros), ZSTD_e_continue)
+			&& compress(NULL, 0, ZSTD_e_end);
+	}
+
+private:
+	bool compress(const char* buf, size_t bsize, ZSTD_EndDirective mode)
+	{
+		ZSTD_inBuffer in = { buf, bsize, 0 };
+		while (true)
+		{
+			ZSTD_outBuffer out = { &out_buf[0], out_buf.size(), 0 };
+			size_t rc = ZSTD_compressStream2(cctx, &out, &in, mode);
+			if (ZSTD_isError(rc))
+			{
+				Server->Log(std::string("Error compressing tar.zst download. ") + ZSTD_getErrorName(rc), LL_ERROR);
+				return false;
+			}
+
+			if (out.pos > 0
+				&& !output->write(&out_buf[0], out.pos))
+			{
+				return false;
+			}
+
+			if (mode == ZSTD_e_end ? rc == 0 : in.pos == in.size)
+			{
+				return true;
+			}
+		}
+	}
+
+	bool pad(int64 size)
+	{
+		size_t rem = static_cast<size_t>(size % tar_block_size);
+		if (rem == 0)
+		{
+			return true;
+		}
+
+		char zeros[tar_block_size] = {};
+		return compress(zeros, tar_block_size - rem, ZSTD_e_continue);
+	}
+
+	static void setOctal(char* field, size_t field_size, int64 val)
+	{
+		for (size_t i = field_size - 1; i > 0; --i)
+		{
+			field[i - 1] = static_cast<char>('0' + (val & 7));
+			val >>= 3;
+		}
+		field[field_size - 1] = 0;
+	}
+
+	static void addPaxRecord(std::string& pax, const std::string& key, const std::string& value)
+	{
+		//Record length includes the length field itself
+		size_t len = key.size() + value.size() + 3;
+		size_t total = len + convert(len).size();
+		if (convert(total).size() != convert(len).size())
+		{
+			total = len + convert(total).size();
+		}
+		pax += convert(total) + " " + key + "=" + value + "\n";
+	}
+
+	bool writeHeader(const std::string& name, char typeflag, int64 size, int64 mtime)
+	{
+		const int64 max_octal_size = 077777777777LL;
+
+		std::string pax;
+		if (name.size() >= 100)
+		{
+			addPaxRecord(pax, "path", name);
+		}
+		if (size > max_octal_size)
+		{
+			addPaxRecord(pax, "size", convert(size));
+		}
+
+		if (!pax.empty())
+		{
+			if (!writeRawHeader("././@PaxHeader", 'x', pax.size(), mtime)
+				|| !compress(pax.data(), pax.size(), ZSTD_e_continue)
+				|| !pad(pax.size()))
+			{
+				return false;
+			}
+		}
+
+		return writeRawHeader(name.substr(0, 99), typeflag, (std::min)(size, max_octal_size), mtime);
+	}
+
+	bool writeRawHeader(const std::string& name, char typeflag, int64 size, int64 mtime)
+	{
+		char header[tar_block_size] = {};
+		memcpy(header, name.data(), (std::min)(name.size(), static_cast<size_t>(99)));
+		setOctal(header + 100, 8, typeflag == '5' ? 0755 : 0644);
+		setOctal(header + 108, 8, 0);
+		setOctal(header + 116, 8, 0);
+		setOctal(header + 124, 12, size);
+		setOctal(header + 136, 12, mtime > 0 ? mtime : 0);
+		header[156] = typeflag;
+		memcpy(header + 257, "ustar", 6);
+		memcpy(header + 263, "00", 2);
+
+		memset(header + 148, ' ', 8);
+		unsigned int chksum = 0;
+		for (size_t i = 0; i < tar_block_size; ++i)
+		{
+			chksum += static_cast<unsigned char>(header[i]);
+		}
+		setOctal(header + 148, 7, chksum);
+
+		return compress(header, tar_block_size, ZSTD_e_continue);
+	}
+
+	IArchiveOutput* output;
+	size_t threads;
+	ZSTD_CCtx* cctx;
+	std::vector<char> out_buf;
+};
+#endif //NO_ZSTD_COMPRESSION
+
+bool add_dir(IArchiveWriter& writer, const std::string& archivefoldername, const std::string& folderbase, const std::string& foldername, const std::string& start_foldername,
 	    const std::string& hashfolderbase, const std::string& hashfoldername, const std::string& filter,
 		bool token_authentication, const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_special)
 {
@@ -93,7 +839,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 	if (has_error)
 	{
-		Server->Log("Error while adding files to ZIP file. Error listing files in folder \""
+		Server->Log("Error while adding files to archive. Error listing files in folder \""
 			+ foldername+"\". " + os_last_error_str(), LL_ERROR);
 		return false;
 	}
@@ -180,7 +926,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 		FileMetadata metadata;
 		if(token_authentication &&
-			( !read_metadata(metadataname, metadata) ||
+			( !HashContainer::readMetadata(metadataname, metadata) ||
 			  !backupaccess::checkFileToken(backup_tokens, tokens, metadata) ) )
 		{
 			continue;
@@ -188,7 +934,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 		else if(!token_authentication
 			&& !metadataname.empty())
 		{
-			has_metadata = read_metadata(metadataname, metadata);
+			has_metadata = HashContainer::readMetadata(metadataname, metadata);
 		}
 		else
 		{
@@ -203,128 +949,18 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 			}
 		}
 
-		time_t* last_modified=NULL;
-		time_t last_modified_wt;
-		CWData extra_data_local;
-		CWData extra_data_central;
-		if(has_metadata)
-		{
-#ifdef _WIN32
-			last_modified_wt=static_cast<time_t>(metadata.last_modified);
-#else
-			last_modified_wt=static_cast<time_t>(metadata.last_modified);
-#endif
-			last_modified=&last_modified_wt;
-
-			if (metadata.created > 0)
-			{
-				//NTFS extra field
-				CWData ntfs_extra;
-				ntfs_extra.addUShort(0x000a);
-				ntfs_extra.addUShort(4 + 2 + 2 + 8 + 8 + 8);
-				ntfs_extra.addUInt(0);
-				ntfs_extra.addUShort(0x0001);
-				ntfs_extra.addUShort(3 * 8);
-				//TODO: Get higher resolution NTFS timestamps from metadata and use it here
-				ntfs_extra.addInt64(os_to_windows_filetime(metadata.last_modified));
-				ntfs_extra.addInt64(os_to_windows_filetime(metadata.accessed));
-				ntfs_extra.addInt64(os_to_windows_filetime(metadata.created));
-
-				extra_data_local.addBuffer(ntfs_extra.getDataPtr(), ntfs_extra.getDataSize());
-				extra_data_central.addBuffer(ntfs_extra.getDataPtr(), ntfs_extra.getDataSize());
-			}
-
-			unsigned char flags = 0 << 1 | 1 << 1;
-			unsigned short local_size = 1 + sizeof(_u32) * 2;
-
-			if (metadata.created > 0)
-			{
-				flags |= 1 << 2;
-				local_size += sizeof(_u32);
-			}
-
-			//Extended Timestamp Extra Field
-			extra_data_local.addUShort(0x5455);
-			extra_data_local.addUShort(local_size);
-			extra_data_local.addUChar(flags);
-			extra_data_local.addUInt(static_cast<_u32>(metadata.last_modified));
-			extra_data_local.addUInt(static_cast<_u32>(metadata.accessed));
-			if (metadata.created>0)
-			{
-				extra_data_local.addUInt(static_cast<_u32>(metadata.created));
-			}
-			
-			extra_data_central.addUShort(0x5455);
-			extra_data_central.addUShort(1 + sizeof(_u32));
-			extra_data_central.addUChar(flags);
-			extra_data_central.addUInt(static_cast<_u32>(metadata.last_modified));
-		}
-
-		//TODO: ZIP has extensions for NTFS/Unix/MacOS attributes, symbolic links, NTFS ACL, ... use them
-
-		std::string os_err;
+		SArchiveEntry entry;
+		entry.archivename = archivename;
+		entry.filename = filename;
+		entry.isdir = file.isdir;
+		entry.has_metadata = has_metadata;
+		entry.size = file.isdir ? 0 : file.size;
+		entry.last_modified = has_metadata ? metadata.last_modified : 0;
+		entry.accessed = has_metadata ? metadata.accessed : 0;
+		entry.created = has_metadata ? metadata.created : 0;
 
-		mz_bool rc;
-		if(file.isdir)
+		if (!writer.add(entry))
 		{
-			rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, (archivename + "/").c_str(), NULL, 0, NULL, 0,
-											MZ_DEFAULT_LEVEL,
-											0, 0, last_modified, extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
-											extra_data_central.getDataPtr(), extra_data_central.getDataSize());
-
-			if (rc == MZ_FALSE)
-			{
-				os_err = os_last_error_str();
-			}
-		}
-		else
-		{	
-			std::auto_ptr<IFsFile> add_file(Server->openFile(os_file_prefix(filename), MODE_READ_SEQUENTIAL));
-			if (add_file.get() == NULL)
-			{
-				Server->Log("Error opening file \"" + filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
-				return false;
-			}
-			int64 fsize = add_file->Size();
-#ifndef _WIN32
-			int fd = add_file->getOsHandle(true);
-#else
-			int fd =_open_osfhandle(reinterpret_cast<intptr_t>(add_file->getOsHandle(true)), _O_RDONLY);
-			if (fd == -1)
-			{
-				Server->Log("Error opening file fd for \"" + filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
-				return false;
-			}
-#endif
-			add_file.reset();
-
-			FILE* file = _fdopen(fd, "r");
-			if (file != NULL)
-			{
-				rc = mz_zip_writer_add_cfile(&zip_archive, archivename.c_str(), file, fsize, last_modified, NULL, 0,
-					MZ_DEFAULT_LEVEL,
-					extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
-					extra_data_central.getDataPtr(), extra_data_central.getDataSize());
-
-				if (rc == MZ_FALSE)
-				{
-					os_err = os_last_error_str();
-				}
-
-				fclose(file);
-			}
-			else
-			{
-				Server->Log("Error opening FILE handle for \"" + filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
-				_close(fd);
-				return false;
-			}
-		}
-
-		if(rc==MZ_FALSE)
-		{
-			mz_zip_error err = mz_zip_get_last_error(&zip_archive);
-			Server->Log("Error while adding file \""+filename+"\" to ZIP file. Error: "+mz_zip_get_error_string(err)+ (os_err.empty() ? "" : (". OS error: "+os_err)), LL_ERROR);
 			return false;
 		}
 
@@ -348,7 +984,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 			if (!symlink_loop && symlink_outside)
 			{
-				if (!add_dir(zip_archive, archivename, folderbase, filename, start_foldername, hashfolderbase, next_hashfoldername, filter,
+				if (!add_dir(writer, archivename, folderbase, filename, start_foldername, hashfolderbase, next_hashfoldername, filter,
 								token_authentication, backup_tokens, tokens, false))
 				{
 					return false;
@@ -359,7 +995,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 				if(symlink_loop)
 					Server->Log("Not following looping symbolic link at \"" + orig_filename + "\" to \""+filename+"\"", LL_INFO);
 				else if(!symlink_outside)
-					Server->Log("Not following symbolic link at \"" + orig_filename + "\" to \""+filename+"\" because its contents are already in the ZIP file", LL_INFO);
+					Server->Log("Not following symbolic link at \"" + orig_filename + "\" to \""+filename+"\" because its contents are already in the archive", LL_INFO);
 			}
 		}
 	}
@@ -369,42 +1005,92 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 }
 
-bool create_zip_to_output(const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase,
-	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
-	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes)
+EArchiveFormat archive_format_from_str(const std::string& str)
 {
-	mz_zip_archive zip_archive;
-	memset(&zip_archive, 0, sizeof(zip_archive));
-
-	MiniZFileInfo file_info = {};
-
-	file_info.tid=Server->getThreadID();
-	file_info.last_writetime = Server->getTimeMS();
+	if (str == "zip_store")
+	{
+		return EArchiveFormat_ZipStore;
+	}
+#ifndef NO_ZSTD_COMPRESSION
+	else if (str == "tar.zst")
+	{
+		return EArchiveFormat_TarZstd;
+	}
+#endif
+	return EArchiveFormat_Zip;
+}
 
-	if(!my_miniz_init(&zip_archive, &file_info))
+std::string archive_format_extension(EArchiveFormat format)
+{
+	if (format == EArchiveFormat_TarZstd)
 	{
-		Server->Log("Error while initializing ZIP archive", LL_ERROR);
-		return false;
+		return ".tar.zst";
 	}
+	return ".zip";
+}
 
-	if(!add_dir(zip_archive, "", folderbase, foldername, foldername, hashfolderbase,
-		hashfoldername, filter, token_authentication, backup_tokens, tokens, skip_hashes))
+size_t archive_compression_threads()
+{
+	std::string threads = Server->getServerParameter("archive_download_threads");
+	if (!threads.empty())
 	{
-		Server->Log("Error while adding files and folders to ZIP archive", LL_ERROR);
-		return false;
+		return (std::max)(1, watoi(threads));
 	}
+	//Downloads share the compression threads, so a few are enough
+	return (std::max)(static_cast<size_t>(2), (std::min)(static_cast<size_t>(4), os_get_num_cpus()));
+}
 
-	if(!mz_zip_writer_finalize_archive(&zip_archive))
+void archive_init_mutex()
+{
+	ZipCompressPool::init_mutex();
+}
+
+bool create_archive(IArchiveOutput* output, EArchiveFormat format, size_t threads,
+	const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase,
+	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
+	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes)
+{
+	std::auto_ptr<IArchiveWriter> writer;
+
+#ifndef NO_ZSTD_COMPRESSION
+	if (format == EArchiveFormat_TarZstd)
 	{
-		Server->Log("Error while finalizing ZIP archive", LL_ERROR);
-		return false;
+		TarZstdArchiveWriter* tar_writer = new TarZstdArchiveWriter(output, threads);
+		writer.reset(tar_writer);
+		if (!tar_writer->init())
+		{
+			return false;
+		}
+	}
+	else
+#endif
+	{
+		ZipArchiveWriter* zip_writer = new ZipArchiveWriter(output,
+			format == EArchiveFormat_ZipStore ? MZ_NO_COMPRESSION : MZ_DEFAULT_LEVEL, threads);
+		writer.reset(zip_writer);
+		if (!zip_writer->init())
+		{
+			return false;
+		}
 	}
 
-	if(!mz_zip_writer_end(&zip_archive))
+	if(!add_dir(*writer, "", folderbase, foldername, foldername, hashfolderbase,
+		hashfoldername, filter, token_authentication, backup_tokens, tokens, skip_hashes))
 	{
-		Server->Log("Error while ending ZIP archive writer", LL_ERROR);
+		Server->Log("Error while adding files and folders to archive", LL_ERROR);
 		return false;
 	}
 
-	return true;
-}
\ No newline at end of file
+	return writer->finish();
+}
+
+bool create_zip_to_output(const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase,
+	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
+	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes,
+	EArchiveFormat format)
+{
+	HttpArchiveOutput output;
+
+	return create_archive(&output, format, archive_compression_threads(), folderbase, foldername,
+		hashfolderbase, hashfoldername, filter, token_authentication, backup_tokens, tokens, skip_hashes);
+}
@@ -0,0 +1,60 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+
+#include "backups.h"
+#include <string>
+#include <vector>
+
+enum EArchiveFormat
+{
+	EArchiveFormat_Zip,
+	EArchiveFormat_ZipStore,
+	EArchiveFormat_TarZstd
+};
+
+class IArchiveOutput
+{
+public:
+	virtual bool write(const char* buf, size_t bsize) = 0;
+};
+
+EArchiveFormat archive_format_from_str(const std::string& str);
+
+std::string archive_format_extension(EArchiveFormat format);
+
+size_t archive_compression_threads();
+
+void archive_init_mutex();
+
+/**
+* Streams an archive of foldername to output. Zip entries are deflated by
+* worker threads shared by all downloads (started up to "threads") and
+* written in directory order, tar.zst is compressed with "threads" zstd
+* workers.
+*/
+bool create_archive(IArchiveOutput* output, EArchiveFormat format, size_t threads,
+	const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase,
+	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
+	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes);
+
+bool create_zip_to_output(const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase,
+	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
+	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes,
+	EArchiveFormat format);
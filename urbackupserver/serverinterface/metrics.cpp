@@ -0,0 +1,48 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef CLIENT_ONLY
+
+#include "action_header.h"
+#include "../PerfCounters.h"
+
+ACTION_IMPL(metrics)
+{
+	std::string metrics_token = Server->getServerParameter("metrics_token");
+
+	bool has_access = !metrics_token.empty() && GET["token"] == metrics_token;
+
+	if (!has_access)
+	{
+		Helper helper(tid, &POST, &PARAMS);
+		SUser *session = helper.getSession();
+		has_access = session != NULL && helper.getRights("all") == "all";
+	}
+
+	if (!has_access)
+	{
+		Server->setContentType(tid, "text/plain");
+		Server->Write(tid, "Access denied\n");
+		return;
+	}
+
+	Server->setContentType(tid, "text/plain; version=0.0.4");
+	Server->Write(tid, PerfCounters::getOpenMetrics());
+}
+
+#endif //CLIENT_ONLY
@@ -0,0 +1,136 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef CLIENT_ONLY
+
+#include "action_header.h"
+#include "../PathIndex.h"
+#include "../FileBackup.h"
+#include "../server_log.h"
+
+namespace
+{
+	const size_t search_default_limit = 1000;
+	const size_t search_max_limit = 100000;
+}
+
+ACTION_IMPL(search)
+{
+	Helper helper(tid, &POST, &PARAMS);
+
+	JSON::Object ret;
+	SUser *session=helper.getSession();
+	if(session!=NULL && session->id==SESSION_ID_INVALID) return;
+
+	std::string rights=helper.getRights("browse_backups");
+	std::vector<int> clientid=helper.getRightIDs(rights);
+	int t_clientid=watoi(POST["clientid"]);
+	std::string pattern=POST["q"];
+
+	if(session==NULL || rights=="none" || rights=="tokens"
+		|| !helper.hasRights(t_clientid, rights, clientid))
+	{
+		ret.set("error", 1);
+		helper.Write(ret.stringify(false));
+		return;
+	}
+
+	if(pattern.empty())
+	{
+		ret.set("error", 2);
+		helper.Write(ret.stringify(false));
+		return;
+	}
+
+	size_t limit=search_default_limit;
+	if(POST.find("limit")!=POST.end())
+	{
+		limit=(std::min)(static_cast<size_t>(watoi(POST["limit"])), search_max_limit);
+	}
+	bool case_sensitive=POST["case_sensitive"]=="1";
+	int only_backupid=POST.find("backupid")!=POST.end() ? watoi(POST["backupid"]) : 0;
+
+	IDatabase *db=helper.getDatabase();
+	IQuery *q=db->Prepare("SELECT id, strftime('"+helper.getTimeFormatString()+"', backuptime) AS backuptime, path FROM backups WHERE complete=1 AND done=1 AND clientid=? ORDER BY backuptime DESC");
+	q->Bind(t_clientid);
+	db_results res=q->Read();
+	q->Reset();
+
+	JSON::Array backups;
+	size_t num_matches=0;
+	bool truncated=false;
+	for(size_t i=0;i<res.size() && !truncated;++i)
+	{
+		int backupid=watoi(res[i]["id"]);
+		if(only_backupid!=0 && backupid!=only_backupid)
+		{
+			continue;
+		}
+
+		PathIndex path_index;
+		if(!path_index.open(backupid))
+		{
+			std::string clientlist_fn=FileBackup::clientlistName(backupid);
+			if(!Server->fileExists(clientlist_fn)
+				|| !PathIndex::build(clientlist_fn, backupid, logid_t())
+				|| !path_index.open(backupid))
+			{
+				continue;
+			}
+		}
+
+		std::vector<PathIndex::SEntry> matches;
+		if(!path_index.search(pattern, case_sensitive, limit-num_matches, matches, truncated))
+		{
+			Server->Log("Error reading path index of backup "+convert(backupid), LL_WARNING);
+			continue;
+		}
+
+		if(matches.empty())
+		{
+			continue;
+		}
+
+		JSON::Array files;
+		for(size_t j=0;j<matches.size();++j)
+		{
+			JSON::Object obj;
+			obj.set("path", matches[j].path);
+			obj.set("dir", matches[j].isdir);
+			obj.set("size", matches[j].size);
+			obj.set("mod", matches[j].last_modified);
+			files.add(obj);
+		}
+		num_matches+=matches.size();
+
+		JSON::Object backup;
+		backup.set("id", backupid);
+		backup.set("backuptime", watoi64(res[i]["backuptime"]));
+		backup.set("path", res[i]["path"]);
+		backup.set("files", files);
+		backups.add(backup);
+	}
+
+	ret.set("clientid", t_clientid);
+	ret.set("backups", backups);
+	ret.set("truncated", truncated);
+
+	helper.Write(ret.stringify(false));
+}
+
+#endif //CLIENT_ONLY
@@ -25,6 +25,7 @@
 #include "../../cryptoplugin/ICryptoFactory.h"
 #include "../server.h"
 #include "../ClientMain.h"
+#include "../BandwidthScheduler.h"
 #include "../dao/ServerBackupDao.h"
 
 #include <algorithm>
@@ -348,6 +349,12 @@ ACTION_IMPL(status)
 
 		std::vector<SStatus> client_status=ServerStatus::getStatus();
 
+		std::map<int, BandwidthScheduler::SClientRate> client_rates;
+		if(BandwidthScheduler::getInstance()!=NULL)
+		{
+			client_rates=BandwidthScheduler::getInstance()->getClientRates();
+		}
+
 		for(size_t i=0;i<res.size();++i)
 		{
 			JSON::Object stat;
@@ -454,6 +461,14 @@ ACTION_IMPL(status)
 			stat.set("processes", processes);
 			stat.set("lastseen", lastseen);
 
+			std::map<int, BandwidthScheduler::SClientRate>::iterator it_rate=client_rates.find(clientid);
+			if(it_rate!=client_rates.end())
+			{
+				stat.set("bw_rate", it_rate->second.rate_bps);
+				stat.set("bw_alloc", it_rate->second.alloc_bps);
+				stat.set("bw_limited", it_rate->second.limited);
+			}
+
 			status.add(stat);
 		}
 
@@ -18,7 +18,7 @@
 (function(){dust.register("has_ident_error_clients",body_0);function body_0(chk,ctx){return chk.f(ctx.get(["tThis server has discovered clients which are currently not configured to use this server."], false),ctx,"h").w(" <a href=\"help.htm#ident_err\" target=\"_blank\">").f(ctx.get(["tSee here for details on how this can happen."], false),ctx,"h").w("</a><br /><br />").x(ctx.get(["stop_show_key"], false),ctx,{"block":body_1},{});}body_0.__dustBody=!0;function body_1(chk,ctx){return chk.w("<a href=\"javascript: stopShowError('").f(ctx.get(["stop_show_key"], false),ctx,"h").w("')\">").f(ctx.get(["tOk. Dismiss this hint."], false),ctx,"h").w("</a>");}body_1.__dustBody=!0;return body_0;})();
 (function(){dust.register("lastacts_row",body_0);function body_0(chk,ctx){return chk.w("<tr><td>").f(ctx.get(["id"], false),ctx,"h").w("</td><td>").f(ctx.get(["name"], false),ctx,"h").w("</td><td>").f(ctx.get(["action"], false),ctx,"h").w("</td><td>").x(ctx.get(["is_image"], false),ctx,{"else":body_1,"block":body_4},{}).w("</td><td>").f(ctx.get(["backuptime"], false),ctx,"h").w("</td><td>").f(ctx.get(["duration"], false),ctx,"h").w("</td><td>").f(ctx.get(["size"], false),ctx,"h").w("</td></tr>");}body_0.__dustBody=!0;function body_1(chk,ctx){return chk.x(ctx.get(["file_restore"], false),ctx,{"else":body_2,"block":body_3},{});}body_1.__dustBody=!0;function body_2(chk,ctx){return chk.w("-");}body_2.__dustBody=!0;function body_3(chk,ctx){return chk.w("Path: ").f(ctx.get(["details"], false),ctx,"h",["s"]);}body_3.__dustBody=!0;function body_4(chk,ctx){return chk.w("Volume: ").f(ctx.get(["details"], false),ctx,"h");}body_4.__dustBody=!0;return body_0;})();
 (function(){dust.register("client_added",body_0);function body_0(chk,ctx){return chk.w("<div class=\"panel panel-default\"><div class=\"panel-heading\">").f(ctx.get(["tClient added successfully"], false),ctx,"h").w("</div><div class=\"panel-body\"><p>").f(ctx.get(["tAdded new client with name:"], false),ctx,"h").w(" ").f(ctx.get(["new_clientname"], false),ctx,"h").w("</p><p>").f(ctx.get(["tDefault authentication key:"], false),ctx,"h").w(" ").f(ctx.get(["new_authkey"], false),ctx,"h").w("</p><p><ul><li><a href=\"#\" onClick=\"javascript: downloadClient(").f(ctx.get(["new_clientid"], false),ctx,"h").w(", '").f(ctx.get(["new_authkey"], false),ctx,"h").w("', 'windows')\">").f(ctx.get(["tDownload preconfigured client installer for Windows"], false),ctx,"h").w("</a></li><li><a href=\"#\" onClick=\"javascript: downloadClient(").f(ctx.get(["new_clientid"], false),ctx,"h").w(", '").f(ctx.get(["new_authkey"], false),ctx,"h").w("', 'linux')\">").f(ctx.get(["tDownload preconfigured client installer for Linux"], false),ctx,"h").w("</a><p>").f(ctx.get(["tInstall it directly in the terminal via:"], false),ctx,"h").w("<blockquote><p><code>TF=`mktemp` && wget \"").f(ctx.get(["linux_url"], false),ctx,"h").w("\" -O $TF && sudo sh $TF; rm -f $TF</code></p></blockquote>").f(ctx.get(["tWith Docker (web interface accessible from client):"], false),ctx,"h").w("<blockquote><p><code>RUN TF=`mktemp` &&\\<br>wget \"").f(ctx.get(["linux_url"], false),ctx,"h").w("\" -O $TF &&\\<br>sh $TF &&\\<br>rm -f $TF &&\\<br>( [ ! -e /etc/default/urbackupclient ] || sed -i 's/INTERNET_ONLY=false/INTERNET_ONLY=true/' /etc/default/urbackupclient ) &&\\<br>( [ ! -e /etc/sysconfig/urbackupclient ] || sed -i 's/INTERNET_ONLY=false/INTERNET_ONLY=true/' /etc/sysconfig/urbackupclient )</code></p></blockquote>").f(ctx.get(["tWith Docker (web interface not accessible from client):"], false),ctx,"h").w("<blockquote><p><code>RUN TF=`mktemp` &&\\<br>wget \"https://hndl.urbackup.org/Client/latest/update/UrBackupUpdateLinux.sh\" -O $TF &&\\<br>sh $TF &&\\<br>rm -f $TF &&\\<br>urbackupclientctl wait-for-backend &&\\<br>urbackupclientctl set-settings -k internet_mode_enabled -v true -k internet_server -v ").f(ctx.get(["internet_server"], false),ctx,"h").w(" -k internet_server_port -v ").f(ctx.get(["internet_server_port"], false),ctx,"h").w(" -k computername -v \"").f(ctx.get(["new_clientname"], false),ctx,"h").w("\" -k internet_authkey -v ").f(ctx.get(["new_authkey"], false),ctx,"h").f(ctx.get(["internet_proxy_settings"], false),ctx,"h").w(" &&\\<br>( [ ! -e /etc/default/urbackupclient ] || sed -i 's/INTERNET_ONLY=false/INTERNET_ONLY=true/' /etc/default/urbackupclient ) &&\\<br>( [ ! -e /etc/sysconfig/urbackupclient ] || sed -i 's/INTERNET_ONLY=false/INTERNET_ONLY=true/' /etc/sysconfig/urbackupclient )</code></p></blockquote></p></li><li><p>").f(ctx.get(["tAlternatively after you installed the client from:"], false),ctx,"h").w(" <a href=\"https://www.urbackup.org/download.html\" target=\"_blank\">https://www.urbackup.org/download.html</a></p><p><ul><li>").f(ctx.get(["tGo to the settings screen on the client"], false),ctx,"h").w("</li><li>").f(ctx.get(["tEnable the internet mode on the client"], false),ctx,"h").w("</li><li>").f(ctx.get(["tSet the internet server to:"], false),ctx,"h").w(" ").f(ctx.get(["internet_server"], false),ctx,"h").w("</li><li>").f(ctx.get(["tSet the internet server port to:"], false),ctx,"h").w(" ").f(ctx.get(["internet_server_port"], false),ctx,"h").w("</li><li>").f(ctx.get(["tSet the computer name to:"], false),ctx,"h").w(" ").f(ctx.get(["new_clientname"], false),ctx,"h").w("</li><li>").f(ctx.get(["tSet the authentication key to:"], false),ctx,"h").w(" ").f(ctx.get(["new_authkey"], false),ctx,"h").w("</li><li>").f(ctx.get(["tWithout firewall/NAT: Enable internet only mode if you only plan to use the client via internet. On Linux by changing INTERNET_ONLY to true in /etc/default/urbackupclient or /etc/sysconfig/urbackupclient"], false),ctx,"h").w("</li></ul></p><p>").f(ctx.get(["tWith the command line:"], false),ctx,"h").w("<blockquote><p><code>urbackupclientctl wait-for-backend<br>urbackupclientctl set-settings -k internet_mode_enabled -v true -k internet_server -v ").f(ctx.get(["internet_server"], false),ctx,"h").w(" -k internet_server_port -v ").f(ctx.get(["internet_server_port"], false),ctx,"h").w(" -k computername -v \"").f(ctx.get(["new_clientname"], false),ctx,"h").w("\" -k internet_authkey -v ").f(ctx.get(["new_authkey"], false),ctx,"h").f(ctx.get(["internet_proxy_settings"], false),ctx,"h").w("<br>[ ! -e /etc/default/urbackupclient ] || sed -i 's/INTERNET_ONLY=false/INTERNET_ONLY=true/' /etc/default/urbackupclient<br>[ ! -e /etc/sysconfig/urbackupclient ] || sed -i 's/INTERNET_ONLY=false/INTERNET_ONLY=true/' /etc/sysconfig/urbackupclient</code></p></blockquote></p></li></ul></p></div></div>");}body_0.__dustBody=!0;return body_0;})();
-(function(){dust.register("backups_files",body_0);function body_0(chk,ctx){return chk.w("<div class=\"panel panel-default\"><div class=\"panel-heading\">").x(ctx.get(["show_client_breadcrumb"], false),ctx,{"block":body_1},{}).w("<a href=\"javascript: tabMouseClickClients(").f(ctx.get(["clientid"], false),ctx,"h").w(")\">").f(ctx.get(["clientname"], false),ctx,"h").w("</a> > ").f(ctx.get(["cpath"], false),ctx,"h",["s"]).w("</div><div class=\"panel-body\">").s(ctx.get(["image_backup_info"], false),ctx,{"block":body_2},{}).x(ctx.get(["can_mount"], false),ctx,{"else":body_4,"block":body_11},{}).x(ctx.get(["download_zip"], false),ctx,{"block":body_13},{}).x(ctx.get(["can_restore"], false),ctx,{"block":body_14},{}).w("</div></div>");}body_0.__dustBody=!0;function body_1(chk,ctx){return chk.w("<a href=\"javascript: show_backups1()\">").f(ctx.get(["tClients"], false),ctx,"h").w("</a> >");}body_1.__dustBody=!0;function body_2(chk,ctx){return chk.w("<div class=\"panel panel-default\"><div class=\"panel-heading\">").f(ctx.get(["tImage backup information"], false),ctx,"h").w("</div><div class=\"panel-body\"><div class=\"row\"><div style=\"float:left; margin-right: 40px; margin-left:10px\"><strong>").f(ctx.get(["tId"], false),ctx,"h").w(": </strong>").f(ctx.get(["id"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tBackup time"], false),ctx,"h").w(": </strong>").f(ctx.get(["backuptime"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tIncremental"], false),ctx,"h").w(": </strong>").f(ctx.get(["incr"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tSize"], false),ctx,"h").w(": </strong>").f(ctx.get(["size_bytes"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tVolume"], false),ctx,"h").w(": </strong>").f(ctx.get(["letter"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tArchived"], false),ctx,"h").w(": </strong>").f(ctx.get(["archived"], false),ctx,"h",["s"]).w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tVolume size"], false),ctx,"h").w(": </strong>").f(ctx.get(["volume_size"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tPartition style"], false),ctx,"h").w(": </strong>").f(ctx.get(["part_table"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tDisk number"], false),ctx,"h").w(": </strong>").f(ctx.get(["disk_number"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tPartition number"], false),ctx,"h").w(": </strong>").f(ctx.get(["partition_number"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tFile system type"], false),ctx,"h").w(": </strong>").f(ctx.get(["fs_type"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tVolume name"], false),ctx,"h").w(": </strong>").f(ctx.get(["volume_name"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tSerial number"], false),ctx,"h").w(": </strong>").f(ctx.get(["serial_number"], false),ctx,"h").w("</div></div>").x(ctx.get(["linux_image_restore"], false),ctx,{"block":body_3},{}).w("</div></div>");}body_2.__dustBody=!0;function body_3(chk,ctx){return chk.w("<br><a class=\"btn btn-default\" href=\"#\" onClick=\"tabMouseClickLinuxImageRestore(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w("*-1); return false\">").f(ctx.get(["tRestore Linux image"], false),ctx,"h").w("</a>");}body_3.__dustBody=!0;function body_4(chk,ctx){return chk.nx(ctx.get(["no_files"], false),ctx,{"block":body_5},{});}body_4.__dustBody=!0;function body_5(chk,ctx){return chk.x(ctx.get(["mount_failed"], false),ctx,{"else":body_6,"block":body_10},{});}body_5.__dustBody=!0;function body_6(chk,ctx){return chk.w("<table class=\"table table-hover\"><thead><tr><th style=\"width: 25px\" class=\"tabHeader\">&nbsp;</th><th style=\"width: 100%\" class=\"tabHeader\">").f(ctx.get(["tFile"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tSize"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tCreated"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tLast modified"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tLast accessed"], false),ctx,"h").w("</th><th class=\"tabHeader\">&nbsp;</th></tr></thead><tbody>").s(ctx.get(["files"], false),ctx,{"block":body_7},{}).w("</tbody></table>");}body_6.__dustBody=!0;function body_7(chk,ctx){return chk.w("<tr><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer\">&nbsp;</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer\">").f(ctx.get(["name"], false),ctx,"h",["s"]).w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["size"], false),ctx,"h").w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["creat"], false),ctx,"h").w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["mod"], false),ctx,"h").w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["access"], false),ctx,"h").w("</td><td style=\"white-space: nowrap;\">").x(ctx.get(["list_items"], false),ctx,{"block":body_8},{}).x(ctx.get(["can_restore"], false),ctx,{"block":body_9},{}).w("</td><td></tr>");}body_7.__dustBody=!0;function body_8(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("Access(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h",["j"]).w("'); return false\">").f(ctx.get(["tList"], false),ctx,"h").w("</a>");}body_8.__dustBody=!0;function body_9(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"restoreFiles(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w(", '").f(ctx.get(["folder_path"], false),ctx,"h",["j"]).w("', ").f(ctx.get(["server_confirms_restore"], false),ctx,"h").w(", '").f(ctx.get(["name"], false),ctx,"h",["s","j"]).w("'); return false\">").f(ctx.get(["tRestore"], false),ctx,"h").w("</a>");}body_9.__dustBody=!0;function body_10(chk,ctx){return chk.w("<div class=\"alert alert-danger\">").f(ctx.get(["tMounting image failed. Please see server log file for details."], false),ctx,"h").w("<br>").f(ctx.get(["mount_errmsg"], false),ctx,"h").w("</div>");}body_10.__dustBody=!0;function body_11(chk,ctx){return chk.w("<br><br><div class=\"text-center\"><a class=\"btn btn-default\" href=\"#\" onClick=\"tabMouseClickFiles(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("', true); return false\">").f(ctx.get(["tMount image"], false),ctx,"h").w("</a>").x(ctx.get(["os_mount"], false),ctx,{"block":body_12},{}).w("</div>");}body_11.__dustBody=!0;function body_12(chk,ctx){return chk.w("<br><font color=\"red\">").f(ctx.get(["tUrBackup will use non-sandboxed server operating system functionality to mount the image. Only mount the image if you trust its source."], false),ctx,"h").w("</font>");}body_12.__dustBody=!0;function body_13(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"downloadZIP(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w(", '").f(ctx.get(["path"], false),ctx,"h",["j"]).w("'); return false\">").f(ctx.get(["tDownload folder as ZIP"], false),ctx,"h").w("</a>");}body_13.__dustBody=!0;function body_14(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"restoreFiles(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h",["j"]).w("', ").f(ctx.get(["server_confirms_restore"], false),ctx,"h").w("); return false\">").f(ctx.get(["tRestore folder to client"], false),ctx,"h").w("</a>");}body_14.__dustBody=!0;return body_0;})();
+(function(){dust.register("backups_files",body_0);function body_0(chk,ctx){return chk.w("<div class=\"panel panel-default\"><div class=\"panel-heading\">").x(ctx.get(["show_client_breadcrumb"], false),ctx,{"block":body_1},{}).w("<a href=\"javascript: tabMouseClickClients(").f(ctx.get(["clientid"], false),ctx,"h").w(")\">").f(ctx.get(["clientname"], false),ctx,"h").w("</a> > ").f(ctx.get(["cpath"], false),ctx,"h",["s"]).w("</div><div class=\"panel-body\">").s(ctx.get(["image_backup_info"], false),ctx,{"block":body_2},{}).x(ctx.get(["can_mount"], false),ctx,{"else":body_4,"block":body_11},{}).x(ctx.get(["download_zip"], false),ctx,{"block":body_13},{}).x(ctx.get(["can_restore"], false),ctx,{"block":body_14},{}).w("</div></div>");}body_0.__dustBody=!0;function body_1(chk,ctx){return chk.w("<a href=\"javascript: show_backups1()\">").f(ctx.get(["tClients"], false),ctx,"h").w("</a> >");}body_1.__dustBody=!0;function body_2(chk,ctx){return chk.w("<div class=\"panel panel-default\"><div class=\"panel-heading\">").f(ctx.get(["tImage backup information"], false),ctx,"h").w("</div><div class=\"panel-body\"><div class=\"row\"><div style=\"float:left; margin-right: 40px; margin-left:10px\"><strong>").f(ctx.get(["tId"], false),ctx,"h").w(": </strong>").f(ctx.get(["id"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tBackup time"], false),ctx,"h").w(": </strong>").f(ctx.get(["backuptime"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tIncremental"], false),ctx,"h").w(": </strong>").f(ctx.get(["incr"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tSize"], false),ctx,"h").w(": </strong>").f(ctx.get(["size_bytes"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tVolume"], false),ctx,"h").w(": </strong>").f(ctx.get(["letter"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tArchived"], false),ctx,"h").w(": </strong>").f(ctx.get(["archived"], false),ctx,"h",["s"]).w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tVolume size"], false),ctx,"h").w(": </strong>").f(ctx.get(["volume_size"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tPartition style"], false),ctx,"h").w(": </strong>").f(ctx.get(["part_table"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tDisk number"], false),ctx,"h").w(": </strong>").f(ctx.get(["disk_number"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tPartition number"], false),ctx,"h").w(": </strong>").f(ctx.get(["partition_number"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tFile system type"], false),ctx,"h").w(": </strong>").f(ctx.get(["fs_type"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tVolume name"], false),ctx,"h").w(": </strong>").f(ctx.get(["volume_name"], false),ctx,"h").w("</div><div style=\"float:left; margin-right: 40px\"><strong>").f(ctx.get(["tSerial number"], false),ctx,"h").w(": </strong>").f(ctx.get(["serial_number"], false),ctx,"h").w("</div></div>").x(ctx.get(["linux_image_restore"], false),ctx,{"block":body_3},{}).w("</div></div>");}body_2.__dustBody=!0;function body_3(chk,ctx){return chk.w("<br><a class=\"btn btn-default\" href=\"#\" onClick=\"tabMouseClickLinuxImageRestore(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w("*-1); return false\">").f(ctx.get(["tRestore Linux image"], false),ctx,"h").w("</a>");}body_3.__dustBody=!0;function body_4(chk,ctx){return chk.nx(ctx.get(["no_files"], false),ctx,{"block":body_5},{});}body_4.__dustBody=!0;function body_5(chk,ctx){return chk.x(ctx.get(["mount_failed"], false),ctx,{"else":body_6,"block":body_10},{});}body_5.__dustBody=!0;function body_6(chk,ctx){return chk.w("<table class=\"table table-hover\"><thead><tr><th style=\"width: 25px\" class=\"tabHeader\">&nbsp;</th><th style=\"width: 100%\" class=\"tabHeader\">").f(ctx.get(["tFile"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tSize"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tCreated"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tLast modified"], false),ctx,"h").w("</th><th class=\"tabHeader\" style=\"white-space: nowrap;\">").f(ctx.get(["tLast accessed"], false),ctx,"h").w("</th><th class=\"tabHeader\">&nbsp;</th></tr></thead><tbody>").s(ctx.get(["files"], false),ctx,{"block":body_7},{}).w("</tbody></table>");}body_6.__dustBody=!0;function body_7(chk,ctx){return chk.w("<tr><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer\">&nbsp;</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer\">").f(ctx.get(["name"], false),ctx,"h",["s"]).w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["size"], false),ctx,"h").w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["creat"], false),ctx,"h").w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["mod"], false),ctx,"h").w("</td><td onclick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("')\" style=\"cursor: pointer;white-space: nowrap;\">").f(ctx.get(["access"], false),ctx,"h").w("</td><td style=\"white-space: nowrap;\">").x(ctx.get(["list_items"], false),ctx,{"block":body_8},{}).x(ctx.get(["can_restore"], false),ctx,{"block":body_9},{}).w("</td><td></tr>");}body_7.__dustBody=!0;function body_8(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"tabMouseClick").f(ctx.get(["proc"], false),ctx,"h").w("Access(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h",["j"]).w("'); return false\">").f(ctx.get(["tList"], false),ctx,"h").w("</a>");}body_8.__dustBody=!0;function body_9(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"restoreFiles(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w(", '").f(ctx.get(["folder_path"], false),ctx,"h",["j"]).w("', ").f(ctx.get(["server_confirms_restore"], false),ctx,"h").w(", '").f(ctx.get(["name"], false),ctx,"h",["s","j"]).w("'); return false\">").f(ctx.get(["tRestore"], false),ctx,"h").w("</a>");}body_9.__dustBody=!0;function body_10(chk,ctx){return chk.w("<div class=\"alert alert-danger\">").f(ctx.get(["tMounting image failed. Please see server log file for details."], false),ctx,"h").w("<br>").f(ctx.get(["mount_errmsg"], false),ctx,"h").w("</div>");}body_10.__dustBody=!0;function body_11(chk,ctx){return chk.w("<br><br><div class=\"text-center\"><a class=\"btn btn-default\" href=\"#\" onClick=\"tabMouseClickFiles(").f(ctx.get(["clientid"], false),ctx,"h").w(",").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h").w("', true); return false\">").f(ctx.get(["tMount image"], false),ctx,"h").w("</a>").x(ctx.get(["os_mount"], false),ctx,{"block":body_12},{}).w("</div>");}body_11.__dustBody=!0;function body_12(chk,ctx){return chk.w("<br><font color=\"red\">").f(ctx.get(["tUrBackup will use non-sandboxed server operating system functionality to mount the image. Only mount the image if you trust its source."], false),ctx,"h").w("</font>");}body_12.__dustBody=!0;function body_13(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"downloadZIP(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w(", '").f(ctx.get(["path"], false),ctx,"h",["j"]).w("'); return false\">").f(ctx.get(["tDownload folder as ZIP"], false),ctx,"h").w("</a>");}body_13.__dustBody=!0;function body_14(chk,ctx){return chk.w("<a class=\"btn btn-default\" href=\"#\" onClick=\"restoreFiles(").f(ctx.get(["clientid"], false),ctx,"h").w(", ").f(ctx.get(["backupid"], false),ctx,"h").w(",'").f(ctx.get(["path"], false),ctx,"h",["j"]).w("', ").f(ctx.get(["server_confirms_restore"], false),ctx,"h").w("); return false\">").f(ctx.get(["tRestore folder to client"], false),ctx,"h").w("</a><label style=\"font-weight: normal; margin-left: 10px\"><input type=\"checkbox\" id=\"restore_local_reuse\"/> ").f(ctx.get(["tCopy identical files already on the client"], false),ctx,"h").w("</label>");}body_14.__dustBody=!0;return body_0;})();
 (function(){dust.register("live_log_row",body_0);function body_0(chk,ctx){return chk.w("<tr><td style=\"width: 0%; vertical-align: top\"><span style=\"white-space: nowrap\">").f(ctx.get(["time"], false),ctx,"h").w("&nbsp;&nbsp;</span></td><td style=\"width: 0%; vertical-align: top; ").f(ctx.get(["background_color"], false),ctx,"h").w("\"><span style=\"white-space: nowrap\">").f(ctx.get(["loglevel"], false),ctx,"h").w("&nbsp;&nbsp;</span></td><td>").f(ctx.get(["message"], false),ctx,"h",["s"]).w("</td></tr>");}body_0.__dustBody=!0;return body_0;})();
 (function(){dust.register("log_single",body_0);function body_0(chk,ctx){return chk.w("<div class=\"panel panel-default\" style=\"margin-top:20px\"><div class=\"panel-heading\"><strong>").f(ctx.get(["tLog"], false),ctx,"h").w(":</strong> (").f(ctx.get(["name"], false),ctx,"h").w(")</div><div class=\"panel-body\"><table class=\"table table-striped\"><tr>\t<th>").f(ctx.get(["tLevel"], false),ctx,"h").w("</th><th>").f(ctx.get(["tTime"], false),ctx,"h").w("</th><th>").f(ctx.get(["tMessage"], false),ctx,"h").w("</th></tr>").f(ctx.get(["rows"], false),ctx,"h",["s"]).w("</table></div></div><p><a class=\"btn btn-default\" href=\"javascript: show_logs1('").f(ctx.get(["params"], false),ctx,"h").w("')\">").f(ctx.get(["tBack"], false),ctx,"h").w("</a></p>");}body_0.__dustBody=!0;return body_0;})();
 (function(){dust.register("log_single_filter",body_0);function body_0(chk,ctx){return chk.w("<form class=\"form-inline\"><div class=\"form-group\"><label>").f(ctx.get(["tFilter"], false),ctx,"h").w(":</label><select class=\"form-control\" size=\"1\" onchange=\"logFilterChange()\" id=\"logfilter\" style=\"margin-left:20px\"><option value=\"2\">").f(ctx.get(["tErrors"], false),ctx,"h").w("</option><option value=\"1\">").f(ctx.get(["tWarnings"], false),ctx,"h").w("</option><option value=\"0\">").f(ctx.get(["tInfos"], false),ctx,"h").w("</option></select></form>");}body_0.__dustBody=!0;return body_0;})();
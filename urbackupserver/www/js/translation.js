@@ -1657,6 +1657,7 @@ translations.en = {
 "tList": "List",
 "tRestore": "Restore",
 "tRestore folder to client": "Restore folder to client",
+"tCopy identical files already on the client": "Copy identical files already on the client",
 "tVersion": "Version",
 "tClient added successfully": "Client added successfully",
 "tAdded new client with name:": "Added new client with name:",
@@ -2414,7 +2414,14 @@ function restoreFiles(clientid, backupid, path, server_confirms_restore, fn_filt
 	g.curr_backupid = backupid;
 	g.curr_path = path;
 	
-	new getJSON("backups", "sa=clientdl&clientid="+clientid+"&backupid="+backupid+"&path="+path.replace(/\//g,"%2F")+filter, restore_callback);
+	//Optionally copy files with identical content already on the client locally (verified by hash)
+	var local_reuse="";
+	if(I('restore_local_reuse') && I('restore_local_reuse').checked)
+	{
+		local_reuse="&local_reuse=1";
+	}
+	
+	new getJSON("backups", "sa=clientdl&clientid="+clientid+"&backupid="+backupid+"&path="+path.replace(/\//g,"%2F")+filter+local_reuse, restore_callback);
 }
 
 function restore_callback(data)